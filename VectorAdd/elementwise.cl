@@ -0,0 +1,142 @@
+/*
+ * c = op(a, b) elementwise over count elements, specialized at build time:
+ *
+ *    -D T=<type>    input element type: int, float, half or double
+ *    -D TO=<type>   output element type (OP_CONVERT only, default T)
+ *    -D W=<n>       vector width: 1, 2, 4, 8 or 16
+ *    -D OP_ADD | OP_SUB | OP_MUL | OP_AXPY | OP_FMA | OP_CLAMP | OP_CONVERT
+ *    -D T_FLOAT, T_HALF, T_DOUBLE, TO_HALF, TO_DOUBLE  mark floating types
+ *
+ *    add/sub/mul  c = a + b, a - b, a * b
+ *    axpy         c = alpha*a + b
+ *    fma          c = a*b + c (c is read and written)
+ *    clamp        c = clamp(a, lo, hi)
+ *    convert      c = (TO)a
+ *
+ * half is a storage format: it is loaded and stored with vload_half and
+ * vstore_half and computed in float, so no fp16 support is needed. Each
+ * work-item strides over whole W-vectors; the count % W tail elements are
+ * done one each by the first work-items.
+ */
+
+#if defined(T_DOUBLE) || defined(TO_DOUBLE)
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+#ifndef T
+#define T float
+#endif
+#ifndef TO
+#define TO T
+#ifdef T_HALF
+#define TO_HALF
+#endif
+#endif
+#ifndef W
+#define W 4
+#endif
+
+#define CAT(a, b) a##b
+#define XCAT(a, b) CAT(a, b)
+
+/* Compute types: half is widened to float */
+#ifdef T_HALF
+#define S float
+#else
+#define S T
+#endif
+#ifdef TO_HALF
+#define SO float
+#else
+#define SO TO
+#endif
+
+#if W == 1
+#define VEC(t) t
+#define VLOAD(i, p) ((p)[i])
+#define VSTORE(v, i, p) ((p)[i] = (v))
+#define VLOAD_HALF(i, p) vload_half(i, p)
+#define VSTORE_HALF(v, i, p) vstore_half(v, i, p)
+#else
+#define VEC(t) XCAT(t, W)
+#define VLOAD(i, p) XCAT(vload, W)(i, p)
+#define VSTORE(v, i, p) XCAT(vstore, W)(v, i, p)
+#define VLOAD_HALF(i, p) XCAT(vload_half, W)(i, p)
+#define VSTORE_HALF(v, i, p) XCAT(vstore_half, W)(v, i, p)
+#endif
+#define CONVERT_VEC(x) XCAT(convert_, VEC(SO))(x)
+#define CONVERT_ONE(x) XCAT(convert_, SO)(x)
+
+#ifdef T_HALF
+#define LOAD_IN(i, p) VLOAD_HALF(i, p)
+#define LOAD_IN_ONE(i, p) vload_half(i, p)
+#else
+#define LOAD_IN(i, p) VLOAD(i, p)
+#define LOAD_IN_ONE(i, p) ((p)[i])
+#endif
+#ifdef TO_HALF
+#define LOAD_OUT(i, p) VLOAD_HALF(i, p)
+#define LOAD_OUT_ONE(i, p) vload_half(i, p)
+#define STORE_OUT(v, i, p) VSTORE_HALF(v, i, p)
+#define STORE_OUT_ONE(v, i, p) vstore_half(v, i, p)
+#else
+#define LOAD_OUT(i, p) VLOAD(i, p)
+#define LOAD_OUT_ONE(i, p) ((p)[i])
+#define STORE_OUT(v, i, p) VSTORE(v, i, p)
+#define STORE_OUT_ONE(v, i, p) ((p)[i] = (v))
+#endif
+
+/* One expression for both the vector body and the scalar tail */
+#if defined(OP_ADD)
+#define APPLY(a, b, c, CVT) ((a) + (b))
+#elif defined(OP_SUB)
+#define APPLY(a, b, c, CVT) ((a) - (b))
+#elif defined(OP_MUL)
+#define APPLY(a, b, c, CVT) ((a) * (b))
+#elif defined(OP_AXPY)
+#define APPLY(a, b, c, CVT) (alpha * (a) + (b))
+#elif defined(OP_FMA)
+#define READS_C
+#if defined(T_HALF) || defined(T_DOUBLE) || defined(T_FLOAT)
+#define APPLY(a, b, c, CVT) fma(a, b, c)
+#else
+#define APPLY(a, b, c, CVT) ((a) * (b) + (c))
+#endif
+#elif defined(OP_CLAMP)
+#define APPLY(a, b, c, CVT) clamp(a, lo, hi)
+#elif defined(OP_CONVERT)
+#define APPLY(a, b, c, CVT) CVT(a)
+#else
+#error "elementwise.cl needs one of OP_ADD, OP_SUB, OP_MUL, OP_AXPY, OP_FMA, OP_CLAMP, OP_CONVERT"
+#endif
+
+__kernel void elementwise(__global const T *a, __global const T *b,
+      __global TO *c, S alpha, S lo, S hi, ulong count) {
+
+   ulong vectors = count / W;
+   ulong stride = get_global_size(0);
+   ulong gid = get_global_id(0);
+
+   for(ulong v = gid; v < vectors; v += stride) {
+      VEC(S) x = LOAD_IN(v, a);
+      VEC(S) y = LOAD_IN(v, b);
+#ifdef READS_C
+      VEC(SO) z = LOAD_OUT(v, c);
+#else
+      VEC(SO) z = (VEC(SO))(0);
+#endif
+      STORE_OUT(APPLY(x, y, z, CONVERT_VEC), v, c);
+   }
+
+   ulong t = vectors * W + gid;
+   if(t < count) {
+      S x = LOAD_IN_ONE(t, a);
+      S y = LOAD_IN_ONE(t, b);
+#ifdef READS_C
+      SO z = LOAD_OUT_ONE(t, c);
+#else
+      SO z = 0;
+#endif
+      STORE_OUT_ONE(APPLY(x, y, z, CONVERT_ONE), t, c);
+   }
+}
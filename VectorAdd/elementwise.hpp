@@ -0,0 +1,183 @@
+#ifndef ELEMENTWISE_HPP
+#define ELEMENTWISE_HPP
+
+#include <CL/cl.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include "../common/program_cache.hpp"
+
+#define ELEMENTWISE_PROGRAM_FILE "elementwise.cl"
+#define ELEMENTWISE_LOCAL_SIZE 256
+#define ELEMENTWISE_ITEMS 4
+
+enum ElementType
+{
+    ELEM_INT,
+    ELEM_FLOAT,
+    ELEM_HALF,
+    ELEM_DOUBLE
+};
+
+enum ElementwiseOp
+{
+    ELEMENTWISE_ADD,      /* c = a + b */
+    ELEMENTWISE_SUB,      /* c = a - b */
+    ELEMENTWISE_MUL,      /* c = a * b */
+    ELEMENTWISE_AXPY,     /* c = alpha*a + b */
+    ELEMENTWISE_FMA,      /* c = a*b + c */
+    ELEMENTWISE_CLAMP,    /* c = clamp(a, lo, hi), b unused */
+    ELEMENTWISE_CONVERT   /* c = (outType)a, b unused */
+};
+
+/* Scalars for the ops that take them, given as double and passed in the compute type */
+struct ElementwiseArgs
+{
+    double alpha;
+    double lo, hi;
+
+    ElementwiseArgs(double alpha = 0.0, double lo = 0.0, double hi = 0.0) : alpha(alpha), lo(lo), hi(hi) {}
+};
+
+/*
+ * Runs elementwise.cl with one program per (op, types, width). The default
+ * width per type is int4, float8, half16 and double4; each work-item then
+ * covers ELEMENTWISE_ITEMS vectors on average, and the tail past the last
+ * whole vector is handled in the same launch. Any count is accepted.
+ */
+class ElementwiseEngine
+{
+public:
+    ElementwiseEngine(ProgramCache &cache, cl_command_queue queue,
+                      const std::string &programFile = ELEMENTWISE_PROGRAM_FILE,
+                      size_t localSize = ELEMENTWISE_LOCAL_SIZE)
+        : m_cache(cache), m_queue(queue), m_programFile(programFile), m_localSize(localSize)
+    {
+    }
+
+    ~ElementwiseEngine()
+    {
+        for (std::map<std::string, cl_kernel>::iterator it = m_kernels.begin(); it != m_kernels.end(); ++it)
+        {
+            clReleaseKernel(it->second);
+        }
+    }
+
+    static size_t elementSize(ElementType type)
+    {
+        static const size_t sizes[] = { sizeof(cl_int), sizeof(cl_float), sizeof(cl_half), sizeof(cl_double) };
+        return sizes[type];
+    }
+
+    static cl_uint defaultWidth(ElementType type)
+    {
+        static const cl_uint widths[] = { 4, 8, 16, 4 };
+        return widths[type];
+    }
+
+    /* a, b and c hold count elements of type; b may be NULL for clamp. width 0 picks defaultWidth(type). */
+    cl_int apply(ElementwiseOp op, ElementType type, cl_mem a, cl_mem b, cl_mem c, size_t count,
+                 const ElementwiseArgs &args = ElementwiseArgs(), cl_uint width = 0, cl_event *event = NULL)
+    {
+        if (op == ELEMENTWISE_CONVERT)
+            return CL_INVALID_VALUE;
+        return launch(op, type, type, a, b, c, count, args, width, event);
+    }
+
+    /* c[i] = (outType)a[i]; float to int truncates, to half rounds to nearest even */
+    cl_int convert(ElementType type, cl_mem a, ElementType outType, cl_mem c, size_t count, cl_uint width = 0,
+                   cl_event *event = NULL)
+    {
+        return launch(ELEMENTWISE_CONVERT, type, outType, a, NULL, c, count, ElementwiseArgs(), width, event);
+    }
+
+private:
+    cl_int launch(ElementwiseOp op, ElementType type, ElementType outType, cl_mem a, cl_mem b, cl_mem c,
+                  size_t count, const ElementwiseArgs &args, cl_uint width, cl_event *event)
+    {
+        cl_int status;
+        if (width == 0)
+            width = defaultWidth(type);
+        if ((width & (width - 1)) != 0 || width > 16)
+            return CL_INVALID_VALUE;
+        if (count == 0)
+            return CL_SUCCESS;
+
+        cl_kernel kernel = getKernel(buildOptions(op, type, outType, width), &status);
+        if (status != CL_SUCCESS)
+            return status;
+
+        cl_ulong n = count;
+        status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a);
+        status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), b != NULL ? &b : &a);
+        status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &c);
+        status |= setScalar(kernel, 3, type, args.alpha);
+        status |= setScalar(kernel, 4, type, args.lo);
+        status |= setScalar(kernel, 5, type, args.hi);
+        status |= clSetKernelArg(kernel, 6, sizeof(cl_ulong), &n);
+        if (status != CL_SUCCESS)
+            return status;
+
+        /* Enough work-items for ELEMENTWISE_ITEMS vectors each, and at least one group for the tail */
+        size_t vectors = count / width;
+        size_t groups = (vectors + m_localSize * ELEMENTWISE_ITEMS - 1) / (m_localSize * ELEMENTWISE_ITEMS);
+        size_t globalSize = (groups > 0 ? groups : 1) * m_localSize;
+        return clEnqueueNDRangeKernel(m_queue, kernel, 1, NULL, &globalSize, &m_localSize, 0, NULL, event);
+    }
+
+    std::string buildOptions(ElementwiseOp op, ElementType type, ElementType outType, cl_uint width) const
+    {
+        static const char *types[] = { "int", "float", "half", "double" };
+        static const char *marks[] = { "", "FLOAT", "HALF", "DOUBLE" };
+        static const char *ops[] = { "OP_ADD", "OP_SUB", "OP_MUL", "OP_AXPY", "OP_FMA", "OP_CLAMP", "OP_CONVERT" };
+        char options[128];
+        int n = snprintf(options, sizeof(options), "-D T=%s -D W=%u -D %s", types[type], width, ops[op]);
+        if (type != ELEM_INT)
+            n += snprintf(options + n, sizeof(options) - n, " -D T_%s", marks[type]);
+        if (op == ELEMENTWISE_CONVERT)
+        {
+            n += snprintf(options + n, sizeof(options) - n, " -D TO=%s", types[outType]);
+            if (outType == ELEM_HALF || outType == ELEM_DOUBLE)
+                snprintf(options + n, sizeof(options) - n, " -D TO_%s", marks[outType]);
+        }
+        return options;
+    }
+
+    /* half computes in float */
+    cl_int setScalar(cl_kernel kernel, cl_uint index, ElementType type, double value)
+    {
+        cl_int i = (cl_int)value;
+        cl_float f = (cl_float)value;
+        switch (type)
+        {
+        case ELEM_INT:    return clSetKernelArg(kernel, index, sizeof(i), &i);
+        case ELEM_DOUBLE: return clSetKernelArg(kernel, index, sizeof(value), &value);
+        default:          return clSetKernelArg(kernel, index, sizeof(f), &f);
+        }
+    }
+
+    cl_kernel getKernel(const std::string &options, cl_int *status)
+    {
+        std::map<std::string, cl_kernel>::iterator it = m_kernels.find(options);
+        if (it != m_kernels.end())
+        {
+            *status = CL_SUCCESS;
+            return it->second;
+        }
+
+        cl_kernel kernel = m_cache.createKernel(m_programFile, options, "elementwise", status);
+        if (*status == CL_SUCCESS)
+        {
+            m_kernels[options] = kernel;
+        }
+        return kernel;
+    }
+
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::string m_programFile;
+    size_t m_localSize;
+    std::map<std::string, cl_kernel> m_kernels;
+};
+
+#endif
@@ -1,95 +1,374 @@
-// This program implements a vector addition using OpenCL
-// System includes
+#include <CL/cl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
-// OpenCL includes
-#include <CL/cl.h>
-// OpenCL kernel to perform an element-wise addition
-const char *programSource = 
-"__kernel                                         \n"
-"void vecadd(__global int *A,                     \n"
-"            __global int *B,                     \n"
-"            __global int *C)                     \n"
-"{                                                \n"
-"  // Get the work-item's unique ID               \n"
-"  int idx = get_global_id(0);                    \n"
-"                                                 \n"
-"  // Add the corresponding locations of          \n"
-"  // 'A' and 'B', and store the reasult in 'C'   \n"
-"  //C[idx] = A[idx] + B[idx];					  \n"
-"  C[idx] = A[idx]     ;                          \n"
-"}                                                \n"
-;
-int main(){
-	// This code executes on the OpenCL host
-	// Elements in each array
-	const int elements = 32;
-	// Compute the size of the data
-	size_t datasize = sizeof(int) * elements;
-	// Allocate space for input/output host data
-	int *A = (int *)malloc(datasize); // Input array
-	int *B = (int *)malloc(datasize); // Input array
-	int *C = (int *)malloc(datasize); // Output array
-	// Initialize the input data
-	int i;
-	for (i = 0; i < elements; i++){
-		A[i] = i;
-		B[i] = i;
-	}
-	// Use this to check the output of each API call
-	cl_int status;
-	// Get the first platforms
-	cl_platform_id platform;
-	status = clGetPlatformIDs(1, &platform, NULL);
-	// Get the first devices
-	cl_device_id device;
-	status = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 1, &device, NULL);
-	// Create a context and associate it with the device
-	cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, &status);
-	// Create a command-queue and associate it with device
-	cl_command_queue cmdQueue = clCreateCommandQueue(context, device, 0, &status);
-	// Allocate two input buffers and one output buffer for the three vectors in the vector addition
-	cl_mem bufA = clCreateBuffer(context, CL_MEM_READ_ONLY, datasize, NULL, &status);
-	cl_mem bufB = clCreateBuffer(context, CL_MEM_READ_ONLY, datasize, NULL, &status);
-	cl_mem bufC = clCreateBuffer(context, CL_MEM_WRITE_ONLY, datasize, NULL, &status);
-	// Write data from the input arrays to the buffers
-	status = clEnqueueWriteBuffer(cmdQueue, bufA, CL_FALSE, 0, datasize, A, 0, NULL, NULL);
-	status = clEnqueueWriteBuffer(cmdQueue, bufB, CL_FALSE, 0, datasize, B, 0, NULL, NULL);
-	// Create a program with source code
-	cl_program program = clCreateProgramWithSource(context, 1, (const char**)&programSource, NULL, &status);
-	// Build(compile) the program for the device
-	status = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
-	// Create the vector addition kernel
-	cl_kernel kernel = clCreateKernel(program, "vecadd", &status);
-	// Set the kernel arguments
-	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &bufA);
-	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &bufB);
-	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &bufC);
-	// Define an incde space of work-items for execution
-	// A work-group size is not required, but can be used.
-	size_t indexSpaceSize[1], workGroupSize[1];
-	// There are 'elements' work-items
-	indexSpaceSize[0] = elements;
-	workGroupSize[0] = 1;
-	// Execute the kernel
-	status = clEnqueueNDRangeKernel(cmdQueue, kernel, 1, NULL, indexSpaceSize, workGroupSize, 0, NULL, NULL);
-	// Read the device output buffer to the host output array
-	status = clEnqueueReadBuffer(cmdQueue, bufC, CL_TRUE, 0, datasize, C, 0, NULL, NULL);
-	for (i = 0; i < elements; i++){
-		printf("%d \n",C[i]);	
-	}
-	// Free OpenCL resouces
-	clReleaseKernel(kernel);
-	clReleaseProgram(program);
-	clReleaseCommandQueue(cmdQueue);
-	clReleaseMemObject(bufA);
-	clReleaseMemObject(bufB);
-	clReleaseMemObject(bufC);
-	clReleaseContext(context);
-	// free host resouces
-	free(A);
-	free(B);
-	free(C);
-	return 0;
+#include <string.h>
+#include <string>
+#include <vector>
+#include "elementwise.hpp"
+#include "../common/fusion.hpp"
+
+#define LOOP 10
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+cl_mem create_buffer(cl_context context, size_t bytes, const void *host)
+{
+    cl_int err;
+    cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | (host != NULL ? CL_MEM_COPY_HOST_PTR : 0),
+                                   bytes, (void *)host, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a buffer");
+        exit(1);
+    }
+    return buffer;
+}
+
+double event_ms(cl_event event)
+{
+    cl_ulong start, end;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    return (end - start) * 1e-6;
+}
+
+/* IEEE half <-> float for the host side of the checks (normal numbers and zero) */
+cl_half float_to_half(float f)
+{
+    cl_uint bits;
+    memcpy(&bits, &f, sizeof(bits));
+    cl_uint sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    cl_uint mantissa = bits & 0x7fffff;
+    if (exponent <= 0)
+        return (cl_half)sign;
+    if (exponent >= 31)
+        return (cl_half)(sign | 0x7c00);
+    /* Round to nearest even */
+    cl_uint half = sign | (exponent << 10) | (mantissa >> 13);
+    cl_uint rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return (cl_half)half;
+}
+
+float half_to_float(cl_half h)
+{
+    cl_uint sign = (cl_uint)(h & 0x8000) << 16;
+    int exponent = (h >> 10) & 0x1f;
+    cl_uint mantissa = h & 0x3ff;
+    cl_uint bits = exponent == 0 ? sign : sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+void store(ElementType type, std::vector<unsigned char> &data, size_t i, double value)
+{
+    void *p = &data[i * ElementwiseEngine::elementSize(type)];
+    cl_int iv = (cl_int)value;
+    cl_float fv = (cl_float)value;
+    cl_half hv = float_to_half(fv);
+    switch (type)
+    {
+    case ELEM_INT:    memcpy(p, &iv, sizeof(iv)); break;
+    case ELEM_FLOAT:  memcpy(p, &fv, sizeof(fv)); break;
+    case ELEM_HALF:   memcpy(p, &hv, sizeof(hv)); break;
+    case ELEM_DOUBLE: memcpy(p, &value, sizeof(value)); break;
+    }
+}
+
+double load(ElementType type, const std::vector<unsigned char> &data, size_t i)
+{
+    const void *p = &data[i * ElementwiseEngine::elementSize(type)];
+    cl_int iv;
+    cl_float fv;
+    cl_half hv;
+    cl_double dv;
+    switch (type)
+    {
+    case ELEM_INT:    memcpy(&iv, p, sizeof(iv)); return iv;
+    case ELEM_FLOAT:  memcpy(&fv, p, sizeof(fv)); return fv;
+    case ELEM_HALF:   memcpy(&hv, p, sizeof(hv)); return half_to_float(hv);
+    default:          memcpy(&dv, p, sizeof(dv)); return dv;
+    }
+}
+
+/* Inputs are small integers, so every op and conversion is exact in every type */
+bool check_op(cl_context context, cl_command_queue queue, ElementwiseEngine &engine, ElementwiseOp op,
+              ElementType type, ElementType outType, size_t count, cl_uint width)
+{
+    size_t inSize = ElementwiseEngine::elementSize(type), outSize = ElementwiseEngine::elementSize(outType);
+    std::vector<unsigned char> a(count * inSize), b(count * inSize), c(count * outSize), out(c.size());
+    ElementwiseArgs args(2.0, -3.0, 5.0);
+    for (size_t i = 0; i < count; i++)
+    {
+        store(type, a, i, rand() % 17 - 8);
+        store(type, b, i, rand() % 17 - 8);
+        store(outType, c, i, rand() % 17 - 8);
+    }
+
+    cl_mem bufA = create_buffer(context, a.size(), a.data());
+    cl_mem bufB = create_buffer(context, b.size(), b.data());
+    cl_mem bufC = create_buffer(context, c.size(), c.data());
+    cl_int err = op == ELEMENTWISE_CONVERT ? engine.convert(type, bufA, outType, bufC, count, width)
+                                           : engine.apply(op, type, bufA, bufB, bufC, count, args, width);
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(queue, bufC, CL_TRUE, 0, out.size(), out.data(), 0, NULL, NULL);
+    clReleaseMemObject(bufA);
+    clReleaseMemObject(bufB);
+    clReleaseMemObject(bufC);
+
+    bool ok = err == CL_SUCCESS;
+    for (size_t i = 0; i < count && ok; i++)
+    {
+        double x = load(type, a, i), y = load(type, b, i), z = load(outType, c, i), expected = 0.0;
+        switch (op)
+        {
+        case ELEMENTWISE_ADD:     expected = x + y; break;
+        case ELEMENTWISE_SUB:     expected = x - y; break;
+        case ELEMENTWISE_MUL:     expected = x * y; break;
+        case ELEMENTWISE_AXPY:    expected = args.alpha * x + y; break;
+        case ELEMENTWISE_FMA:     expected = x * y + z; break;
+        case ELEMENTWISE_CLAMP:   expected = fmin(fmax(x, args.lo), args.hi); break;
+        case ELEMENTWISE_CONVERT: expected = x; break;
+        }
+        ok = load(outType, out, i) == expected;
+    }
+    return ok;
+}
+
+/* c = a + b at sizes from 1e3 up; GB/s counts two reads and one write */
+void benchmark(cl_context context, cl_device_id device, ElementwiseEngine &engine, ElementType type,
+               cl_uint width, size_t maxCount)
+{
+    static const char *typeNames[] = { "int", "float", "half", "double" };
+    size_t elementSize = ElementwiseEngine::elementSize(type);
+    cl_ulong maxAlloc = 0, globalMem = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, NULL);
+    clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMem), &globalMem, NULL);
+
+    printf("%s%u add:\n", typeNames[type], width);
+    for (size_t count = 1000; count <= maxCount; count *= 10)
+    {
+        size_t bytes = count * elementSize;
+        if (bytes > maxAlloc || 3 * bytes > globalMem)
+        {
+            printf("  %10u elements: skipped, needs %.1f GB\n", (unsigned int)count, 3.0 * bytes / 1e9);
+            continue;
+        }
+        cl_mem a = create_buffer(context, bytes, NULL);
+        cl_mem b = create_buffer(context, bytes, NULL);
+        cl_mem c = create_buffer(context, bytes, NULL);
+        cl_event event;
+        double ms = 0.0;
+
+        engine.apply(ELEMENTWISE_ADD, type, a, b, c, count, ElementwiseArgs(), width);
+        for (int i = 0; i < LOOP; i++)
+        {
+            engine.apply(ELEMENTWISE_ADD, type, a, b, c, count, ElementwiseArgs(), width, &event);
+            clWaitForEvents(1, &event);
+            ms += event_ms(event);
+            clReleaseEvent(event);
+        }
+        ms /= LOOP;
+        printf("  %10u elements: %9.4f ms  %7.2f GB/s\n", (unsigned int)count, ms, 3.0 * bytes / (ms * 1e6));
+
+        clReleaseMemObject(a);
+        clReleaseMemObject(b);
+        clReleaseMemObject(c);
+    }
+}
+
+/*
+ * y = relu(alpha*a + b) * c as three ElementwiseEngine launches (axpy, mul,
+ * clamp at zero) against one FusionGraph kernel. Unfused, the two
+ * intermediates are written and read again: 8 array passes instead of 4.
+ */
+bool fused_chain(cl_context context, cl_command_queue queue, ElementwiseEngine &engine, FusionGraph &graph,
+                 size_t count)
+{
+    std::vector<float> a(count), b(count), c(count), unfused(count), fused(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        a[i] = (float)rand() / RAND_MAX - 0.5f;
+        b[i] = (float)rand() / RAND_MAX - 0.5f;
+        c[i] = (float)rand() / RAND_MAX;
+    }
+    size_t bytes = count * sizeof(float);
+    cl_mem bufA = create_buffer(context, bytes, a.data());
+    cl_mem bufB = create_buffer(context, bytes, b.data());
+    cl_mem bufC = create_buffer(context, bytes, c.data());
+    cl_mem bufT = create_buffer(context, bytes, NULL);
+    cl_mem bufY = create_buffer(context, bytes, NULL);
+    cl_event events[3];
+    double unfusedMs = 0.0, fusedMs = 0.0;
+    cl_int err = CL_SUCCESS;
+
+    graph.clear();
+    FusionGraph::Node y = graph.mul(graph.relu(graph.add(graph.mul(graph.scalar(2.0f), graph.input(bufA)),
+                                                         graph.input(bufB))),
+                                    graph.input(bufC));
+    graph.output(y, bufY);
+
+    for (int i = 0; i <= LOOP && err == CL_SUCCESS; i++)
+    {
+        err = engine.apply(ELEMENTWISE_AXPY, ELEM_FLOAT, bufA, bufB, bufT, count, ElementwiseArgs(2.0), 0,
+                           &events[0]);
+        err |= engine.apply(ELEMENTWISE_MUL, ELEM_FLOAT, bufT, bufC, bufT, count, ElementwiseArgs(), 0, &events[1]);
+        err |= engine.apply(ELEMENTWISE_CLAMP, ELEM_FLOAT, bufT, NULL, bufT, count,
+                            ElementwiseArgs(0.0, 0.0, INFINITY), 0, &events[2]);
+        if (err != CL_SUCCESS)
+            break;
+        clWaitForEvents(3, events);
+        for (int k = 0; k < 3; k++)
+        {
+            unfusedMs += i > 0 ? event_ms(events[k]) : 0.0;
+            clReleaseEvent(events[k]);
+        }
+
+        err = graph.run(count, &events[0]);
+        if (err != CL_SUCCESS)
+            break;
+        clWaitForEvents(1, events);
+        fusedMs += i > 0 ? event_ms(events[0]) : 0.0;
+        clReleaseEvent(events[0]);
+    }
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(queue, bufT, CL_TRUE, 0, bytes, unfused.data(), 0, NULL, NULL);
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(queue, bufY, CL_TRUE, 0, bytes, fused.data(), 0, NULL, NULL);
+
+    /* relu(x)*c == relu(x*c) for c >= 0; the fused side may contract to fma */
+    bool ok = err == CL_SUCCESS;
+    for (size_t i = 0; i < count && ok; i++)
+    {
+        float expected = fmaxf(2.0f * a[i] + b[i], 0.0f) * c[i];
+        ok = fabsf(fused[i] - expected) <= 1e-6f && fabsf(unfused[i] - expected) <= 1e-6f;
+    }
+    printf("relu(2a + b) * c, %u floats: 3 launches %.3f ms, fused %.3f ms (%.2fx)  %s\n", (unsigned int)count,
+           unfusedMs / LOOP, fusedMs / LOOP, unfusedMs / fusedMs, ok ? "Check passed." : "Check failed.");
+
+    clReleaseMemObject(bufA);
+    clReleaseMemObject(bufB);
+    clReleaseMemObject(bufC);
+    clReleaseMemObject(bufT);
+    clReleaseMemObject(bufY);
+    return ok;
 }
 
+int main(int argc, char *argv[])
+{
+    static const char *typeNames[] = { "int", "float", "half", "double" };
+    static const char *opNames[] = { "add", "sub", "mul", "axpy", "fma", "clamp", "convert" };
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_int err;
+    size_t maxCount = 1000000000;
+    int failed = 0;
+
+    if (argc > 1)
+    {
+        maxCount = strtoull(argv[1], NULL, 10);
+    }
+
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+    queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a command queue");
+        exit(1);
+    }
+
+    char extensions[4096] = "";
+    clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, sizeof(extensions), extensions, NULL);
+    bool fp64 = strstr(extensions, "cl_khr_fp64") != NULL;
+
+    ProgramCache cache(context, device);
+    ElementwiseEngine engine(cache, queue);
+    FusionGraph graph(cache, queue);
+
+    /* Counts that leave every tail length for width 16, plus one group's worth */
+    size_t counts[] = { 1, 15, 17, 4096 + 13, 100003 };
+    cl_uint widths[] = { 0, 1, 16 };
+    srand(123);
+    for (int type = ELEM_INT; type <= ELEM_DOUBLE; type++)
+    {
+        if (type == ELEM_DOUBLE && !fp64)
+        {
+            printf("double: no cl_khr_fp64, skipped\n");
+            continue;
+        }
+        int passed = 0, total = 0;
+        for (int op = ELEMENTWISE_ADD; op <= ELEMENTWISE_CONVERT; op++)
+        {
+            for (int outType = ELEM_INT; outType <= ELEM_DOUBLE; outType++)
+            {
+                if ((op != ELEMENTWISE_CONVERT && outType != type) || (outType == ELEM_DOUBLE && !fp64))
+                    continue;
+                for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); n++)
+                {
+                    for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+                    {
+                        bool ok = check_op(context, queue, engine, (ElementwiseOp)op, (ElementType)type,
+                                           (ElementType)outType, counts[n], widths[w]);
+                        if (!ok)
+                            printf("  %s %s -> %s, %u elements, width %u failed\n", opNames[op], typeNames[type],
+                                   typeNames[outType], (unsigned int)counts[n], widths[w]);
+                        passed += ok;
+                        total++;
+                    }
+                }
+            }
+        }
+        failed |= passed != total;
+        printf("%s: %d/%d, %s\n", typeNames[type], passed, total, passed == total ? "Check passed." : "Check failed.");
+    }
+
+    failed |= !fused_chain(context, queue, engine, graph, 1 << 24);
+    failed |= !fused_chain(context, queue, engine, graph, 1001);
+
+    benchmark(context, device, engine, ELEM_FLOAT, 1, maxCount);
+    benchmark(context, device, engine, ELEM_FLOAT, 8, maxCount);
+    benchmark(context, device, engine, ELEM_FLOAT, 16, maxCount);
+    benchmark(context, device, engine, ELEM_INT, 4, maxCount);
+    benchmark(context, device, engine, ELEM_HALF, 16, maxCount);
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+    return failed;
+}
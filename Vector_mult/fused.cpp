@@ -0,0 +1,182 @@
+#include <CL/cl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include "../reduction/reduction.hpp"
+
+#define ARRAY_SIZE (1 << 24)
+#define LOOP 10
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+}
+
+/* Reference in double on the host */
+double reference(const std::vector<float> &a, const std::vector<float> &b, MapReduceOp op)
+{
+    double r = op == MAPREDUCE_MUL_MAX ? -INFINITY : 0.0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        double x = a[i], y = b[i];
+        switch (op)
+        {
+        case MAPREDUCE_DOT:     r += x * y; break;
+        case MAPREDUCE_L1:      r += fabs(x); break;
+        case MAPREDUCE_L2:      r += x * x; break;
+        case MAPREDUCE_LINF:    r = fmax(r, fabs(x)); break;
+        case MAPREDUCE_MUL_MAX: r = fmax(r, (double)(a[i] * b[i])); break;
+        }
+    }
+    return op == MAPREDUCE_L2 ? sqrt(r) : r;
+}
+
+/*
+ * Fused map-reduce against the unfused pipeline: vector_map writes the
+ * mapped array and ReductionEngine::reduce reads it back. The fused kernel
+ * reads the inputs once; the unfused one also writes and rereads n floats.
+ */
+int main(int argc, char *argv[])
+{
+    static const char *opNames[] = { "dot", "l1", "l2", "linf", "mul_max" };
+    static const int mapOps[] = { 0, 1, 2, 1, 0 };
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_int err;
+    size_t count = ARRAY_SIZE;
+    int failed = 0;
+
+    if (argc > 1)
+    {
+        count = strtoull(argv[1], NULL, 10);
+    }
+
+    std::vector<float> a(count), b(count);
+    srand(123);
+    for (size_t i = 0; i < count; i++)
+    {
+        a[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+        b[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+    }
+
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+    queue = clCreateCommandQueue(context, device, 0, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a command queue");
+        exit(1);
+    }
+
+    ProgramCache cache(context, device);
+    ReductionEngine engine(cache, queue, "../reduction/reduction.cl");
+    cl_kernel mapKernel = cache.createKernel("vector.cl", "", "vector_map", &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a kernel");
+        exit(1);
+    }
+
+    size_t bytes = count * sizeof(float);
+    cl_mem bufA = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, a.data(), &err);
+    cl_mem bufB = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, b.data(), &err);
+    cl_mem mapped = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a buffer");
+        exit(1);
+    }
+
+    printf("%u floats, %d runs each\n", (unsigned int)count, LOOP);
+    for (int op = MAPREDUCE_DOT; op <= MAPREDUCE_MUL_MAX; op++)
+    {
+        double fused = 0.0, unfused = 0.0, expected = reference(a, b, (MapReduceOp)op);
+        bool twoInputs = op == MAPREDUCE_DOT || op == MAPREDUCE_MUL_MAX;
+        std::chrono::steady_clock::time_point start, end;
+
+        /* Warm-up builds both programs */
+        engine.mapReduce(bufA, twoInputs ? bufB : NULL, count, REDUCE_FLOAT, (MapReduceOp)op, &fused);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < LOOP; i++)
+        {
+            err = engine.mapReduce(bufA, twoInputs ? bufB : NULL, count, REDUCE_FLOAT, (MapReduceOp)op, &fused);
+        }
+        end = std::chrono::steady_clock::now();
+        double fusedMs = elapsed_ms(start, end) / LOOP;
+
+        cl_int mapOp = mapOps[op];
+        cl_uint n = (cl_uint)count;
+        size_t localSize = 256, globalSize = (count + localSize - 1) / localSize * localSize;
+        ReduceOp reduceOp = op == MAPREDUCE_LINF || op == MAPREDUCE_MUL_MAX ? REDUCE_MAX : REDUCE_SUM;
+        ReduceResult result;
+        err |= clSetKernelArg(mapKernel, 0, sizeof(cl_mem), &bufA);
+        err |= clSetKernelArg(mapKernel, 1, sizeof(cl_mem), &bufB);
+        err |= clSetKernelArg(mapKernel, 2, sizeof(cl_mem), &mapped);
+        err |= clSetKernelArg(mapKernel, 3, sizeof(cl_int), &mapOp);
+        err |= clSetKernelArg(mapKernel, 4, sizeof(cl_uint), &n);
+        engine.reduce(mapped, count, REDUCE_FLOAT, reduceOp, &result);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < LOOP; i++)
+        {
+            err |= clEnqueueNDRangeKernel(queue, mapKernel, 1, NULL, &globalSize, &localSize, 0, NULL, NULL);
+            err |= engine.reduce(mapped, count, REDUCE_FLOAT, reduceOp, &result);
+        }
+        end = std::chrono::steady_clock::now();
+        double unfusedMs = elapsed_ms(start, end) / LOOP;
+        unfused = op == MAPREDUCE_L2 ? sqrt(result.value) : result.value;
+
+        /* Float accumulation error grows with n, not with the (cancelling) result. A max picks one
+           element and is exact; one float ulp is left for a device that rounds the product differently */
+        float magnitude = (float)fabs(expected);
+        double tolerance = reduceOp == REDUCE_MAX ? (double)nextafterf(magnitude, INFINITY) - magnitude
+                                                  : 1e-6 * count + 1e-4 * fabs(expected);
+        bool ok = err == CL_SUCCESS && fabs(fused - expected) <= tolerance && fabs(unfused - expected) <= tolerance;
+        failed |= !ok;
+        printf("%-8s fused %8.3f ms  unfused %8.3f ms  (%.2fx)  result %g  %s\n", opNames[op], fusedMs, unfusedMs,
+               unfusedMs / fusedMs, fused, ok ? "Check passed." : "Check failed.");
+    }
+
+    clReleaseMemObject(bufA);
+    clReleaseMemObject(bufB);
+    clReleaseMemObject(mapped);
+    clReleaseKernel(mapKernel);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+    return failed;
+}
@@ -1,4 +1,5 @@
-__kernel void findmax(__global float *data,
+/* Fused multiply-max: max(data[i]*array[i]) per work-group */
+__kernel void mul_max(__global float *data,
 	  __global float *array,
 	  __local float *temp,
       __global float *result) {
@@ -21,4 +22,23 @@ __kernel void findmax(__global float *data,
 		result[get_group_id(0)] = temp[0];
 	}
 
-}
\ No newline at end of file
+}
+
+/* Elementwise step of the unfused baseline in fused.cpp: c = map(a, b),
+   op 0 = a*b, 1 = |a|, 2 = a*a */
+__kernel void vector_map(__global const float *a,
+	  __global const float *b,
+	  __global float *c,
+	  int op, uint count) {
+
+	uint gid = get_global_id(0);
+	if (gid >= count)
+		return;
+
+	if (op == 0)
+		c[gid] = a[gid] * b[gid];
+	else if (op == 1)
+		c[gid] = fabs(a[gid]);
+	else
+		c[gid] = a[gid] * a[gid];
+}
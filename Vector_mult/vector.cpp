@@ -19,6 +19,7 @@
 #else
 #include <CL/cl.h>
 #endif
+#include "../common/host_memory.hpp"
 
 /* CPU 计算最大值 */
 void findmax(float *array, unsigned int size, float *max)
@@ -130,13 +131,12 @@ int main() {
 	cl_int i, err;
 	size_t local_size, global_size;
 	/* 若存在多个kernel函数，则命名放于这里*/
-	char kernel_names [20] = { "vector"};
+	char kernel_names [20] = { "mul_max"};
 
 	/* Data and buffers */
 	/* 数据和缓存*/
-	float array_A[ARRAY_SIZE];
-	float array_B[ARRAY_SIZE];
-	float sum , *scalar_sum;
+	float *array_A, *array_B;
+	float max_value, cpu_max, *scalar_max;
 	/* 定义三个内存对象*/
 	cl_mem data_A,data_B, scalar_max_buffer;
 	cl_int num_groups;
@@ -145,6 +145,9 @@ int main() {
 	clock_t start, end;
 	/* Initialize data */
 	/* 初始化数据*/
+	/* 数组放在堆上以免栈溢出；按页对齐，输入buffer直接使用这块内存而不拷贝*/
+	array_A = (float*)alignedAlloc(ARRAY_SIZE * sizeof(float));
+	array_B = (float*)alignedAlloc(ARRAY_SIZE * sizeof(float));
 	srand((unsigned)time(NULL));
 	for (i = 0; i < ARRAY_SIZE; i++) {
 		array_A[i] = 1.0f*(rand()%ARRAY_SIZE);
@@ -161,13 +164,9 @@ int main() {
 		perror("Couldn't obtain device information");
 		exit(1);
 	}
-	/* Allocate and initialize output arrays */
-	/* 申请内存并初始化输出数组*/
+	/* Every group writes its maximum, so the output buffer needs no initial contents */
+	/* 每个工作组都会写出自己的最大值，输出buffer无需初始化*/
 	num_groups = ARRAY_SIZE / local_size;
-	scalar_sum = (float*)malloc(num_groups * sizeof(float));
-	for (i = 0; i < num_groups; i++) {
-		scalar_sum[i] = 0.0f;
-	}
 
 
 	/* Create a context */
@@ -184,12 +183,22 @@ int main() {
 
 	/* Create data buffer */
 	/* 创建数据buffer缓存，OpenCL一共可以创建Buffer和Image两种内存对象类型，实际应用中具体用途有所区别*/
-	data_A = clCreateBuffer(context, CL_MEM_READ_ONLY |
-		CL_MEM_COPY_HOST_PTR, ARRAY_SIZE * sizeof(float), array_A, &err);
-	data_B = clCreateBuffer(context, CL_MEM_READ_ONLY |
-		CL_MEM_COPY_HOST_PTR, ARRAY_SIZE * sizeof(float), array_B, &err);
-	scalar_max_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE |
-		CL_MEM_COPY_HOST_PTR, num_groups * sizeof(float), scalar_sum, &err);
+	/* The inputs are used in place (CL_MEM_USE_HOST_PTR) and the result is mapped, not copied */
+	/* 输入直接使用主机内存，结果通过映射读取，共享内存的设备上不拷贝数据*/
+	data_A = createHostBuffer(context, CL_MEM_READ_ONLY,
+		ARRAY_SIZE * sizeof(float), array_A, &err);
+	if (err < 0) {
+		perror("Couldn't create a buffer");
+		exit(1);
+	};
+	data_B = createHostBuffer(context, CL_MEM_READ_ONLY,
+		ARRAY_SIZE * sizeof(float), array_B, &err);
+	if (err < 0) {
+		perror("Couldn't create a buffer");
+		exit(1);
+	};
+	scalar_max_buffer = createHostBuffer(context, CL_MEM_READ_WRITE,
+		num_groups * sizeof(float), NULL, &err);
 	if (err < 0) {
 		perror("Couldn't create a buffer");
 		exit(1);
@@ -250,10 +259,10 @@ int main() {
 	/* 读取结果*/
 	
 	/*将标量传入kernel计算*/
-	err = clEnqueueReadBuffer(queue, scalar_max_buffer, CL_TRUE, 0,
-		num_groups * sizeof(float), scalar_sum, 0, NULL, NULL);
+	scalar_max = mapBuffer<float>(queue, scalar_max_buffer, CL_MAP_READ,
+		num_groups * sizeof(float), &err);
 	if (err < 0) {
-		perror("Couldn't read the buffer");
+		perror("Couldn't map the buffer");
 		exit(1);
 	}
 
@@ -261,27 +270,35 @@ int main() {
 	/* Check result */
 	/* 校验运算结果*/
 	
-	findmax(scalar_sum, num_groups, &sum);
-	printf("gpu result : %f \n", sum);
+	/* 每个工作组得到一个最大值，主机端再取最大*/
+	findmax(scalar_max, num_groups, &max_value);
+	unmapBuffer(queue, scalar_max_buffer, scalar_max);
+	printf("gpu max(a*b) : %f \n", max_value);
 	//std::cout << "gpu Total time =  " << total_time<<"*1E-6 ms"<< std::endl;
 	printf( "gpu: %f ms\n",total_time*1e-6);  
 	/* Deallocate event */
 	/* 释放事件——为什么要每次释放事件? 实时监测每次运算中的报错，prof_event作为参数输入不同cl函数可以输出不同信息*/
 	clReleaseEvent(prof_event);
-	/*
 	start = clock();//star
-	findmax(data, ARRAY_SIZE, &sum);
-	printf("cpu result : %f \n", sum);
+	cpu_max = array_A[0] * array_B[0];
+	for (i = 1; i < ARRAY_SIZE; i++) {
+		cpu_max = fmax(cpu_max, array_A[i] * array_B[i]);
+	}
 	end	 = clock();//end
+	printf("cpu max(a*b) : %f \n", cpu_max);
 	printf( "cpu: %f ms\n", (double)(end - start) / CLOCKS_PER_SEC *1000);  
-	*/
+	if (max_value == cpu_max)
+		printf("Check passed.\n");
+	else
+		printf("Check failed.\n");
 	/* Deallocate resources */
 	/* 释放资源*/
-	free(scalar_sum);
 	clReleaseKernel(kernel);
-	clReleaseMemObject(scalar_sum);
+	clReleaseMemObject(scalar_max_buffer);
 	clReleaseMemObject(data_A);
 	clReleaseMemObject(data_B);
+	alignedFree(array_A);
+	alignedFree(array_B);
 	clReleaseCommandQueue(queue);
 	clReleaseProgram(program);
 	clReleaseContext(context);
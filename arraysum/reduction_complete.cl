@@ -40,3 +40,179 @@ __kernel void reduction_vector(__global float4* data,
    }
 }
 
+
+__kernel void reduction_scalar_bounded(__global float* data, 
+      __local float* partial_sums, __global float* output, uint count) {
+
+   int lid = get_local_id(0);
+   int group_size = get_local_size(0);
+
+   /* Pad the last group with zeros so any count can be reduced */
+   partial_sums[lid] = get_global_id(0) < count ? data[get_global_id(0)] : 0.0f;
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for(int i = group_size/2; i>0; i >>= 1) {
+      if(lid < i) {
+         partial_sums[lid] += partial_sums[lid + i];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   if(lid == 0) {
+      output[get_group_id(0)] = partial_sums[0];
+   }
+}
+
+/* Single launch: the last group to finish sums every group's partial.
+   Relies on the device making the fenced partials visible before the
+   atomic increment, which holds on the GPUs and CPUs we run on but is
+   not promised by OpenCL 1.2; the multi-pass path above is portable. */
+__kernel void reduction_last_block(__global float4* data, 
+      __local float4* partial_sums, __global float* partials, 
+      volatile __global uint* counter, __global float* output) {
+
+   __local int is_last;
+   int lid = get_local_id(0);
+   int group_size = get_local_size(0);
+   int num_groups = get_num_groups(0);
+   float sum;
+
+   partial_sums[lid] = data[get_global_id(0)];
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for(int i = group_size/2; i>0; i >>= 1) {
+      if(lid < i) {
+         partial_sums[lid] += partial_sums[lid + i];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   if(lid == 0) {
+      partials[get_group_id(0)] = dot(partial_sums[0], (float4)(1.0f));
+      mem_fence(CLK_GLOBAL_MEM_FENCE);
+      is_last = (atomic_inc(counter) == num_groups - 1);
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   if(is_last) {
+      sum = 0.0f;
+      for(int i = lid; i < num_groups; i += group_size) {
+         sum += ((volatile __global float*)partials)[i];
+      }
+      partial_sums[lid] = (float4)(sum, 0.0f, 0.0f, 0.0f);
+      barrier(CLK_LOCAL_MEM_FENCE);
+
+      for(int i = group_size/2; i>0; i >>= 1) {
+         if(lid < i) {
+            partial_sums[lid].x += partial_sums[lid + i].x;
+         }
+         barrier(CLK_LOCAL_MEM_FENCE);
+      }
+
+      if(lid == 0) {
+         output[0] = partial_sums[0].x;
+         /* Reset for the next launch */
+         *counter = 0;
+      }
+   }
+}
+
+/* Error-free transformation: s.x + s.y == a + b exactly (Knuth two-sum).
+   Only valid without -cl-fast-relaxed-math / -cl-unsafe-math-optimizations. */
+inline float2 two_sum(float a, float b) {
+
+   float s = a + b;
+   float bb = s - a;
+   return (float2)(s, (a - (s - bb)) + (b - bb));
+}
+
+/* Add two double-float pairs (hi, lo) and renormalize */
+inline float2 pair_add(float2 a, float2 b) {
+
+   float2 s = two_sum(a.x, b.x);
+   return two_sum(s.x, s.y + a.y + b.y);
+}
+
+/* Compensated sum: each work-item walks the data with a fixed grid and
+   keeps its running sum as a (hi, lo) pair, the tree adds pairs */
+__kernel void reduction_kahan(__global float4* data, 
+      __local float2* partial_sums, __global float2* output, uint count) {
+
+   int lid = get_local_id(0);
+   int group_size = get_local_size(0);
+   float2 sum = (float2)(0.0f);
+   float4 v;
+
+   for(uint i = get_global_id(0); i < count; i += get_global_size(0)) {
+      v = data[i];
+      sum = pair_add(sum, (float2)(v.x, 0.0f));
+      sum = pair_add(sum, (float2)(v.y, 0.0f));
+      sum = pair_add(sum, (float2)(v.z, 0.0f));
+      sum = pair_add(sum, (float2)(v.w, 0.0f));
+   }
+   partial_sums[lid] = sum;
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for(int i = group_size/2; i>0; i >>= 1) {
+      if(lid < i) {
+         partial_sums[lid] = pair_add(partial_sums[lid], partial_sums[lid + i]);
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   if(lid == 0) {
+      output[get_group_id(0)] = partial_sums[0];
+   }
+}
+
+/* Later passes over the (hi, lo) partials of reduction_kahan */
+__kernel void reduction_kahan_partials(__global float2* data, 
+      __local float2* partial_sums, __global float2* output, uint count) {
+
+   int lid = get_local_id(0);
+   int group_size = get_local_size(0);
+
+   partial_sums[lid] = get_global_id(0) < count ? data[get_global_id(0)] : (float2)(0.0f);
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for(int i = group_size/2; i>0; i >>= 1) {
+      if(lid < i) {
+         partial_sums[lid] = pair_add(partial_sums[lid], partial_sums[lid + i]);
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   if(lid == 0) {
+      output[get_group_id(0)] = partial_sums[0];
+   }
+}
+
+/* Deterministic sum: every FIXED_BLOCK elements go through the same pairwise
+   tree whatever the local size (<= FIXED_BLOCK), and there are no atomics,
+   so the result is bitwise identical across runs and work-group sizes.
+   block holds FIXED_BLOCK floats; the tail of the last block is zero. */
+#define FIXED_BLOCK 1024
+
+__kernel void reduction_fixed_order(__global float* data, 
+      __local float* block, __global float* output, uint count) {
+
+   int lid = get_local_id(0);
+   int group_size = get_local_size(0);
+   uint base = get_group_id(0) * FIXED_BLOCK;
+
+   for(int i = lid; i < FIXED_BLOCK; i += group_size) {
+      block[i] = base + i < count ? data[base + i] : 0.0f;
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for(int s = FIXED_BLOCK/2; s>0; s >>= 1) {
+      for(int i = lid; i < s; i += group_size) {
+         block[i] += block[i + s];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   if(lid == 0) {
+      output[get_group_id(0)] = block[0];
+   }
+}
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <chrono>
 
 /* 设置输出数组的大小，在预编译阶段会申请一部分内存，申请内存的大小若超过限制(一般为1M)则会报错*/
 #define ARRAY_SIZE 1048576
@@ -20,6 +21,12 @@
 #else
 #include <CL/cl.h>
 #endif
+#include "../common/buffer_pool.hpp"
+#include "../common/host_memory.hpp"
+
+/* Requests per size in the request latency benchmark */
+/* 请求延迟测试中每种规模的请求次数*/
+#define REQUESTS 200
 
 /* Find a GPU or CPU associated with the first available platform */
 /* 发现可用平台下的GPU或CPU设备*/
@@ -103,6 +110,188 @@ cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename)
 	return program;
 }
 
+/* One bounded pass: each group reduces items_per_group elements of input to one */
+/* 一次带边界的归约：每个工作组把items_per_group个元素归约为一个*/
+void enqueue_pass(cl_command_queue queue, cl_kernel kernel, cl_mem input, cl_mem output,
+	cl_uint count, size_t local_size, size_t items_per_group, size_t element_size,
+	cl_event *event) {
+
+	size_t global_size;
+	int err;
+
+	global_size = (count + items_per_group - 1) / items_per_group * local_size;
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+	err |= clSetKernelArg(kernel, 1, items_per_group * element_size, NULL);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &output);
+	err |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &count);
+	if (err < 0) {
+		perror("Couldn't create a kernel argument");
+		exit(1);
+	}
+
+	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size,
+		&local_size, 0, NULL, event);
+	if (err < 0) {
+		perror("Couldn't enqueue the kernel");
+		exit(1);
+	}
+}
+
+/* Reduce count partial sums to one value with repeated bounded passes */
+/* 用多次带边界的归约把count个部分和在设备端归约为一个值，返回结果所在的buffer*/
+cl_mem reduce_partials(cl_command_queue queue, cl_kernel kernel, cl_mem partials,
+	cl_mem scratch, cl_uint count, size_t local_size, size_t items_per_group,
+	size_t element_size, cl_event *last_event) {
+
+	cl_mem temp;
+
+	while (count > 1) {
+		/* Passes are ordered by the in-order queue, no host sync in between */
+		/* 顺序队列保证各次归约的先后，中间不需要主机同步*/
+		if (*last_event != NULL) {
+			clReleaseEvent(*last_event);
+		}
+		enqueue_pass(queue, kernel, partials, scratch, count, local_size,
+			items_per_group, element_size, last_event);
+
+		count = (cl_uint)((count + items_per_group - 1) / items_per_group);
+		temp = partials; partials = scratch; scratch = temp;
+	}
+
+	return partials;
+}
+
+/* Kernel time from the start of first to the end of last */
+/* 从first开始到last结束的设备时间，单位ms*/
+double event_span_ms(cl_event first, cl_event last) {
+
+	cl_ulong time_start, time_end;
+	clGetEventProfilingInfo(first, CL_PROFILING_COMMAND_START,
+		sizeof(time_start), &time_start, NULL);
+	clGetEventProfilingInfo(last, CL_PROFILING_COMMAND_END,
+		sizeof(time_end), &time_end, NULL);
+	return (time_end - time_start)*1e-6;
+}
+
+/* Host-mappable buffer from the pool, or from clCreateBuffer when pool is NULL */
+/* 从缓冲池取可映射的buffer，pool为NULL时直接调用clCreateBuffer（CL_MEM_ALLOC_HOST_PTR）*/
+cl_mem get_buffer(cl_context ctx, BufferPool *pool, size_t bytes) {
+
+	cl_mem buffer;
+	cl_int err;
+
+	if (pool != NULL)
+		buffer = pool->acquire(bytes, &err);
+	else
+		buffer = createHostBuffer(ctx, CL_MEM_READ_WRITE, bytes, NULL, &err);
+	if (err < 0) {
+		perror("Couldn't create a buffer");
+		exit(1);
+	}
+	return buffer;
+}
+
+void put_buffer(BufferPool *pool, cl_mem buffer) {
+
+	if (pool != NULL)
+		pool->release(buffer);
+	else
+		clReleaseMemObject(buffer);
+}
+
+/* One value of a result buffer through a mapping instead of a read copy */
+/* 通过映射而不是读拷贝取回结果buffer中的一个值*/
+void read_value(cl_command_queue queue, cl_mem buffer, void *value, size_t bytes) {
+
+	cl_int err;
+	char *mapped = mapBuffer<char>(queue, buffer, CL_MAP_READ, bytes, &err);
+	if (err < 0) {
+		perror("Couldn't map the buffer");
+		exit(1);
+	}
+	memcpy(value, mapped, bytes);
+	unmapBuffer(queue, buffer, mapped);
+}
+
+/* One request as a service would run it: three buffers, upload, reduce, read one value */
+/* 按服务端处理一次请求的方式：申请三个buffer、上传、归约、读回一个值，再释放*/
+float run_request(cl_context ctx, cl_command_queue queue, cl_kernel kernel,
+	BufferPool *pool, const float *data, cl_uint count, size_t local_size) {
+
+	cl_mem input, partials, scratch, result;
+	cl_event last_event = NULL;
+	cl_uint groups;
+	float sum;
+	int err;
+
+	groups = (cl_uint)((count + local_size - 1) / local_size);
+	input = get_buffer(ctx, pool, count * sizeof(float));
+	partials = get_buffer(ctx, pool, groups * sizeof(float));
+	scratch = get_buffer(ctx, pool, groups * sizeof(float));
+
+	/* The request data goes into the mapped input; only the copy out of the caller's array remains */
+	/* 请求数据直接写入映射后的输入buffer*/
+	float *mapped = mapBuffer<float>(queue, input, CL_MAP_WRITE_INVALIDATE_REGION,
+		count * sizeof(float), &err);
+	if (err < 0) {
+		perror("Couldn't map the buffer");
+		exit(1);
+	}
+	memcpy(mapped, data, count * sizeof(float));
+	unmapBuffer(queue, input, mapped);
+	enqueue_pass(queue, kernel, input, partials, count, local_size, local_size,
+		sizeof(float), &last_event);
+	result = reduce_partials(queue, kernel, partials, scratch, groups,
+		local_size, local_size, sizeof(float), &last_event);
+	read_value(queue, result, &sum, sizeof(float));
+	clReleaseEvent(last_event);
+
+	/* The blocking map has drained the queue, the buffers can go back now */
+	/* 阻塞读取后队列已空，buffer可以立即归还*/
+	put_buffer(pool, input);
+	put_buffer(pool, partials);
+	put_buffer(pool, scratch);
+	return sum;
+}
+
+/* Mean wall time per request with per-request clCreateBuffer and with the pool */
+/* 比较每次请求都clCreateBuffer与使用缓冲池时的平均请求延迟*/
+int request_latency(cl_context ctx, cl_device_id dev, cl_command_queue queue,
+	cl_kernel kernel, const float *data, size_t local_size) {
+
+	cl_uint sizes[4] = { 1024, 16384, 262144, ARRAY_SIZE };
+	double ms[2], expected;
+	int failed = 0;
+	float sum;
+
+	printf("request latency, %d requests each:\n", REQUESTS);
+	for (int s = 0; s < 4; s++) {
+		expected = (double)sizes[s] / 2 * (sizes[s] - 1);
+		for (int k = 0; k < 2; k++) {
+			BufferPool pool(ctx, dev, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+			BufferPool *p = k == 1 ? &pool : NULL;
+
+			/* Warm up: builds the kernel binary and fills the pool */
+			/* 预热：完成首次启动，并让缓冲池中有可用buffer*/
+			run_request(ctx, queue, kernel, p, data, sizes[s], local_size);
+			std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+			for (int r = 0; r < REQUESTS; r++) {
+				sum = run_request(ctx, queue, kernel, p, data, sizes[s], local_size);
+				failed |= fabs(sum - expected) > 0.01*expected;
+			}
+			std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+			ms[k] = std::chrono::duration<double, std::milli>(t1 - t0).count() / REQUESTS;
+			if (k == 1 && s == 3) {
+				pool.printStats("  buffer pool");
+			}
+		}
+		printf("  %8u floats: clCreateBuffer %8.3f ms, pool %8.3f ms (%.2fx)\n",
+			sizes[s], ms[0], ms[1], ms[0] / ms[1]);
+	}
+	printf("request_latency: %s\n", failed ? "Check failed." : "Check passed.");
+	return failed;
+}
+
 using namespace std;
 
 int main() {
@@ -118,15 +307,17 @@ int main() {
 	/* prof_event用于*/
 	cl_event prof_event;
 	cl_int i, j, err;
-	size_t local_size, global_size;
+	size_t local_size, global_size, max_local;
 	/* 若存在多个kernel函数，则命名放于这里*/
 	char kernel_names[NUM_KERNELS][20] =
 	{ "reduction_scalar", "reduction_vector" };
 
 	/* Data and buffers */
 	/* 数据和缓存*/
-	float data[ARRAY_SIZE];
-	float sum, actual_sum, *scalar_sum, *vector_sum;
+	float *data;
+	float sum, actual_sum, *scalar_sum, *vector_sum, *mapped;
+	/* 主机端的部分和累加和精确值用double，避免主机端再引入误差*/
+	double host_sum, exact_sum, vector_ms = 0.0;
 	/* 定义三个内存对象*/
 	cl_mem data_buffer, scalar_sum_buffer, vector_sum_buffer;
 	cl_int num_groups;
@@ -134,7 +325,8 @@ int main() {
 	cl_ulong time_start, time_end, total_time;
 	clock_t start, end;
 	/* Initialize data */
-	/* 初始化数据*/
+	/* 初始化数据，数组放在堆上以免栈溢出*/
+	data = (float*)malloc(ARRAY_SIZE * sizeof(float));
 	for (i = 0; i < ARRAY_SIZE; i++) {
 		data[i] = 1.0f*i;
 	}
@@ -143,23 +335,15 @@ int main() {
 	/* 创建设备并决定本地大小*/
 	device = create_device();
 	err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
-		sizeof(local_size), &local_size, NULL);
+		sizeof(max_local), &max_local, NULL);
 	local_size = LOCAL_SIZE;
 	if (err < 0) {
 		perror("Couldn't obtain device information");
 		exit(1);
 	}
-	/* Allocate and initialize output arrays */
-	/* 申请内存并初始化输出数组*/
+	/* Every group writes its partial sum, so the output buffers need no initial contents */
+	/* 每个工作组都会写出自己的部分和，输出buffer无需初始化*/
 	num_groups = ARRAY_SIZE / local_size;
-	scalar_sum = (float*)malloc(num_groups * sizeof(float));
-	vector_sum = (float*)malloc(num_groups / 4 * sizeof(float));
-	for (i = 0; i < num_groups; i++) {
-		scalar_sum[i] = 0.0f;
-	}
-	for (i = 0; i < num_groups / 4; i++) {
-		vector_sum[i] = 0.0f;
-	}
 
 	/* Create a context */
 	/* 创建一个上下文*/
@@ -173,19 +357,6 @@ int main() {
 	/* 构建程序*/
 	program = build_program(context, device, PROGRAM_FILE);
 
-	/* Create data buffer */
-	/* 创建数据buffer缓存，OpenCL一共可以创建Buffer和Image两种内存对象类型，实际应用中具体用途有所区别*/
-	data_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY |
-		CL_MEM_COPY_HOST_PTR, ARRAY_SIZE * sizeof(float), data, &err);
-	scalar_sum_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE |
-		CL_MEM_COPY_HOST_PTR, num_groups * sizeof(float), scalar_sum, &err);
-	vector_sum_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE |
-		CL_MEM_COPY_HOST_PTR, num_groups * sizeof(float), vector_sum, &err);
-	if (err < 0) {
-		perror("Couldn't create a buffer");
-		exit(1);
-	};
-
 	/* Create a command queue */
 	/* 创建一个命令队列*/
 	queue = clCreateCommandQueue(context, device,
@@ -195,6 +366,25 @@ int main() {
 		exit(1);
 	};
 
+	/* Create data buffer */
+	/* 创建数据buffer缓存，OpenCL一共可以创建Buffer和Image两种内存对象类型，实际应用中具体用途有所区别*/
+	/* 所有buffer都从缓冲池申请，池中buffer内容未定义，需要显式写入*/
+	/* Host-mappable (CL_MEM_ALLOC_HOST_PTR) buffers: the input is written and the results are read
+	   through mappings, so nothing is copied on devices sharing host memory */
+	/* 缓冲池中的buffer可被主机映射：输入通过映射写入，结果通过映射读取，共享内存的设备上无需拷贝*/
+	BufferPool pool(context, device, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+	data_buffer = get_buffer(context, &pool, ARRAY_SIZE * sizeof(float));
+	scalar_sum_buffer = get_buffer(context, &pool, num_groups * sizeof(float));
+	vector_sum_buffer = get_buffer(context, &pool, num_groups * sizeof(float));
+	mapped = mapBuffer<float>(queue, data_buffer, CL_MAP_WRITE_INVALIDATE_REGION,
+		ARRAY_SIZE * sizeof(float), &err);
+	if (err < 0) {
+		perror("Couldn't map the buffer");
+		exit(1);
+	};
+	memcpy(mapped, data, ARRAY_SIZE * sizeof(float));
+	unmapBuffer(queue, data_buffer, mapped);
+
 	for (i = 0; i < NUM_KERNELS; i++) {
 
 		/* Create a kernel */
@@ -249,29 +439,33 @@ int main() {
 
 		if (i == 0) {
 			/*将标量传入kernel计算*/
-			err = clEnqueueReadBuffer(queue, scalar_sum_buffer, CL_TRUE, 0,
-				num_groups * sizeof(float), scalar_sum, 0, NULL, NULL);
+			scalar_sum = mapBuffer<float>(queue, scalar_sum_buffer, CL_MAP_READ,
+				num_groups * sizeof(float), &err);
 			if (err < 0) {
-				perror("Couldn't read the buffer");
+				perror("Couldn't map the buffer");
 				exit(1);
 			}
-			sum = 0.0f;
+			host_sum = 0.0;
 			for (j = 0; j < num_groups; j++) {
-				sum += scalar_sum[j];
+				host_sum += scalar_sum[j];
 			}
+			unmapBuffer(queue, scalar_sum_buffer, scalar_sum);
+			sum = (float)host_sum;
 		}
 		else {
 			/*将向量传入kernel计算*/
-			err = clEnqueueReadBuffer(queue, vector_sum_buffer, CL_TRUE, 0,
-				num_groups / 4 * sizeof(float), vector_sum, 0, NULL, NULL);
+			vector_sum = mapBuffer<float>(queue, vector_sum_buffer, CL_MAP_READ,
+				num_groups / 4 * sizeof(float), &err);
 			if (err < 0) {
-				perror("Couldn't read the buffer");
+				perror("Couldn't map the buffer");
 				exit(1);
 			}
-			sum = 0.0f;
+			host_sum = 0.0;
 			for (j = 0; j < num_groups / 4; j++) {
-				sum += vector_sum[j];
+				host_sum += vector_sum[j];
 			}
+			unmapBuffer(queue, vector_sum_buffer, vector_sum);
+			sum = (float)host_sum;
 		}
 
 		/* Check result */
@@ -284,33 +478,249 @@ int main() {
 			printf("Check passed.\n");
 		//std::cout << "gpu Total time =  " << total_time<<"*1E-6 ms"<< std::endl;
 		printf( "gpu: %f ms\n",total_time*1e-6);  
+		if (i == 1) {
+			vector_ms = total_time*1e-6;
+		}
 		/* Deallocate event */
 		/* 释放事件——为什么要每次释放事件? 实时监测每次运算中的报错，prof_event作为参数输入不同cl函数可以输出不同信息*/
 		clReleaseEvent(prof_event);
 	}
 
-	float temp; 
+	/* Finish the reduction on the device and read back a single value */
+	/* 在设备端完成全部归约，只读回一个值*/
+	cl_kernel pass_kernel, last_block_kernel;
+	cl_mem pass_buffer[2], counter_buffer, result_buffer;
+	cl_event last_event;
+	cl_uint *counter;
+
+	pass_kernel = clCreateKernel(program, "reduction_scalar_bounded", &err);
+	if (err < 0) {
+		perror("Couldn't create a kernel");
+		exit(1);
+	};
+	last_block_kernel = clCreateKernel(program, "reduction_last_block", &err);
+	if (err < 0) {
+		perror("Couldn't create a kernel");
+		exit(1);
+	};
+
+	pass_buffer[0] = get_buffer(context, &pool, num_groups * sizeof(float));
+	pass_buffer[1] = get_buffer(context, &pool, num_groups * sizeof(float));
+	counter_buffer = get_buffer(context, &pool, sizeof(cl_uint));
+	counter = mapBuffer<cl_uint>(queue, counter_buffer, CL_MAP_WRITE_INVALIDATE_REGION,
+		sizeof(cl_uint), &err);
+	if (err < 0) {
+		perror("Couldn't map the buffer");
+		exit(1);
+	};
+	*counter = 0;
+	unmapBuffer(queue, counter_buffer, counter);
+
+	/* Multi-pass: reduction_vector followed by bounded scalar passes */
+	/* 多级归约：先执行reduction_vector，再对部分和做带边界的标量归约*/
+	global_size = ARRAY_SIZE / 4;
+	err = clSetKernelArg(kernel[1], 2, sizeof(cl_mem), &pass_buffer[0]);
+	if (err < 0) {
+		perror("Couldn't create a kernel argument");
+		exit(1);
+	}
+	err = clEnqueueNDRangeKernel(queue, kernel[1], 1, NULL, &global_size,
+		&local_size, 0, NULL, &prof_event);
+	if (err < 0) {
+		perror("Couldn't enqueue the kernel");
+		exit(1);
+	}
+	last_event = NULL;
+	result_buffer = reduce_partials(queue, pass_kernel, pass_buffer[0], pass_buffer[1],
+		(cl_uint)(global_size / local_size), local_size, local_size, sizeof(float), &last_event);
+	if (last_event == NULL) {
+		clRetainEvent(prof_event);
+		last_event = prof_event;
+	}
+	read_value(queue, result_buffer, &sum, sizeof(float));
+	clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_START,
+		sizeof(time_start), &time_start, NULL);
+	clGetEventProfilingInfo(last_event, CL_PROFILING_COMMAND_END,
+		sizeof(time_end), &time_end, NULL);
+	printf("reduction_multipass: ");
+	if (fabs(sum - actual_sum) > 0.01*fabs(sum))
+		printf("Check failed.\n");
+	else
+		printf("Check passed.\n");
+	printf("gpu: %f ms\n", (time_end - time_start)*1e-6);
+	clReleaseEvent(prof_event);
+	clReleaseEvent(last_event);
+
+	/* Atomic last block: one launch, the last group sums all partials */
+	/* 原子计数：单次启动，最后完成的工作组汇总所有部分和*/
+	err = clSetKernelArg(last_block_kernel, 0, sizeof(cl_mem), &data_buffer);
+	err |= clSetKernelArg(last_block_kernel, 1, local_size * 4 * sizeof(float), NULL);
+	err |= clSetKernelArg(last_block_kernel, 2, sizeof(cl_mem), &pass_buffer[0]);
+	err |= clSetKernelArg(last_block_kernel, 3, sizeof(cl_mem), &counter_buffer);
+	err |= clSetKernelArg(last_block_kernel, 4, sizeof(cl_mem), &pass_buffer[1]);
+	if (err < 0) {
+		perror("Couldn't create a kernel argument");
+		exit(1);
+	}
+	err = clEnqueueNDRangeKernel(queue, last_block_kernel, 1, NULL, &global_size,
+		&local_size, 0, NULL, &prof_event);
+	if (err < 0) {
+		perror("Couldn't enqueue the kernel");
+		exit(1);
+	}
+	read_value(queue, pass_buffer[1], &sum, sizeof(float));
+	clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_START,
+		sizeof(time_start), &time_start, NULL);
+	clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_END,
+		sizeof(time_end), &time_end, NULL);
+	printf("reduction_last_block: ");
+	if (fabs(sum - actual_sum) > 0.01*fabs(sum))
+		printf("Check failed.\n");
+	else
+		printf("Check passed.\n");
+	printf("gpu: %f ms\n", (time_end - time_start)*1e-6);
+	clReleaseEvent(prof_event);
+
+	/* Compensated sum: fixed grid of (hi, lo) pairs, then pair passes */
+	/* 补偿求和：固定网格上每个工作项保存(hi, lo)对，再对部分和做多级归约*/
+	cl_kernel kahan_kernel, kahan_pass_kernel, fixed_kernel;
+	cl_event first_event;
+	cl_uint compute_units, kahan_groups, count;
+	cl_float2 kahan_sum;
+	double kahan_ms, fixed_ms, kahan_error;
+
+	exact_sum = (double)ARRAY_SIZE / 2 * (ARRAY_SIZE - 1);
+	kahan_kernel = clCreateKernel(program, "reduction_kahan", &err);
+	kahan_pass_kernel = clCreateKernel(program, "reduction_kahan_partials", &err);
+	fixed_kernel = clCreateKernel(program, "reduction_fixed_order", &err);
+	if (err < 0) {
+		perror("Couldn't create a kernel");
+		exit(1);
+	};
+	clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS,
+		sizeof(compute_units), &compute_units, NULL);
+	kahan_groups = compute_units * 8;
+	if (kahan_groups * 2 > (cl_uint)num_groups) {
+		kahan_groups = num_groups / 2;
+	}
+
+	/* kahan_groups*local_size work-items stride through ARRAY_SIZE/4 float4 */
+	/* kahan_groups*local_size个工作项以网格步长遍历ARRAY_SIZE/4个float4*/
+	count = ARRAY_SIZE / 4;
+	err = clSetKernelArg(kahan_kernel, 0, sizeof(cl_mem), &data_buffer);
+	err |= clSetKernelArg(kahan_kernel, 1, local_size * sizeof(cl_float2), NULL);
+	err |= clSetKernelArg(kahan_kernel, 2, sizeof(cl_mem), &pass_buffer[0]);
+	err |= clSetKernelArg(kahan_kernel, 3, sizeof(cl_uint), &count);
+	if (err < 0) {
+		perror("Couldn't create a kernel argument");
+		exit(1);
+	}
+	global_size = kahan_groups * local_size;
+	err = clEnqueueNDRangeKernel(queue, kahan_kernel, 1, NULL, &global_size,
+		&local_size, 0, NULL, &first_event);
+	if (err < 0) {
+		perror("Couldn't enqueue the kernel");
+		exit(1);
+	}
+	last_event = NULL;
+	result_buffer = reduce_partials(queue, kahan_pass_kernel, pass_buffer[0], pass_buffer[1],
+		kahan_groups, local_size, local_size, sizeof(cl_float2), &last_event);
+	if (last_event == NULL) {
+		clRetainEvent(first_event);
+		last_event = first_event;
+	}
+	read_value(queue, result_buffer, &kahan_sum, sizeof(cl_float2));
+	kahan_ms = event_span_ms(first_event, last_event);
+	kahan_error = fabs((double)kahan_sum.s[0] + kahan_sum.s[1] - exact_sum);
+	printf("reduction_kahan: ");
+	if (kahan_error > 1e-7*exact_sum)
+		printf("Check failed.\n");
+	else
+		printf("Check passed.\n");
+	printf("gpu: %f ms, abs error %g, %.2fx reduction_vector time\n",
+		kahan_ms, kahan_error, kahan_ms / vector_ms);
+	clReleaseEvent(first_event);
+	clReleaseEvent(last_event);
+
+	/* Fixed order: same result bits for every run and local size */
+	/* 固定顺序：每次运行、每种本地大小得到的结果逐位相同*/
+	float fixed_sum, first_sum = 0.0f;
+	size_t fixed_local[3] = { 64, 128, 256 };
+	int reproducible = 1, runs = 0;
+	fixed_ms = 0.0;
+	for (j = 0; j < 3; j++) {
+		if (fixed_local[j] > max_local) {
+			continue;
+		}
+		for (int run = 0; run < 2; run++) {
+			last_event = NULL;
+			enqueue_pass(queue, fixed_kernel, data_buffer, pass_buffer[0], ARRAY_SIZE,
+				fixed_local[j], 1024, sizeof(float), &first_event);
+			result_buffer = reduce_partials(queue, fixed_kernel, pass_buffer[0], pass_buffer[1],
+				(ARRAY_SIZE + 1023) / 1024, fixed_local[j], 1024, sizeof(float), &last_event);
+			if (last_event == NULL) {
+				clRetainEvent(first_event);
+				last_event = first_event;
+			}
+			read_value(queue, result_buffer, &fixed_sum, sizeof(float));
+			if (fixed_local[j] == local_size) {
+				fixed_ms = event_span_ms(first_event, last_event);
+			}
+			if (runs++ == 0) {
+				first_sum = fixed_sum;
+			}
+			reproducible &= memcmp(&fixed_sum, &first_sum, sizeof(float)) == 0;
+			clReleaseEvent(first_event);
+			clReleaseEvent(last_event);
+		}
+	}
+	printf("reduction_fixed_order: ");
+	if (!reproducible || fabs(first_sum - exact_sum) > 1e-6*exact_sum)
+		printf("Check failed.\n");
+	else
+		printf("Check passed.\n");
+	printf("gpu: %f ms, %d runs bitwise identical: %s, %.2fx reduction_vector time\n",
+		fixed_ms, runs, reproducible ? "yes" : "no", fixed_ms / vector_ms);
+
+	/* CPU reference in double */
+	/* CPU端用double累加作为对照*/
+	double temp = 0.0;
 	start = clock();//star
 	for(int i = 0;i<ARRAY_SIZE ;i++)
 	{
-		temp += data[1];
+		temp += data[i];
 	}
 	end	 = clock();//end
+	printf("cpu result : %f (exact %f)\n", temp, exact_sum);
 	printf( "cpu: %f ms\n", (double)(end - start) / CLOCKS_PER_SEC *1000);  
+
+	/* Per-request allocation against the buffer pool */
+	/* 每次请求分配buffer与使用缓冲池的对比*/
+	int failed = request_latency(context, device, queue, pass_kernel, data, local_size);
+
 	/* Deallocate resources */
 	/* 释放资源*/
-	free(scalar_sum);
-	free(vector_sum);
+	free(data);
 	for (i = 0; i < NUM_KERNELS; i++) {
 		clReleaseKernel(kernel[i]);
 	}
+	clReleaseKernel(pass_kernel);
+	clReleaseKernel(last_block_kernel);
+	clReleaseKernel(kahan_kernel);
+	clReleaseKernel(kahan_pass_kernel);
+	clReleaseKernel(fixed_kernel);
+	pool.release(pass_buffer[0]);
+	pool.release(pass_buffer[1]);
+	pool.release(counter_buffer);
 	/* 在循环执行的最后释放所有的内存对象，这些内存对象可以循环使用不需要中途释放重新建立，否则太影响效率*/
-	clReleaseMemObject(scalar_sum_buffer);
-	clReleaseMemObject(vector_sum_buffer);
-	clReleaseMemObject(data_buffer);
+	pool.release(scalar_sum_buffer);
+	pool.release(vector_sum_buffer);
+	pool.release(data_buffer);
+	pool.printStats("buffer pool");
+	pool.trim();
 	clReleaseCommandQueue(queue);
 	clReleaseProgram(program);
 	clReleaseContext(context);
-	return 0;
+	return failed;
 }
 
@@ -0,0 +1,148 @@
+/*
+ * Reduce-then-scan prefix sum. The host picks the variant at build time:
+ *
+ *    -D T=int|uint|float  element and accumulator type
+ *    -D ITEMS=<n>         consecutive elements per work-item
+ *    -D SEGMENTED         a nonzero flag starts a new segment
+ *
+ * A tile is get_local_size(0)*ITEMS elements. scan_reduce writes one
+ * (sum, has-head) pair per tile, the host scans those pairs with the same
+ * kernels, and scan_downsweep rescans every tile seeded with the inclusive
+ * prefix of the tiles before it.
+ */
+
+#ifndef ITEMS
+#define ITEMS 8
+#endif
+
+/* flag is 1 if the range contains a segment head; always 0 when unsegmented */
+typedef struct {
+   T value;
+   uint flag;
+} pair_t;
+
+inline pair_t make_pair(T value, uint flag) {
+   pair_t p;
+   p.value = value;
+   p.flag = flag;
+   return p;
+}
+
+/* Segmented sum operator: a head in b discards everything from a */
+inline pair_t combine(pair_t a, pair_t b) {
+#ifdef SEGMENTED
+   return make_pair(b.flag ? b.value : a.value + b.value, a.flag | b.flag);
+#else
+   return make_pair(a.value + b.value, 0);
+#endif
+}
+
+/* Coalesced copy of one tile into local memory, the tail padded with zeros */
+inline void load_tile(__global const T *data, __global const uchar *flags,
+      uint count, uint base, __local T *l_values, __local uchar *l_flags) {
+
+   uint lid = get_local_id(0);
+   uint tile = get_local_size(0) * ITEMS;
+
+   for(uint i = lid; i < tile; i += get_local_size(0)) {
+      l_values[i] = base + i < count ? data[base + i] : (T)0;
+#ifdef SEGMENTED
+      l_flags[i] = base + i < count && flags[base + i] != 0;
+#else
+      l_flags[i] = 0;
+#endif
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+/* Fold of the work-item's own ITEMS elements, in order */
+inline pair_t thread_fold(__local const T *l_values, __local const uchar *l_flags) {
+
+   uint first = get_local_id(0) * ITEMS;
+   pair_t p = make_pair(l_values[first], l_flags[first]);
+
+   for(uint k = 1; k < ITEMS; k++) {
+      p = combine(p, make_pair(l_values[first + k], l_flags[first + k]));
+   }
+   return p;
+}
+
+/* Inclusive Hillis-Steele scan of one pair per work-item */
+inline pair_t group_scan(pair_t p, __local pair_t *l_pairs) {
+
+   uint lid = get_local_id(0);
+   pair_t other;
+
+   l_pairs[lid] = p;
+   barrier(CLK_LOCAL_MEM_FENCE);
+   for(uint offset = 1; offset < get_local_size(0); offset <<= 1) {
+      if(lid >= offset) {
+         other = l_pairs[lid - offset];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+      if(lid >= offset) {
+         p = combine(other, p);
+         l_pairs[lid] = p;
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+   return p;
+}
+
+/* Phase 1: one (sum, has-head) pair per tile */
+__kernel void scan_reduce(__global const T *data, __global const uchar *flags,
+      uint count, __local T *l_values, __local uchar *l_flags, __local pair_t *l_pairs,
+      __global T *sums, __global uchar *sum_flags) {
+
+   uint base = get_group_id(0) * get_local_size(0) * ITEMS;
+   pair_t p;
+
+   load_tile(data, flags, count, base, l_values, l_flags);
+   p = group_scan(thread_fold(l_values, l_flags), l_pairs);
+
+   if(get_local_id(0) == get_local_size(0) - 1) {
+      sums[get_group_id(0)] = p.value;
+#ifdef SEGMENTED
+      sum_flags[get_group_id(0)] = p.flag;
+#endif
+   }
+}
+
+/* Phase 2: rescan every tile. block_scan holds the inclusive scan of the
+   tile pairs and is only read by groups after the first. output may be data. */
+__kernel void scan_downsweep(__global const T *data, __global const uchar *flags,
+      uint count, __local T *l_values, __local uchar *l_flags, __local pair_t *l_pairs,
+      __global const T *block_scan, __global T *output, uint exclusive) {
+
+   uint lid = get_local_id(0);
+   uint tile = get_local_size(0) * ITEMS;
+   uint base = get_group_id(0) * tile;
+   uint first = lid * ITEMS;
+   pair_t running, x;
+
+   load_tile(data, flags, count, base, l_values, l_flags);
+   group_scan(thread_fold(l_values, l_flags), l_pairs);
+
+   /* The seed carries no head: tile heads are in l_flags already */
+   running = make_pair(get_group_id(0) > 0 ? block_scan[get_group_id(0) - 1] : (T)0, 0);
+   if(lid > 0) {
+      running = combine(running, l_pairs[lid - 1]);
+   }
+
+   for(uint k = 0; k < ITEMS; k++) {
+      x = make_pair(l_values[first + k], l_flags[first + k]);
+      if(exclusive) {
+         l_values[first + k] = x.flag ? (T)0 : running.value;
+         running = combine(running, x);
+      }
+      else {
+         running = combine(running, x);
+         l_values[first + k] = running.value;
+      }
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for(uint i = lid; i < tile && base + i < count; i += get_local_size(0)) {
+      output[base + i] = l_values[i];
+   }
+}
@@ -0,0 +1,224 @@
+#include <CL/cl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "scan.hpp"
+
+#define BENCH_MAX (1u << 30)
+#define LOOP 5
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+/* Host reference; small integers keep float sums exact so results compare bitwise */
+template <typename T>
+void reference_scan(const std::vector<T> &in, const std::vector<cl_uchar> *flags, bool exclusive,
+                    std::vector<T> &out)
+{
+    T running = 0;
+    out.resize(in.size());
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        if (flags != NULL && (*flags)[i])
+            running = 0;
+        if (exclusive)
+        {
+            out[i] = running;
+            running += in[i];
+        }
+        else
+        {
+            running += in[i];
+            out[i] = running;
+        }
+    }
+}
+
+template <typename T>
+bool check_scan(cl_context context, cl_command_queue queue, ScanEngine &engine, ScanType type,
+                size_t count, bool exclusive, bool segmented)
+{
+    std::vector<T> in(count), out(count), expected;
+    std::vector<cl_uchar> flags(count);
+    cl_int err;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        in[i] = (T)(rand() % 5) - (type == SCAN_UINT ? (T)0 : (T)2);
+        flags[i] = rand() % 97 == 0;
+    }
+    reference_scan(in, segmented ? &flags : NULL, exclusive, expected);
+
+    cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                   count * sizeof(T), in.data(), &err);
+    cl_mem flagBuffer = NULL;
+    if (err == CL_SUCCESS && segmented)
+        flagBuffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                    count, flags.data(), &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a buffer");
+        exit(1);
+    }
+
+    /* In place, the way the benchmark runs */
+    err = engine.scan(buffer, buffer, (cl_uint)count, type, exclusive, flagBuffer);
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, count * sizeof(T), out.data(), 0, NULL, NULL);
+
+    clReleaseMemObject(buffer);
+    if (flagBuffer != NULL)
+        clReleaseMemObject(flagBuffer);
+    return err == CL_SUCCESS && memcmp(out.data(), expected.data(), count * sizeof(T)) == 0;
+}
+
+/* In-place inclusive int scan of all ones: element i must become i + 1 */
+void benchmark(cl_context context, cl_command_queue queue, ScanEngine &engine, cl_uint count)
+{
+    cl_int err, one = 1;
+    size_t bytes = (size_t)count * sizeof(cl_int);
+
+    cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    if (err < 0)
+    {
+        printf("%10u elements: skipped, buffer of %.2f GB not available\n", count, bytes / 1e9);
+        return;
+    }
+
+    double total = 0.0;
+    bool ok = true;
+    for (int i = 0; i <= LOOP && ok; i++)
+    {
+        clEnqueueFillBuffer(queue, buffer, &one, sizeof(one), 0, bytes, 0, NULL, NULL);
+        clFinish(queue);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        err = engine.scan(buffer, buffer, count, SCAN_INT, false);
+        clFinish(queue);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        ok = err == CL_SUCCESS;
+
+        /* The first run builds the programs and allocates the level buffers */
+        if (i > 0)
+            total += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+    }
+
+    /* Spot-check the ends and a few positions in between */
+    for (int k = 0; k <= 16 && ok; k++)
+    {
+        size_t index = k == 16 ? count - 1 : (size_t)count / 16 * k;
+        cl_int value;
+        clEnqueueReadBuffer(queue, buffer, CL_TRUE, index * sizeof(cl_int), sizeof(value), &value, 0, NULL, NULL);
+        ok = value == (cl_int)(index + 1);
+    }
+
+    double ms = total / LOOP;
+    printf("%10u elements: %9.3f ms  %7.3f Gelem/s  %7.2f GB/s  %s\n", count, ms,
+           count / (ms * 1e6), 2.0 * bytes / (ms * 1e6), ok ? "Check passed." : "Check failed.");
+    clReleaseMemObject(buffer);
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *typeNames[] = { "int", "uint", "float" };
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_int err;
+    cl_uint benchMax = BENCH_MAX;
+    int failed = 0;
+
+    if (argc > 1)
+    {
+        benchMax = (cl_uint)strtoul(argv[1], NULL, 10);
+    }
+
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+    queue = clCreateCommandQueue(context, device, 0, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a command queue");
+        exit(1);
+    }
+
+    ProgramCache cache(context, device);
+    ScanEngine engine(cache, queue);
+
+    /* One tile, tile boundaries, two and three levels */
+    size_t tile = engine.tileSize();
+    size_t lengths[] = { 1, 7, tile - 1, tile, tile + 1, 100003, tile * tile - 1, tile * tile + 5 };
+    srand(123);
+    for (int type = SCAN_INT; type <= SCAN_FLOAT; type++)
+    {
+        for (int mode = 0; mode < 4; mode++)
+        {
+            bool exclusive = mode & 1, segmented = (mode & 2) != 0;
+            int passed = 0, total = 0;
+            for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+            {
+                bool ok = type == SCAN_INT ? check_scan<cl_int>(context, queue, engine, SCAN_INT, lengths[l], exclusive, segmented) :
+                          type == SCAN_UINT ? check_scan<cl_uint>(context, queue, engine, SCAN_UINT, lengths[l], exclusive, segmented) :
+                          check_scan<cl_float>(context, queue, engine, SCAN_FLOAT, lengths[l], exclusive, segmented);
+                if (!ok)
+                    printf("  length %u failed\n", (unsigned int)lengths[l]);
+                passed += ok;
+                total++;
+            }
+            failed |= passed != total;
+            printf("%-5s %s %-11s: %d/%d lengths, %s\n", typeNames[type], exclusive ? "exclusive" : "inclusive",
+                   segmented ? "segmented" : "unsegmented", passed, total,
+                   passed == total ? "Check passed." : "Check failed.");
+        }
+    }
+
+    /* 1M to 1B elements, as far as the device allows */
+    cl_ulong maxAlloc = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, NULL);
+    printf("inclusive int scan, in place (max allocation %.2f GB):\n", maxAlloc / 1e9);
+    for (cl_ulong count = 1 << 20; count <= benchMax; count <<= 2)
+    {
+        if (count * sizeof(cl_int) > maxAlloc)
+        {
+            printf("%10u elements: skipped, above CL_DEVICE_MAX_MEM_ALLOC_SIZE\n", (unsigned int)count);
+            continue;
+        }
+        benchmark(context, queue, engine, (cl_uint)count);
+    }
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+    return failed;
+}
@@ -0,0 +1,195 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <CL/cl.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../common/program_cache.hpp"
+
+#define SCAN_PROGRAM_FILE "scan.cl"
+#define SCAN_LOCAL_SIZE 256
+#define SCAN_ITEMS 8
+
+enum ScanType
+{
+    SCAN_INT,
+    SCAN_UINT,
+    SCAN_FLOAT
+};
+
+/*
+ * Prefix sum over int, uint or float buffers with scan.cl. Each level
+ * reduces tiles of localSize*items elements to one pair per tile, scans the
+ * tile pairs with the next level, and rescans every tile with its offset,
+ * so a scan of n elements costs about 3n memory traffic and log_tile(n)
+ * levels. Segmented scans take a uchar flag per element, nonzero at the
+ * first element of each segment.
+ */
+class ScanEngine
+{
+public:
+    ScanEngine(ProgramCache &cache, cl_command_queue queue,
+               const std::string &programFile = SCAN_PROGRAM_FILE,
+               size_t localSize = SCAN_LOCAL_SIZE, size_t items = SCAN_ITEMS)
+        : m_cache(cache), m_queue(queue), m_programFile(programFile), m_localSize(localSize),
+          m_items(items)
+    {
+    }
+
+    ~ScanEngine()
+    {
+        for (std::map<std::string, cl_kernel>::iterator it = m_kernels.begin(); it != m_kernels.end(); ++it)
+        {
+            clReleaseKernel(it->second);
+        }
+        for (size_t i = 0; i < m_sums.size(); i++)
+        {
+            clReleaseMemObject(m_sums[i]);
+            clReleaseMemObject(m_sumFlags[i]);
+        }
+    }
+
+    size_t tileSize() const { return m_localSize * m_items; }
+
+    /* output may be input; flags may be NULL for an unsegmented scan */
+    cl_int scan(cl_mem input, cl_mem output, cl_uint count, ScanType type, bool exclusive,
+                cl_mem flags = NULL)
+    {
+        cl_int status;
+        std::string options = buildOptions(type, flags != NULL);
+        cl_kernel reduce = getKernel(options, "scan_reduce", &status);
+        if (status != CL_SUCCESS)
+            return status;
+        cl_kernel downsweep = getKernel(options, "scan_downsweep", &status);
+        if (status != CL_SUCCESS)
+            return status;
+        if (count == 0)
+            return CL_SUCCESS;
+        return scanLevel(0, reduce, downsweep, input, flags, count, output, exclusive);
+    }
+
+private:
+    std::string buildOptions(ScanType type, bool segmented) const
+    {
+        static const char *typeNames[] = { "int", "uint", "float" };
+        char options[128];
+        snprintf(options, sizeof(options), "-D T=%s -D ITEMS=%u%s", typeNames[type],
+                 (unsigned int)m_items, segmented ? " -D SEGMENTED" : "");
+        return options;
+    }
+
+    cl_kernel getKernel(const std::string &options, const char *name, cl_int *status)
+    {
+        std::string key = options + ' ' + name;
+        std::map<std::string, cl_kernel>::iterator it = m_kernels.find(key);
+        if (it != m_kernels.end())
+        {
+            *status = CL_SUCCESS;
+            return it->second;
+        }
+
+        cl_kernel kernel = m_cache.createKernel(m_programFile, options, name, status);
+        if (*status == CL_SUCCESS)
+        {
+            m_kernels[key] = kernel;
+        }
+        return kernel;
+    }
+
+    /* Tile sums of this level live in m_sums[level] and are scanned in place by the next */
+    cl_int reserveLevel(size_t level, size_t tiles)
+    {
+        cl_int status = CL_SUCCESS;
+        if (level < m_sums.size() && m_levelSize[level] >= tiles)
+            return CL_SUCCESS;
+
+        if (level < m_sums.size())
+        {
+            clReleaseMemObject(m_sums[level]);
+            clReleaseMemObject(m_sumFlags[level]);
+        }
+        else
+        {
+            m_sums.push_back(NULL);
+            m_sumFlags.push_back(NULL);
+            m_levelSize.push_back(0);
+        }
+
+        /* Every scan type is four bytes wide */
+        m_sums[level] = clCreateBuffer(m_cache.context(), CL_MEM_READ_WRITE, tiles * sizeof(cl_uint), NULL, &status);
+        if (status == CL_SUCCESS)
+            m_sumFlags[level] = clCreateBuffer(m_cache.context(), CL_MEM_READ_WRITE, tiles, NULL, &status);
+        m_levelSize[level] = status == CL_SUCCESS ? tiles : 0;
+        return status;
+    }
+
+    cl_int setTileArgs(cl_kernel kernel, cl_mem input, cl_mem flags, cl_uint count)
+    {
+        size_t tile = tileSize();
+        cl_int status;
+        status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+        status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &flags);
+        status |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &count);
+        status |= clSetKernelArg(kernel, 3, tile * sizeof(cl_uint), NULL);
+        status |= clSetKernelArg(kernel, 4, tile * sizeof(cl_uchar), NULL);
+        status |= clSetKernelArg(kernel, 5, m_localSize * 2 * sizeof(cl_uint), NULL);
+        return status;
+    }
+
+    cl_int scanLevel(size_t level, cl_kernel reduce, cl_kernel downsweep, cl_mem input, cl_mem flags,
+                     cl_uint count, cl_mem output, bool exclusive)
+    {
+        size_t tiles = (count + tileSize() - 1) / tileSize();
+        size_t globalSize = tiles * m_localSize;
+        cl_uint exclusiveArg = exclusive ? 1 : 0;
+        cl_mem blockScan = input;
+        cl_int status;
+
+        if (tiles > 1)
+        {
+            status = reserveLevel(level, tiles);
+            if (status != CL_SUCCESS)
+                return status;
+            blockScan = m_sums[level];
+            cl_mem sumFlags = flags != NULL ? m_sumFlags[level] : NULL;
+
+            status = setTileArgs(reduce, input, flags, count);
+            status |= clSetKernelArg(reduce, 6, sizeof(cl_mem), &blockScan);
+            status |= clSetKernelArg(reduce, 7, sizeof(cl_mem), &sumFlags);
+            if (status != CL_SUCCESS)
+                return status;
+            status = clEnqueueNDRangeKernel(m_queue, reduce, 1, NULL, &globalSize, &m_localSize, 0, NULL, NULL);
+            if (status != CL_SUCCESS)
+                return status;
+
+            /* Tile offsets are the inclusive scan of the tile pairs */
+            status = scanLevel(level + 1, reduce, downsweep, blockScan, sumFlags, (cl_uint)tiles,
+                               blockScan, false);
+            if (status != CL_SUCCESS)
+                return status;
+        }
+
+        /* A single tile never reads blockScan; any valid buffer will do */
+        status = setTileArgs(downsweep, input, flags, count);
+        status |= clSetKernelArg(downsweep, 6, sizeof(cl_mem), &blockScan);
+        status |= clSetKernelArg(downsweep, 7, sizeof(cl_mem), &output);
+        status |= clSetKernelArg(downsweep, 8, sizeof(cl_uint), &exclusiveArg);
+        if (status != CL_SUCCESS)
+            return status;
+        return clEnqueueNDRangeKernel(m_queue, downsweep, 1, NULL, &globalSize, &m_localSize, 0, NULL, NULL);
+    }
+
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::string m_programFile;
+    size_t m_localSize;
+    size_t m_items;
+    std::map<std::string, cl_kernel> m_kernels;
+    std::vector<cl_mem> m_sums;
+    std::vector<cl_mem> m_sumFlags;
+    std::vector<size_t> m_levelSize;
+};
+
+#endif
@@ -0,0 +1,87 @@
+// CPU baseline for the OpenCL sorters: parallel radix sort against std::sort
+
+#include<iostream>                                                                              //for std::cout
+#include<algorithm>
+#include<chrono>
+#include<climits>
+#include<limits>
+#include<cstdlib>
+#include<random>
+#include<vector>
+#include<omp.h>
+#include "parallelSort.hpp"
+#include "../../common/array_file.hpp"
+using namespace std;
+
+template<typename Key>
+vector<Key> randomKeys(size_t n)
+{
+    mt19937 generator(123);
+    uniform_int_distribution<long long> distribution(numeric_limits<Key>::min(), numeric_limits<Key>::max());
+    vector<Key> keys(n);
+    for(size_t i = 0; i < n; i++)
+    {
+        keys[i] = (Key)distribution(generator);
+    }
+    return keys;
+}
+
+template<typename Key>
+bool benchmark(const char *name, vector<Key> ar, int threads)                                   //sort the same keys with both sorts and compare
+{
+    size_t n = ar.size();
+    vector<Key> reference(ar);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    parallelRadixSort(ar.data(), n, threads);
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    double radixTime = chrono::duration_cast<chrono::microseconds>(end - start).count() / 1000.0;
+
+    start = chrono::steady_clock::now();
+    sort(reference.begin(), reference.end());
+    end = chrono::steady_clock::now();
+    double stdTime = chrono::duration_cast<chrono::microseconds>(end - start).count() / 1000.0;
+
+    bool ok = ar == reference;
+    cout<<name<<": "<<(ok ? "sorted" : "sorting failed")<<", parallel radix "<<radixTime<<" ms ("
+        <<n / radixTime / 1000.0<<" Mkeys/s), std::sort "<<stdTime<<" ms\n";
+    return ok;
+}
+
+int main(int argc, char **argv)                                                                 //usage: cpuSort [number of elements | int32 array file] [threads]
+{
+    size_t n = 1 << 24;
+    int threads = omp_get_num_procs();                                                          //gives number of logical cores
+    bool fromFile = argc > 1 && isArrayFileArgument(argv[1]);                                     //an existing file or *.arr: keys from randomNumberGenerator
+    if(argc > 1 && !fromFile && !parseArrayCount(argv[1], &n))
+    {
+        cerr<<argv[1]<<": neither a positive count nor an array file\n";
+        return 1;
+    }
+    if(argc > 2)
+    {
+        threads = atoi(argv[2]);
+    }
+
+    if(fromFile)
+    {
+        ArrayFile file;
+        if(!file.open(argv[1]))
+        {
+            cerr<<argv[1]<<": "<<file.error()<<"\n";
+            return 1;
+        }
+        if(!file.expect(argv[1], ARRAY_INT32, 1))
+        {
+            return 1;
+        }
+        cout<<"sorting "<<file.count()<<" keys of "<<argv[1]<<" with "<<threads<<" threads\n";
+        const int *keys = file.data<int>();
+        return benchmark<int>("file", vector<int>(keys, keys + file.count()), threads) ? 0 : 1;
+    }
+
+    cout<<"sorting "<<n<<" keys with "<<threads<<" threads\n";
+    bool ok = benchmark<int>("int", randomKeys<int>(n), threads);
+    ok = benchmark<unsigned short>("ushort", randomKeys<unsigned short>(n), threads) && ok;
+    return ok ? 0 : 1;
+}
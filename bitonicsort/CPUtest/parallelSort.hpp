@@ -0,0 +1,107 @@
+// multithreaded LSD radix sort, used as the CPU fallback and the CPU baseline for the OpenCL sorters
+
+#ifndef PARALLEL_SORT_HPP
+#define PARALLEL_SORT_HPP
+
+#include<algorithm>
+#include<cstddef>
+#include<type_traits>
+#include<vector>
+#include<omp.h>
+
+const int radixBits = 8;                                                                        //one byte per pass, 256 buckets fit in L1 per thread
+const int radixBuckets = 1 << radixBits;
+const size_t radixSmallSort = 1 << 14;                                                          //below this a single-threaded comparison sort wins
+
+template<typename Key>
+inline typename std::make_unsigned<Key>::type radixEncode(Key key)                              //map a key to an unsigned value with the same ordering
+{
+    typedef typename std::make_unsigned<Key>::type Bits;
+    Bits bits = static_cast<Bits>(key);
+    if(std::is_signed<Key>::value)
+    {
+        bits ^= static_cast<Bits>(Bits(1) << (sizeof(Key) * 8 - 1));                           //flip the sign bit so negative keys come first
+    }
+    return bits;
+}
+
+template<typename Key>
+void parallelRadixSort(Key *ar, size_t n, int numThreads = omp_get_max_threads())               //sort ar[0..n) ascending; Key is one of the OpenCL sorters' key types (int, unsigned short)
+{
+    static_assert(std::is_integral<Key>::value, "radix sort needs integral keys");
+
+    if(n < radixSmallSort || numThreads < 2)
+    {
+        std::sort(ar, ar + n);
+        return;
+    }
+
+    std::vector<Key> buffer(n);
+    std::vector<size_t> counts(numThreads * radixBuckets);
+    Key *src = ar;
+    Key *dst = buffer.data();
+
+    for(size_t shift = 0; shift < sizeof(Key) * 8; shift += radixBits)
+    {
+        bool skipPass = false;
+
+        #pragma omp parallel num_threads(numThreads)
+        {
+            int thread = omp_get_thread_num();
+            int threads = omp_get_num_threads();
+            size_t begin = n * thread / threads;
+            size_t end = n * (thread + 1) / threads;
+            size_t *count = &counts[thread * radixBuckets];
+
+            std::fill(count, count + radixBuckets, 0);
+            for(size_t i = begin; i < end; i++)                                                 //every thread histograms its own contiguous chunk
+            {
+                count[(radixEncode(src[i]) >> shift) & (radixBuckets - 1)]++;
+            }
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                size_t sum = 0;
+                for(int digit = 0; digit < radixBuckets; digit++)                               //digit-major, thread-minor offsets keep the scatter stable
+                {
+                    size_t digitSum = sum;
+                    for(int t = 0; t < threads; t++)
+                    {
+                        size_t c = counts[t * radixBuckets + digit];
+                        counts[t * radixBuckets + digit] = sum;
+                        sum += c;
+                    }
+                    if(sum - digitSum == n)                                                     //all keys share this digit, the pass would be a plain copy
+                    {
+                        skipPass = true;
+                    }
+                }
+            }
+
+            if(!skipPass)
+            {
+                for(size_t i = begin; i < end; i++)
+                {
+                    dst[count[(radixEncode(src[i]) >> shift) & (radixBuckets - 1)]++] = src[i];
+                }
+            }
+        }
+
+        if(!skipPass)
+        {
+            std::swap(src, dst);
+        }
+    }
+
+    if(src != ar)
+    {
+        #pragma omp parallel for num_threads(numThreads)
+        for(long long i = 0; i < (long long)n; i++)
+        {
+            ar[i] = src[i];
+        }
+    }
+}
+
+#endif
@@ -1,22 +1,96 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include<time.h>
+// Writes random test data as an array file (../../common/array_file.hpp) that the sorters, gemm, reduction and
+// inversion tools map instead of parsing
+//
+// The inversion kernels do not pivot, so a matrix for matrix_inversion must be diagonally dominant, as the one it
+// makes itself is:
+//     randomNumberGenerator m.arr 512 512 dominant
+//     matrix_inversion m.arr
+
 #include<iostream>
+#include<cctype>
+#include<climits>
+#include<cstdlib>
+#include<cstring>
+#include<random>
+#include<vector>
+#include "../../common/array_file.hpp"
 using namespace std;
-int main () {
-   int i, n;
-   time_t t;
-   
-   cin>>n;
-   
-   /* Intializes random number generator */
-   srand((unsigned) time(&t));
 
-   /* Print 5 random numbers from 0 to 49 */
-   cout<<n<<"\n";
-   for( i = 0 ; i < n ; i++ ) {
-       cout<<rand()<<"\n";
-   }
-   
-   return(0);
+int usage(const char *name)
+{
+    cerr<<"usage: "<<name<<" file rows [cols] [float] [dominant]\n"
+        <<"  int32 keys over the whole range, or float32 in [0, 1); one dimension without cols\n"
+        <<"  dominant: a square float32 matrix with rows added to the diagonal (for matrix_inversion)\n";
+    return 1;
+}
+
+int main(int argc, char **argv)                                                                 //usage: randomNumberGenerator file rows [cols] [float] [dominant]
+{
+    bool floats = false, dominant = false;
+    size_t shape[2] = {0, 1};
+    size_t dims = 0;
+    for(int i = 2; i < argc; i++)
+    {
+        if(strcmp(argv[i], "float") == 0)
+            floats = true;
+        else if(strcmp(argv[i], "dominant") == 0)
+            dominant = floats = true;
+        else
+        {
+            char *end;
+            unsigned long long value = strtoull(argv[i], &end, 10);
+            if(dims == 2 || floats)
+            {
+                cerr<<argv[i]<<": at most rows and cols, before the options\n";
+                return usage(argv[0]);
+            }
+            if(!isdigit((unsigned char)argv[i][0]) || *end != '\0' || value == 0)
+            {
+                cerr<<argv[i]<<": not a positive size\n";
+                return usage(argv[0]);
+            }
+            shape[dims++] = value;
+        }
+    }
+    if(argc < 2 || dims == 0)                                                                   //"file float" is not a size
+        return usage(argv[0]);
+    if(dominant && (dims != 2 || shape[0] != shape[1]))
+    {
+        cerr<<"dominant needs a square matrix: rows and cols equal\n";
+        return usage(argv[0]);
+    }
+    size_t n = shape[0] * shape[1];
+
+    mt19937 generator(random_device{}());                                                      //a new data set every run, like the old srand(time)
+    bool ok;
+    if(floats)
+    {
+        uniform_real_distribution<float> distribution(0.0f, 1.0f);
+        vector<float> data(n);
+        for(size_t i = 0; i < n; i++)
+        {
+            data[i] = distribution(generator);
+            if(dominant && i / shape[1] == i % shape[1])
+                data[i] += (float)shape[0];                                                     //the same shift matrix_inversion applies
+        }
+        ok = writeArrayFile(argv[1], ARRAY_FLOAT32, dims, shape, data.data());
+    }
+    else
+    {
+        uniform_int_distribution<int> distribution(INT_MIN, INT_MAX);
+        vector<int> data(n);
+        for(size_t i = 0; i < n; i++)
+        {
+            data[i] = distribution(generator);
+        }
+        ok = writeArrayFile(argv[1], ARRAY_INT32, dims, shape, data.data());
+    }
+    if(!ok)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    cout<<"wrote "<<n<<(floats ? " float32" : " int32")<<(dominant ? " diagonally dominant" : "")
+        <<" values to "<<argv[1]<<"\n";
+    return 0;
 }
@@ -270,3 +270,168 @@ __kernel void bitonic_sort_merge_last(__global int4 *g_data, __local int4 *l_dat
     g_data[global_start + get_local_id(0) + 1] = input2;
 
 }
+
+/* Keep the larger half of an ascending/descending run pair and sort it */
+__kernel void bitonic_topk_reduce(__global int4 *g_in, __local int4 *l_data,
+    __global int4 *g_out)
+{
+
+    int dir;
+    uint id, run_start, run_size, stride;
+    int4 input1, input2, temp;
+    int4 comp;
+
+    uint4 mask1 = (uint4)(1, 0, 3, 2);
+    uint4 mask2 = (uint4)(2, 3, 0, 1);
+
+    int4 add1 = (int4)(1, 1, 3, 3);
+    int4 add2 = (int4)(2, 3, 2, 3);
+    int4 add3 = (int4)(4, 5, 6, 7);
+
+    /* Each group consumes two runs written by the previous pass */
+    id = get_local_id(0);
+    dir = (get_group_id(0) % 2) * -1;
+    run_size = get_local_size(0) * 2;
+    run_start = get_group_id(0) * run_size * 2;
+
+    /* The element-wise maximum of an ascending and a descending run is a
+       bitonic set holding the largest half of both runs */
+    input1 = max(g_in[run_start + id], g_in[run_start + run_size + id]);
+    input2 = max(g_in[run_start + get_local_size(0) + id],
+        g_in[run_start + run_size + get_local_size(0) + id]);
+
+    /* Perform initial swap */
+    comp = (input1 < input2 ^ dir) * 4 + add3;
+    l_data[id] = shuffle2(input1, input2, as_uint4(comp));
+    l_data[id + get_local_size(0)] = shuffle2(input2, input1, as_uint4(comp));
+
+    /* Perform bitonic merge */
+    for(stride = get_local_size(0)/2; stride > 1; stride >>= 1)
+    {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        id = get_local_id(0) + (get_local_id(0)/stride)*stride;
+        VECTOR_SWAP(l_data[id], l_data[id + stride], dir)
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    /* Perform final sort */
+    id = get_local_id(0) * 2;
+    input1 = l_data[id]; input2 = l_data[id+1];
+    temp = input1;
+    comp = (input1 < input2 ^ dir) * 4 + add3;
+    input1 = shuffle2(input1, input2, as_uint4(comp));
+    input2 = shuffle2(input2, temp, as_uint4(comp));
+    VECTOR_SORT(input1, dir);
+    VECTOR_SORT(input2, dir);
+
+    /* Store the surviving run, alternating direction for the next pass */
+    g_out[get_group_id(0) * run_size + id] = input1;
+    g_out[get_group_id(0) * run_size + id + 1] = input2;
+
+}
+
+/* Count the elements of a that precede diagonal diag of the merge path */
+inline uint merge_path_search(__global const int *a, uint a_len,
+    __global const int *b, uint b_len, uint diag)
+{
+
+    uint low, high, mid;
+
+    low = diag > b_len ? diag - b_len : 0;
+    high = min(diag, a_len);
+    while(low < high)
+    {
+        mid = (low + high) >> 1;
+        if(a[mid] <= b[diag - 1 - mid])
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+
+}
+
+/* Same search over the tile staged in local memory */
+inline uint merge_path_search_local(__local const int *a, uint a_len,
+    __local const int *b, uint b_len, uint diag)
+{
+
+    uint low, high, mid;
+
+    low = diag > b_len ? diag - b_len : 0;
+    high = min(diag, a_len);
+    while(low < high)
+    {
+        mid = (low + high) >> 1;
+        if(a[mid] <= b[diag - 1 - mid])
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+
+}
+
+/* Split the merge path of a and b into tiles of equal output size */
+__kernel void merge_path_partition(__global const int *a, uint a_len,
+    __global const int *b, uint b_len, __global uint *splits,
+    uint tile_size, uint num_splits)
+{
+
+    uint id, diag;
+
+    id = get_global_id(0);
+    if(id >= num_splits)
+        return;
+
+    diag = min(id * tile_size, a_len + b_len);
+    splits[id] = merge_path_search(a, a_len, b, b_len, diag);
+
+}
+
+/* Merge one tile of the output per work-group */
+__kernel void merge_path_merge(__global const int *a, uint a_len,
+    __global const int *b, uint b_len, __global const uint *splits,
+    __local int *l_data, __global int *c, uint tile_size)
+{
+
+    uint i, lid, local_size, items;
+    uint diag_start, diag_end, a_start, b_start, a_count, b_count;
+    uint diag, diag_stop, a_id, b_id;
+
+    lid = get_local_id(0);
+    local_size = get_local_size(0);
+
+    /* Determine the slices of a and b that feed this tile */
+    diag_start = min((uint)get_group_id(0) * tile_size, a_len + b_len);
+    diag_end = min(diag_start + tile_size, a_len + b_len);
+    a_start = splits[get_group_id(0)];
+    b_start = diag_start - a_start;
+    a_count = splits[get_group_id(0) + 1] - a_start;
+    b_count = diag_end - diag_start - a_count;
+
+    /* Stage both slices in local memory with coalesced reads */
+    for(i = lid; i < a_count; i += local_size)
+        l_data[i] = a[a_start + i];
+    for(i = lid; i < b_count; i += local_size)
+        l_data[a_count + i] = b[b_start + i];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    /* Each work-item merges an equal share of the tile */
+    items = (tile_size + local_size - 1) / local_size;
+    diag = min(lid * items, a_count + b_count);
+    diag_stop = min(diag + items, a_count + b_count);
+    a_id = merge_path_search_local(l_data, a_count,
+        l_data + a_count, b_count, diag);
+    b_id = diag - a_id;
+
+    for(i = diag; i < diag_stop; i++)
+    {
+        if(b_id >= b_count ||
+            (a_id < a_count && l_data[a_id] <= l_data[a_count + b_id]))
+            c[diag_start + i] = l_data[a_id++];
+        else
+            c[diag_start + i] = l_data[a_count + b_id++];
+    }
+
+}
@@ -10,6 +10,11 @@
 #include <chrono>
 #include <climits>
 #include <CL/cl.hpp>
+#include "CPUtest/parallelSort.hpp"
+#include "bitonic-sort.hpp"
+#include "../common/buffer_pool.hpp"
+#include "../common/command_recorder.hpp"
+#include "../common/host_memory.hpp"
 
 #define PROGRAM_FILE                "bitonic-sort.cl"
 #define BITONIC_SORT_INIT           "bitonic_sort_init"
@@ -25,6 +30,10 @@
  */
 #define DATA_SIZE 32
 
+/* Keys and runs of the launch-overhead comparison; 2^20 keys take ~55 launches */
+#define REPLAY_SIZE                 (1 << 20)
+#define REPLAY_RUNS                 20
+
 #define PRESENT_DATA_INPUT          false
 #define PRESENT_DATA_OUTPUT         false
 #define PRESENT_PLATFORMS_DETAILS   false
@@ -101,10 +110,144 @@ cl_int chech_integrity(int *_data)
 
 }
 
+/*
+ * Host cost per launch of the sort: the engine's setArg + enqueue loop
+ * against a CommandRecorder replay of the same sequence. Only the enqueue
+ * calls are timed; the device work is waited for outside the timed part.
+ */
+bool replay_overhead(cl_context context, cl_device_id device, cl_command_queue queue)
+{
+    std::vector<int> keys(REPLAY_SIZE), sorted(REPLAY_SIZE);
+    std::default_random_engine generator;
+    std::uniform_int_distribution<int> distribution(INT_MIN, INT_MAX);
+    std::generate(keys.begin(), keys.end(), [&]() { return distribution(generator); });
+
+    ProgramCache cache(context, device);
+    BitonicSortEngine engine(cache, queue, PROGRAM_FILE);
+    cl_int err;
+    cl_mem buffer = createHostBuffer(context, CL_MEM_READ_WRITE, keys.size() * sizeof(int), NULL, &err);
+    if(err != CL_SUCCESS)
+    {
+        std::clog << "Couldn't create a buffer." << std::endl;
+        return false;
+    }
+
+    /* Warm-up builds the program */
+    err = engine.sort(buffer, REPLAY_SIZE, DIRECTION != 0);
+    clFinish(queue);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < REPLAY_RUNS && err == CL_SUCCESS; ++i)
+        err = engine.sort(buffer, REPLAY_SIZE, DIRECTION != 0);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    clFinish(queue);
+    double direct = std::chrono::duration<double, std::micro>(end - start).count() / REPLAY_RUNS;
+
+    CommandRecorder recorder(queue);
+    if(err == CL_SUCCESS)
+        err = engine.record(recorder, buffer, REPLAY_SIZE, DIRECTION != 0);
+    if(err == CL_SUCCESS)
+        err = recorder.finalize();
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < REPLAY_RUNS && err == CL_SUCCESS; ++i)
+        err = recorder.replay();
+    end = std::chrono::steady_clock::now();
+    clFinish(queue);
+    double replayed = std::chrono::duration<double, std::micro>(end - start).count() / REPLAY_RUNS;
+
+    /* The replay must still sort */
+    int *mapped = NULL;
+    if(err == CL_SUCCESS)
+        mapped = mapBuffer<int>(queue, buffer, CL_MAP_WRITE_INVALIDATE_REGION, keys.size() * sizeof(int), &err);
+    if(err == CL_SUCCESS)
+    {
+        std::copy(keys.begin(), keys.end(), mapped);
+        err = unmapBuffer(queue, buffer, mapped);
+    }
+    if(err == CL_SUCCESS)
+        err = recorder.replay();
+    if(err == CL_SUCCESS)
+        mapped = mapBuffer<int>(queue, buffer, CL_MAP_READ, sorted.size() * sizeof(int), &err);
+    if(err == CL_SUCCESS)
+    {
+        std::copy(mapped, mapped + sorted.size(), sorted.begin());
+        err = unmapBuffer(queue, buffer, mapped);
+    }
+    clFinish(queue);
+    clReleaseMemObject(buffer);
+    if(DIRECTION == 0)
+        std::sort(keys.begin(), keys.end());
+    else
+        std::sort(keys.begin(), keys.end(), std::greater<int>());
+    bool ok = err == CL_SUCCESS && keys == sorted;
+
+    size_t launches = recorder.launches();
+    std::clog << "launch overhead, " << REPLAY_SIZE << " keys, " << launches << " launches: setArg+enqueue "
+        << direct / launches << "us, " << (recorder.usesCommandBuffer() ? "command buffer " : "pre-bound replay ")
+        << replayed / launches << "us per launch ("
+        << recorder.kernels() << " kernel objects). " << (ok ? "Check passed." : "Check failed.") << std::endl;
+    return ok;
+}
+
+/*
+ * Sorts the int32 keys of an array file (CPUtest/randomNumberGenerator) in
+ * a buffer over the mapped file, so the keys reach the device without a
+ * parse or a host copy. The count must be a power of two of at least 8.
+ */
+bool sort_file(cl_context context, cl_device_id device, cl_command_queue queue, const char *path)
+{
+    ArrayFile file;
+    if(!file.open(path))
+    {
+        std::clog << path << ": " << file.error() << std::endl;
+        return false;
+    }
+    size_t count = file.count();
+    if(!file.expect(path, ARRAY_INT32, 1))
+        return false;
+    if(count < 8 || (count & (count - 1)) != 0)
+    {
+        std::clog << path << ": " << count << " keys, the bitonic sort needs a power of two of at least 8" << std::endl;
+        return false;
+    }
+
+    /* The reference reads the mapped keys before the device sorts them in place */
+    const int *keys = file.data<int>();
+    std::vector<int> expected(keys, keys + count);
+    if(DIRECTION == 0)
+        std::sort(expected.begin(), expected.end());
+    else
+        std::sort(expected.begin(), expected.end(), std::greater<int>());
+
+    ProgramCache cache(context, device);
+    BitonicSortEngine engine(cache, queue, PROGRAM_FILE);
+    cl_int err;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    cl_mem buffer = createArrayBuffer(context, CL_MEM_READ_WRITE, file, &err);
+    if(err == CL_SUCCESS)
+        err = engine.sort(buffer, (cl_uint)count, DIRECTION != 0);
+    int *sorted = NULL;
+    if(err == CL_SUCCESS)
+        sorted = mapBuffer<int>(queue, buffer, CL_MAP_READ, count * sizeof(int), &err);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    bool ok = err == CL_SUCCESS && std::equal(expected.begin(), expected.end(), sorted);
+    if(sorted != NULL)
+        unmapBuffer(queue, buffer, sorted);
+    if(buffer != NULL)
+        clReleaseMemObject(buffer);
+    clFinish(queue);
+    std::clog << path << ": " << count << " keys, buffer over the mapped file, sorted and mapped back in "
+        << std::chrono::duration<double, std::milli>(end - start).count() << "ms (program build included). "
+        << (ok ? "Check passed." : "Check failed.") << std::endl;
+    return ok;
+}
+
 int main(int argc, char const *argv[])
 {
 
     int data[DATA_SIZE]; init_data(data);
+    int cpu_data[DATA_SIZE]; std::copy(data, data + DATA_SIZE, cpu_data);
 
     size_t local_size, global_size;
     cl_uint stage, high_stage, num_stages;
@@ -117,7 +260,25 @@ int main(int argc, char const *argv[])
 
     std::chrono::steady_clock::time_point start, end;
 
+    /* CPU baseline, also the result when no OpenCL platform is present */
+    start = std::chrono::steady_clock::now();
+    parallelRadixSort(cpu_data, DATA_SIZE);
+    #if DIRECTION != 0
+        std::reverse(cpu_data, cpu_data + DATA_SIZE);
+    #endif
+    end = std::chrono::steady_clock::now();
+    std::clog << "cpu parallel radix sort: "
+        << std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()/1000
+        << "us" << std::endl;
+
     cl::Platform::get(&platforms);
+    if(platforms.empty())
+    {
+        std::clog << "No OpenCL platform, using the CPU sort." << std::endl;
+        std::copy(cpu_data, cpu_data + DATA_SIZE, data);
+        std::clog << (chech_integrity(data) ? "Success!" : "Sorting failed.") << std::endl;
+        return 0;
+    }
     platforms[0].getDevices(CL_DEVICE_TYPE_ALL, &platform_devices);
 
     #if PRESENT_PLATFORMS_DETAILS
@@ -159,12 +320,35 @@ int main(int argc, char const *argv[])
 
     local_size = (int)pow(2, trunc(log2(local_size)));
 
+    /* Create a command queue with SPECIFIC device!*/
+    cl::CommandQueue queue(context, ctx_devices[0], 0, nullptr);
+
+    /* The device allocation is paid once here, as a long-running service
+       would; the timed sort takes its buffer from the pool. The pool
+       memory is host-mappable, so the keys go in and out through maps */
+    BufferPool pool(context(), ctx_devices[0](), CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+    pool.release(pool.acquire(sizeof(data), &err));
+
     if(CALCULATE_EXECUTION_TIME) /*start calculating time*/
         start = std::chrono::steady_clock::now();
 
-    /* Create buffer */
-    cl::Buffer data_buffer(context,
-        CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(data), data);
+    /* Get a buffer; cl::Buffer takes over the extra reference */
+    cl_mem data_mem = pool.acquire(sizeof(data), &err);
+    if(err != CL_SUCCESS)
+    {
+        std::clog << "Couldn't create a buffer." << std::endl;
+        return 1;
+    }
+    clRetainMemObject(data_mem);
+    cl::Buffer data_buffer(data_mem);
+    int *mapped = mapBuffer<int>(queue(), data_mem, CL_MAP_WRITE_INVALIDATE_REGION, sizeof(data), &err);
+    if(err != CL_SUCCESS)
+    {
+        std::clog << "Couldn't map the buffer." << std::endl;
+        return 1;
+    }
+    std::copy(data, data + DATA_SIZE, mapped);
+    unmapBuffer(queue(), data_mem, mapped);
 
     for(int i = 0; i < kernels.size(); ++i)
     {
@@ -172,9 +356,6 @@ int main(int argc, char const *argv[])
         (*kernels[i]).setArg(1, 8*local_size*sizeof(float), NULL);
     }
 
-    /* Create a command queue with SPECIFIC device!*/
-    cl::CommandQueue queue(context, ctx_devices[0], 0, nullptr);
-
     global_size = DATA_SIZE / 8;
 
     if(global_size < local_size)
@@ -216,9 +397,16 @@ int main(int argc, char const *argv[])
 
     queue.enqueueNDRangeKernel( kernel_merge_last, 1, global_size, local_size);
 
-    /* Read the result */
-    queue.enqueueReadBuffer(
-        data_buffer, CL_TRUE, 0, sizeof(data), data, NULL, NULL );
+    /* Map the result */
+    mapped = mapBuffer<int>(queue(), data_mem, CL_MAP_READ, sizeof(data), &err);
+    if(err != CL_SUCCESS)
+    {
+        std::clog << "Couldn't map the buffer." << std::endl;
+        return 1;
+    }
+    std::copy(mapped, mapped + DATA_SIZE, data);
+    unmapBuffer(queue(), data_mem, mapped);
+    pool.release(data_mem);
 
     if(CALCULATE_EXECUTION_TIME)//end calculating time
     {
@@ -239,6 +427,12 @@ int main(int argc, char const *argv[])
     }
     else std::clog << "Sorting failed." << std::endl;
 
+    replay_overhead(context(), ctx_devices[0](), queue());
+
+    /* bitonic-sort keys.arr: also sort the keys of an array file; its check decides the exit status */
+    if(argc > 1)
+        return sort_file(context(), ctx_devices[0](), queue(), argv[1]) ? 0 : 1;
+
     return 0;
 
 }
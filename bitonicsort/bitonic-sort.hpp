@@ -0,0 +1,156 @@
+#ifndef BITONIC_SORT_HPP
+#define BITONIC_SORT_HPP
+
+#include <CL/cl.h>
+#include <string>
+#include "../common/command_recorder.hpp"
+#include "../common/future.hpp"
+#include "../common/program_cache.hpp"
+
+#define SORT_PROGRAM_FILE "bitonic-sort.cl"
+
+/*
+ * In-place bitonic sort of int keys with the kernels of bitonic-sort.cl,
+ * in the launch sequence of bitonic-sort.cpp: every work-item holds two
+ * int4, so count must be a power of two and at least 8. The sequence is
+ * the same on every call for a given buffer and count, so record() can
+ * capture it once for CommandRecorder replay.
+ */
+class BitonicSortEngine
+{
+public:
+    BitonicSortEngine(ProgramCache &cache, cl_command_queue queue, const std::string &programFile = SORT_PROGRAM_FILE)
+        : m_cache(cache), m_queue(queue), m_programFile(programFile), m_localSize(0)
+    {
+        for (int i = 0; i < KERNELS; i++)
+            m_kernels[i] = NULL;
+    }
+
+    ~BitonicSortEngine()
+    {
+        for (int i = 0; i < KERNELS; i++)
+        {
+            if (m_kernels[i] != NULL)
+                clReleaseKernel(m_kernels[i]);
+        }
+    }
+
+    cl_int sort(cl_mem data, cl_uint count, bool descending = false, cl_event *event = NULL)
+    {
+        QueueLauncher queue(m_queue);
+        return encode(queue, data, count, descending, event);
+    }
+
+    /* Captures the launches of sort() for CommandRecorder::replay() */
+    cl_int record(CommandRecorder &recorder, cl_mem data, cl_uint count, bool descending = false)
+    {
+        return encode(recorder, data, count, descending, NULL);
+    }
+
+    /* sort() after the futures in after, without waiting for it */
+    Future sortAsync(cl_mem data, cl_uint count, bool descending = false, const WaitList &after = WaitList())
+    {
+        return enqueueAfter(m_queue, after, [&](cl_event *event) { return sort(data, count, descending, event); });
+    }
+
+private:
+    enum
+    {
+        INIT,
+        STAGE_0,
+        STAGE_N,
+        MERGE,
+        MERGE_LAST,
+        KERNELS
+    };
+
+    /* Kernels on first use; the local size is the largest power of two the init kernel allows */
+    cl_int prepare()
+    {
+        static const char *names[KERNELS] = { "bitonic_sort_init", "bitonic_sort_stage_zero",
+                                              "bitonic_sort_stage_n", "bitonic_sort_merge",
+                                              "bitonic_sort_merge_last" };
+        cl_int status = CL_SUCCESS;
+        if (m_kernels[INIT] != NULL)
+            return CL_SUCCESS;
+
+        for (int i = 0; i < KERNELS && status == CL_SUCCESS; i++)
+            m_kernels[i] = m_cache.createKernel(m_programFile, "", names[i], &status);
+        if (status == CL_SUCCESS)
+        {
+            size_t maxSize = 1;
+            status = clGetKernelWorkGroupInfo(m_kernels[INIT], m_cache.device(), CL_KERNEL_WORK_GROUP_SIZE,
+                                              sizeof(maxSize), &maxSize, NULL);
+            for (m_localSize = 1; m_localSize * 2 <= maxSize; m_localSize *= 2)
+                ;
+        }
+        if (status != CL_SUCCESS)
+        {
+            for (int i = 0; i < KERNELS; i++)
+            {
+                if (m_kernels[i] != NULL)
+                    clReleaseKernel(m_kernels[i]);
+                m_kernels[i] = NULL;
+            }
+        }
+        return status;
+    }
+
+    template <typename Target>
+    cl_int encode(Target &target, cl_mem data, cl_uint count, bool descending, cl_event *event)
+    {
+        if (count < 8 || (count & (count - 1)) != 0)
+            return CL_INVALID_VALUE;
+        cl_int status = prepare();
+        if (status != CL_SUCCESS)
+            return status;
+
+        size_t globalSize = count / 8;
+        size_t localSize = globalSize < m_localSize ? globalSize : m_localSize;
+        cl_int direction = descending ? -1 : 0;
+        cl_uint numStages = (cl_uint)(globalSize / localSize);
+        cl_uint stage, highStage;
+
+        for (int i = 0; i < KERNELS; i++)
+        {
+            status |= target.setArg(m_kernels[i], 0, sizeof(cl_mem), &data);
+            status |= target.setArg(m_kernels[i], 1, 8 * localSize * sizeof(cl_int), NULL);
+        }
+        status |= target.setArg(m_kernels[MERGE], 3, sizeof(cl_int), &direction);
+        status |= target.setArg(m_kernels[MERGE_LAST], 2, sizeof(cl_int), &direction);
+        if (status != CL_SUCCESS)
+            return status;
+
+        status = target.launch(m_kernels[INIT], 1, &globalSize, &localSize, NULL);
+        for (highStage = 2; status == CL_SUCCESS && highStage < numStages; highStage <<= 1)
+        {
+            status = target.setArg(m_kernels[STAGE_0], 2, sizeof(cl_uint), &highStage);
+            status |= target.setArg(m_kernels[STAGE_N], 3, sizeof(cl_uint), &highStage);
+            for (stage = highStage; status == CL_SUCCESS && stage > 1; stage >>= 1)
+            {
+                status = target.setArg(m_kernels[STAGE_N], 2, sizeof(cl_uint), &stage);
+                if (status == CL_SUCCESS)
+                    status = target.launch(m_kernels[STAGE_N], 1, &globalSize, &localSize, NULL);
+            }
+            if (status == CL_SUCCESS)
+                status = target.launch(m_kernels[STAGE_0], 1, &globalSize, &localSize, NULL);
+        }
+        for (stage = numStages; status == CL_SUCCESS && stage > 1; stage >>= 1)
+        {
+            status = target.setArg(m_kernels[MERGE], 2, sizeof(cl_uint), &stage);
+            if (status == CL_SUCCESS)
+                status = target.launch(m_kernels[MERGE], 1, &globalSize, &localSize, NULL);
+        }
+        if (status == CL_SUCCESS)
+            status = target.launch(m_kernels[MERGE_LAST], 1, &globalSize, &localSize, event);
+        return status;
+    }
+
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::string m_programFile;
+    cl_kernel m_kernels[KERNELS];
+    size_t m_localSize;
+};
+
+#endif
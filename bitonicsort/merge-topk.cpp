@@ -0,0 +1,301 @@
+/*
+ * Merge path and top-k selection on top of the bitonic sort kernels.
+ * Both are benchmarked against sorting everything and slicing the result.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <random>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <CL/cl.hpp>
+
+#define PROGRAM_FILE                "bitonic-sort.cl"
+#define BITONIC_SORT_INIT           "bitonic_sort_init"
+#define BITONIC_SORT_STAGE_0        "bitonic_sort_stage_zero"
+#define BITONIC_SORT_STAGE_N        "bitonic_sort_stage_n"
+#define BITONIC_SORT_MERGE          "bitonic_sort_merge"
+#define BITONIC_SORT_MERGE_LAST     "bitonic_sort_merge_last"
+#define BITONIC_TOPK_REDUCE         "bitonic_topk_reduce"
+#define MERGE_PATH_PARTITION        "merge_path_partition"
+#define MERGE_PATH_MERGE            "merge_path_merge"
+
+/* POW(2, N) total size; each merge input holds half of it */
+#define DATA_SIZE                   1048576
+#define TOP_K                       64
+#define ITEMS_PER_WORK_ITEM         8
+#define LOOP                        10
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+void init_data(int *_data, size_t _size, unsigned int _seed)
+{
+    std::default_random_engine generator(_seed);
+    std::uniform_int_distribution<int> distribution(INT_MIN, INT_MAX);
+
+    std::generate(_data, _data + _size,
+        [&]() -> int
+        {
+            return distribution(generator);
+        }
+    );
+}
+
+double elapsed_us(time_point _start, time_point _end)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(_end - _start).count() / 1000.0;
+}
+
+/* Same launch sequence as bitonic-sort.cpp, sorting _data_size ints in place */
+void bitonic_sort(const cl::CommandQueue &_queue, const std::vector<cl::Kernel *> &_kernels,
+    const cl::Buffer &_data_buffer, size_t _data_size, size_t _local_size, cl_int _direction)
+{
+    cl::Kernel &kernel_init = *_kernels[0];
+    cl::Kernel &kernel_stage_0 = *_kernels[1];
+    cl::Kernel &kernel_stage_n = *_kernels[2];
+    cl::Kernel &kernel_merge = *_kernels[3];
+    cl::Kernel &kernel_merge_last = *_kernels[4];
+    size_t global_size = _data_size / 8;
+    cl_uint stage, high_stage, num_stages;
+
+    if(global_size < _local_size)
+        _local_size = global_size;
+
+    for(size_t i = 0; i < _kernels.size(); ++i)
+    {
+        (*_kernels[i]).setArg(0, _data_buffer);
+        (*_kernels[i]).setArg(1, 8*_local_size*sizeof(int), NULL);
+    }
+
+    _queue.enqueueNDRangeKernel(kernel_init, 1, global_size, _local_size);
+
+    num_stages = global_size / _local_size;
+
+    for(high_stage = 2; high_stage < num_stages; high_stage <<= 1)
+    {
+        kernel_stage_0.setArg(2, sizeof(int), &high_stage);
+        kernel_stage_n.setArg(3, sizeof(int), &high_stage);
+
+        for(stage = high_stage; stage > 1; stage >>= 1)
+        {
+            kernel_stage_n.setArg(2, sizeof(int), &stage);
+            _queue.enqueueNDRangeKernel(kernel_stage_n, 1, global_size, _local_size);
+        }
+
+        _queue.enqueueNDRangeKernel(kernel_stage_0, 1, global_size, _local_size);
+    }
+
+    kernel_merge.setArg(3, sizeof(int), &_direction);
+    kernel_merge_last.setArg(2, sizeof(int), &_direction);
+
+    for(stage = num_stages; stage > 1; stage >>= 1)
+    {
+        kernel_merge.setArg(2, sizeof(int), &stage);
+        _queue.enqueueNDRangeKernel(kernel_merge, 1, global_size, _local_size);
+    }
+
+    _queue.enqueueNDRangeKernel(kernel_merge_last, 1, global_size, _local_size);
+}
+
+/* Sort 8*local_size blocks, then halve the candidates until one block is left.
+ * Returns the buffer holding the final ascending block. */
+const cl::Buffer &bitonic_topk(const cl::CommandQueue &_queue, cl::Kernel &_kernel_init,
+    cl::Kernel &_kernel_topk, const cl::Buffer &_data_buffer, const cl::Buffer &_scratch_buffer,
+    size_t _data_size, size_t _local_size)
+{
+    size_t global_size = _data_size / 8;
+    size_t num_runs = global_size / _local_size;
+    const cl::Buffer *in = &_data_buffer, *out = &_scratch_buffer;
+
+    _kernel_init.setArg(0, _data_buffer);
+    _kernel_init.setArg(1, 8*_local_size*sizeof(int), NULL);
+    _queue.enqueueNDRangeKernel(_kernel_init, 1, global_size, _local_size);
+
+    _kernel_topk.setArg(1, 8*_local_size*sizeof(int), NULL);
+    for(; num_runs > 1; num_runs >>= 1)
+    {
+        _kernel_topk.setArg(0, *in);
+        _kernel_topk.setArg(2, *out);
+        _queue.enqueueNDRangeKernel(_kernel_topk, 1, num_runs / 2 * _local_size, _local_size);
+        std::swap(in, out);
+    }
+
+    return *in;
+}
+
+/* Merge a and b into c through the merge path partition */
+void merge_path(const cl::CommandQueue &_queue, cl::Kernel &_kernel_partition,
+    cl::Kernel &_kernel_merge, const cl::Buffer &_a, cl_uint _a_len, const cl::Buffer &_b,
+    cl_uint _b_len, const cl::Buffer &_splits, const cl::Buffer &_c, size_t _local_size)
+{
+    cl_uint tile_size = _local_size * ITEMS_PER_WORK_ITEM;
+    cl_uint num_tiles = (_a_len + _b_len + tile_size - 1) / tile_size;
+    cl_uint num_splits = num_tiles + 1;
+    size_t partition_size = (num_splits + _local_size - 1) / _local_size * _local_size;
+
+    _kernel_partition.setArg(0, _a);
+    _kernel_partition.setArg(1, _a_len);
+    _kernel_partition.setArg(2, _b);
+    _kernel_partition.setArg(3, _b_len);
+    _kernel_partition.setArg(4, _splits);
+    _kernel_partition.setArg(5, tile_size);
+    _kernel_partition.setArg(6, num_splits);
+    _queue.enqueueNDRangeKernel(_kernel_partition, cl::NullRange, partition_size, _local_size);
+
+    _kernel_merge.setArg(0, _a);
+    _kernel_merge.setArg(1, _a_len);
+    _kernel_merge.setArg(2, _b);
+    _kernel_merge.setArg(3, _b_len);
+    _kernel_merge.setArg(4, _splits);
+    _kernel_merge.setArg(5, tile_size*sizeof(int), NULL);
+    _kernel_merge.setArg(6, _c);
+    _kernel_merge.setArg(7, tile_size);
+    _queue.enqueueNDRangeKernel(_kernel_merge, cl::NullRange, num_tiles * _local_size, _local_size);
+}
+
+int main(int argc, char const *argv[])
+{
+
+    const size_t half_size = DATA_SIZE / 2;
+    std::vector<int> data(DATA_SIZE), a(half_size), b(half_size);
+    std::vector<int> merged(DATA_SIZE), expected(DATA_SIZE), top(TOP_K), expected_top(TOP_K);
+    size_t local_size;
+    time_point start, end;
+    double merge_time = 0, merge_sort_time = 0, topk_time = 0, topk_sort_time = 0;
+
+    std::vector<cl::Platform> platforms;
+    std::vector<cl::Device> platform_devices, ctx_devices;
+
+    init_data(a.data(), half_size, 1);
+    init_data(b.data(), half_size, 2);
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    std::merge(a.begin(), a.end(), b.begin(), b.end(), expected.begin());
+
+    init_data(data.data(), DATA_SIZE, 3);
+    std::partial_sort_copy(data.begin(), data.end(), expected_top.begin(), expected_top.end(),
+        std::greater<int>());
+    std::sort(expected_top.begin(), expected_top.end());
+
+    cl::Platform::get(&platforms);
+    platforms[0].getDevices(CL_DEVICE_TYPE_ALL, &platform_devices);
+
+    cl::Context context(platform_devices);
+    ctx_devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+    /* Open and build program */
+    std::ifstream program_file(PROGRAM_FILE);
+
+    std::string program_string(std::istreambuf_iterator<char>(program_file),
+        (std::istreambuf_iterator<char>()));
+
+    cl::Program::Sources source(1, std::make_pair(program_string.c_str(),
+        program_string.length()+1));
+
+    cl::Program program(context, source);
+    program.build(platform_devices);
+
+    cl::Kernel kernel_init(program, BITONIC_SORT_INIT);
+    cl::Kernel kernel_stage_0(program, BITONIC_SORT_STAGE_0);
+    cl::Kernel kernel_stage_n(program, BITONIC_SORT_STAGE_N);
+    cl::Kernel kernel_merge(program, BITONIC_SORT_MERGE);
+    cl::Kernel kernel_merge_last(program, BITONIC_SORT_MERGE_LAST);
+    cl::Kernel kernel_topk(program, BITONIC_TOPK_REDUCE);
+    cl::Kernel kernel_partition(program, MERGE_PATH_PARTITION);
+    cl::Kernel kernel_merge_path(program, MERGE_PATH_MERGE);
+
+    std::vector<cl::Kernel *> sort_kernels = { &kernel_init, &kernel_stage_0,
+        &kernel_stage_n, &kernel_merge, &kernel_merge_last };
+
+    /* Determine maximum work-group size */
+    local_size = std::min(
+        kernel_init.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(ctx_devices[0]),
+        kernel_topk.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(ctx_devices[0]));
+    local_size = (int)pow(2, trunc(log2(local_size)));
+    local_size = std::min(local_size, (size_t)(DATA_SIZE / 8));
+
+    if(8 * local_size < TOP_K)
+    {
+        std::clog << "TOP_K must not exceed 8 * local size (" << 8 * local_size << ")." << std::endl;
+        return 1;
+    }
+
+    cl::CommandQueue queue(context, ctx_devices[0], 0, nullptr);
+
+    cl::Buffer a_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        half_size * sizeof(int), a.data());
+    cl::Buffer b_buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        half_size * sizeof(int), b.data());
+    cl::Buffer c_buffer(context, CL_MEM_READ_WRITE, DATA_SIZE * sizeof(int));
+    cl::Buffer splits_buffer(context, CL_MEM_READ_WRITE,
+        (DATA_SIZE / (local_size * ITEMS_PER_WORK_ITEM) + 2) * sizeof(cl_uint));
+    cl::Buffer data_buffer(context, CL_MEM_READ_WRITE, DATA_SIZE * sizeof(int));
+    cl::Buffer scratch_buffer(context, CL_MEM_READ_WRITE, DATA_SIZE / 2 * sizeof(int));
+
+    /* Merge path against concatenate-and-sort */
+    for(int i = 0; i < LOOP; ++i)
+    {
+        start = std::chrono::steady_clock::now();
+        merge_path(queue, kernel_partition, kernel_merge_path, a_buffer, half_size,
+            b_buffer, half_size, splits_buffer, c_buffer, local_size);
+        queue.finish();
+        end = std::chrono::steady_clock::now();
+        merge_time += elapsed_us(start, end);
+
+        queue.enqueueCopyBuffer(a_buffer, data_buffer, 0, 0, half_size * sizeof(int));
+        queue.enqueueCopyBuffer(b_buffer, data_buffer, 0, half_size * sizeof(int),
+            half_size * sizeof(int));
+        queue.finish();
+        start = std::chrono::steady_clock::now();
+        bitonic_sort(queue, sort_kernels, data_buffer, DATA_SIZE, local_size, 0);
+        queue.finish();
+        end = std::chrono::steady_clock::now();
+        merge_sort_time += elapsed_us(start, end);
+    }
+
+    queue.enqueueReadBuffer(c_buffer, CL_TRUE, 0, DATA_SIZE * sizeof(int), merged.data());
+    std::clog << "merge path: " << (merged == expected ? "Success!" : "Merging failed.") << std::endl;
+    queue.enqueueReadBuffer(data_buffer, CL_TRUE, 0, DATA_SIZE * sizeof(int), merged.data());
+    std::clog << "sort-then-slice merge: "
+        << (merged == expected ? "Success!" : "Sorting failed.") << std::endl;
+
+    /* Top-k against sort-everything-then-slice */
+    for(int i = 0; i < LOOP; ++i)
+    {
+        queue.enqueueWriteBuffer(data_buffer, CL_TRUE, 0, DATA_SIZE * sizeof(int), data.data());
+        start = std::chrono::steady_clock::now();
+        const cl::Buffer &result = bitonic_topk(queue, kernel_init, kernel_topk,
+            data_buffer, scratch_buffer, DATA_SIZE, local_size);
+        queue.enqueueReadBuffer(result, CL_TRUE, (8 * local_size - TOP_K) * sizeof(int),
+            TOP_K * sizeof(int), top.data());
+        end = std::chrono::steady_clock::now();
+        topk_time += elapsed_us(start, end);
+    }
+    std::clog << "bitonic top-k: " << (top == expected_top ? "Success!" : "Selection failed.")
+        << std::endl;
+
+    for(int i = 0; i < LOOP; ++i)
+    {
+        queue.enqueueWriteBuffer(data_buffer, CL_TRUE, 0, DATA_SIZE * sizeof(int), data.data());
+        start = std::chrono::steady_clock::now();
+        bitonic_sort(queue, sort_kernels, data_buffer, DATA_SIZE, local_size, 0);
+        queue.enqueueReadBuffer(data_buffer, CL_TRUE, (DATA_SIZE - TOP_K) * sizeof(int),
+            TOP_K * sizeof(int), top.data());
+        end = std::chrono::steady_clock::now();
+        topk_sort_time += elapsed_us(start, end);
+    }
+    std::clog << "sort-then-slice top-k: "
+        << (top == expected_top ? "Success!" : "Sorting failed.") << std::endl;
+
+    std::clog << "data size " << DATA_SIZE << ", top " << TOP_K << std::endl;
+    std::clog << "merge path:            " << merge_time / LOOP << "us" << std::endl;
+    std::clog << "sort-then-slice merge: " << merge_sort_time / LOOP << "us" << std::endl;
+    std::clog << "bitonic top-k:         " << topk_time / LOOP << "us" << std::endl;
+    std::clog << "sort-then-slice top-k: " << topk_sort_time / LOOP << "us" << std::endl;
+
+    return 0;
+
+}
@@ -0,0 +1,350 @@
+#ifndef ARRAY_FILE_HPP
+#define ARRAY_FILE_HPP
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Binary array files that load with mmap instead of a parse. A 128-byte
+ * header gives the element type, up to four dimensions, byte strides and
+ * where the data starts; the data follows at a multiple of the header's
+ * alignment (a page by default) and is padded with zeros to a multiple of
+ * ARRAY_FILE_PADDING bytes. A page-aligned, padded data block satisfies
+ * isZeroCopyAligned(), so createArrayBuffer() (host_memory.hpp) hands the
+ * mapped pages straight to CL_MEM_USE_HOST_PTR: the file is read by the
+ * page faults of whoever touches the data first, and never copied.
+ *
+ * Numbers are in the byte order of the writer; a reader rejects files of
+ * the other order.
+ */
+
+#define ARRAY_FILE_MAGIC "CLARRAY"
+#define ARRAY_FILE_VERSION 1
+#define ARRAY_FILE_BYTE_ORDER 0x01020304u
+#define ARRAY_FILE_MAX_DIMS 4
+#define ARRAY_FILE_ALIGNMENT 4096
+#define ARRAY_FILE_PADDING 64
+
+enum ArrayType
+{
+    ARRAY_INT32,
+    ARRAY_UINT32,
+    ARRAY_FLOAT32,
+    ARRAY_FLOAT64,
+    ARRAY_FLOAT16,
+    ARRAY_TYPES
+};
+
+struct ArrayFileHeader
+{
+    char magic[8];                    /* ARRAY_FILE_MAGIC, NUL terminated */
+    uint32_t version;
+    uint32_t byteOrder;               /* ARRAY_FILE_BYTE_ORDER as the writer stores it */
+    uint32_t type;                    /* ArrayType */
+    uint32_t dims;
+    uint64_t alignment;               /* offset is a multiple of it */
+    uint64_t offset;                  /* of the data from the start of the file */
+    uint64_t bytes;                   /* of the data, without the padding */
+    uint64_t shape[ARRAY_FILE_MAX_DIMS];
+    int64_t strides[ARRAY_FILE_MAX_DIMS];  /* in bytes; unused dimensions 0 */
+    uint64_t reserved[2];
+};
+
+static_assert(sizeof(ArrayFileHeader) == 128, "the array file header is 128 bytes");
+
+inline size_t arrayTypeSize(ArrayType type)
+{
+    static const size_t sizes[ARRAY_TYPES] = { 4, 4, 4, 8, 2 };
+    return type < ARRAY_TYPES ? sizes[type] : 0;
+}
+
+inline const char *arrayTypeName(ArrayType type)
+{
+    static const char *names[ARRAY_TYPES] = { "int32", "uint32", "float32", "float64", "float16" };
+    return type < ARRAY_TYPES ? names[type] : "unknown";
+}
+
+/*
+ * How the tools read an argument that is either a size or an array file:
+ * a file when it names an existing regular file or ends in ".arr". This is
+ * decided before anything is allocated, so a file called "1024" is still a
+ * file, and a typo such as "1M" is reported as a bad count rather than a
+ * missing file.
+ */
+inline bool isArrayFileArgument(const char *arg)
+{
+    struct stat info;
+    size_t length = strlen(arg);
+    if (stat(arg, &info) == 0 && (info.st_mode & S_IFMT) == S_IFREG)
+        return true;
+    return length >= 4 && strcmp(arg + length - 4, ".arr") == 0;
+}
+
+/* A positive decimal count, digits only; false for anything else */
+inline bool parseArrayCount(const char *arg, size_t *count)
+{
+    if (!isdigit((unsigned char)arg[0]))
+        return false;
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if (*end != '\0' || value == 0 || errno == ERANGE || value > (size_t)-1)
+        return false;
+    *count = (size_t)value;
+    return true;
+}
+
+/*
+ * Writes a row-major array of dims dimensions. Returns false with errno
+ * set when the file cannot be written.
+ */
+inline bool writeArrayFile(const char *path, ArrayType type, size_t dims, const size_t *shape, const void *data,
+                           size_t alignment = ARRAY_FILE_ALIGNMENT)
+{
+    if (type >= ARRAY_TYPES || dims == 0 || dims > ARRAY_FILE_MAX_DIMS || alignment < sizeof(ArrayFileHeader))
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    ArrayFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARRAY_FILE_MAGIC, sizeof(ARRAY_FILE_MAGIC));
+    header.version = ARRAY_FILE_VERSION;
+    header.byteOrder = ARRAY_FILE_BYTE_ORDER;
+    header.type = type;
+    header.dims = (uint32_t)dims;
+    header.alignment = alignment;
+    header.offset = alignment;
+    uint64_t stride = arrayTypeSize(type);
+    for (size_t i = dims; i-- > 0;)
+    {
+        header.shape[i] = shape[i];
+        header.strides[i] = (int64_t)stride;
+        stride *= shape[i];
+    }
+    header.bytes = stride;
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+    static const char zeros[ARRAY_FILE_PADDING] = { 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (uint64_t at = sizeof(header); ok && at < header.offset; at += sizeof(zeros))
+    {
+        size_t n = header.offset - at < sizeof(zeros) ? (size_t)(header.offset - at) : sizeof(zeros);
+        ok = fwrite(zeros, 1, n, file) == n;
+    }
+    ok = ok && (header.bytes == 0 || fwrite(data, (size_t)header.bytes, 1, file) == 1);
+    size_t padding = (size_t)((ARRAY_FILE_PADDING - header.bytes % ARRAY_FILE_PADDING) % ARRAY_FILE_PADDING);
+    ok = ok && (padding == 0 || fwrite(zeros, 1, padding, file) == padding);
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
+
+/*
+ * A mapped array file. The mapping is private and writable (copy on
+ * write): a buffer over it may be written by kernels (a sort in place),
+ * which changes this process's copy of the pages and never the file.
+ */
+class ArrayFile
+{
+public:
+    ArrayFile() : m_base(NULL), m_size(0), m_error("not open")
+    {
+        memset(&m_header, 0, sizeof(m_header));
+    }
+
+    ~ArrayFile()
+    {
+        close();
+    }
+
+    /* false, with the reason in error(), if path is not a valid array file */
+    bool open(const char *path)
+    {
+        close();
+        if (!map(path))
+            return false;
+        memcpy(&m_header, m_base, sizeof(m_header));
+        if (!validate())
+        {
+            const char *error = m_error;
+            close();
+            m_error = error;
+            return false;
+        }
+        m_error = NULL;
+        return true;
+    }
+
+    void close()
+    {
+        if (m_base != NULL)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(m_base);
+#else
+            munmap(m_base, m_size);
+#endif
+        }
+        m_base = NULL;
+        m_size = 0;
+        m_error = "not open";
+        memset(&m_header, 0, sizeof(m_header));
+    }
+
+    bool isOpen() const { return m_base != NULL; }
+    const char *error() const { return m_error; }
+
+    ArrayType type() const { return (ArrayType)m_header.type; }
+    size_t dims() const { return m_header.dims; }
+    size_t shape(size_t dim) const { return dim < m_header.dims ? (size_t)m_header.shape[dim] : 1; }
+    int64_t stride(size_t dim) const { return dim < m_header.dims ? m_header.strides[dim] : 0; }
+    size_t bytes() const { return (size_t)m_header.bytes; }
+    size_t alignment() const { return (size_t)m_header.alignment; }
+
+    size_t count() const
+    {
+        size_t n = 1;
+        for (size_t i = 0; i < m_header.dims; i++)
+            n *= (size_t)m_header.shape[i];
+        return n;
+    }
+
+    /* Row major without gaps, the layout buffers and the tools expect */
+    bool contiguous() const
+    {
+        int64_t expected = (int64_t)arrayTypeSize(type());
+        for (size_t i = m_header.dims; i-- > 0;)
+        {
+            if (m_header.shape[i] > 1 && m_header.strides[i] != expected)
+                return false;
+            expected *= (int64_t)m_header.shape[i];
+        }
+        return true;
+    }
+
+    /* Whether this is a contiguous array of type with dims dimensions; prints why not */
+    bool expect(const char *name, ArrayType type, size_t dims) const
+    {
+        if (m_header.type != (uint32_t)type || m_header.dims != dims || !contiguous())
+        {
+            printf("%s: expected a contiguous %uD %s array, got a %s%uD %s array\n", name, (unsigned int)dims,
+                   arrayTypeName(type), contiguous() ? "" : "strided ", (unsigned int)m_header.dims,
+                   arrayTypeName(this->type()));
+            return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    T *data() const { return m_base != NULL ? (T *)(m_base + m_header.offset) : NULL; }
+
+private:
+    bool fail(const char *error)
+    {
+        m_error = error;
+        return false;
+    }
+
+#ifdef _WIN32
+    bool map(const char *path)
+    {
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return fail("cannot open the file");
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart < (LONGLONG)sizeof(ArrayFileHeader))
+        {
+            CloseHandle(file);
+            return fail("too short for an array file header");
+        }
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        void *base = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0) : NULL;
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        if (base == NULL)
+            return fail("cannot map the file");
+        m_base = (char *)base;
+        m_size = (size_t)size.QuadPart;
+        return true;
+    }
+#else
+    bool map(const char *path)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            return fail(strerror(errno));
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(ArrayFileHeader))
+        {
+            ::close(fd);
+            return fail("too short for an array file header");
+        }
+        void *base = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED)
+            return fail(strerror(errno));
+        m_base = (char *)base;
+        m_size = (size_t)info.st_size;
+
+        /* Start reading ahead; the data is usually consumed front to back */
+        madvise(m_base, m_size, MADV_WILLNEED);
+        return true;
+    }
+#endif
+
+    bool validate()
+    {
+        const ArrayFileHeader &h = m_header;
+        if (memcmp(h.magic, ARRAY_FILE_MAGIC, sizeof(ARRAY_FILE_MAGIC)) != 0)
+            return fail("not an array file");
+        if (h.byteOrder != ARRAY_FILE_BYTE_ORDER)
+            return fail("written with the other byte order");
+        if (h.version != ARRAY_FILE_VERSION)
+            return fail("unsupported array file version");
+        if (h.type >= ARRAY_TYPES || h.dims == 0 || h.dims > ARRAY_FILE_MAX_DIMS)
+            return fail("bad element type or dimensions");
+        if (h.alignment == 0 || h.offset % h.alignment != 0 || h.offset < sizeof(ArrayFileHeader))
+            return fail("bad data offset");
+        if (h.offset > m_size || h.bytes > m_size - h.offset)
+            return fail("truncated");
+
+        /* Every element the strides reach must lie inside the data */
+        uint64_t extent = arrayTypeSize(type());
+        for (size_t i = 0; i < h.dims; i++)
+        {
+            if (h.shape[i] == 0)
+                return h.bytes == 0 ? true : fail("empty shape with data");
+            if (h.strides[i] < 0 || (h.shape[i] > 1 && (uint64_t)h.strides[i] > h.bytes / (h.shape[i] - 1)))
+                return fail("strides outside the data");
+            extent += (h.shape[i] - 1) * (uint64_t)h.strides[i];
+        }
+        if (extent > h.bytes)
+            return fail("strides outside the data");
+        return true;
+    }
+
+    char *m_base;
+    size_t m_size;
+    const char *m_error;
+    ArrayFileHeader m_header;
+};
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <CL/cl.h>
+#include <stdio.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#define BUFFER_POOL_MIN_BYTES 256
+#define BUFFER_POOL_SLAB_BYTES (8 << 20)
+#define BUFFER_POOL_CARVE_LIMIT (1 << 20)
+
+struct BufferPoolStats
+{
+    cl_ulong acquires;        /* acquire() calls that returned a buffer */
+    cl_ulong hits;            /* served from a free list */
+    cl_ulong releases;
+    cl_ulong buffers;         /* clCreateBuffer calls, slabs included */
+    cl_ulong subBuffers;      /* clCreateSubBuffer calls */
+    cl_ulong slabs;           /* slabs currently held */
+    size_t bytesInUse;        /* size classes of the live buffers */
+    size_t bytesRequested;    /* what the callers of the live buffers asked for */
+    size_t peakBytesInUse;
+    size_t bytesReserved;     /* device memory held: slabs, whole buffers */
+};
+
+/*
+ * Device buffer pool for code that allocates per call. Sizes are rounded up
+ * to a power of two no smaller than BUFFER_POOL_MIN_BYTES or the device base
+ * address alignment, and released buffers wait on a free list per size
+ * class for the next acquire() of that class.
+ *
+ * Classes up to BUFFER_POOL_CARVE_LIMIT are carved with clCreateSubBuffer
+ * from BUFFER_POOL_SLAB_BYTES slabs, so a cold small request costs a
+ * sub-buffer instead of a device allocation; larger classes are whole
+ * buffers. Every buffer is created with flags, CL_MEM_READ_WRITE by default;
+ * with CL_MEM_ALLOC_HOST_PTR added the pool hands out buffers to map (see
+ * host_memory.hpp). The contents of an acquired buffer are undefined.
+ *
+ * release() does not wait for the device: hand a buffer back once its last
+ * command is enqueued on the in-order queue every user of the pool shares,
+ * or once that command has completed.
+ */
+class BufferPool
+{
+public:
+    BufferPool(cl_context context, cl_device_id device, cl_mem_flags flags = CL_MEM_READ_WRITE,
+               size_t slabBytes = BUFFER_POOL_SLAB_BYTES, size_t carveLimit = BUFFER_POOL_CARVE_LIMIT)
+        : m_context(context), m_flags(flags), m_slabBytes(slabBytes), m_carveLimit(carveLimit), m_current(NULL),
+          m_offset(0)
+    {
+        cl_uint alignBits = 0;
+        clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(alignBits), &alignBits, NULL);
+        m_minClass = BUFFER_POOL_MIN_BYTES;
+        while (m_minClass < alignBits / 8)
+            m_minClass *= 2;
+        if (m_carveLimit > m_slabBytes)
+            m_carveLimit = m_slabBytes;
+        m_stats = BufferPoolStats();
+    }
+
+    ~BufferPool()
+    {
+        for (std::map<cl_mem, Block>::iterator it = m_live.begin(); it != m_live.end(); ++it)
+            clReleaseMemObject(it->first);
+        for (std::map<size_t, std::vector<cl_mem> >::iterator it = m_free.begin(); it != m_free.end(); ++it)
+        {
+            for (size_t i = 0; i < it->second.size(); i++)
+                clReleaseMemObject(it->second[i]);
+        }
+        for (std::map<cl_mem, Slab>::iterator it = m_slabs.begin(); it != m_slabs.end(); ++it)
+            clReleaseMemObject(it->first);
+    }
+
+    /* A buffer of at least bytes; NULL with *status set on failure */
+    cl_mem acquire(size_t bytes, cl_int *status)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (bytes == 0)
+        {
+            *status = CL_INVALID_BUFFER_SIZE;
+            return NULL;
+        }
+        size_t size = sizeClass(bytes);
+        cl_mem buffer = NULL;
+
+        std::vector<cl_mem> &list = m_free[size];
+        if (!list.empty())
+        {
+            buffer = list.back();
+            list.pop_back();
+            m_stats.hits++;
+            *status = CL_SUCCESS;
+        }
+        else if (size <= m_carveLimit)
+        {
+            buffer = carve(size, status);
+        }
+        else
+        {
+            buffer = clCreateBuffer(m_context, m_flags, size, NULL, status);
+            if (*status == CL_SUCCESS)
+            {
+                m_stats.buffers++;
+                m_stats.bytesReserved += size;
+            }
+        }
+        if (*status != CL_SUCCESS)
+            return NULL;
+
+        std::map<cl_mem, cl_mem>::iterator parent = m_parent.find(buffer);
+        if (parent != m_parent.end())
+            m_slabs[parent->second].live++;
+
+        Block block = { size, bytes };
+        m_live[buffer] = block;
+        m_stats.acquires++;
+        m_stats.bytesInUse += size;
+        m_stats.bytesRequested += bytes;
+        if (m_stats.bytesInUse > m_stats.peakBytesInUse)
+            m_stats.peakBytesInUse = m_stats.bytesInUse;
+        return buffer;
+    }
+
+    /* Return a buffer from acquire() to its free list */
+    cl_int release(cl_mem buffer)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::map<cl_mem, Block>::iterator it = m_live.find(buffer);
+        if (it == m_live.end())
+            return CL_INVALID_MEM_OBJECT;
+
+        std::map<cl_mem, cl_mem>::iterator parent = m_parent.find(buffer);
+        if (parent != m_parent.end())
+            m_slabs[parent->second].live--;
+
+        m_free[it->second.size].push_back(buffer);
+        m_stats.releases++;
+        m_stats.bytesInUse -= it->second.size;
+        m_stats.bytesRequested -= it->second.requested;
+        m_live.erase(it);
+        return CL_SUCCESS;
+    }
+
+    /* Give free whole buffers, and slabs with nothing live in them, back to the device */
+    void trim()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (std::map<size_t, std::vector<cl_mem> >::iterator it = m_free.begin(); it != m_free.end(); ++it)
+        {
+            std::vector<cl_mem> kept;
+            for (size_t i = 0; i < it->second.size(); i++)
+            {
+                cl_mem buffer = it->second[i];
+                std::map<cl_mem, cl_mem>::iterator parent = m_parent.find(buffer);
+                if (parent == m_parent.end())
+                {
+                    m_stats.bytesReserved -= it->first;
+                    clReleaseMemObject(buffer);
+                }
+                else if (m_slabs[parent->second].live == 0 && parent->second != m_current)
+                {
+                    m_parent.erase(parent);
+                    clReleaseMemObject(buffer);
+                }
+                else
+                {
+                    kept.push_back(buffer);
+                }
+            }
+            it->second.swap(kept);
+        }
+
+        for (std::map<cl_mem, Slab>::iterator it = m_slabs.begin(); it != m_slabs.end();)
+        {
+            if (it->second.live == 0 && it->first != m_current)
+            {
+                clReleaseMemObject(it->first);
+                m_stats.bytesReserved -= m_slabBytes;
+                m_stats.slabs--;
+                m_slabs.erase(it++);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    BufferPoolStats stats()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    void printStats(const char *name)
+    {
+        BufferPoolStats s = stats();
+        printf("%s: %llu acquires, %llu hits (%.1f%%), %llu buffers + %llu sub-buffers created, "
+               "%llu slabs, %.2f MB reserved, peak %.2f MB in use\n",
+               name, (unsigned long long)s.acquires, (unsigned long long)s.hits,
+               s.acquires ? 100.0 * s.hits / s.acquires : 0.0, (unsigned long long)s.buffers,
+               (unsigned long long)s.subBuffers, (unsigned long long)s.slabs, s.bytesReserved / 1048576.0,
+               s.peakBytesInUse / 1048576.0);
+    }
+
+    size_t sizeClass(size_t bytes) const
+    {
+        size_t size = m_minClass;
+        while (size < bytes)
+            size *= 2;
+        return size;
+    }
+
+private:
+    struct Block
+    {
+        size_t size;
+        size_t requested;
+    };
+
+    struct Slab
+    {
+        size_t live;    /* sub-buffers handed out and not released */
+    };
+
+    /* Next size bytes of the current slab; a new slab when it does not fit */
+    cl_mem carve(size_t size, cl_int *status)
+    {
+        if (m_current == NULL || m_offset + size > m_slabBytes)
+        {
+            retireSlab();
+            m_current = clCreateBuffer(m_context, m_flags, m_slabBytes, NULL, status);
+            if (*status != CL_SUCCESS)
+            {
+                m_current = NULL;
+                return NULL;
+            }
+            Slab s = { 0 };
+            m_slabs[m_current] = s;
+            m_offset = 0;
+            m_stats.buffers++;
+            m_stats.slabs++;
+            m_stats.bytesReserved += m_slabBytes;
+        }
+
+        cl_mem buffer = subBuffer(m_offset, size, status);
+        if (buffer != NULL)
+            m_offset += size;
+        return buffer;
+    }
+
+    /*
+     * Sizes and offsets are multiples of m_minClass, so the unused tail of a
+     * slab splits into power-of-two pieces that go on the free lists.
+     */
+    void retireSlab()
+    {
+        cl_int status = CL_SUCCESS;
+        while (m_current != NULL && m_offset + m_minClass <= m_slabBytes)
+        {
+            size_t size = m_minClass;
+            while (size * 2 <= m_carveLimit && m_offset + size * 2 <= m_slabBytes && m_offset % (size * 2) == 0)
+                size *= 2;
+            cl_mem buffer = subBuffer(m_offset, size, &status);
+            if (buffer == NULL)
+                break;
+            m_free[size].push_back(buffer);
+            m_offset += size;
+        }
+        m_current = NULL;
+    }
+
+    cl_mem subBuffer(size_t offset, size_t size, cl_int *status)
+    {
+        /* Host pointer flags are inherited from the slab and may not be repeated */
+        cl_mem_flags access = m_flags & (CL_MEM_READ_WRITE | CL_MEM_READ_ONLY | CL_MEM_WRITE_ONLY);
+        cl_buffer_region region = { offset, size };
+        cl_mem buffer = clCreateSubBuffer(m_current, access, CL_BUFFER_CREATE_TYPE_REGION, &region, status);
+        if (*status != CL_SUCCESS)
+            return NULL;
+        m_parent[buffer] = m_current;
+        m_stats.subBuffers++;
+        return buffer;
+    }
+
+    cl_context m_context;
+    cl_mem_flags m_flags;
+    size_t m_slabBytes;
+    size_t m_carveLimit;
+    size_t m_minClass;
+    cl_mem m_current;
+    size_t m_offset;
+    std::map<size_t, std::vector<cl_mem> > m_free;
+    std::map<cl_mem, Block> m_live;
+    std::map<cl_mem, cl_mem> m_parent;    /* sub-buffer to slab */
+    std::map<cl_mem, Slab> m_slabs;
+    BufferPoolStats m_stats;
+    std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef COMMAND_RECORDER_HPP
+#define COMMAND_RECORDER_HPP
+
+#include <CL/cl.h>
+#include <CL/cl_ext.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Launch target that goes straight to a queue. Engines write a launch
+ * sequence once against a target with setArg()/launch() and run it with
+ * a QueueLauncher, or hand it a CommandRecorder to capture it.
+ */
+struct QueueLauncher
+{
+    cl_command_queue queue;
+
+    explicit QueueLauncher(cl_command_queue queue) : queue(queue) {}
+
+    cl_int setArg(cl_kernel kernel, cl_uint index, size_t size, const void *value)
+    {
+        return clSetKernelArg(kernel, index, size, value);
+    }
+
+    cl_int launch(cl_kernel kernel, cl_uint dims, const size_t *global, const size_t *local, cl_event *event)
+    {
+        return clEnqueueNDRangeKernel(queue, kernel, dims, NULL, global, local, 0, NULL, event);
+    }
+};
+
+/*
+ * Records a fixed sequence of kernel launches with their arguments once
+ * and replays it on one queue. Every argument a launch uses must be set
+ * through the recorder; buffers and sizes are those of the recording.
+ *
+ * With cl_khr_command_buffer the sequence becomes a finalized command
+ * buffer and a replay is one clEnqueueCommandBufferKHR. Otherwise each
+ * distinct (kernel, arguments) pair gets a private kernel object with its
+ * arguments set at finalize(), and a replay is a bare loop of
+ * clEnqueueNDRangeKernel: no clSetKernelArg, and the engine's own kernels
+ * may be used in between without disturbing it.
+ */
+class CommandRecorder
+{
+public:
+    explicit CommandRecorder(cl_command_queue queue, bool useCommandBuffer = true)
+        : m_queue(queue), m_kernels(0), m_finalized(false), m_status(CL_SUCCESS)
+    {
+#ifdef cl_khr_command_buffer
+        m_commandBuffer = NULL;
+        m_pending = NULL;
+        m_simultaneous = false;
+        m_api = CommandBufferApi();
+        if (useCommandBuffer)
+            loadCommandBufferApi();
+#else
+        (void)useCommandBuffer;
+#endif
+    }
+
+    ~CommandRecorder()
+    {
+        reset();
+    }
+
+    /* Drops the recording; record a new sequence after this */
+    void reset()
+    {
+#ifdef cl_khr_command_buffer
+        if (m_pending != NULL)
+        {
+            clWaitForEvents(1, &m_pending);
+            clReleaseEvent(m_pending);
+            m_pending = NULL;
+        }
+        if (m_commandBuffer != NULL)
+            m_api.release(m_commandBuffer);
+        m_commandBuffer = NULL;
+#endif
+        for (size_t i = 0; i < m_prebound.size(); i++)
+        {
+            if (m_prebound[i] != NULL)
+                clReleaseKernel(m_prebound[i]);
+        }
+        m_prebound.clear();
+        m_launches.clear();
+        m_bound.clear();
+        m_kernels = 0;
+        m_finalized = false;
+        m_status = CL_SUCCESS;
+    }
+
+    cl_int setArg(cl_kernel kernel, cl_uint index, size_t size, const void *value)
+    {
+        if (m_finalized)
+            return CL_INVALID_OPERATION;
+        std::vector<std::string> &args = m_bound[kernel];
+        if (args.size() <= index)
+            args.resize(index + 1);
+        /* Size, a null flag, then the bytes: local memory arguments have no value */
+        args[index].assign((const char *)&size, sizeof(size));
+        args[index] += value != NULL ? '\1' : '\0';
+        if (value != NULL)
+            args[index].append((const char *)value, size);
+        return CL_SUCCESS;
+    }
+
+    /* event must be NULL: the event of a replay comes from replay() */
+    cl_int launch(cl_kernel kernel, cl_uint dims, const size_t *global, const size_t *local, cl_event *event)
+    {
+        if (m_finalized)
+            return CL_INVALID_OPERATION;
+        if (event != NULL || dims < 1 || dims > 3)
+            return CL_INVALID_VALUE;
+        Launch launch;
+        launch.kernel = kernel;
+        launch.dims = dims;
+        launch.hasLocal = local != NULL;
+        for (cl_uint d = 0; d < 3; d++)
+        {
+            launch.global[d] = d < dims ? global[d] : 1;
+            launch.local[d] = d < dims && local != NULL ? local[d] : 1;
+        }
+        launch.args = m_bound[kernel];
+        m_launches.push_back(launch);
+        return CL_SUCCESS;
+    }
+
+    cl_int finalize()
+    {
+        if (m_finalized)
+            return m_status;
+        m_finalized = true;
+#ifdef cl_khr_command_buffer
+        if (m_api.create != NULL)
+        {
+            m_status = recordCommandBuffer();
+            if (m_status == CL_SUCCESS)
+                return CL_SUCCESS;
+            if (m_commandBuffer != NULL)
+                m_api.release(m_commandBuffer);
+            m_commandBuffer = NULL;
+        }
+#endif
+        m_status = prebind();
+        return m_status;
+    }
+
+    /* Enqueues the recorded sequence; event, if given, is that of its last command */
+    cl_int replay(cl_event *event = NULL)
+    {
+        cl_int status = finalize();
+        if (status != CL_SUCCESS)
+            return status;
+#ifdef cl_khr_command_buffer
+        if (m_commandBuffer != NULL)
+            return replayCommandBuffer(event);
+#endif
+        for (size_t i = 0; i < m_launches.size() && status == CL_SUCCESS; i++)
+        {
+            const Launch &launch = m_launches[i];
+            status = clEnqueueNDRangeKernel(m_queue, m_prebound[i], launch.dims, NULL, launch.global,
+                                            launch.hasLocal ? launch.local : NULL, 0, NULL,
+                                            i + 1 == m_launches.size() ? event : NULL);
+        }
+        if (status == CL_SUCCESS && event != NULL && m_launches.empty())
+            status = clEnqueueMarkerWithWaitList(m_queue, 0, NULL, event);
+        return status;
+    }
+
+    size_t launches() const { return m_launches.size(); }
+
+    /* Private kernel objects of the replay loop */
+    size_t kernels() const { return m_kernels; }
+
+    bool usesCommandBuffer() const
+    {
+#ifdef cl_khr_command_buffer
+        return m_commandBuffer != NULL;
+#else
+        return false;
+#endif
+    }
+
+private:
+    struct Launch
+    {
+        cl_kernel kernel;
+        cl_uint dims;
+        size_t global[3];
+        size_t local[3];
+        bool hasLocal;
+        std::vector<std::string> args;
+    };
+
+    static cl_int setArgs(cl_kernel kernel, const std::vector<std::string> &args)
+    {
+        cl_int status = CL_SUCCESS;
+        for (size_t i = 0; i < args.size() && status == CL_SUCCESS; i++)
+        {
+            const std::string &arg = args[i];
+            if (arg.empty())
+                return CL_INVALID_KERNEL_ARGS;
+            size_t size;
+            memcpy(&size, arg.data(), sizeof(size));
+            const char *value = arg[sizeof(size)] != '\0' ? arg.data() + sizeof(size) + 1 : NULL;
+            status = clSetKernelArg(kernel, (cl_uint)i, size, value);
+        }
+        return status;
+    }
+
+    /* One kernel object per distinct (kernel, arguments), created from the kernel's program */
+    cl_int prebind()
+    {
+        std::map<std::pair<cl_kernel, std::string>, cl_kernel> made;
+        cl_int status = CL_SUCCESS;
+        m_prebound.assign(m_launches.size(), (cl_kernel)NULL);
+        for (size_t i = 0; i < m_launches.size() && status == CL_SUCCESS; i++)
+        {
+            const Launch &launch = m_launches[i];
+            std::string key;
+            for (size_t a = 0; a < launch.args.size(); a++)
+                key += std::to_string(launch.args[a].size()) + ':' + launch.args[a];
+            std::pair<cl_kernel, std::string> id(launch.kernel, key);
+
+            std::map<std::pair<cl_kernel, std::string>, cl_kernel>::iterator it = made.find(id);
+            cl_kernel kernel;
+            if (it != made.end())
+            {
+                kernel = it->second;
+            }
+            else
+            {
+                kernel = cloneKernel(launch.kernel, &status);
+                if (status == CL_SUCCESS)
+                    status = setArgs(kernel, launch.args);
+                if (kernel != NULL)
+                {
+                    made[id] = kernel;
+                    m_kernels++;
+                }
+            }
+            if (kernel != NULL)
+            {
+                clRetainKernel(kernel);
+                m_prebound[i] = kernel;
+            }
+        }
+        /* m_prebound holds a reference per launch */
+        for (std::map<std::pair<cl_kernel, std::string>, cl_kernel>::iterator it = made.begin();
+             it != made.end(); ++it)
+        {
+            clReleaseKernel(it->second);
+        }
+        return status;
+    }
+
+    static cl_kernel cloneKernel(cl_kernel kernel, cl_int *status)
+    {
+        cl_program program;
+        size_t size = 0;
+        *status = clGetKernelInfo(kernel, CL_KERNEL_PROGRAM, sizeof(program), &program, NULL);
+        if (*status == CL_SUCCESS)
+            *status = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, 0, NULL, &size);
+        if (*status != CL_SUCCESS)
+            return NULL;
+        std::string name(size, '\0');
+        *status = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, size, &name[0], NULL);
+        if (*status != CL_SUCCESS)
+            return NULL;
+        return clCreateKernel(program, name.c_str(), status);
+    }
+
+#ifdef cl_khr_command_buffer
+    struct CommandBufferApi
+    {
+        clCreateCommandBufferKHR_fn create;
+        clCommandNDRangeKernelKHR_fn ndrange;
+        clFinalizeCommandBufferKHR_fn finalize;
+        clEnqueueCommandBufferKHR_fn enqueue;
+        clReleaseCommandBufferKHR_fn release;
+    };
+
+    void loadCommandBufferApi()
+    {
+        cl_device_id device;
+        cl_platform_id platform;
+        size_t size = 0;
+        if (clGetCommandQueueInfo(m_queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL) != CL_SUCCESS ||
+            clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL) != CL_SUCCESS ||
+            clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, NULL, &size) != CL_SUCCESS)
+            return;
+        std::string extensions(size, '\0');
+        clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, size, &extensions[0], NULL);
+        /* Whole names only: cl_khr_command_buffer_mutable_dispatch is a different extension */
+        if ((" " + std::string(extensions.c_str()) + " ").find(" cl_khr_command_buffer ") == std::string::npos)
+            return;
+
+        CommandBufferApi api;
+        api.create = (clCreateCommandBufferKHR_fn)clGetExtensionFunctionAddressForPlatform(
+            platform, "clCreateCommandBufferKHR");
+        api.ndrange = (clCommandNDRangeKernelKHR_fn)clGetExtensionFunctionAddressForPlatform(
+            platform, "clCommandNDRangeKernelKHR");
+        api.finalize = (clFinalizeCommandBufferKHR_fn)clGetExtensionFunctionAddressForPlatform(
+            platform, "clFinalizeCommandBufferKHR");
+        api.enqueue = (clEnqueueCommandBufferKHR_fn)clGetExtensionFunctionAddressForPlatform(
+            platform, "clEnqueueCommandBufferKHR");
+        api.release = (clReleaseCommandBufferKHR_fn)clGetExtensionFunctionAddressForPlatform(
+            platform, "clReleaseCommandBufferKHR");
+        if (api.create != NULL && api.ndrange != NULL && api.finalize != NULL && api.enqueue != NULL &&
+            api.release != NULL)
+            m_api = api;
+    }
+
+    cl_int recordCommandBuffer()
+    {
+        /* Simultaneous use lets a replay be enqueued while the previous one runs */
+        cl_command_buffer_properties_khr properties[] = { CL_COMMAND_BUFFER_FLAGS_KHR,
+                                                          CL_COMMAND_BUFFER_SIMULTANEOUS_USE_KHR, 0 };
+        cl_int status;
+        m_simultaneous = true;
+        m_commandBuffer = m_api.create(1, &m_queue, properties, &status);
+        if (status != CL_SUCCESS)
+        {
+            m_simultaneous = false;
+            m_commandBuffer = m_api.create(1, &m_queue, NULL, &status);
+        }
+        /* Arguments are captured when each command is recorded */
+        for (size_t i = 0; i < m_launches.size() && status == CL_SUCCESS; i++)
+        {
+            const Launch &launch = m_launches[i];
+            status = setArgs(launch.kernel, launch.args);
+            if (status == CL_SUCCESS)
+                status = m_api.ndrange(m_commandBuffer, NULL, NULL, launch.kernel, launch.dims, NULL, launch.global,
+                                       launch.hasLocal ? launch.local : NULL, 0, NULL, NULL, NULL);
+        }
+        if (status == CL_SUCCESS)
+            status = m_api.finalize(m_commandBuffer);
+        return status;
+    }
+
+    cl_int replayCommandBuffer(cl_event *event)
+    {
+        cl_int status = CL_SUCCESS;
+        if (!m_simultaneous && m_pending != NULL)
+        {
+            status = clWaitForEvents(1, &m_pending);
+            clReleaseEvent(m_pending);
+            m_pending = NULL;
+        }
+        cl_event done = NULL;
+        if (status == CL_SUCCESS)
+            status = m_api.enqueue(1, &m_queue, m_commandBuffer, 0, NULL,
+                                   event != NULL || !m_simultaneous ? &done : NULL);
+        if (status == CL_SUCCESS && !m_simultaneous)
+        {
+            clRetainEvent(done);
+            m_pending = done;
+        }
+        if (event != NULL)
+            *event = done;
+        else if (done != NULL)
+            clReleaseEvent(done);
+        return status;
+    }
+
+    CommandBufferApi m_api;
+    cl_command_buffer_khr m_commandBuffer;
+    cl_event m_pending;
+    bool m_simultaneous;
+#endif
+
+    cl_command_queue m_queue;
+    std::vector<Launch> m_launches;
+    std::map<cl_kernel, std::vector<std::string> > m_bound;
+    std::vector<cl_kernel> m_prebound;
+    size_t m_kernels;
+    bool m_finalized;
+    cl_int m_status;
+};
+
+#endif
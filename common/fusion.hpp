@@ -0,0 +1,281 @@
+#ifndef FUSION_HPP
+#define FUSION_HPP
+
+#include <CL/cl.h>
+#include <stdio.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "program_cache.hpp"
+
+#define FUSION_LOCAL_SIZE 256
+#define FUSION_ITEMS 4
+
+/*
+ * Builds a chain of float elementwise operations over cl_mem buffers and
+ * runs it as one generated kernel: every input is read once, every output
+ * written once, and the intermediates stay in registers.
+ *
+ *     FusionGraph g(cache, queue);
+ *     FusionGraph::Node y = g.relu(g.add(g.mul(g.scalar(2.0f), g.input(a)), g.input(b)));
+ *     g.output(y, c);
+ *     g.run(count);
+ *
+ * Nodes are created in dependency order, so creation order is the
+ * evaluation order. Scalars are kernel arguments: setScalar() changes a
+ * value without a rebuild. The source depends only on the shape of the
+ * graph, so the program is built once per shape through ProgramCache, and
+ * graphs with the same shape share it.
+ */
+class FusionGraph
+{
+public:
+    struct Node
+    {
+        int id;
+    };
+
+    FusionGraph(ProgramCache &cache, cl_command_queue queue)
+        : m_cache(cache), m_queue(queue)
+    {
+    }
+
+    ~FusionGraph()
+    {
+        for (std::map<std::string, cl_kernel>::iterator it = m_kernels.begin(); it != m_kernels.end(); ++it)
+        {
+            clReleaseKernel(it->second);
+        }
+    }
+
+    /* A buffer used several times is read once */
+    Node input(cl_mem buffer)
+    {
+        for (size_t i = 0; i < m_nodes.size(); i++)
+        {
+            if (m_nodes[i].kind == INPUT && m_inputs[m_nodes[i].slot] == buffer)
+                return make(i);
+        }
+        m_inputs.push_back(buffer);
+        return append(INPUT, "", -1, -1, -1, (int)m_inputs.size() - 1);
+    }
+
+    Node scalar(cl_float value)
+    {
+        m_scalars.push_back(value);
+        return append(SCALAR, "", -1, -1, -1, (int)m_scalars.size() - 1);
+    }
+
+    void setScalar(Node node, cl_float value) { m_scalars[m_nodes[node.id].slot] = value; }
+
+    Node add(Node a, Node b) { return binary("+", a, b); }
+    Node sub(Node a, Node b) { return binary("-", a, b); }
+    Node mul(Node a, Node b) { return binary("*", a, b); }
+    Node div(Node a, Node b) { return binary("/", a, b); }
+    Node max(Node a, Node b) { return call("fmax", a, b); }
+    Node min(Node a, Node b) { return call("fmin", a, b); }
+    Node fma(Node a, Node b, Node c) { return append(CALL, "fma", a.id, b.id, c.id, -1); }
+    Node clamp(Node a, Node lo, Node hi) { return append(CALL, "clamp", a.id, lo.id, hi.id, -1); }
+
+    Node neg(Node a) { return append(UNARY, "-", a.id, -1, -1, -1); }
+    Node abs(Node a) { return call("fabs", a); }
+    Node sqrt(Node a) { return call("sqrt", a); }
+    Node exp(Node a) { return call("exp", a); }
+    Node tanh(Node a) { return call("tanh", a); }
+    Node relu(Node a) { return append(RELU, "", a.id, -1, -1, -1); }
+    Node sigmoid(Node a) { return append(SIGMOID, "", a.id, -1, -1, -1); }
+
+    /* Outputs may alias inputs: every element is read before it is written */
+    void output(Node node, cl_mem buffer)
+    {
+        m_outputs.push_back(std::make_pair(node.id, buffer));
+    }
+
+    /* Forget the graph; built kernels are kept for the next graph of the same shape */
+    void clear()
+    {
+        m_nodes.clear();
+        m_inputs.clear();
+        m_scalars.clear();
+        m_outputs.clear();
+    }
+
+    /* Kernel "fused": inputs, outputs, scalars, count */
+    std::string source() const
+    {
+        std::ostringstream s;
+        s << "__kernel void fused(";
+        for (size_t i = 0; i < m_inputs.size(); i++)
+            s << "__global const float *in" << i << ", ";
+        for (size_t i = 0; i < m_outputs.size(); i++)
+            s << "__global float *out" << i << ", ";
+        for (size_t i = 0; i < m_scalars.size(); i++)
+            s << "float s" << i << ", ";
+        s << "ulong count) {\n"
+          << "   ulong stride = get_global_size(0);\n"
+          << "   ulong gid = get_global_id(0);\n"
+          << "   for(ulong v = gid; v < count / 4; v += stride) {\n";
+        body(s, "float4", "vload4(v, in%)", "vstore4(%, v, out#)");
+        s << "   }\n"
+          << "   ulong i = count / 4 * 4 + gid;\n"
+          << "   if(i < count) {\n";
+        body(s, "float", "in%[i]", "out#[i] = %");
+        s << "   }\n"
+          << "}\n";
+        return s.str();
+    }
+
+    cl_int run(size_t count, cl_event *event = NULL)
+    {
+        cl_int status;
+        if (m_outputs.empty())
+            return CL_INVALID_VALUE;
+        if (count == 0)
+            return CL_SUCCESS;
+
+        cl_kernel kernel = getKernel(&status);
+        if (status != CL_SUCCESS)
+            return status;
+
+        cl_uint index = 0;
+        cl_ulong n = count;
+        status = CL_SUCCESS;
+        for (size_t i = 0; i < m_inputs.size(); i++)
+            status |= clSetKernelArg(kernel, index++, sizeof(cl_mem), &m_inputs[i]);
+        for (size_t i = 0; i < m_outputs.size(); i++)
+            status |= clSetKernelArg(kernel, index++, sizeof(cl_mem), &m_outputs[i].second);
+        for (size_t i = 0; i < m_scalars.size(); i++)
+            status |= clSetKernelArg(kernel, index++, sizeof(cl_float), &m_scalars[i]);
+        status |= clSetKernelArg(kernel, index++, sizeof(cl_ulong), &n);
+        if (status != CL_SUCCESS)
+            return status;
+
+        size_t localSize = FUSION_LOCAL_SIZE;
+        size_t groups = (count / 4 + localSize * FUSION_ITEMS - 1) / (localSize * FUSION_ITEMS);
+        size_t globalSize = (groups > 0 ? groups : 1) * localSize;
+        return clEnqueueNDRangeKernel(m_queue, kernel, 1, NULL, &globalSize, &localSize, 0, NULL, event);
+    }
+
+private:
+    enum Kind
+    {
+        INPUT,
+        SCALAR,
+        BINARY,
+        UNARY,
+        CALL,
+        RELU,
+        SIGMOID
+    };
+
+    struct Op
+    {
+        Kind kind;
+        const char *name;   /* operator or function */
+        int args[3];
+        int slot;           /* input or scalar index */
+    };
+
+    Node make(size_t id)
+    {
+        Node node = { (int)id };
+        return node;
+    }
+
+    Node append(Kind kind, const char *name, int a, int b, int c, int slot)
+    {
+        Op op = { kind, name, { a, b, c }, slot };
+        m_nodes.push_back(op);
+        return make(m_nodes.size() - 1);
+    }
+
+    Node binary(const char *op, Node a, Node b) { return append(BINARY, op, a.id, b.id, -1, -1); }
+    Node call(const char *name, Node a) { return append(CALL, name, a.id, -1, -1, -1); }
+    Node call(const char *name, Node a, Node b) { return append(CALL, name, a.id, b.id, -1, -1); }
+
+    /* One statement per node; % in the patterns is the slot, # the output index */
+    void body(std::ostringstream &s, const char *type, const char *load, const char *store) const
+    {
+        for (size_t i = 0; i < m_nodes.size(); i++)
+        {
+            const Op &op = m_nodes[i];
+            s << "      " << type << " t" << i << " = ";
+            switch (op.kind)
+            {
+            case INPUT:   s << substitute(load, '%', slot(op.slot)); break;
+            case SCALAR:  s << "(" << type << ")(s" << op.slot << ")"; break;
+            case BINARY:  s << "t" << op.args[0] << " " << op.name << " t" << op.args[1]; break;
+            case UNARY:   s << op.name << "t" << op.args[0]; break;
+            case RELU:    s << "fmax(t" << op.args[0] << ", (" << type << ")(0.0f))"; break;
+            case SIGMOID: s << "1.0f / (1.0f + exp(-t" << op.args[0] << "))"; break;
+            case CALL:
+                s << op.name << "(";
+                for (int k = 0; k < 3 && op.args[k] >= 0; k++)
+                    s << (k > 0 ? ", t" : "t") << op.args[k];
+                s << ")";
+                break;
+            }
+            s << ";\n";
+        }
+        for (size_t o = 0; o < m_outputs.size(); o++)
+        {
+            std::string t = "t" + slot(m_outputs[o].first);
+            s << "      " << substitute(substitute(store, '#', slot((int)o)).c_str(), '%', t) << ";\n";
+        }
+    }
+
+    static std::string slot(int i)
+    {
+        std::ostringstream s;
+        s << i;
+        return s.str();
+    }
+
+    static std::string substitute(const char *pattern, char mark, const std::string &value)
+    {
+        std::string s;
+        for (const char *p = pattern; *p; p++)
+        {
+            if (*p == mark)
+                s += value;
+            else
+                s += *p;
+        }
+        return s;
+    }
+
+    cl_kernel getKernel(cl_int *status)
+    {
+        std::string src = source();
+        std::map<std::string, cl_kernel>::iterator it = m_kernels.find(src);
+        if (it != m_kernels.end())
+        {
+            *status = CL_SUCCESS;
+            return it->second;
+        }
+
+        cl_program program = m_cache.getProgramFromSource("fused", src, "");
+        if (program == NULL)
+        {
+            *status = CL_BUILD_PROGRAM_FAILURE;
+            return NULL;
+        }
+        cl_kernel kernel = clCreateKernel(program, "fused", status);
+        if (*status == CL_SUCCESS)
+        {
+            m_kernels[src] = kernel;
+        }
+        return kernel;
+    }
+
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::vector<Op> m_nodes;
+    std::vector<cl_mem> m_inputs;
+    std::vector<cl_float> m_scalars;
+    std::vector<std::pair<int, cl_mem> > m_outputs;
+    std::map<std::string, cl_kernel> m_kernels;
+};
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef FUTURE_HPP
+#define FUTURE_HPP
+
+#include <CL/cl.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/*
+ * Completion of an enqueued operation, backed by the cl_event of its last
+ * command. Copies share the event. An operation that produces a host value
+ * (a reduction result) attaches a finish step that decodes it; the step runs
+ * once, in the first wait() that sees the event complete, so the value is
+ * only valid after wait(). The finish step owns the host memory the
+ * operation reads into, so dropping the last copy of a future whose finish
+ * step has not run waits for the event first: the device never writes into
+ * freed memory, whether or not anyone waited.
+ *
+ * Operations take a WaitList of earlier futures and start after them, on any
+ * queue of the same context, so a chain such as invert -> gemv -> reduce is
+ * enqueued in one go and the host waits once at the end.
+ */
+class Future
+{
+public:
+    /* Complete, nothing to wait for */
+    Future() {}
+
+    /* Takes over the reference to event */
+    explicit Future(cl_event event, const std::function<void()> &finish = std::function<void()>())
+        : m_state(std::make_shared<State>())
+    {
+        m_state->event = event;
+        m_state->finish = finish;
+    }
+
+    /* An operation that could not be enqueued */
+    static Future failed(cl_int status)
+    {
+        Future future;
+        future.m_state = std::make_shared<State>();
+        future.m_state->status = status;
+        return future;
+    }
+
+    cl_event event() const { return m_state ? m_state->event : NULL; }
+
+    /* CL_SUCCESS unless enqueueing failed */
+    cl_int error() const { return m_state ? m_state->status : CL_SUCCESS; }
+
+    bool ready() const
+    {
+        cl_int state = CL_COMPLETE;
+        if (event() != NULL)
+            clGetEventInfo(event(), CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(state), &state, NULL);
+        return state <= CL_COMPLETE;
+    }
+
+    /* Blocks until done and runs the finish step; the enqueue or execution error if any */
+    cl_int wait() const
+    {
+        if (!m_state || m_state->status != CL_SUCCESS)
+            return error();
+        if (m_state->event != NULL)
+        {
+            cl_int state = CL_COMPLETE;
+            cl_int status = clWaitForEvents(1, &m_state->event);
+            clGetEventInfo(m_state->event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(state), &state, NULL);
+            if (status != CL_SUCCESS || state < 0)
+            {
+                m_state->status = state < 0 ? state : status;
+                return m_state->status;
+            }
+        }
+        if (m_state->finish)
+        {
+            m_state->finish();
+            m_state->finish = std::function<void()>();
+        }
+        return CL_SUCCESS;
+    }
+
+private:
+    struct State
+    {
+        cl_event event;
+        cl_int status;
+        std::function<void()> finish;
+
+        State() : event(NULL), status(CL_SUCCESS) {}
+        ~State()
+        {
+            if (event != NULL)
+            {
+                if (finish)
+                    clWaitForEvents(1, &event);
+                clReleaseEvent(event);
+            }
+        }
+    };
+
+    std::shared_ptr<State> m_state;
+};
+
+typedef std::vector<Future> WaitList;
+
+inline cl_int waitAll(const WaitList &futures)
+{
+    cl_int status = CL_SUCCESS;
+    for (size_t i = 0; i < futures.size(); i++)
+    {
+        cl_int s = futures[i].wait();
+        if (status == CL_SUCCESS)
+            status = s;
+    }
+    return status;
+}
+
+/*
+ * Make the next commands on queue wait for after. Events of an earlier
+ * command on the same in-order queue are already ordered and are skipped,
+ * so a chain on one queue adds no barrier at all.
+ */
+inline cl_int enqueueWait(cl_command_queue queue, const WaitList &after)
+{
+    cl_command_queue_properties properties = 0;
+    std::vector<cl_event> events;
+    bool queried = false;
+
+    for (size_t i = 0; i < after.size(); i++)
+    {
+        if (after[i].error() != CL_SUCCESS)
+            return after[i].error();
+        cl_event event = after[i].event();
+        if (event == NULL)
+            continue;
+
+        cl_command_queue owner = NULL;
+        clGetEventInfo(event, CL_EVENT_COMMAND_QUEUE, sizeof(owner), &owner, NULL);
+        if (owner == queue && !queried)
+        {
+            clGetCommandQueueInfo(queue, CL_QUEUE_PROPERTIES, sizeof(properties), &properties, NULL);
+            queried = true;
+        }
+        if (owner != queue || (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE))
+            events.push_back(event);
+    }
+    if (events.empty())
+        return CL_SUCCESS;
+    return clEnqueueBarrierWithWaitList(queue, (cl_uint)events.size(), &events[0], NULL);
+}
+
+/*
+ * Enqueue op(cl_event *last) on queue after the futures in after. If op
+ * leaves no event (it had nothing to do), a marker stands in for it.
+ */
+template <typename Op>
+Future enqueueAfter(cl_command_queue queue, const WaitList &after, Op op,
+                    const std::function<void()> &finish = std::function<void()>())
+{
+    cl_event event = NULL;
+    cl_int status = enqueueWait(queue, after);
+    if (status == CL_SUCCESS)
+        status = op(&event);
+    if (status == CL_SUCCESS && event == NULL)
+        status = clEnqueueMarkerWithWaitList(queue, 0, NULL, &event);
+    if (status != CL_SUCCESS)
+    {
+        if (event != NULL)
+            clReleaseEvent(event);
+        return Future::failed(status);
+    }
+    return Future(event, finish);
+}
+
+#endif
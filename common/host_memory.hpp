@@ -0,0 +1,137 @@
+#ifndef HOST_MEMORY_HPP
+#define HOST_MEMORY_HPP
+
+#include <CL/cl.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "array_file.hpp"
+
+/*
+ * Host memory the runtime can use in place. Most drivers only skip the copy
+ * for CL_MEM_USE_HOST_PTR when the pointer is page aligned and the size is a
+ * whole number of cache lines; otherwise they allocate a shadow copy and
+ * copy at every map. CL_MEM_ALLOC_HOST_PTR lets the driver choose (pinned
+ * memory on discrete GPUs, the same pages on CPU and integrated devices).
+ *
+ * Either way the host reaches the data with mapBuffer()/unmapBuffer()
+ * instead of clEnqueueReadBuffer()/clEnqueueWriteBuffer(): on a device that
+ * shares host memory the map is just a pointer and no bytes move.
+ */
+
+#define HOST_MEMORY_ALIGNMENT 4096
+#define HOST_MEMORY_SIZE_ALIGNMENT 64
+
+/* Rounded up to a multiple of HOST_MEMORY_SIZE_ALIGNMENT; NULL on failure */
+inline void *alignedAlloc(size_t bytes, size_t alignment = HOST_MEMORY_ALIGNMENT)
+{
+    bytes = (bytes + HOST_MEMORY_SIZE_ALIGNMENT - 1) / HOST_MEMORY_SIZE_ALIGNMENT * HOST_MEMORY_SIZE_ALIGNMENT;
+#ifdef _WIN32
+    return _aligned_malloc(bytes, alignment);
+#else
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, alignment, bytes) != 0)
+        return NULL;
+    return ptr;
+#endif
+}
+
+inline void alignedFree(void *ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+/* Whether CL_MEM_USE_HOST_PTR on ptr can be zero-copy */
+inline bool isZeroCopyAligned(const void *ptr, size_t bytes)
+{
+    return (uintptr_t)ptr % HOST_MEMORY_ALIGNMENT == 0 && bytes % HOST_MEMORY_SIZE_ALIGNMENT == 0;
+}
+
+/* For std::vector<T, AlignedAllocator<T> > storage that can back a buffer */
+template <typename T>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        void *ptr = alignedAlloc(n * sizeof(T));
+        if (ptr == NULL)
+            throw std::bad_alloc();
+        return (T *)ptr;
+    }
+
+    void deallocate(T *ptr, size_t) { alignedFree(ptr); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+/*
+ * A buffer the host maps instead of copying: over host (CL_MEM_USE_HOST_PTR)
+ * when given, which must then satisfy isZeroCopyAligned(), and allocated by
+ * the driver (CL_MEM_ALLOC_HOST_PTR) otherwise. flags is the access, e.g.
+ * CL_MEM_READ_WRITE.
+ */
+inline cl_mem createHostBuffer(cl_context context, cl_mem_flags flags, size_t bytes, void *host, cl_int *status)
+{
+    if (host != NULL && !isZeroCopyAligned(host, bytes))
+    {
+        *status = CL_INVALID_HOST_PTR;
+        return NULL;
+    }
+    flags |= host != NULL ? CL_MEM_USE_HOST_PTR : CL_MEM_ALLOC_HOST_PTR;
+    return clCreateBuffer(context, flags, bytes, host, status);
+}
+
+/*
+ * A buffer over the data of a mapped array file. Files with the default
+ * alignment are used in place (CL_MEM_USE_HOST_PTR), and file must then
+ * stay open as long as the buffer; others are copied once at creation.
+ */
+inline cl_mem createArrayBuffer(cl_context context, cl_mem_flags flags, const ArrayFile &file, cl_int *status)
+{
+    void *data = file.data<void>();
+    size_t padded = (file.bytes() + HOST_MEMORY_SIZE_ALIGNMENT - 1) / HOST_MEMORY_SIZE_ALIGNMENT *
+                    HOST_MEMORY_SIZE_ALIGNMENT;
+    if (data == NULL || file.bytes() == 0)
+    {
+        *status = CL_INVALID_VALUE;
+        return NULL;
+    }
+    if (isZeroCopyAligned(data, padded))
+        return clCreateBuffer(context, flags | CL_MEM_USE_HOST_PTR, padded, data, status);
+    return clCreateBuffer(context, flags | CL_MEM_COPY_HOST_PTR, file.bytes(), data, status);
+}
+
+/*
+ * Blocking map of the first bytes of buffer. Use CL_MAP_WRITE_INVALIDATE_REGION
+ * for data the host overwrites completely, so the old contents are not
+ * brought back first, and CL_MAP_READ for results.
+ */
+template <typename T>
+T *mapBuffer(cl_command_queue queue, cl_mem buffer, cl_map_flags flags, size_t bytes, cl_int *status)
+{
+    return (T *)clEnqueueMapBuffer(queue, buffer, CL_TRUE, flags, 0, bytes, 0, NULL, NULL, status);
+}
+
+/* Kernels enqueued after this see what the host wrote through the mapping */
+inline cl_int unmapBuffer(cl_command_queue queue, cl_mem buffer, void *ptr, cl_event *event = NULL)
+{
+    return clEnqueueUnmapMemObject(queue, buffer, ptr, 0, NULL, event);
+}
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef PROGRAM_CACHE_HPP
+#define PROGRAM_CACHE_HPP
+
+#include <CL/cl.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+
+/*
+ * Builds each (source, build options) pair once per process and keeps the
+ * program until the cache is destroyed. Built binaries are written next to
+ * the source, tagged with device, vendor, driver and options, so a later run
+ * on the same device skips clBuildProgram (same scheme as gemm.cpp).
+ */
+class ProgramCache
+{
+public:
+    ProgramCache(cl_context context, cl_device_id device)
+        : m_context(context), m_device(device)
+    {
+        char buf[256];
+
+        clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(buf), buf, NULL);
+        m_tag = buf;
+        m_tag += '\n';
+        clGetDeviceInfo(device, CL_DEVICE_VENDOR, sizeof(buf), buf, NULL);
+        m_tag += buf;
+        m_tag += '\n';
+        clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(buf), buf, NULL);
+        m_tag += buf;
+        m_tag += '\n';
+    }
+
+    ~ProgramCache()
+    {
+        for (std::map<Key, cl_program>::iterator it = m_programs.begin(); it != m_programs.end(); ++it)
+        {
+            clReleaseProgram(it->second);
+        }
+    }
+
+    /* Build from a .cl file; returns NULL and prints the build log on failure */
+    cl_program getProgram(const std::string &fileName, const std::string &options)
+    {
+        std::string source;
+        if (!readFile(fileName, source))
+        {
+            printf("Error: failed to open file %s\n", fileName.c_str());
+            return NULL;
+        }
+        return getProgramFromSource(fileName, source, options);
+    }
+
+    /* Build from a source string; name identifies the source in the cache */
+    cl_program getProgramFromSource(const std::string &name, const std::string &source,
+                                    const std::string &options)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        Key key(name + '\n' + source, options);
+        std::map<Key, cl_program>::iterator it = m_programs.find(key);
+        if (it != m_programs.end())
+        {
+            m_hits++;
+            return it->second;
+        }
+
+        std::string binName = binaryName(name, source, options);
+        std::string tag = m_tag + options + '\n';
+        cl_program program = loadBinary(binName, tag);
+        if (program == NULL)
+        {
+            program = buildSource(source, options);
+            if (program == NULL)
+            {
+                return NULL;
+            }
+            saveBinary(binName, tag, program);
+        }
+
+        m_builds++;
+        m_programs[key] = program;
+        return program;
+    }
+
+    /* The kernel is owned by the caller */
+    cl_kernel createKernel(const std::string &fileName, const std::string &options,
+                           const char *kernelName, cl_int *status)
+    {
+        cl_program program = getProgram(fileName, options);
+        if (program == NULL)
+        {
+            *status = CL_BUILD_PROGRAM_FAILURE;
+            return NULL;
+        }
+        return clCreateKernel(program, kernelName, status);
+    }
+
+    cl_context context() const { return m_context; }
+    cl_device_id device() const { return m_device; }
+    size_t hits() const { return m_hits; }
+    size_t builds() const { return m_builds; }
+
+private:
+    typedef std::pair<std::string, std::string> Key;
+
+    static bool readFile(const std::string &fileName, std::string &s)
+    {
+        std::ifstream f(fileName.c_str(), std::ifstream::in | std::ifstream::binary);
+        if (!f.is_open())
+        {
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << f.rdbuf();
+        s = buffer.str();
+        return true;
+    }
+
+    static std::string binaryName(const std::string &name, const std::string &source,
+                                  const std::string &options)
+    {
+        std::ostringstream s;
+        s << name << '.' << std::hex << std::hash<std::string>()(source + '\n' + options) << ".bin";
+        return s.str();
+    }
+
+    cl_program buildSource(const std::string &source, const std::string &options)
+    {
+        cl_int status;
+        const char *str = source.c_str();
+        size_t size = source.size();
+
+        cl_program program = clCreateProgramWithSource(m_context, 1, &str, &size, &status);
+        if (status != CL_SUCCESS)
+        {
+            printf("clCreateProgramWithSource error:%d\n", status);
+            return NULL;
+        }
+
+        status = clBuildProgram(program, 1, &m_device, options.c_str(), NULL, NULL);
+        if (status != CL_SUCCESS)
+        {
+            size_t logSize = 0;
+            clGetProgramBuildInfo(program, m_device, CL_PROGRAM_BUILD_LOG, 0, NULL, &logSize);
+            std::string log(logSize, '\0');
+            clGetProgramBuildInfo(program, m_device, CL_PROGRAM_BUILD_LOG, logSize, &log[0], NULL);
+            printf("clBuildProgram error:%d (%s)\n%s\n", status, options.c_str(), log.c_str());
+            clReleaseProgram(program);
+            return NULL;
+        }
+        return program;
+    }
+
+    void saveBinary(const std::string &path, const std::string &tag, cl_program program)
+    {
+        size_t size = 0;
+        cl_int status = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL);
+        if (status != CL_SUCCESS || !size)
+        {
+            return;
+        }
+
+        std::string binary(size, '\0');
+        unsigned char *ptr = (unsigned char *)&binary[0];
+        status = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char *), &ptr, NULL);
+        if (status != CL_SUCCESS)
+        {
+            return;
+        }
+
+        FILE *fp = fopen(path.c_str(), "wb");
+        if (!fp)
+        {
+            return;
+        }
+        fwrite(tag.data(), 1, tag.size(), fp);
+        fwrite(binary.data(), 1, size, fp);
+        fclose(fp);
+    }
+
+    cl_program loadBinary(const std::string &path, const std::string &tag)
+    {
+        std::string contents;
+        if (!readFile(path, contents) || contents.size() <= tag.size() ||
+            contents.compare(0, tag.size(), tag) != 0)
+        {
+            return NULL;
+        }
+
+        cl_int status, binaryStatus;
+        size_t size = contents.size() - tag.size();
+        const unsigned char *ptr = (const unsigned char *)contents.data() + tag.size();
+        cl_program program = clCreateProgramWithBinary(m_context, 1, &m_device, &size, &ptr,
+                                                       &binaryStatus, &status);
+        if (status != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+        {
+            return NULL;
+        }
+
+        status = clBuildProgram(program, 1, &m_device, NULL, NULL, NULL);
+        if (status != CL_SUCCESS)
+        {
+            clReleaseProgram(program);
+            return NULL;
+        }
+        return program;
+    }
+
+    cl_context m_context;
+    cl_device_id m_device;
+    std::string m_tag;
+    std::map<Key, cl_program> m_programs;
+    std::mutex m_mutex;
+    size_t m_hits = 0;
+    size_t m_builds = 0;
+};
+
+#endif
@@ -0,0 +1,354 @@
+#ifndef STREAM_PIPELINE_HPP
+#define STREAM_PIPELINE_HPP
+
+#include <CL/cl.h>
+#include <stdio.h>
+#include <functional>
+#include <vector>
+#include "future.hpp"
+#include "host_memory.hpp"
+
+#define STREAM_PIPELINE_DEPTH 3
+
+/* One chunk as the compute stage sees it */
+struct StreamChunk
+{
+    size_t index;             /* chunk number, from 0 */
+    size_t offset;            /* byte offset of the chunk in the stream */
+    size_t bytes;             /* input bytes in the chunk */
+    size_t outputBytes;       /* bytes to download; min(bytes, capacity) unless the stage changes it */
+    cl_mem input;             /* the chunk on the device */
+    cl_mem output;            /* output capacity bytes, NULL without output */
+};
+
+struct StreamStats
+{
+    cl_ulong chunks;
+    cl_ulong bytes;           /* input bytes */
+    double uploadMs;          /* busy time of each queue */
+    double computeMs;
+    double downloadMs;
+    double serialMs;          /* upload + compute + download */
+    double wallMs;            /* first upload start to last command end */
+    double efficiency;        /* share of the time that could overlap that did, 0 to 1 */
+};
+
+/*
+ * Streams input that does not fit, or has not arrived yet, through the
+ * device in chunks. Uploads, compute and downloads go to three in-order
+ * queues tied together by events, and depth chunk slots rotate through
+ * them, so chunk i+1 uploads and chunk i-1 downloads while chunk i
+ * computes. Host staging is pinned (CL_MEM_ALLOC_HOST_PTR, mapped once),
+ * which the DMA engines need to copy without blocking the host.
+ *
+ * run() pulls chunks from a source into staging, enqueues the stage on
+ * computeQueue() (engines doing the work are bound to that queue), and
+ * hands each finished chunk to the sink in order. A slot is reused only
+ * after its previous chunk retired, so the source may block on disk while
+ * the device works on the chunks in flight. Depth 1 serializes everything
+ * and gives the baseline for the overlap.
+ *
+ * The queues profile their commands; stats() reports the busy time per
+ * queue, the wall time, and the overlap efficiency
+ * (serial - wall) / (serial - longest queue): 1 when the two shorter queues
+ * are hidden behind the longest, 0 when nothing overlaps.
+ */
+class StreamPipeline
+{
+public:
+    /* Fills chunk with up to capacity bytes; 0 ends the stream */
+    typedef std::function<size_t(void *chunk, size_t capacity)> Source;
+    /* Enqueues the work on chunk.input (and chunk.output) on computeQueue() */
+    typedef std::function<Future(StreamChunk &chunk)> Stage;
+    /* Gets each chunk once its stage completed, in order; output is NULL without output */
+    typedef std::function<void(const StreamChunk &chunk, const void *output)> Sink;
+
+    StreamPipeline(cl_context context, cl_device_id device, size_t chunkBytes, size_t outputBytes = 0,
+                   int depth = STREAM_PIPELINE_DEPTH)
+        : m_context(context), m_chunkBytes(chunkBytes), m_outputBytes(outputBytes), m_status(CL_SUCCESS)
+    {
+        cl_command_queue *queues[3] = { &m_upload, &m_compute, &m_download };
+        for (int i = 0; i < 3; i++)
+        {
+            cl_int status;
+            *queues[i] = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &status);
+            if (m_status == CL_SUCCESS)
+                m_status = status;
+        }
+        m_slots.resize(depth > 0 ? depth : 1);
+        m_stats = StreamStats();
+    }
+
+    ~StreamPipeline()
+    {
+        for (size_t i = 0; i < m_slots.size(); i++)
+            releaseSlot(m_slots[i]);
+        cl_command_queue queues[3] = { m_upload, m_compute, m_download };
+        for (int i = 0; i < 3; i++)
+        {
+            if (queues[i] != NULL)
+                clReleaseCommandQueue(queues[i]);
+        }
+    }
+
+    cl_command_queue computeQueue() const { return m_compute; }
+    size_t chunkBytes() const { return m_chunkBytes; }
+    int depth() const { return (int)m_slots.size(); }
+
+    cl_int run(const Source &source, const Stage &stage, const Sink &sink = Sink())
+    {
+        cl_int status = prepare();
+        if (status != CL_SUCCESS)
+            return status;
+
+        m_stats = StreamStats();
+        m_first = 0;
+        m_last = 0;
+        size_t depth = m_slots.size(), offset = 0, chunk;
+        for (chunk = 0; status == CL_SUCCESS; chunk++)
+        {
+            Slot &slot = m_slots[chunk % depth];
+            if (slot.busy)
+                status = retire(slot, sink);
+            size_t bytes = status == CL_SUCCESS ? source(slot.staging, m_chunkBytes) : 0;
+            if (bytes == 0)
+                break;
+            if (bytes > m_chunkBytes)
+            {
+                status = CL_INVALID_VALUE;
+                break;
+            }
+            status = enqueue(slot, stage, chunk, offset, bytes);
+            offset += bytes;
+        }
+
+        /* Retire the chunks still in flight, oldest first */
+        for (size_t i = 1; i <= depth; i++)
+        {
+            Slot &slot = m_slots[(chunk + i) % depth];
+            if (slot.busy)
+            {
+                cl_int s = retire(slot, sink);
+                if (status == CL_SUCCESS)
+                    status = s;
+            }
+        }
+
+        StreamStats &s = m_stats;
+        s.serialMs = s.uploadMs + s.computeMs + s.downloadMs;
+        s.wallMs = m_last > m_first ? (m_last - m_first) * 1e-6 : 0.0;
+        double longest = s.uploadMs > s.computeMs ? s.uploadMs : s.computeMs;
+        longest = longest > s.downloadMs ? longest : s.downloadMs;
+        s.efficiency = s.serialMs > longest ? (s.serialMs - s.wallMs) / (s.serialMs - longest) : 1.0;
+        s.efficiency = s.efficiency < 0.0 ? 0.0 : s.efficiency > 1.0 ? 1.0 : s.efficiency;
+        return status;
+    }
+
+    const StreamStats &stats() const { return m_stats; }
+
+    void printStats(const char *name) const
+    {
+        const StreamStats &s = m_stats;
+        printf("%s: %llu chunks, %.2f MB, depth %d: upload %.2f ms, compute %.2f ms, download %.2f ms, "
+               "serial %.2f ms, wall %.2f ms (%.2fx), overlap efficiency %.0f%%\n",
+               name, (unsigned long long)s.chunks, s.bytes / 1048576.0, depth(), s.uploadMs, s.computeMs,
+               s.downloadMs, s.serialMs, s.wallMs, s.wallMs > 0.0 ? s.serialMs / s.wallMs : 0.0,
+               100.0 * s.efficiency);
+    }
+
+private:
+    struct Slot
+    {
+        cl_mem stagingBuffer;     /* pinned, mapped for the life of the slot */
+        cl_mem outputStagingBuffer;
+        void *staging;
+        void *outputStaging;
+        cl_mem input;
+        cl_mem output;
+        StreamChunk chunk;
+        cl_event uploaded;
+        cl_event begun;           /* marker: compute may start */
+        cl_event downloaded;
+        Future computed;
+        bool busy;
+
+        Slot()
+            : stagingBuffer(NULL), outputStagingBuffer(NULL), staging(NULL), outputStaging(NULL), input(NULL),
+              output(NULL), uploaded(NULL), begun(NULL), downloaded(NULL), busy(false)
+        {
+        }
+    };
+
+    /* Buffers on first use */
+    cl_int prepare()
+    {
+        cl_int status = m_status;
+        for (size_t i = 0; i < m_slots.size() && status == CL_SUCCESS; i++)
+        {
+            Slot &slot = m_slots[i];
+            if (slot.input != NULL)
+                continue;
+            slot.stagingBuffer = createHostBuffer(m_context, CL_MEM_READ_WRITE, m_chunkBytes, NULL, &status);
+            if (status == CL_SUCCESS)
+                slot.staging = mapBuffer<void>(m_upload, slot.stagingBuffer, CL_MAP_WRITE_INVALIDATE_REGION,
+                                               m_chunkBytes, &status);
+            if (status == CL_SUCCESS)
+                slot.input = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_chunkBytes, NULL, &status);
+            if (status == CL_SUCCESS && m_outputBytes > 0)
+            {
+                slot.outputStagingBuffer = createHostBuffer(m_context, CL_MEM_READ_WRITE, m_outputBytes, NULL,
+                                                            &status);
+                if (status == CL_SUCCESS)
+                    slot.outputStaging = mapBuffer<void>(m_download, slot.outputStagingBuffer, CL_MAP_READ,
+                                                         m_outputBytes, &status);
+                if (status == CL_SUCCESS)
+                    slot.output = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_outputBytes, NULL, &status);
+            }
+            if (status != CL_SUCCESS)
+                releaseSlot(slot);
+        }
+        m_status = status;
+        return status;
+    }
+
+    cl_int enqueue(Slot &slot, const Stage &stage, size_t index, size_t offset, size_t bytes)
+    {
+        StreamChunk &chunk = slot.chunk;
+        chunk.index = index;
+        chunk.offset = offset;
+        chunk.bytes = bytes;
+        chunk.outputBytes = bytes < m_outputBytes ? bytes : m_outputBytes;
+        chunk.input = slot.input;
+        chunk.output = slot.output;
+
+        cl_int status = clEnqueueWriteBuffer(m_upload, slot.input, CL_FALSE, 0, bytes, slot.staging, 0, NULL,
+                                             &slot.uploaded);
+        if (status == CL_SUCCESS)
+            status = clEnqueueMarkerWithWaitList(m_compute, 1, &slot.uploaded, &slot.begun);
+        slot.busy = true;
+        if (status != CL_SUCCESS)
+            return status;
+
+        /* The marker is earlier on the same queue, so the stage needs no wait list */
+        slot.computed = stage(chunk);
+        status = slot.computed.error();
+        if (status == CL_SUCCESS && chunk.outputBytes > m_outputBytes)
+            status = CL_INVALID_VALUE;
+        if (status == CL_SUCCESS && m_outputBytes > 0)
+        {
+            cl_event computed = slot.computed.event() != NULL ? slot.computed.event() : slot.begun;
+            status = clEnqueueReadBuffer(m_download, slot.output, CL_FALSE, 0, chunk.outputBytes,
+                                         slot.outputStaging, 1, &computed, &slot.downloaded);
+        }
+
+        /* Submit now; the next chunk's source read overlaps this one */
+        clFlush(m_upload);
+        clFlush(m_compute);
+        if (m_outputBytes > 0)
+            clFlush(m_download);
+        return status;
+    }
+
+    /* Waits for the chunk in slot, records its times and passes it to sink */
+    cl_int retire(Slot &slot, const Sink &sink)
+    {
+        cl_int status = slot.computed.wait();
+        cl_event events[3] = { slot.uploaded, slot.begun, slot.downloaded };
+        for (int i = 0; i < 3; i++)
+        {
+            if (events[i] != NULL)
+            {
+                cl_int s = clWaitForEvents(1, &events[i]);
+                if (status == CL_SUCCESS)
+                    status = s;
+            }
+        }
+
+        if (status == CL_SUCCESS && slot.begun != NULL)
+        {
+            cl_ulong start, end;
+            profile(slot.uploaded, &start, &end);
+            m_stats.uploadMs += (end - start) * 1e-6;
+            m_first = m_first == 0 || start < m_first ? start : m_first;
+            m_last = end > m_last ? end : m_last;
+
+            profile(slot.begun, &start, &end);
+            if (slot.computed.event() != NULL)
+            {
+                start = end;
+                profile(slot.computed.event(), NULL, &end);
+            }
+            m_stats.computeMs += (end - start) * 1e-6;
+            m_last = end > m_last ? end : m_last;
+
+            if (slot.downloaded != NULL)
+            {
+                profile(slot.downloaded, &start, &end);
+                m_stats.downloadMs += (end - start) * 1e-6;
+                m_last = end > m_last ? end : m_last;
+            }
+            m_stats.chunks++;
+            m_stats.bytes += slot.chunk.bytes;
+            if (sink)
+                sink(slot.chunk, slot.outputStaging);
+        }
+
+        for (int i = 0; i < 3; i++)
+        {
+            if (events[i] != NULL)
+                clReleaseEvent(events[i]);
+        }
+        slot.uploaded = slot.begun = slot.downloaded = NULL;
+        slot.computed = Future();
+        slot.busy = false;
+        return status;
+    }
+
+    static void profile(cl_event event, cl_ulong *start, cl_ulong *end)
+    {
+        cl_ulong value = 0;
+        if (start != NULL)
+        {
+            clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(value), &value, NULL);
+            *start = value;
+        }
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(value), &value, NULL);
+        *end = value;
+    }
+
+    void releaseSlot(Slot &slot)
+    {
+        if (slot.busy)
+            retire(slot, Sink());
+        if (slot.staging != NULL)
+            unmapBuffer(m_upload, slot.stagingBuffer, slot.staging);
+        if (slot.outputStaging != NULL)
+            unmapBuffer(m_download, slot.outputStagingBuffer, slot.outputStaging);
+        if (slot.staging != NULL || slot.outputStaging != NULL)
+        {
+            clFinish(m_upload);
+            clFinish(m_download);
+        }
+        cl_mem buffers[4] = { slot.stagingBuffer, slot.outputStagingBuffer, slot.input, slot.output };
+        for (int i = 0; i < 4; i++)
+        {
+            if (buffers[i] != NULL)
+                clReleaseMemObject(buffers[i]);
+        }
+        slot = Slot();
+    }
+
+    cl_context m_context;
+    cl_command_queue m_upload;
+    cl_command_queue m_compute;
+    cl_command_queue m_download;
+    size_t m_chunkBytes;
+    size_t m_outputBytes;
+    cl_int m_status;
+    std::vector<Slot> m_slots;
+    StreamStats m_stats;
+    cl_ulong m_first;
+    cl_ulong m_last;
+};
+
+#endif
@@ -0,0 +1,282 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ThreadPoolStats
+{
+    unsigned long long executed;  /* tasks run */
+    unsigned long long stolen;    /* taken from another worker's deque */
+};
+
+/*
+ * Work-stealing pool for host work around the OpenCL calls: independent
+ * requests, data generation, reference checks, partial-result combining.
+ * Each worker has a deque; a task submitted from a worker goes to the back
+ * of its own deque, others are dealt round-robin. A worker pops its newest
+ * task and, when out of work, steals the oldest task of another worker.
+ *
+ * Waiting inside a task never idles a worker: wait() and parallelFor()
+ * run pending tasks until what they wait for is done, so nested
+ * parallelism cannot deadlock the pool.
+ *
+ * Enqueueing from several threads is fine with one command queue per
+ * thread (see PerWorker); kernels hold their arguments, so engines are per
+ * thread too. ProgramCache and BufferPool may be shared.
+ */
+class ThreadPool
+{
+public:
+    /* 0 threads: one per hardware thread */
+    explicit ThreadPool(size_t threads = 0)
+        : m_queues(threads > 0 ? threads : defaultThreads()), m_next(0), m_pending(0), m_stop(false),
+          m_executed(0), m_stolen(0)
+    {
+        for (size_t i = 0; i < m_queues.size(); i++)
+            m_queues[i].reset(new WorkQueue);
+        for (size_t i = 0; i < m_queues.size(); i++)
+            m_threads.push_back(std::thread(&ThreadPool::work, this, (int)i));
+    }
+
+    /* Runs what is queued, then joins */
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (size_t i = 0; i < m_threads.size(); i++)
+            m_threads[i].join();
+    }
+
+    size_t threads() const { return m_threads.size(); }
+
+    /* Worker index of the calling thread in this pool, -1 outside it */
+    int currentWorker() const
+    {
+        return current().pool == this ? current().index : -1;
+    }
+
+    template <typename F>
+    auto submit(F task) -> std::future<decltype(task())>
+    {
+        typedef decltype(task()) Result;
+        std::shared_ptr<std::packaged_task<Result()> > packaged =
+            std::make_shared<std::packaged_task<Result()> >(task);
+        std::future<Result> future = packaged->get_future();
+        push([packaged]() { (*packaged)(); });
+        return future;
+    }
+
+    /* Blocks until future is ready, running pool tasks meanwhile */
+    template <typename T>
+    void wait(const std::future<T> &future)
+    {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            if (!runOne())
+                future.wait_for(std::chrono::microseconds(100));
+        }
+    }
+
+    /*
+     * body(begin, end) over [begin, end) in pieces of grain. The caller
+     * runs pieces too, and returns when all are done.
+     */
+    void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &body)
+    {
+        if (begin >= end)
+            return;
+        grain = grain > 0 ? grain : 1;
+        struct Range
+        {
+            std::atomic<size_t> next;
+            std::atomic<size_t> done;
+        };
+        std::shared_ptr<Range> range = std::make_shared<Range>();
+        range->next = begin;
+        range->done = begin;
+
+        /* Helpers find the range used up once the caller is finished; they hold no reference to body then */
+        std::function<void()> piece = [range, end, grain, &body]() {
+            for (size_t first; (first = range->next.fetch_add(grain)) < end;)
+            {
+                size_t last = first + grain < end ? first + grain : end;
+                body(first, last);
+                range->done += last - first;
+            }
+        };
+        size_t pieces = (end - begin + grain - 1) / grain;
+        size_t helpers = pieces - 1 < threads() ? pieces - 1 : threads();
+        for (size_t i = 0; i < helpers; i++)
+            push(piece);
+        piece();
+        while (range->done.load() < end)
+        {
+            if (!runOne())
+                std::this_thread::yield();
+        }
+    }
+
+    ThreadPoolStats stats() const
+    {
+        ThreadPoolStats s;
+        s.executed = m_executed.load();
+        s.stolen = m_stolen.load();
+        return s;
+    }
+
+private:
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    struct Current
+    {
+        const ThreadPool *pool;
+        int index;
+    };
+
+    static Current &current()
+    {
+        static thread_local Current worker = { NULL, -1 };
+        return worker;
+    }
+
+    static size_t defaultThreads()
+    {
+        unsigned int n = std::thread::hardware_concurrency();
+        return n > 0 ? n : 4;
+    }
+
+    void push(const std::function<void()> &task)
+    {
+        int self = currentWorker();
+        size_t index = self >= 0 ? (size_t)self : m_next++ % m_queues.size();
+
+        /* Counted before it can be taken, so the decrement in runOne() never comes first */
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(task);
+        }
+        m_wake.notify_one();
+    }
+
+    /* Own newest task first, then the oldest of another worker */
+    bool take(int self, std::function<void()> &task)
+    {
+        size_t count = m_queues.size();
+        if (self >= 0)
+        {
+            WorkQueue &own = *m_queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        size_t start = self >= 0 ? (size_t)self + 1 : 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            WorkQueue &victim = *m_queues[(start + i) % count];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                if (self >= 0)
+                    m_stolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool runOne()
+    {
+        std::function<void()> task;
+        if (!take(currentWorker(), task))
+            return false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending--;
+        }
+        task();
+        m_executed++;
+        return true;
+    }
+
+    void work(int index)
+    {
+        current().pool = this;
+        current().index = index;
+        for (;;)
+        {
+            if (runOne())
+                continue;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_stop || m_pending > 0; });
+            if (m_stop && m_pending == 0)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkQueue> > m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_next;
+    std::mutex m_mutex;               /* guards m_pending and m_stop for the sleepers */
+    std::condition_variable m_wake;
+    size_t m_pending;
+    bool m_stop;
+    std::atomic<unsigned long long> m_executed;
+    std::atomic<unsigned long long> m_stolen;
+};
+
+/*
+ * One T per worker of a pool, made on first use in that worker, e.g. a
+ * command queue with its engines. local() outside the pool's workers
+ * returns the extra instance kept for the calling (client) thread; only
+ * one such thread may use it.
+ */
+template <typename T>
+class PerWorker
+{
+public:
+    PerWorker(const ThreadPool &pool, const std::function<T *()> &make)
+        : m_pool(pool), m_make(make), m_items(pool.threads() + 1)
+    {
+    }
+
+    T &local()
+    {
+        int index = m_pool.currentWorker();
+        std::unique_ptr<T> &item = m_items[index >= 0 ? (size_t)index : m_items.size() - 1];
+        if (!item)
+            item.reset(m_make());
+        return *item;
+    }
+
+private:
+    const ThreadPool &m_pool;
+    std::function<T *()> m_make;
+    std::vector<std::unique_ptr<T> > m_items;
+};
+
+#endif
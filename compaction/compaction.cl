@@ -0,0 +1,185 @@
+/*
+ * Device-side filter and histogram, so post-processing no longer needs the
+ * whole buffer on the host. Built with -D T=int|float (plus -D T_FLOAT for
+ * float) and -D ITEMS=<n>.
+ *
+ * The filter keeps elements with lo <= x <= hi. Each group walks a tile of
+ * get_local_size(0)*ITEMS elements in ITEMS coalesced rounds and ranks the
+ * kept elements of each round with a local scan.
+ */
+
+#ifndef ITEMS
+#define ITEMS 8
+#endif
+
+#define KEEP(x, lo, hi) ((x) >= (lo) && (x) <= (hi))
+
+/* Exclusive scan of one uint per work-item; *total gets the group sum */
+inline uint group_exclusive_scan(uint x, __local uint *l_scan, uint *total) {
+
+   uint lid = get_local_id(0);
+   uint size = get_local_size(0);
+   uint value = x, other = 0;
+
+   l_scan[lid] = value;
+   barrier(CLK_LOCAL_MEM_FENCE);
+   for(uint offset = 1; offset < size; offset <<= 1) {
+      if(lid >= offset) {
+         other = l_scan[lid - offset];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+      if(lid >= offset) {
+         value += other;
+         l_scan[lid] = value;
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+   *total = l_scan[size - 1];
+   barrier(CLK_LOCAL_MEM_FENCE);
+   return value - x;
+}
+
+/* Stable filter, pass 1: number of kept elements per tile */
+__kernel void compact_count(__global const T *data, uint count, T lo, T hi,
+      __local uint *l_counts, __global uint *tile_counts) {
+
+   uint lid = get_local_id(0);
+   uint size = get_local_size(0);
+   uint base = get_group_id(0) * size * ITEMS;
+   uint kept = 0;
+
+   for(uint r = 0; r < ITEMS; r++) {
+      uint i = base + r * size + lid;
+      kept += i < count && KEEP(data[i], lo, hi);
+   }
+
+   l_counts[lid] = kept;
+   barrier(CLK_LOCAL_MEM_FENCE);
+   for(uint i = size/2; i > 0; i >>= 1) {
+      if(lid < i) {
+         l_counts[lid] += l_counts[lid + i];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   if(lid == 0) {
+      tile_counts[get_group_id(0)] = l_counts[0];
+   }
+}
+
+/* Stable filter, pass 2: tile_scan is the inclusive scan of tile_counts */
+__kernel void compact_scatter(__global const T *data, uint count, T lo, T hi,
+      __local uint *l_scan, __global const uint *tile_scan, __global T *output) {
+
+   uint lid = get_local_id(0);
+   uint size = get_local_size(0);
+   uint base = get_group_id(0) * size * ITEMS;
+   uint offset = get_group_id(0) > 0 ? tile_scan[get_group_id(0) - 1] : 0;
+   uint total, rank, keep;
+   T x;
+
+   for(uint r = 0; r < ITEMS; r++) {
+      uint i = base + r * size + lid;
+      x = i < count ? data[i] : (T)0;
+      keep = i < count && KEEP(x, lo, hi);
+      rank = group_exclusive_scan(keep, l_scan, &total);
+      if(keep) {
+         output[offset + rank] = x;
+      }
+      offset += total;
+   }
+}
+
+/* Single-pass filter: one atomic per tile reserves the output range. Only
+   the multiset of kept elements is preserved: within a tile they are
+   ordered by work-item first, and tiles land in any order */
+__kernel void compact_atomic(__global const T *data, uint count, T lo, T hi,
+      __local uint *l_scan, volatile __global uint *counter, __global T *output) {
+
+   __local uint tile_offset;
+   uint lid = get_local_id(0);
+   uint size = get_local_size(0);
+   uint base = get_group_id(0) * size * ITEMS;
+   uint kept[ITEMS];
+   uint total, ranks = 0, rank, offset;
+
+   /* Rank every round first so the tile needs only one atomic */
+   for(uint r = 0; r < ITEMS; r++) {
+      uint i = base + r * size + lid;
+      kept[r] = i < count && KEEP(data[i], lo, hi);
+   }
+   for(uint r = 0; r < ITEMS; r++) {
+      ranks += kept[r];
+   }
+   rank = group_exclusive_scan(ranks, l_scan, &total);
+
+   if(lid == size - 1) {
+      tile_offset = atomic_add(counter, total);
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   offset = tile_offset + rank;
+   for(uint r = 0; r < ITEMS; r++) {
+      if(kept[r]) {
+         output[offset++] = data[base + r * size + lid];
+      }
+   }
+}
+
+/* Bin index or -1 when x falls outside the histogram. Integer bins are
+   width values wide, float bins 1/scale wide; both start at lo. */
+#ifdef T_FLOAT
+typedef float bin_param_t;
+
+inline int bin_of(float x, float lo, float scale, uint num_bins) {
+   float f = (x - lo) * scale;
+   if(!(f >= 0.0f) || f >= (float)num_bins)
+      return -1;
+   return min((int)f, (int)num_bins - 1);
+}
+#else
+typedef uint bin_param_t;
+
+inline int bin_of(int x, int lo, uint width, uint num_bins) {
+   if(x < lo)
+      return -1;
+   uint bin = ((uint)x - (uint)lo) / width;
+   return bin < num_bins ? (int)bin : -1;
+}
+#endif
+
+/* Each group counts into its own copy of the bins in local memory and
+   merges the non-zero bins into the global histogram with atomics. With
+   use_local == 0 (the bins do not fit in local memory) it updates the
+   global bins directly. */
+__kernel void histogram(__global const T *data, uint count, T lo, bin_param_t param,
+      uint num_bins, uint use_local, __local uint *l_bins, volatile __global uint *bins) {
+
+   uint lid = get_local_id(0);
+   int bin;
+
+   if(use_local) {
+      for(uint b = lid; b < num_bins; b += get_local_size(0)) {
+         l_bins[b] = 0;
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   for(uint i = get_global_id(0); i < count; i += get_global_size(0)) {
+      bin = bin_of(data[i], lo, param, num_bins);
+      if(bin >= 0) {
+         if(use_local)
+            atomic_inc(&l_bins[bin]);
+         else
+            atomic_inc(&bins[bin]);
+      }
+   }
+
+   if(use_local) {
+      barrier(CLK_LOCAL_MEM_FENCE);
+      for(uint b = lid; b < num_bins; b += get_local_size(0)) {
+         if(l_bins[b] != 0)
+            atomic_add(&bins[b], l_bins[b]);
+      }
+   }
+}
@@ -0,0 +1,280 @@
+#include <CL/cl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "compaction.hpp"
+
+#define BENCH_SIZE (1 << 24)
+#define LOOP 10
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+}
+
+cl_mem create_buffer(cl_context context, size_t bytes, const void *host)
+{
+    cl_int err;
+    cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | (host != NULL ? CL_MEM_COPY_HOST_PTR : 0),
+                                   bytes, (void *)host, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a buffer");
+        exit(1);
+    }
+    return buffer;
+}
+
+/* Host filter and histograms, what the post-processing did before */
+template <typename T>
+void host_filter(const std::vector<T> &in, T lo, T hi, std::vector<T> &out)
+{
+    out.clear();
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        if (in[i] >= lo && in[i] <= hi)
+            out.push_back(in[i]);
+    }
+}
+
+void host_histogram(const std::vector<cl_int> &in, cl_int lo, cl_uint width, std::vector<cl_uint> &bins)
+{
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        if (in[i] < lo)
+            continue;
+        cl_uint bin = ((cl_uint)in[i] - (cl_uint)lo) / width;
+        if (bin < bins.size())
+            bins[bin]++;
+    }
+}
+
+void host_histogram(const std::vector<cl_float> &in, cl_float lo, cl_float hi, std::vector<cl_uint> &bins)
+{
+    cl_float scale = bins.size() / (hi - lo);
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        cl_float f = (in[i] - lo) * scale;
+        if (!(f >= 0.0f) || f >= (cl_float)bins.size())
+            continue;
+        bins[std::min((size_t)f, bins.size() - 1)]++;
+    }
+}
+
+/* The unstable filter only promises the same multiset */
+template <typename T>
+bool check_filter(cl_context context, cl_command_queue queue, FilterEngine &engine,
+                  const std::vector<T> &in, T lo, T hi, bool stable)
+{
+    std::vector<T> expected, out(in.size());
+    cl_uint kept;
+    host_filter(in, lo, hi, expected);
+
+    cl_mem input = create_buffer(context, in.size() * sizeof(T), in.data());
+    cl_mem output = create_buffer(context, in.size() * sizeof(T), NULL);
+    cl_int err = engine.copyIf(input, (cl_uint)in.size(), lo, hi, output, &kept, stable);
+    if (err == CL_SUCCESS && kept > 0)
+        err = clEnqueueReadBuffer(queue, output, CL_TRUE, 0, kept * sizeof(T), out.data(), 0, NULL, NULL);
+    clReleaseMemObject(input);
+    clReleaseMemObject(output);
+
+    out.resize(err == CL_SUCCESS ? kept : 0);
+    if (!stable)
+    {
+        std::sort(out.begin(), out.end());
+        std::sort(expected.begin(), expected.end());
+    }
+    return err == CL_SUCCESS && out == expected;
+}
+
+template <typename T, typename P>
+bool check_histogram(cl_context context, cl_command_queue queue, FilterEngine &engine,
+                     const std::vector<T> &in, T lo, P param, cl_uint numBins)
+{
+    std::vector<cl_uint> expected(numBins, 0), bins(numBins);
+    host_histogram(in, lo, param, expected);
+
+    cl_mem input = create_buffer(context, in.size() * sizeof(T), in.data());
+    cl_mem output = create_buffer(context, numBins * sizeof(cl_uint), NULL);
+    cl_int err = engine.histogram(input, (cl_uint)in.size(), lo, param, numBins, output);
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(queue, output, CL_TRUE, 0, numBins * sizeof(cl_uint), bins.data(), 0, NULL, NULL);
+    clReleaseMemObject(input);
+    clReleaseMemObject(output);
+    return err == CL_SUCCESS && bins == expected;
+}
+
+/* Device filter + reading the kept elements against reading everything back */
+void benchmark(cl_context context, cl_command_queue queue, FilterEngine &engine, size_t count)
+{
+    std::vector<cl_float> in(count), out(count), host;
+    for (size_t i = 0; i < count; i++)
+    {
+        in[i] = (cl_float)rand() / RAND_MAX;
+    }
+    cl_float lo = 0.45f, hi = 0.55f;
+    cl_uint numBins = 256, kept = 0;
+    std::vector<cl_uint> bins(numBins);
+    std::chrono::steady_clock::time_point start, end;
+
+    cl_mem input = create_buffer(context, count * sizeof(cl_float), in.data());
+    cl_mem output = create_buffer(context, count * sizeof(cl_float), NULL);
+    cl_mem binBuffer = create_buffer(context, numBins * sizeof(cl_uint), NULL);
+
+    /* Before: read the whole buffer and filter/bin on the host */
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < LOOP; i++)
+    {
+        clEnqueueReadBuffer(queue, input, CL_TRUE, 0, count * sizeof(cl_float), out.data(), 0, NULL, NULL);
+        host_filter(out, lo, hi, host);
+    }
+    end = std::chrono::steady_clock::now();
+    printf("filter %u floats, %.0f%% kept:\n", (unsigned int)count, 100.0 * host.size() / count);
+    printf("  read back + host filter : %8.3f ms\n", elapsed_ms(start, end) / LOOP);
+
+    for (int stable = 1; stable >= 0; stable--)
+    {
+        engine.copyIf(input, (cl_uint)count, lo, hi, output, &kept, stable != 0);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < LOOP; i++)
+        {
+            engine.copyIf(input, (cl_uint)count, lo, hi, output, &kept, stable != 0);
+            clEnqueueReadBuffer(queue, output, CL_TRUE, 0, kept * sizeof(cl_float), out.data(), 0, NULL, NULL);
+        }
+        end = std::chrono::steady_clock::now();
+        printf("  copy_if %-8s + read  : %8.3f ms  %s\n", stable ? "stable" : "atomic", elapsed_ms(start, end) / LOOP,
+               kept == host.size() ? "Check passed." : "Check failed.");
+    }
+
+    std::vector<cl_uint> hostBins(numBins, 0);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < LOOP; i++)
+    {
+        std::fill(hostBins.begin(), hostBins.end(), 0);
+        clEnqueueReadBuffer(queue, input, CL_TRUE, 0, count * sizeof(cl_float), out.data(), 0, NULL, NULL);
+        host_histogram(out, 0.0f, 1.0f, hostBins);
+    }
+    end = std::chrono::steady_clock::now();
+    printf("histogram %u bins:\n", numBins);
+    printf("  read back + host bins   : %8.3f ms\n", elapsed_ms(start, end) / LOOP);
+
+    engine.histogram(input, (cl_uint)count, 0.0f, 1.0f, numBins, binBuffer);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < LOOP; i++)
+    {
+        engine.histogram(input, (cl_uint)count, 0.0f, 1.0f, numBins, binBuffer);
+        clEnqueueReadBuffer(queue, binBuffer, CL_TRUE, 0, numBins * sizeof(cl_uint), bins.data(), 0, NULL, NULL);
+    }
+    end = std::chrono::steady_clock::now();
+    printf("  device histogram + read : %8.3f ms  %s\n", elapsed_ms(start, end) / LOOP,
+           bins == hostBins ? "Check passed." : "Check failed.");
+
+    clReleaseMemObject(input);
+    clReleaseMemObject(output);
+    clReleaseMemObject(binBuffer);
+}
+
+int main(int argc, char *argv[])
+{
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_int err;
+    size_t benchCount = BENCH_SIZE;
+    int failed = 0;
+
+    if (argc > 1)
+    {
+        benchCount = strtoull(argv[1], NULL, 10);
+    }
+
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+    queue = clCreateCommandQueue(context, device, 0, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a command queue");
+        exit(1);
+    }
+
+    ProgramCache cache(context, device);
+    FilterEngine engine(cache, queue);
+
+    size_t tile = engine.tileSize();
+    size_t lengths[] = { 1, 5, tile - 1, tile + 1, 65537, tile * tile + 3 };
+    int passed = 0, total = 0;
+    srand(123);
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+    {
+        std::vector<cl_int> ints(lengths[l]);
+        std::vector<cl_float> floats(lengths[l]);
+        for (size_t i = 0; i < lengths[l]; i++)
+        {
+            ints[i] = rand() % 2001 - 1000;
+            floats[i] = (cl_float)rand() / RAND_MAX * 4.0f - 2.0f;
+        }
+
+        bool ok[] = {
+            check_filter<cl_int>(context, queue, engine, ints, -100, 300, true),
+            check_filter<cl_int>(context, queue, engine, ints, -100, 300, false),
+            check_filter<cl_float>(context, queue, engine, floats, -0.5f, 0.25f, true),
+            check_filter<cl_float>(context, queue, engine, floats, -0.5f, 0.25f, false),
+            check_histogram<cl_int, cl_uint>(context, queue, engine, ints, -500, 10, 64),
+            check_histogram<cl_float, cl_float>(context, queue, engine, floats, -1.0f, 1.0f, 100),
+            /* Too many bins for local memory: the global-atomic path */
+            check_histogram<cl_int, cl_uint>(context, queue, engine, ints, -1000, 1, 1 << 20),
+        };
+        for (size_t k = 0; k < sizeof(ok) / sizeof(ok[0]); k++)
+        {
+            if (!ok[k])
+                printf("  length %u, check %u failed\n", (unsigned int)lengths[l], (unsigned int)k);
+            passed += ok[k];
+            total++;
+        }
+    }
+    failed = passed != total;
+    printf("copy_if and histogram: %d/%d, %s\n", passed, total, failed ? "Check failed." : "Check passed.");
+
+    benchmark(context, queue, engine, benchCount);
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+    return failed;
+}
@@ -0,0 +1,247 @@
+#ifndef COMPACTION_HPP
+#define COMPACTION_HPP
+
+#include <CL/cl.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include "../common/program_cache.hpp"
+#include "../arraysum/scan.hpp"
+
+#define COMPACTION_PROGRAM_FILE "compaction.cl"
+#define COMPACTION_SCAN_FILE "../arraysum/scan.cl"
+#define COMPACTION_LOCAL_SIZE 256
+#define COMPACTION_ITEMS 8
+
+/*
+ * copyIf packs the elements with lo <= x <= hi into output and returns
+ * their number. The stable path counts per tile, scans the tile counts with
+ * ScanEngine and scatters, keeping input order; the unstable path is one
+ * launch that reserves each tile's output range with a single atomic.
+ *
+ * histogram counts int values in bins of width starting at lo, or floats in
+ * numBins equal bins over [lo, hi). Out-of-range values are dropped.
+ */
+class FilterEngine
+{
+public:
+    FilterEngine(ProgramCache &cache, cl_command_queue queue,
+                 const std::string &programFile = COMPACTION_PROGRAM_FILE,
+                 const std::string &scanFile = COMPACTION_SCAN_FILE,
+                 size_t localSize = COMPACTION_LOCAL_SIZE)
+        : m_cache(cache), m_queue(queue), m_programFile(programFile), m_localSize(localSize),
+          m_scan(cache, queue, scanFile), m_tileCounts(NULL), m_tileCountsSize(0), m_counter(NULL)
+    {
+        cl_uint computeUnits = 1;
+        clGetDeviceInfo(cache.device(), CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, NULL);
+        m_histogramGroups = computeUnits * 8;
+        m_localMemSize = 0;
+        clGetDeviceInfo(cache.device(), CL_DEVICE_LOCAL_MEM_SIZE, sizeof(m_localMemSize), &m_localMemSize, NULL);
+    }
+
+    ~FilterEngine()
+    {
+        for (std::map<std::string, cl_kernel>::iterator it = m_kernels.begin(); it != m_kernels.end(); ++it)
+        {
+            clReleaseKernel(it->second);
+        }
+        if (m_tileCounts != NULL)
+            clReleaseMemObject(m_tileCounts);
+        if (m_counter != NULL)
+            clReleaseMemObject(m_counter);
+    }
+
+    size_t tileSize() const { return m_localSize * COMPACTION_ITEMS; }
+
+    cl_int copyIf(cl_mem input, cl_uint count, cl_int lo, cl_int hi, cl_mem output, cl_uint *kept,
+                  bool stable = true)
+    {
+        return copyIf(input, count, "-D T=int", &lo, &hi, sizeof(cl_int), output, kept, stable);
+    }
+
+    cl_int copyIf(cl_mem input, cl_uint count, cl_float lo, cl_float hi, cl_mem output, cl_uint *kept,
+                  bool stable = true)
+    {
+        return copyIf(input, count, "-D T=float -D T_FLOAT", &lo, &hi, sizeof(cl_float), output, kept,
+                      stable);
+    }
+
+    /* bins receives numBins counts; it is cleared first */
+    cl_int histogram(cl_mem input, cl_uint count, cl_int lo, cl_uint width, cl_uint numBins, cl_mem bins)
+    {
+        return histogram(input, count, "-D T=int", &lo, &width, numBins, bins);
+    }
+
+    cl_int histogram(cl_mem input, cl_uint count, cl_float lo, cl_float hi, cl_uint numBins, cl_mem bins)
+    {
+        cl_float scale = numBins / (hi - lo);
+        return histogram(input, count, "-D T=float -D T_FLOAT", &lo, &scale, numBins, bins);
+    }
+
+private:
+    std::string buildOptions(const char *type) const
+    {
+        char options[128];
+        snprintf(options, sizeof(options), "%s -D ITEMS=%d", type, COMPACTION_ITEMS);
+        return options;
+    }
+
+    cl_kernel getKernel(const std::string &options, const char *name, cl_int *status)
+    {
+        std::string key = options + ' ' + name;
+        std::map<std::string, cl_kernel>::iterator it = m_kernels.find(key);
+        if (it != m_kernels.end())
+        {
+            *status = CL_SUCCESS;
+            return it->second;
+        }
+
+        cl_kernel kernel = m_cache.createKernel(m_programFile, options, name, status);
+        if (*status == CL_SUCCESS)
+        {
+            m_kernels[key] = kernel;
+        }
+        return kernel;
+    }
+
+    cl_int reserveBuffers(size_t tiles)
+    {
+        cl_int status = CL_SUCCESS;
+        if (m_counter == NULL)
+        {
+            m_counter = clCreateBuffer(m_cache.context(), CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &status);
+            if (status != CL_SUCCESS)
+                return status;
+        }
+        if (tiles <= m_tileCountsSize)
+            return CL_SUCCESS;
+        if (m_tileCounts != NULL)
+            clReleaseMemObject(m_tileCounts);
+        m_tileCounts = clCreateBuffer(m_cache.context(), CL_MEM_READ_WRITE, tiles * sizeof(cl_uint), NULL, &status);
+        m_tileCountsSize = status == CL_SUCCESS ? tiles : 0;
+        return status;
+    }
+
+    /* Arguments 0-4 are shared by the three filter kernels */
+    cl_int setFilterArgs(cl_kernel kernel, cl_mem input, cl_uint count, const void *lo, const void *hi,
+                         size_t valueSize)
+    {
+        cl_int status;
+        status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+        status |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &count);
+        status |= clSetKernelArg(kernel, 2, valueSize, lo);
+        status |= clSetKernelArg(kernel, 3, valueSize, hi);
+        status |= clSetKernelArg(kernel, 4, m_localSize * sizeof(cl_uint), NULL);
+        return status;
+    }
+
+    cl_int copyIf(cl_mem input, cl_uint count, const char *type, const void *lo, const void *hi,
+                  size_t valueSize, cl_mem output, cl_uint *kept, bool stable)
+    {
+        std::string options = buildOptions(type);
+        size_t tiles = (count + tileSize() - 1) / tileSize();
+        size_t globalSize = tiles * m_localSize;
+        cl_uint zero = 0;
+        cl_int status;
+
+        *kept = 0;
+        if (count == 0)
+            return CL_SUCCESS;
+        status = reserveBuffers(tiles);
+        if (status != CL_SUCCESS)
+            return status;
+
+        if (!stable)
+        {
+            cl_kernel kernel = getKernel(options, "compact_atomic", &status);
+            if (status != CL_SUCCESS)
+                return status;
+            status = clEnqueueFillBuffer(m_queue, m_counter, &zero, sizeof(zero), 0, sizeof(zero), 0, NULL, NULL);
+            status |= setFilterArgs(kernel, input, count, lo, hi, valueSize);
+            status |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &m_counter);
+            status |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &output);
+            if (status != CL_SUCCESS)
+                return status;
+            status = clEnqueueNDRangeKernel(m_queue, kernel, 1, NULL, &globalSize, &m_localSize, 0, NULL, NULL);
+            if (status != CL_SUCCESS)
+                return status;
+            return clEnqueueReadBuffer(m_queue, m_counter, CL_TRUE, 0, sizeof(cl_uint), kept, 0, NULL, NULL);
+        }
+
+        cl_kernel countKernel = getKernel(options, "compact_count", &status);
+        if (status != CL_SUCCESS)
+            return status;
+        cl_kernel scatterKernel = getKernel(options, "compact_scatter", &status);
+        if (status != CL_SUCCESS)
+            return status;
+
+        status = setFilterArgs(countKernel, input, count, lo, hi, valueSize);
+        status |= clSetKernelArg(countKernel, 5, sizeof(cl_mem), &m_tileCounts);
+        if (status != CL_SUCCESS)
+            return status;
+        status = clEnqueueNDRangeKernel(m_queue, countKernel, 1, NULL, &globalSize, &m_localSize, 0, NULL, NULL);
+        if (status != CL_SUCCESS)
+            return status;
+
+        /* Inclusive: tile g starts at scan[g - 1] and the last entry is the total */
+        status = m_scan.scan(m_tileCounts, m_tileCounts, (cl_uint)tiles, SCAN_UINT, false);
+        if (status != CL_SUCCESS)
+            return status;
+
+        status = setFilterArgs(scatterKernel, input, count, lo, hi, valueSize);
+        status |= clSetKernelArg(scatterKernel, 5, sizeof(cl_mem), &m_tileCounts);
+        status |= clSetKernelArg(scatterKernel, 6, sizeof(cl_mem), &output);
+        if (status != CL_SUCCESS)
+            return status;
+        status = clEnqueueNDRangeKernel(m_queue, scatterKernel, 1, NULL, &globalSize, &m_localSize, 0, NULL, NULL);
+        if (status != CL_SUCCESS)
+            return status;
+        return clEnqueueReadBuffer(m_queue, m_tileCounts, CL_TRUE, (tiles - 1) * sizeof(cl_uint), sizeof(cl_uint),
+                                   kept, 0, NULL, NULL);
+    }
+
+    cl_int histogram(cl_mem input, cl_uint count, const char *type, const void *lo, const void *param,
+                     cl_uint numBins, cl_mem bins)
+    {
+        std::string options = buildOptions(type);
+        cl_uint zero = 0;
+        cl_int status;
+
+        cl_kernel kernel = getKernel(options, "histogram", &status);
+        if (status != CL_SUCCESS)
+            return status;
+
+        /* Private bins while they fit in local memory, global atomics otherwise */
+        cl_uint useLocal = numBins * sizeof(cl_uint) <= m_localMemSize / 2;
+        size_t groups = (count + m_localSize - 1) / m_localSize;
+        groups = groups < m_histogramGroups ? groups : m_histogramGroups;
+        size_t globalSize = (groups > 0 ? groups : 1) * m_localSize;
+
+        status = clEnqueueFillBuffer(m_queue, bins, &zero, sizeof(zero), 0, numBins * sizeof(cl_uint), 0, NULL, NULL);
+        status |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+        status |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &count);
+        status |= clSetKernelArg(kernel, 2, 4, lo);
+        status |= clSetKernelArg(kernel, 3, 4, param);
+        status |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &numBins);
+        status |= clSetKernelArg(kernel, 5, sizeof(cl_uint), &useLocal);
+        status |= clSetKernelArg(kernel, 6, useLocal ? numBins * sizeof(cl_uint) : sizeof(cl_uint), NULL);
+        status |= clSetKernelArg(kernel, 7, sizeof(cl_mem), &bins);
+        if (status != CL_SUCCESS)
+            return status;
+        return clEnqueueNDRangeKernel(m_queue, kernel, 1, NULL, &globalSize, &m_localSize, 0, NULL, NULL);
+    }
+
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::string m_programFile;
+    size_t m_localSize;
+    ScanEngine m_scan;
+    std::map<std::string, cl_kernel> m_kernels;
+    cl_mem m_tileCounts;
+    size_t m_tileCountsSize;
+    cl_mem m_counter;
+    size_t m_histogramGroups;
+    cl_ulong m_localMemSize;
+};
+
+#endif
@@ -19,6 +19,7 @@
 #else
 #include <CL/cl.h>
 #endif
+#include "../common/host_memory.hpp"
 
 /* CPU 计算最大值 */
 void findmax(float *array, unsigned int size, float *max)
@@ -134,7 +135,7 @@ int main() {
 
 	/* Data and buffers */
 	/* 数据和缓存*/
-	float data[ARRAY_SIZE];
+	float *data;
 	float max , *scalar_max;
 	/* 定义三个内存对象*/
 	cl_mem data_buffer, scalar_max_buffer;
@@ -144,6 +145,8 @@ int main() {
 	clock_t start, end;
 	/* Initialize data */
 	/* 初始化数据*/
+	/* 数组放在堆上以免栈溢出；按页对齐，data_buffer直接使用这块内存而不拷贝*/
+	data = (float*)alignedAlloc(ARRAY_SIZE * sizeof(float));
 	srand((unsigned)time(NULL));
 	for (i = 0; i < ARRAY_SIZE; i++) {
 		data[i] = 1.0f*(rand()%ARRAY_SIZE);
@@ -159,13 +162,9 @@ int main() {
 		perror("Couldn't obtain device information");
 		exit(1);
 	}
-	/* Allocate and initialize output arrays */
-	/* 申请内存并初始化输出数组*/
+	/* Every group writes its maximum, so the output buffer needs no initial contents */
+	/* 每个工作组都会写出自己的最大值，输出buffer无需初始化*/
 	num_groups = ARRAY_SIZE / local_size;
-	scalar_max = (float*)malloc(num_groups * sizeof(float));
-	for (i = 0; i < num_groups; i++) {
-		scalar_max[i] = 0.0f;
-	}
 
 
 	/* Create a context */
@@ -182,10 +181,16 @@ int main() {
 
 	/* Create data buffer */
 	/* 创建数据buffer缓存，OpenCL一共可以创建Buffer和Image两种内存对象类型，实际应用中具体用途有所区别*/
-	data_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY |
-		CL_MEM_COPY_HOST_PTR, ARRAY_SIZE * sizeof(float), data, &err);
-	scalar_max_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE |
-		CL_MEM_COPY_HOST_PTR, num_groups * sizeof(float), scalar_max, &err);
+	/* The input is used in place (CL_MEM_USE_HOST_PTR) and the result is mapped, not copied */
+	/* 输入直接使用主机内存，结果通过映射读取，共享内存的设备上不拷贝数据*/
+	data_buffer = createHostBuffer(context, CL_MEM_READ_ONLY,
+		ARRAY_SIZE * sizeof(float), data, &err);
+	if (err < 0) {
+		perror("Couldn't create a buffer");
+		exit(1);
+	};
+	scalar_max_buffer = createHostBuffer(context, CL_MEM_READ_WRITE,
+		num_groups * sizeof(float), NULL, &err);
 	if (err < 0) {
 		perror("Couldn't create a buffer");
 		exit(1);
@@ -245,10 +250,10 @@ int main() {
 	/* 读取结果*/
 	
 	/*将标量传入kernel计算*/
-	err = clEnqueueReadBuffer(queue, scalar_max_buffer, CL_TRUE, 0,
-		num_groups * sizeof(float), scalar_max, 0, NULL, NULL);
+	scalar_max = mapBuffer<float>(queue, scalar_max_buffer, CL_MAP_READ,
+		num_groups * sizeof(float), &err);
 	if (err < 0) {
-		perror("Couldn't read the buffer");
+		perror("Couldn't map the buffer");
 		exit(1);
 	}
 
@@ -257,6 +262,7 @@ int main() {
 	/* 校验运算结果*/
 	
 	findmax(scalar_max, num_groups, &max);
+	unmapBuffer(queue, scalar_max_buffer, scalar_max);
 	printf("gpu result : %f \n", max);
 	//std::cout << "gpu Total time =  " << total_time<<"*1E-6 ms"<< std::endl;
 	printf( "gpu: %f ms\n",total_time*1e-6);  
@@ -272,10 +278,10 @@ int main() {
 	
 	/* Deallocate resources */
 	/* 释放资源*/
-	free(scalar_max);
 	clReleaseKernel(kernel);
 	clReleaseMemObject(scalar_max_buffer);
 	clReleaseMemObject(data_buffer);
+	alignedFree(data);
 	clReleaseCommandQueue(queue);
 	clReleaseProgram(program);
 	clReleaseContext(context);
@@ -0,0 +1,260 @@
+#include <CL/cl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include "gemm.hpp"
+#include "../bitonicsort/bitonic-sort.hpp"
+#include "../common/buffer_pool.hpp"
+#include "../common/thread_pool.hpp"
+
+#define GEMM_SIZE 256             /* m = k = n of a gemm job */
+#define SORT_SIZE (1 << 16)       /* keys of a sort job */
+#define JOBS_PER_CLIENT 16
+#define MAX_CLIENTS 8
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+}
+
+/* A command queue and the engines bound to it, one per pool worker */
+struct Worker
+{
+    cl_command_queue queue;
+    GemmEngine gemm;
+    BitonicSortEngine sort;
+
+    Worker(ProgramCache &cache, cl_command_queue queue)
+        : queue(queue), gemm(cache, queue), sort(cache, queue, "../bitonicsort/bitonic-sort.cl")
+    {
+    }
+
+    ~Worker()
+    {
+        clReleaseCommandQueue(queue);
+    }
+};
+
+/* What every job shares: the pool, device buffers and per-worker queues */
+struct Shared
+{
+    ThreadPool &pool;
+    BufferPool &buffers;
+    PerWorker<Worker> &workers;
+};
+
+/* Rows [first, last) of a rows x cols matrix in [0, 1), the same for a given seed whatever the thread */
+void fill_rows(std::vector<float> &data, size_t cols, size_t first, size_t last, unsigned int seed)
+{
+    for (size_t row = first; row < last; row++)
+    {
+        std::minstd_rand generator(seed * 65537u + (unsigned int)row);
+        std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+        for (size_t j = 0; j < cols; j++)
+            data[row * cols + j] = distribution(generator);
+    }
+}
+
+/*
+ * One gemm request: inputs generated and the result checked against the
+ * host product in parallel on the pool, device work on the worker's queue.
+ * Returns 0 when the check passed.
+ */
+int gemm_job(Shared &shared, unsigned int seed)
+{
+    const cl_uint n = GEMM_SIZE;
+    const size_t bytes = n * n * sizeof(float);
+    std::vector<float> a(n * n), b(n * n), c(n * n);
+    shared.pool.parallelFor(0, n, 32, [&](size_t first, size_t last) {
+        fill_rows(a, n, first, last, seed);
+        fill_rows(b, n, first, last, seed + 1);
+    });
+
+    Worker &worker = shared.workers.local();
+    cl_int err;
+    cl_mem bufA = shared.buffers.acquire(bytes, &err);
+    cl_mem bufB = shared.buffers.acquire(bytes, &err);
+    cl_mem bufC = shared.buffers.acquire(bytes, &err);
+    if (bufA == NULL || bufB == NULL || bufC == NULL)
+        return 1;
+    err = clEnqueueWriteBuffer(worker.queue, bufA, CL_FALSE, 0, bytes, a.data(), 0, NULL, NULL);
+    err |= clEnqueueWriteBuffer(worker.queue, bufB, CL_FALSE, 0, bytes, b.data(), 0, NULL, NULL);
+    if (err == CL_SUCCESS)
+        err = worker.gemm.gemm(bufA, bufB, bufC, n, n, n);
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(worker.queue, bufC, CL_TRUE, 0, bytes, c.data(), 0, NULL, NULL);
+    shared.buffers.release(bufA);
+    shared.buffers.release(bufB);
+    shared.buffers.release(bufC);
+    if (err != CL_SUCCESS)
+        return 1;
+
+    std::atomic<int> wrong(0);
+    shared.pool.parallelFor(0, n, 16, [&](size_t first, size_t last) {
+        std::vector<double> row(n);
+        for (size_t i = first; i < last; i++)
+        {
+            std::fill(row.begin(), row.end(), 0.0);
+            for (size_t k = 0; k < n; k++)
+                for (size_t j = 0; j < n; j++)
+                    row[j] += (double)a[i * n + k] * b[k * n + j];
+            for (size_t j = 0; j < n; j++)
+                wrong += fabs(c[i * n + j] - row[j]) > 1e-3 * row[j];
+        }
+    });
+    return wrong.load() != 0;
+}
+
+/* One sort request; the order check is split into pieces whose counts are combined */
+int sort_job(Shared &shared, unsigned int seed)
+{
+    std::vector<cl_int> keys(SORT_SIZE);
+    shared.pool.parallelFor(0, SORT_SIZE, 8192, [&](size_t first, size_t last) {
+        std::minstd_rand generator(seed * 65537u + (unsigned int)first);
+        for (size_t i = first; i < last; i++)
+            keys[i] = (cl_int)generator();
+    });
+
+    Worker &worker = shared.workers.local();
+    cl_int err;
+    size_t bytes = keys.size() * sizeof(cl_int);
+    cl_mem buffer = shared.buffers.acquire(bytes, &err);
+    if (buffer == NULL)
+        return 1;
+    err = clEnqueueWriteBuffer(worker.queue, buffer, CL_FALSE, 0, bytes, keys.data(), 0, NULL, NULL);
+    if (err == CL_SUCCESS)
+        err = worker.sort.sort(buffer, SORT_SIZE);
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(worker.queue, buffer, CL_TRUE, 0, bytes, keys.data(), 0, NULL, NULL);
+    shared.buffers.release(buffer);
+    if (err != CL_SUCCESS)
+        return 1;
+
+    std::atomic<size_t> unsorted(0);
+    shared.pool.parallelFor(1, SORT_SIZE, 8192, [&](size_t first, size_t last) {
+        size_t count = 0;
+        for (size_t i = first; i < last; i++)
+            count += keys[i - 1] > keys[i];
+        unsorted += count;
+    });
+    return unsorted.load() != 0;
+}
+
+/*
+ * Closed-loop clients: each submits a request to the pool, waits for it
+ * and submits the next, alternating gemm and sort. Requests run on the
+ * pool workers, each with its own command queue on the shared context, so
+ * the device sees several queues at once while the host work of other
+ * requests proceeds.
+ */
+int main(int argc, char *argv[])
+{
+    cl_device_id device;
+    cl_context context;
+    cl_int err;
+    size_t threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 0;
+    int failed = 0;
+
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+
+    ProgramCache cache(context, device);
+    BufferPool buffers(context, device);
+    ThreadPool pool(threads);
+    PerWorker<Worker> workers(pool, [&]() {
+        cl_int status;
+        cl_command_queue queue = clCreateCommandQueue(context, device, 0, &status);
+        if (status != CL_SUCCESS)
+        {
+            perror("Couldn't create a command queue");
+            exit(1);
+        }
+        return new Worker(cache, queue);
+    });
+    Shared shared = { pool, buffers, workers };
+    printf("%u pool threads, gemm %dx%d, sort %d keys, %d requests per client\n", (unsigned int)pool.threads(),
+           GEMM_SIZE, GEMM_SIZE, SORT_SIZE, JOBS_PER_CLIENT);
+
+    /* Warm-up builds the programs */
+    failed |= pool.submit([&]() { return gemm_job(shared, 0) | sort_job(shared, 0); }).get();
+
+    double baseline = 0.0;
+    for (int clients = 1; clients <= MAX_CLIENTS; clients *= 2)
+    {
+        std::atomic<int> errors(0);
+        std::vector<double> latencies(clients * JOBS_PER_CLIENT);
+        std::vector<std::thread> threads;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int client = 0; client < clients; client++)
+        {
+            threads.push_back(std::thread([&, client]() {
+                for (int i = 0; i < JOBS_PER_CLIENT; i++)
+                {
+                    unsigned int seed = (unsigned int)(client * JOBS_PER_CLIENT + i + 1);
+                    std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now();
+                    std::future<int> done = pool.submit([&shared, seed, i]() {
+                        return i % 2 == 0 ? gemm_job(shared, seed) : sort_job(shared, seed);
+                    });
+                    errors += done.get();
+                    latencies[client * JOBS_PER_CLIENT + i] = elapsed_ms(submitted, std::chrono::steady_clock::now());
+                }
+            }));
+        }
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+        double ms = elapsed_ms(start, std::chrono::steady_clock::now());
+
+        std::sort(latencies.begin(), latencies.end());
+        double throughput = latencies.size() * 1000.0 / ms;
+        baseline = clients == 1 ? throughput : baseline;
+        printf("%d clients: %.1f requests/s (%.2fx one client), latency p50 %.2f ms p95 %.2f ms, %s\n", clients,
+               throughput, throughput / baseline, latencies[latencies.size() / 2],
+               latencies[latencies.size() * 95 / 100], errors.load() ? "Check failed." : "Check passed.");
+        failed |= errors.load() != 0;
+    }
+
+    ThreadPoolStats stats = pool.stats();
+    printf("pool: %llu tasks, %llu stolen\n", stats.executed, stats.stolen);
+    buffers.printStats("buffer pool");
+    clReleaseContext(context);
+    return failed;
+}
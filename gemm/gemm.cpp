@@ -7,6 +7,12 @@
 #include <string>
 #include <fstream>
 #include <cmath>
+#include "../common/buffer_pool.hpp"
+#include "../common/future.hpp"
+#include "../common/host_memory.hpp"
+#include "../common/program_cache.hpp"
+#include "../common/thread_pool.hpp"
+#include "../reduction/reduction.hpp"
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -19,6 +25,8 @@
 #define SUCCESS 0
 #define FAILURE 1
 #define LOOP 10
+#define TRANSFER_MIN_BYTES (1 << 20)
+#define TRANSFER_MAX_BYTES (64 << 20)
 #define M 4096   // row of A matrix
 #define K 4096   // col of A matrix
 #define N 4096   // row of B matrix
@@ -391,6 +399,92 @@ void gemm_ref(cl_float * input0, cl_float * input1, cl_float * output,
     }
 }
 
+/* Fill and sum every float, so each path touches the data on the host once each way */
+static double fillAndSum(cl_float* fill, const cl_float* sum, size_t count)
+{
+    double total = 0.0;
+    if (fill != NULL)
+        for (size_t i = 0; i < count; i++)
+            fill[i] = (cl_float)(i & 0xff);
+    if (sum != NULL)
+        for (size_t i = 0; i < count; i++)
+            total += sum[i];
+    return total;
+}
+
+/*
+ * Host round trip of one buffer: the host writes it, the device owns it,
+ * the host reads it back. copy uses malloc memory with clEnqueueWriteBuffer
+ * and clEnqueueReadBuffer; the other two map an ALLOC_HOST_PTR buffer or a
+ * USE_HOST_PTR buffer over alignedAlloc memory. On a device with unified
+ * memory the mapped paths should cost about as much as the host loops.
+ */
+int transferBenchmark(cl_context context, cl_device_id device, cl_command_queue queue)
+{
+    const char* names[3] = { "copy", "alloc_host_ptr map", "use_host_ptr map" };
+    cl_bool unified = CL_FALSE;
+    cl_int status;
+    Profiler prof;
+
+    clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+    printf("host round trip, write + read back, unified host memory: %s\n", unified ? "yes" : "no");
+    for(size_t bytes = TRANSFER_MIN_BYTES; bytes <= TRANSFER_MAX_BYTES; bytes *= 4)
+    {
+        size_t count = bytes / sizeof(cl_float);
+        double expected = 0.0, ms[3];
+        for(size_t i = 0; i < count; i++)
+            expected += (double)(i & 0xff);
+
+        for(int path = 0; path < 3; path++)
+        {
+            cl_float* host = path == 1 ? NULL : (cl_float*)alignedAlloc(bytes);
+            cl_mem buffer = path == 0 ? clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &status)
+                                      : createHostBuffer(context, CL_MEM_READ_WRITE, bytes,
+                                                         path == 2 ? host : NULL, &status);
+            CHECK_ERROR(status, "clCreateBuffer");
+
+            double sum = 0.0;
+            prof.resetProfiler();
+            prof.startTime();
+            for(int i = 0; i < LOOP; i++)
+            {
+                if(path == 0)
+                {
+                    fillAndSum(host, NULL, count);
+                    status = clEnqueueWriteBuffer(queue, buffer, CL_TRUE, 0, bytes, host, 0, NULL, NULL);
+                    status |= clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, bytes, host, 0, NULL, NULL);
+                    sum = fillAndSum(NULL, host, count);
+                }
+                else
+                {
+                    cl_float* ptr = mapBuffer<cl_float>(queue, buffer, CL_MAP_WRITE_INVALIDATE_REGION, bytes, &status);
+                    CHECK_ERROR(status, "clEnqueueMapBuffer");
+                    fillAndSum(ptr, NULL, count);
+                    status = unmapBuffer(queue, buffer, ptr);
+                    ptr = mapBuffer<cl_float>(queue, buffer, CL_MAP_READ, bytes, &status);
+                    CHECK_ERROR(status, "clEnqueueMapBuffer");
+                    sum = fillAndSum(NULL, ptr, count);
+                    status |= unmapBuffer(queue, buffer, ptr);
+                    clFinish(queue);
+                }
+                CHECK_ERROR(status, "transfer");
+            }
+            ms[path] = prof.getDurationMS() / LOOP;
+            clReleaseMemObject(buffer);
+            alignedFree(host);
+            if(sum != expected)
+            {
+                printf("%s: Check failed.\n", names[path]);
+                return FAILURE;
+            }
+        }
+        printf("  %4u MB: copy %8.3f ms, alloc_host_ptr map %8.3f ms (%.2fx), use_host_ptr map %8.3f ms (%.2fx)\n",
+               (unsigned int)(bytes >> 20), ms[0], ms[1], ms[0] / ms[1], ms[2], ms[0] / ms[2]);
+    }
+    printf("transfer: Check passed.\n");
+    return SUCCESS;
+}
+
 int main(int argc, char* argv[])
 {
     cl_int  width = N;      //output width
@@ -399,7 +493,29 @@ int main(int argc, char* argv[])
     cl_int  k = K;
     cl_int  n = N;
 
-    if(argc == 4)   // m  k  n
+    /* gemm A.arr B.arr: float32 matrices from array files, used in place */
+    ArrayFile fileA, fileB;
+    bool fromFiles = argc == 3;
+    if(fromFiles)
+    {
+        if(!fileA.open(argv[1]) || !fileB.open(argv[2]))
+        {
+            printf("%s: %s\n", fileA.isOpen() ? argv[2] : argv[1], fileA.isOpen() ? fileB.error() : fileA.error());
+            return FAILURE;
+        }
+        if(!fileA.expect(argv[1], ARRAY_FLOAT32, 2) || !fileB.expect(argv[2], ARRAY_FLOAT32, 2))
+            return FAILURE;
+        m = (cl_int)fileA.shape(0);
+        k = (cl_int)fileA.shape(1);
+        n = (cl_int)fileB.shape(1);
+        if(fileB.shape(0) != (size_t)k || m % 4 != 0 || k % 4 != 0 || n % 4 != 0)
+        {
+            printf("A is %d x %d and B is %d x %d: the inner sizes must match and all be multiples of 4\n",
+                   m, k, (int)fileB.shape(0), n);
+            return FAILURE;
+        }
+    }
+    else if(argc == 4)   // m  k  n
     {
         m = stoi(argv[1]);
         k = stoi(argv[2]);
@@ -485,33 +601,44 @@ int main(int argc, char* argv[])
     cl_uint inputASizeBytes = m * k * sizeof(cl_float);
     cl_uint inputBSizeBytes = n * k * sizeof(cl_float);
     cl_uint outputSizeBytes = width * height * sizeof(cl_float);
-    cl_float* inputA_hostPtr = (cl_float *) malloc( inputASizeBytes);
-    cl_float* inputB_hostPtr = (cl_float *) malloc( inputBSizeBytes);
-    cl_float* output_hostPtr = (cl_float *) malloc(outputSizeBytes);
     cl_float* golden = (cl_float *) malloc(outputSizeBytes);
-    memset(output_hostPtr, 0, outputSizeBytes);
     memset(golden, 0, outputSizeBytes);
-    fillRandom<cl_float>(inputA_hostPtr, k, m, 0, 255);
-    fillRandom<cl_float>(inputB_hostPtr, n, k, 0, 255);
-
-    cl_mem inputAbuf = clCreateBuffer(context,
-                                 CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                                 inputASizeBytes,
-                                 inputA_hostPtr,
-                                 &status);
-    CHECK_ERROR(status, "clCreateBuffer");
-    cl_mem inputBbuf = clCreateBuffer(context,
-                                 CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                                 inputBSizeBytes,
-                                 inputB_hostPtr,
-                                 &status);
-    CHECK_ERROR(status, "clCreateBuffer");
-    cl_mem outputBuf = clCreateBuffer(context,
-                                 CL_MEM_WRITE_ONLY,
-                                 outputSizeBytes,
-                                 NULL,
-                                 &status);
-    CHECK_ERROR(status, "clCreateBuffer");
+
+    /* Pooled buffers are reused across calls; their contents are undefined until written.
+       The inputs are generated straight into the mapped buffers, so nothing is copied
+       on devices that share host memory. Inputs from files are buffers over the mapped
+       files instead, and the file pages are the only copy. */
+    BufferPool pool(context, devices[0], CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR);
+    cl_mem inputAbuf, inputBbuf;
+    cl_float* inputA_hostPtr;
+    cl_float* inputB_hostPtr;
+    if(fromFiles)
+    {
+        inputAbuf = createArrayBuffer(context, CL_MEM_READ_ONLY, fileA, &status);
+        CHECK_ERROR(status, "createArrayBuffer");
+        inputBbuf = createArrayBuffer(context, CL_MEM_READ_ONLY, fileB, &status);
+        CHECK_ERROR(status, "createArrayBuffer");
+    }
+    else
+    {
+        inputAbuf = pool.acquire(inputASizeBytes, &status);
+        CHECK_ERROR(status, "BufferPool::acquire");
+        inputBbuf = pool.acquire(inputBSizeBytes, &status);
+        CHECK_ERROR(status, "BufferPool::acquire");
+        inputA_hostPtr = mapBuffer<cl_float>(commandQueue, inputAbuf, CL_MAP_WRITE_INVALIDATE_REGION,
+                                             inputASizeBytes, &status);
+        CHECK_ERROR(status, "clEnqueueMapBuffer");
+        inputB_hostPtr = mapBuffer<cl_float>(commandQueue, inputBbuf, CL_MAP_WRITE_INVALIDATE_REGION,
+                                             inputBSizeBytes, &status);
+        CHECK_ERROR(status, "clEnqueueMapBuffer");
+        fillRandom<cl_float>(inputA_hostPtr, k, m, 0, 255);
+        fillRandom<cl_float>(inputB_hostPtr, n, k, 0, 255);
+        status = unmapBuffer(commandQueue, inputAbuf, inputA_hostPtr);
+        status |= unmapBuffer(commandQueue, inputBbuf, inputB_hostPtr);
+        CHECK_ERROR(status, "clEnqueueUnmapMemObject");
+    }
+    cl_mem outputBuf = pool.acquire(outputSizeBytes, &status);
+    CHECK_ERROR(status, "BufferPool::acquire");
 
 
     /*Step 8: Create kernel object */
@@ -553,26 +680,62 @@ int main(int argc, char* argv[])
     exeTime = prof.getDurationMS() / loop;
     printf("gemm kernel execution time:%f ms.\n", exeTime);
 
-    /*Step 11: Read the cout put back to host memory.*/
-
-    status = clEnqueueReadBuffer(commandQueue,
-                                outputBuf,
-                                CL_TRUE,
-                                0,
-                                outputSizeBytes,
-                                output_hostPtr,
-                                0,
-                                NULL,
-                                NULL);
-    CHECK_ERROR(status, "clEnqueueReadBuffer");
-    clFinish(commandQueue);
+    /* Checksum of C on the device, chained to the gemm without a host wait in between:
+       sum(C) = sum over k of colsum(A)[k] * rowsum(B)[k]. */
+    ProgramCache cache(context, devices[0]);
+    ReductionEngine reducer(cache, commandQueue, "../reduction/reduction.cl");
+    ReduceResult checksum;
+    Future multiplied = enqueueAfter(commandQueue, WaitList(), [&](cl_event *event) {
+        return clEnqueueNDRangeKernel(commandQueue, kernel, 2, NULL, global_work_size, NULL, 0, NULL, event);
+    });
+    Future summed = reducer.reduceAsync(outputBuf, (cl_ulong)m * n, REDUCE_FLOAT, REDUCE_SUM, &checksum,
+                                        WaitList(1, multiplied));
+
+    /*Step 11: Map the output (and the inputs for the reference) into host memory.*/
+
+    cl_float* output_hostPtr = mapBuffer<cl_float>(commandQueue, outputBuf, CL_MAP_READ, outputSizeBytes, &status);
+    CHECK_ERROR(status, "clEnqueueMapBuffer");
+    inputA_hostPtr = mapBuffer<cl_float>(commandQueue, inputAbuf, CL_MAP_READ, inputASizeBytes, &status);
+    CHECK_ERROR(status, "clEnqueueMapBuffer");
+    inputB_hostPtr = mapBuffer<cl_float>(commandQueue, inputBbuf, CL_MAP_READ, inputBSizeBytes, &status);
+    CHECK_ERROR(status, "clEnqueueMapBuffer");
 
     prof.startTime();
-    //gemm_ref(inputA_hostPtr, inputB_hostPtr, golden, m, k, n);
+#if CHECK_RESULT
+    /* The reference in row blocks on every host thread */
+    ThreadPool threads;
+    threads.parallelFor(0, m, 16, [&](size_t first, size_t last)
+    {
+        gemm_ref(inputA_hostPtr + first * k, inputB_hostPtr, golden + first * n, last - first, k, n);
+    });
+#endif
     cpuTime = prof.getDurationMS();
-    //printf("cpu gemm reference execution time:%f ms.\n", cpuTime);
+#if CHECK_RESULT
+    printf("cpu gemm reference execution time:%f ms.\n", cpuTime);
+#endif
 
     int failFlg = 0;
+    status = summed.wait();
+    CHECK_ERROR(status, "ReductionEngine::reduceAsync");
+    double expected = 0.0;
+    for(int kk = 0; kk < k; kk++)
+    {
+        double colSum = 0.0, rowSum = 0.0;
+        for(int i = 0; i < m; i++)
+            colSum += inputA_hostPtr[i * k + kk];
+        for(int j = 0; j < n; j++)
+            rowSum += inputB_hostPtr[kk * n + j];
+        expected += colSum * rowSum;
+    }
+    if(fabs(checksum.value - expected) > 1e-3 * fabs(expected))
+    {
+        printf("checksum: gpu %g, cpu %g. Check failed.\n", checksum.value, expected);
+        failFlg = 1;
+    }
+    else
+    {
+        printf("checksum: %g. Check passed.\n", checksum.value);
+    }
 #if CHECK_RESULT
     for(int i = 0; i < width * height; i++)
     {
@@ -585,33 +748,32 @@ int main(int argc, char* argv[])
     }
 #endif
 
+    status = unmapBuffer(commandQueue, outputBuf, output_hostPtr);
+    status |= unmapBuffer(commandQueue, inputAbuf, inputA_hostPtr);
+    status |= unmapBuffer(commandQueue, inputBbuf, inputB_hostPtr);
+    CHECK_ERROR(status, "clEnqueueUnmapMemObject");
+
+    failFlg |= transferBenchmark(context, devices[0], commandQueue) != SUCCESS;
+
     /*Step 12: Clean the resources.*/
     status = clReleaseKernel(kernel);                  //Release kernel.
     status |= clReleaseProgram(program);                //Release the program object.
-    status |= clReleaseMemObject(inputAbuf);            //Release mem object.
-    status |= clReleaseMemObject(inputBbuf);
-    status |= clReleaseMemObject(outputBuf);
-    status |= clReleaseCommandQueue(commandQueue);      //Release  Command queue.
-    status |= clReleaseContext(context);                //Release context.
-    CHECK_ERROR(status, "clReleaseContext");
-
-    if (inputA_hostPtr != NULL)
+    if(fromFiles)                                       //Release the buffers over the files,
     {
-        free(inputA_hostPtr);
-        inputA_hostPtr = NULL;
+        status |= clReleaseMemObject(inputAbuf);
+        status |= clReleaseMemObject(inputBbuf);
     }
-
-    if (inputB_hostPtr != NULL)
+    else                                                //or return mem objects to the pool.
     {
-        free(inputB_hostPtr);
-        inputB_hostPtr = NULL;
-    }
-
-    if (output_hostPtr != NULL)
-    {
-        free(output_hostPtr);
-        output_hostPtr = NULL;
+        status |= pool.release(inputAbuf);
+        status |= pool.release(inputBbuf);
     }
+    status |= pool.release(outputBuf);
+    pool.printStats("buffer pool");
+    pool.trim();
+    status |= clReleaseCommandQueue(commandQueue);      //Release  Command queue.
+    status |= clReleaseContext(context);                //Release context.
+    CHECK_ERROR(status, "clReleaseContext");
 
     if (golden != NULL)
     {
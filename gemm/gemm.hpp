@@ -0,0 +1,74 @@
+#ifndef GEMM_HPP
+#define GEMM_HPP
+
+#include <CL/cl.h>
+#include <string>
+#include "../common/future.hpp"
+#include "../common/program_cache.hpp"
+
+#define GEMM_PROGRAM_FILE "gemm_kernel.cl"
+
+/*
+ * C = A*B for row-major float matrices with gemm_block4x4_F32: A is m x k,
+ * B is k x n, and each work-item computes a 4x4 block of C, so m, k and n
+ * must be multiples of 4.
+ */
+class GemmEngine
+{
+public:
+    GemmEngine(ProgramCache &cache, cl_command_queue queue, const std::string &programFile = GEMM_PROGRAM_FILE)
+        : m_cache(cache), m_queue(queue), m_programFile(programFile), m_kernel(NULL)
+    {
+    }
+
+    ~GemmEngine()
+    {
+        if (m_kernel != NULL)
+            clReleaseKernel(m_kernel);
+    }
+
+    cl_int gemm(cl_mem a, cl_mem b, cl_mem c, cl_uint m, cl_uint k, cl_uint n, cl_event *event = NULL)
+    {
+        cl_int status = CL_SUCCESS;
+        if (m % 4 != 0 || k % 4 != 0 || n % 4 != 0)
+            return CL_INVALID_VALUE;
+        if (m == 0 || n == 0)
+            return CL_SUCCESS;
+        if (m_kernel == NULL)
+        {
+            m_kernel = m_cache.createKernel(m_programFile, "", "gemm_block4x4_F32", &status);
+            if (status != CL_SUCCESS)
+            {
+                m_kernel = NULL;
+                return status;
+            }
+        }
+
+        status = clSetKernelArg(m_kernel, 0, sizeof(cl_mem), &a);
+        status |= clSetKernelArg(m_kernel, 1, sizeof(cl_mem), &b);
+        status |= clSetKernelArg(m_kernel, 2, sizeof(cl_mem), &c);
+        status |= clSetKernelArg(m_kernel, 3, sizeof(cl_uint), &m);
+        status |= clSetKernelArg(m_kernel, 4, sizeof(cl_uint), &k);
+        status |= clSetKernelArg(m_kernel, 5, sizeof(cl_uint), &n);
+        if (status != CL_SUCCESS)
+            return status;
+
+        size_t globalSize[2] = { n / 4, m / 4 };
+        return clEnqueueNDRangeKernel(m_queue, m_kernel, 2, NULL, globalSize, NULL, 0, NULL, event);
+    }
+
+    /* gemm() after the futures in after, without waiting for it */
+    Future gemmAsync(cl_mem a, cl_mem b, cl_mem c, cl_uint m, cl_uint k, cl_uint n,
+                     const WaitList &after = WaitList())
+    {
+        return enqueueAfter(m_queue, after, [&](cl_event *event) { return gemm(a, b, c, m, k, n, event); });
+    }
+
+private:
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::string m_programFile;
+    cl_kernel m_kernel;
+};
+
+#endif
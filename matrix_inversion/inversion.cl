@@ -1,20 +1,47 @@
+/*
+ * Gauss-Jordan elimination without pivoting, one launch of inversion per
+ * pivot row index. Work-item idx owns row idx and subtracts the multiple of
+ * the pivot row that clears column index. The pivot row is not scaled, so
+ * nothing a work-item reads is written in the same launch and the launches
+ * need no host synchronization between them; inversion_scale divides by the
+ * remaining diagonal at the end.
+ */
+__kernel void inversion_identity(__global float *eyeResMat, int size) {
+
+    int col = get_global_id(0);
+    int row = get_global_id(1);
+
+    eyeResMat[size * row + col] = row == col ? 1.0f : 0.0f;
+}
+
 __kernel void inversion(__global float *mat,
                         __global float *eyeResMat,
                         int size,
                         int index) {
 
     int idx = get_global_id(0);
-    float scale = 1.0 / mat[size * index + index];
-
-    mat[size * index + idx] *= scale;
-    eyeResMat[size * index + idx] *= scale;
+    if (idx == index) {
+        return;
+    }
 
-    if (idx != index) {
-        float currentScale = mat[size * idx + index];
+    float currentScale = mat[size * idx + index] / mat[size * index + index];
 
-        for (int j = 0; j < size; ++j) {
-            mat[size * idx + j] = mat[size * idx + j] - currentScale * mat[size * index + j];
-            eyeResMat[size * idx + j] = eyeResMat[size * idx + j] - currentScale * eyeResMat[size * index + j];
-        }
+    /* Columns left of the pivot are already zero in the pivot row */
+    for (int j = index; j < size; ++j) {
+        mat[size * idx + j] -= currentScale * mat[size * index + j];
     }
+    for (int j = 0; j < size; ++j) {
+        eyeResMat[size * idx + j] -= currentScale * eyeResMat[size * index + j];
+    }
+}
+
+/* mat is diagonal now; its diagonal is only read here */
+__kernel void inversion_scale(__global const float *mat,
+                              __global float *eyeResMat,
+                              int size) {
+
+    int col = get_global_id(0);
+    int row = get_global_id(1);
+
+    eyeResMat[size * row + col] /= mat[size * row + row];
 }
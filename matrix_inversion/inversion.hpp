@@ -0,0 +1,119 @@
+#ifndef INVERSION_HPP
+#define INVERSION_HPP
+
+#include <CL/cl.h>
+#include <string>
+#include "../common/command_recorder.hpp"
+#include "../common/future.hpp"
+#include "../common/program_cache.hpp"
+
+#define INVERSION_PROGRAM_FILE "inversion.cl"
+
+/*
+ * Inverts an n x n row-major float matrix with the Gauss-Jordan kernels of
+ * inversion.cl: identity, n elimination launches, final scaling. The
+ * launches are ordered by the in-order queue alone, so the host only
+ * waits for the result. There is no pivoting; a zero pivot gives inf/nan.
+ * record() captures the launches for CommandRecorder replay.
+ */
+class InversionEngine
+{
+public:
+    InversionEngine(ProgramCache &cache, cl_command_queue queue,
+                    const std::string &programFile = INVERSION_PROGRAM_FILE)
+        : m_cache(cache), m_queue(queue), m_programFile(programFile)
+    {
+        for (int i = 0; i < KERNELS; i++)
+            m_kernels[i] = NULL;
+    }
+
+    ~InversionEngine()
+    {
+        for (int i = 0; i < KERNELS; i++)
+        {
+            if (m_kernels[i] != NULL)
+                clReleaseKernel(m_kernels[i]);
+        }
+    }
+
+    /* a is overwritten with a diagonal matrix, inverse receives A^-1 */
+    cl_int invert(cl_mem a, cl_mem inverse, cl_uint n, cl_event *event = NULL)
+    {
+        QueueLauncher queue(m_queue);
+        return encode(queue, a, inverse, n, event);
+    }
+
+    /* Captures the n + 2 launches of invert() for CommandRecorder::replay() */
+    cl_int record(CommandRecorder &recorder, cl_mem a, cl_mem inverse, cl_uint n)
+    {
+        return encode(recorder, a, inverse, n, NULL);
+    }
+
+    /* invert() after the futures in after, without waiting for it */
+    Future invertAsync(cl_mem a, cl_mem inverse, cl_uint n, const WaitList &after = WaitList())
+    {
+        return enqueueAfter(m_queue, after, [&](cl_event *event) { return invert(a, inverse, n, event); });
+    }
+
+private:
+    enum
+    {
+        IDENTITY,
+        ELIMINATE,
+        SCALE,
+        KERNELS
+    };
+
+    cl_int prepare()
+    {
+        static const char *names[KERNELS] = { "inversion_identity", "inversion", "inversion_scale" };
+        cl_int status = CL_SUCCESS;
+        for (int i = 0; i < KERNELS && status == CL_SUCCESS; i++)
+        {
+            if (m_kernels[i] == NULL)
+                m_kernels[i] = m_cache.createKernel(m_programFile, "", names[i], &status);
+        }
+        return status;
+    }
+
+    template <typename Target>
+    cl_int encode(Target &target, cl_mem a, cl_mem inverse, cl_uint n, cl_event *event)
+    {
+        if (n == 0)
+            return CL_SUCCESS;
+        cl_int status = prepare();
+        if (status != CL_SUCCESS)
+            return status;
+
+        cl_int size = (cl_int)n;
+        size_t rows = n, square[2] = { n, n };
+        status = target.setArg(m_kernels[IDENTITY], 0, sizeof(cl_mem), &inverse);
+        status |= target.setArg(m_kernels[IDENTITY], 1, sizeof(cl_int), &size);
+        status |= target.setArg(m_kernels[ELIMINATE], 0, sizeof(cl_mem), &a);
+        status |= target.setArg(m_kernels[ELIMINATE], 1, sizeof(cl_mem), &inverse);
+        status |= target.setArg(m_kernels[ELIMINATE], 2, sizeof(cl_int), &size);
+        status |= target.setArg(m_kernels[SCALE], 0, sizeof(cl_mem), &a);
+        status |= target.setArg(m_kernels[SCALE], 1, sizeof(cl_mem), &inverse);
+        status |= target.setArg(m_kernels[SCALE], 2, sizeof(cl_int), &size);
+        if (status != CL_SUCCESS)
+            return status;
+
+        status = target.launch(m_kernels[IDENTITY], 2, square, NULL, NULL);
+        for (cl_int index = 0; status == CL_SUCCESS && index < size; index++)
+        {
+            status = target.setArg(m_kernels[ELIMINATE], 3, sizeof(cl_int), &index);
+            if (status == CL_SUCCESS)
+                status = target.launch(m_kernels[ELIMINATE], 1, &rows, NULL, NULL);
+        }
+        if (status == CL_SUCCESS)
+            status = target.launch(m_kernels[SCALE], 2, square, NULL, event);
+        return status;
+    }
+
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::string m_programFile;
+    cl_kernel m_kernels[KERNELS];
+};
+
+#endif
@@ -4,20 +4,25 @@
 #include <stdlib.h>
 #include <iostream>
 #include <time.h>
+#include <chrono>
 // OpenCL includes
 //#include <OpenCL/cl.h>
 #include <CL/cl.h>
 #include "Matrix.hpp"
+#include "inversion.hpp"
+#include "../common/command_recorder.hpp"
+#include "../common/host_memory.hpp"
+#include "../matvec/gemv.hpp"
+#include "../reduction/reduction.hpp"
 
 // Constants, globals
 double NANOSECOND_SEC = 10E9;
+const int REPLAY_RUNS = 20;
 
 // namespace
 using namespace std;
 
 // Signatures
-char *readSource(const char *sourceFilename);
-
 double *convertValArrayToDouble(valarray<double> array);
 
 double **MatrixTo2DArray(Matrix mat);
@@ -30,34 +35,51 @@ void printResult(int matrixDimension, double cron, Matrix &lRes);
 
 Matrix multiplyMatrix(const Matrix &iMat1, const Matrix &iMat2);
 
+int replayOverhead(cl_context context, cl_command_queue queue, InversionEngine &inverter, cl_mem d_a,
+                   const double *expected, int size);
+
 int main(int argc, char **argv) {
     srand((unsigned) time(nullptr));
 
     printf("Running Matrix Inversion program\n\n");
 
-    clock_t start, end;
-	double total;
+    // main <dimension> inverts a random matrix, main <matrix.arr> the square float32 matrix of an
+    // array file, which the device reads in place. The file's matrix must not need pivoting; make
+    // one with bitonicsort/CPUtest/randomNumberGenerator matrix.arr <n> <n> dominant
     int matrixDimension = 5;
-    if (argc == 2) {
-        matrixDimension = atoi(argv[1]);
+    ArrayFile matrixFile;
+    bool fromFile = argc == 2 && isArrayFileArgument(argv[1]);
+    if (argc == 2 && !fromFile) {
+        size_t dimension;
+        if (!parseArrayCount(argv[1], &dimension) || dimension > 65536) {
+            printf("%s: neither a matrix dimension nor an array file\n", argv[1]);
+            exit(-1);
+        }
+        matrixDimension = (int) dimension;
+    }
+    if (fromFile) {
+        if (!matrixFile.open(argv[1])) {
+            printf("%s: %s\n", argv[1], matrixFile.error());
+            exit(-1);
+        }
+        if (!matrixFile.expect(argv[1], ARRAY_FLOAT32, 2)) {
+            exit(-1);
+        }
+        if (matrixFile.shape(0) != matrixFile.shape(1)) {
+            printf("%s: the matrix is not square\n", argv[1]);
+            exit(-1);
+        }
+        matrixDimension = (int) matrixFile.shape(0);
     }
 
     size_t datasize = sizeof(float) * matrixDimension * matrixDimension;
 
-    MatrixRandom randomMatrix(matrixDimension, matrixDimension);
+    MatrixRandom randomMatrix(fromFile ? 0 : matrixDimension, fromFile ? 0 : matrixDimension);
 
 /// Uncomment if you want to compute matrix error
 //    const Matrix &copyRandomMatrix(randomMatrix);
 
-/// Can't use 2D array like in tp4_openacc so we create a contiguous 1D array
-    double *newMat = convertValArrayToDouble(randomMatrix.getDataArray());
-    double *eyeResMat = convertValArrayToDouble(MatrixIdentity(randomMatrix.rows()).getDataArray());
-    int size = randomMatrix.rows();
-
-    if (newMat == nullptr || eyeResMat == nullptr) {
-        perror("malloc");
-        exit(-1);
-    }
+    int size = matrixDimension;
 
     cl_int status;  // use as return value for most OpenCL functions
     cl_uint numPlatforms = 0;
@@ -170,148 +192,121 @@ int main(int argc, char **argv) {
     // want to execute on
     cl_command_queue cmdQueue;
     const cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
-    cmdQueue = clCreateCommandQueue(context, devices[0], properties, &status);
+    cmdQueue = clCreateCommandQueueWithProperties(context, devices[0], properties, &status);
     if (status != CL_SUCCESS || cmdQueue == nullptr) {
         printf("clCreateCommandQueue failed\n");
         exit(-1);
     }
 
-    cl_mem d_newMat;       /// Original matrix will transform to identity matrix after inversion
-    cl_mem d_eyeResMat;    /// Identity Matrix will transform to inverse matrix after inversion
+    cl_mem d_newMat;       /// Original matrix, reduced to a diagonal matrix by the inversion
+    cl_mem d_eyeResMat;    /// Receives the inverse matrix
 
-    // Create a buffer object (d_newMat) that contains the data from the host ptr newMat
-    d_newMat = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, datasize, newMat, &status);
+    // Host-accessible buffers (CL_MEM_ALLOC_HOST_PTR): the matrices are written and read through
+    // mappings, so on devices sharing host memory nothing is copied. A matrix from a file is a
+    // buffer over the mapped file; the elimination writes to this process's copy of its pages.
+    if (fromFile) {
+        d_newMat = createArrayBuffer(context, CL_MEM_READ_WRITE, matrixFile, &status);
+    } else {
+        d_newMat = createHostBuffer(context, CL_MEM_READ_WRITE, datasize, nullptr, &status);
+    }
     if (status != CL_SUCCESS || d_newMat == nullptr) {
         printf("clCreateBuffer failed\n");
         exit(-1);
     }
-
-    // Create a buffer object (d_eyeResMat) that contains the data from the host ptr eyeResMat
-    d_eyeResMat = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, datasize, eyeResMat, &status);
+    d_eyeResMat = createHostBuffer(context, CL_MEM_READ_WRITE, datasize, nullptr, &status);
     if (status != CL_SUCCESS || d_eyeResMat == nullptr) {
         printf("clCreateBuffer failed\n");
         exit(-1);
     }
 
-    // Create a program. The 'source' string is the code from the
-    // inversion.cl file.
-    cl_program program;
-    char *source;
-    const char *sourceFile = "inversion.cl";
-    source = readSource(sourceFile);
+    // The kernels work in float. There is no pivoting, so the random matrix is made
+    // diagonally dominant to keep the elimination stable; a matrix from a file must not
+    // need pivoting either.
+    if (!fromFile) {
+        float *newMat = mapBuffer<float>(cmdQueue, d_newMat, CL_MAP_WRITE_INVALIDATE_REGION, datasize, &status);
+        if (status != CL_SUCCESS || newMat == nullptr) {
+            printf("clEnqueueMapBuffer failed\n");
+            exit(-1);
+        }
+        const valarray<double> &data = randomMatrix.getDataArray();
+        for (int i = 0; i < size * size; i++) {
+            newMat[i] = (float) data[i] + (i / size == i % size ? (float) size : 0.0f);
+        }
+        status = unmapBuffer(cmdQueue, d_newMat, newMat);
+        if (status != CL_SUCCESS) {
+            printf("clEnqueueUnmapMemObject failed\n");
+            exit(-1);
+        }
+    }
 
-/// Uncomment to print kernel code
-//    cout << source << endl;
-    program = clCreateProgramWithSource(context, 1, (const char **) &source,
-                                        nullptr, &status);
+    // Right-hand side b and the buffers of the check: a copy of A, x = A^-1 b, r = A x - b
+    size_t vectorsize = sizeof(float) * size;
+    cl_mem d_a = clCreateBuffer(context, CL_MEM_READ_WRITE, datasize, nullptr, &status);
+    cl_mem d_b = createHostBuffer(context, CL_MEM_READ_WRITE, vectorsize, nullptr, &status);
+    cl_mem d_x = clCreateBuffer(context, CL_MEM_READ_WRITE, vectorsize, nullptr, &status);
+    cl_mem d_r = clCreateBuffer(context, CL_MEM_READ_WRITE, vectorsize, nullptr, &status);
     if (status != CL_SUCCESS) {
-        printf("clCreateProgramWithSource failed\n");
+        printf("clCreateBuffer failed\n");
         exit(-1);
     }
-
-    cl_int buildErr;
-    // Build (compile & link) the program for the devices.
-    // Save the return value in 'buildErr' (the following
-    // code will print any compilation errors to the screen)
-    buildErr = clBuildProgram(program, numDevices, devices, nullptr, nullptr, nullptr);
-
-    // If there are build errors, print them to the screen
-    if (buildErr != CL_SUCCESS) {
-        printf("Program failed to build.\n");
-        cl_build_status buildStatus;
-        for (unsigned int i = 0; i < numDevices; i++) {
-            clGetProgramBuildInfo(program, devices[i], CL_PROGRAM_BUILD_STATUS,
-                                  sizeof(cl_build_status), &buildStatus, nullptr);
-            if (buildStatus == CL_SUCCESS) {
-                continue;
-            }
-
-            char *buildLog;
-            size_t buildLogSize;
-            clGetProgramBuildInfo(program, devices[i], CL_PROGRAM_BUILD_LOG,
-                                  0, nullptr, &buildLogSize);
-            buildLog = (char *) malloc(buildLogSize);
-            if (buildLog == nullptr) {
-                perror("malloc");
-                exit(-1);
-            }
-            clGetProgramBuildInfo(program, devices[i], CL_PROGRAM_BUILD_LOG,
-                                  buildLogSize, buildLog, nullptr);
-            buildLog[buildLogSize - 1] = '\0';
-            printf("Device %u Build Log:\n%s\n", i, buildLog);
-            free(buildLog);
-        }
-        exit(0);
-    } else {
-        printf("No build errors\n");
+    float *b = mapBuffer<float>(cmdQueue, d_b, CL_MAP_WRITE_INVALIDATE_REGION, vectorsize, &status);
+    if (status != CL_SUCCESS) {
+        printf("clEnqueueMapBuffer failed\n");
+        exit(-1);
     }
-
-    cl_kernel kernel;
-
-    // Create a kernel from the vector addition function (named "inversion")
-    kernel = clCreateKernel(program, "inversion", &status);
+    for (int i = 0; i < size; i++) {
+        b[i] = (float) rand() / RAND_MAX - 0.5f;
+    }
+    unmapBuffer(cmdQueue, d_b, b);
+
+    ProgramCache cache(context, devices[0]);
+    InversionEngine inverter(cache, cmdQueue);
+    GemvEngine gemv(cache, cmdQueue, "../matvec/gemv.cl");
+    ReductionEngine reducer(cache, cmdQueue, "../reduction/reduction.cl");
+
+    // Build the programs before timing: a 1x1 run on the scratch buffers, all overwritten below
+    status = inverter.invert(d_a, d_eyeResMat, 1);
+    status |= gemv.gemv(GEMV_ROW_MAJOR, 1, 1, 1.0f, d_a, 1, d_x, 0.0f, d_r);
+    double residual = 0.0, bNorm = 0.0;
+    status |= reducer.mapReduce(d_b, nullptr, size, REDUCE_FLOAT, MAPREDUCE_LINF, &bNorm);
     if (status != CL_SUCCESS) {
-        printf("clCreateKernel failed\n");
+        printf("Building the kernels failed\n");
         exit(-1);
     }
 
-    // Associate the input and output buffers with the kernel
-    status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_newMat);
-    status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_eyeResMat);
-    status |= clSetKernelArg(kernel, 2, sizeof(cl_int), &size);
+    // Invert, solve and check in one chain of futures; the host waits once, at the end.
+    // The copies run on the same in-order queue, so they need no futures.
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    status = clEnqueueCopyBuffer(cmdQueue, d_newMat, d_a, 0, 0, datasize, 0, nullptr, nullptr);
+    status |= clEnqueueCopyBuffer(cmdQueue, d_b, d_r, 0, 0, vectorsize, 0, nullptr, nullptr);
     if (status != CL_SUCCESS) {
-        printf("clSetKernelArg failed\n");
+        printf("clEnqueueCopyBuffer failed\n");
         exit(-1);
     }
-
-    // Define an index space (global work size) of threads for execution.
-    // A workgroup size (local work size) is not required, but can be used.
-    size_t globalWorkSize[1];  // There are ELEMENTS threads
-    globalWorkSize[0] = matrixDimension;
-
-    cl_event event;
-
-    double accTimeIteration = 0;  /// Accumulate time
-    for (int i = 0; i < matrixDimension; i++) {
-        /// Iteration for each row that can't be parallelized
-        status |= clSetKernelArg(kernel, 3, sizeof(cl_int), &i);
-		start = clock();
-        status = clEnqueueNDRangeKernel(cmdQueue, kernel, 1, nullptr, globalWorkSize,
-                                        nullptr, 0, nullptr, &event);
-
-        /// EVENT PROFILING and TIME MEASUREMENT ///
-        if (status != CL_SUCCESS) {
-            printf("clEnqueueNDRangeKernel failed\n");
-            exit(-1);
-        }
-
-        clWaitForEvents(1, &event); /// wait for kernel to finish
-        clFinish(cmdQueue);
-		end = clock();
-        /// Get kernel execution time for current iteration
-        cl_ulong cronStart, cronEnd; // cronStart and cronEnd are measured in nanosecond so later we divide by 10E9 to get a result in second.
-        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &cronStart, nullptr);
-        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &cronEnd, nullptr);
-
-        /// accumulate time for each kernel execution
-        double execTimeSec = (cronEnd - cronStart) / NANOSECOND_SEC;
-        //accTimeIteration += execTimeSec;
-        total += (double)(end - start);		
+    Future inverted = inverter.invertAsync(d_newMat, d_eyeResMat, size);
+    Future solved = gemv.gemvAsync(GEMV_ROW_MAJOR, size, size, 1.0f, d_eyeResMat, size, d_b, 0.0f, d_x,
+                                   WaitList(1, inverted));
+    Future checked = gemv.gemvAsync(GEMV_ROW_MAJOR, size, size, 1.0f, d_a, size, d_x, -1.0f, d_r,
+                                    WaitList(1, solved));
+    Future done = reducer.mapReduceAsync(d_r, nullptr, size, REDUCE_FLOAT, MAPREDUCE_LINF, &residual,
+                                         WaitList(1, checked));
+    chrono::steady_clock::time_point enqueued = chrono::steady_clock::now();
+    status = done.wait();
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    if (status != CL_SUCCESS) {
+        printf("Inversion failed: %d\n", status);
+        exit(-1);
     }
 
-/// Don't need to gather newMat (now an identity matrix)
-/// Uncomment if you want to verify original matrix which become an identity matrix after inversion
-    //  clEnqueueReadBuffer(cmdQueue, d_newMat, CL_TRUE, 0, datasize, newMat, 0, nullptr, &event);
-
-    // Read the inversed matrix buffer (d_eyeResMat). Need to wait for kernel to end execution before reading matrix; so add &event signal.
-    clEnqueueReadBuffer(cmdQueue, d_eyeResMat, CL_TRUE, 0, datasize, eyeResMat, 0, nullptr, &event);
-
-/// Useful if you want to use pinned memory (fast and with PCIe connection) as the matrix stay on host.
-//    void *newMatInput, *eyeResMatOutput;
-//    newMatInput = clEnqueueMapBuffer(cmdQueue, d_newMat, CL_FALSE, CL_MAP_READ, 0, datasize, 0, nullptr, nullptr,&status);
-//    eyeResMatOutput = clEnqueueMapBuffer(cmdQueue, d_eyeResMat, CL_FALSE, CL_MAP_READ, 0, datasize, 0, nullptr, nullptr,&status);
-//    clEnqueueUnmapMemObject(cmdQueue, d_newMat, newMatInput, 0, nullptr, nullptr);
-//    clEnqueueUnmapMemObject(cmdQueue, d_eyeResMat, eyeResMatOutput, 0, nullptr, nullptr);
+    // Map the inversed matrix buffer (d_eyeResMat); the queue is idle now.
+    float *eyeMat = mapBuffer<float>(cmdQueue, d_eyeResMat, CL_MAP_READ, datasize, &status);
+    if (status != CL_SUCCESS) {
+        printf("clEnqueueMapBuffer failed\n");
+        exit(-1);
+    }
+    double *eyeResMat = new double[size * size];
+    copy(eyeMat, eyeMat + size * size, eyeResMat);
+    unmapBuffer(cmdQueue, d_eyeResMat, eyeMat);
 
     cout << endl << " --- OPENCL execution --- " << endl;
 
@@ -321,25 +316,30 @@ int main(int argc, char **argv) {
 //    Matrix multMatrix = multiplyMatrix(resMatrix, copyRandomMatrix);
 //    printResult(size, accTimeIteration, multMatrix);
 
-/// Comment line below if you want to print matrix error
-    //printResultMin(size, accTimeIteration);
+    double enqueueMs = chrono::duration<double, milli>(enqueued - start).count();
+    double totalMs = chrono::duration<double, milli>(end - start).count();
+    int failed = !(residual <= 1e-4 * bNorm * size);
 	printf( "Matrix dimension : %d \n",size);
-	printf( "Total execution time : %f ms\n", total / CLOCKS_PER_SEC *1000);
+	printf( "Total execution time : %f ms (enqueued in %f ms, one wait)\n", totalMs, enqueueMs);
+    printf( "Residual |A x - b| / |b| : %g, %s\n", residual / bNorm, failed ? "Check failed." : "Check passed.");
 /// Uncomment if you want to print inverse matrix
-    //cout << endl << "Inversed matrix: " << endl << arrayToMatrix(newMat, size).str() << endl;
+    //cout << endl << "Inversed matrix: " << endl << arrayToMatrix(eyeResMat, size).str() << endl;
+
+    failed |= replayOverhead(context, cmdQueue, inverter, d_a, eyeResMat, size);
 
-    clReleaseKernel(kernel);
-    clReleaseProgram(program);
     clReleaseCommandQueue(cmdQueue);
     clReleaseMemObject(d_newMat);
     clReleaseMemObject(d_eyeResMat);
+    clReleaseMemObject(d_a);
+    clReleaseMemObject(d_b);
+    clReleaseMemObject(d_x);
+    clReleaseMemObject(d_r);
     clReleaseContext(context);
 
-    free(newMat);
-    free(eyeResMat);
-    free(source);
+    delete[] eyeResMat;
     free(platforms);
     free(devices);
+    return failed;
 }
 
 Matrix arrayToMatrix(double *array, int size) {
@@ -352,53 +352,76 @@ Matrix arrayToMatrix(double *array, int size) {
     return resMatrix;
 }
 
-char *readSource(const char *sourceFilename) {
-
-    FILE *fp;
-    int err;
-    int size;
-
-    char *source;
-
-    fp = fopen(sourceFilename, "rb");
-    if (fp == nullptr) {
-        printf("Could not open kernel file: %s\n", sourceFilename);
-        exit(-1);
+/**
+ * Host cost per launch of the size + 2 inversion launches: InversionEngine::invert() sets the
+ * pivot index before every launch, a CommandRecorder replay enqueues the captured sequence.
+ * Only the enqueue calls are timed. The replayed inverse of d_a must match expected exactly.
+ * @return 1 on failure
+ */
+int replayOverhead(cl_context context, cl_command_queue queue, InversionEngine &inverter, cl_mem d_a,
+                   const double *expected, int size) {
+    size_t datasize = sizeof(float) * size * size;
+    cl_int status;
+    cl_mem d_work = clCreateBuffer(context, CL_MEM_READ_WRITE, datasize, nullptr, &status);
+    cl_mem d_inv = clCreateBuffer(context, CL_MEM_READ_WRITE, datasize, nullptr, &status);
+    if (status != CL_SUCCESS) {
+        printf("clCreateBuffer failed\n");
+        return 1;
     }
 
-    err = fseek(fp, 0, SEEK_END);
-    if (err != 0) {
-        printf("Error seeking to end of file\n");
-        exit(-1);
+    // The matrix goes diagonal after the first run; later runs still do the same launches
+    status = clEnqueueCopyBuffer(queue, d_a, d_work, 0, 0, datasize, 0, nullptr, nullptr);
+    clFinish(queue);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < REPLAY_RUNS && status == CL_SUCCESS; i++) {
+        status = inverter.invert(d_work, d_inv, size);
     }
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    clFinish(queue);
+    double direct = chrono::duration<double, micro>(end - start).count() / REPLAY_RUNS;
 
-    size = ftell(fp);
-    if (size < 0) {
-        printf("Error getting file position\n");
-        exit(-1);
+    CommandRecorder recorder(queue);
+    if (status == CL_SUCCESS) {
+        status = inverter.record(recorder, d_work, d_inv, size);
     }
-
-    err = fseek(fp, 0, SEEK_SET);
-    if (err != 0) {
-        printf("Error seeking to start of file\n");
-        exit(-1);
+    if (status == CL_SUCCESS) {
+        status = recorder.finalize();
     }
-
-    source = (char *) malloc(size + 1);
-    if (source == nullptr) {
-        printf("Error allocating %d bytes for the program source\n", size + 1);
-        exit(-1);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < REPLAY_RUNS && status == CL_SUCCESS; i++) {
+        status = recorder.replay();
     }
-
-    err = fread(source, 1, size, fp);
-    if (err != size) {
-        printf("only read %d bytes\n", err);
-        exit(0);
+    end = chrono::steady_clock::now();
+    clFinish(queue);
+    double replayed = chrono::duration<double, micro>(end - start).count() / REPLAY_RUNS;
+
+    // Same kernels on the same input: the replay gives the inverse bit for bit
+    int mismatches = size * size;
+    if (status == CL_SUCCESS) {
+        status = clEnqueueCopyBuffer(queue, d_a, d_work, 0, 0, datasize, 0, nullptr, nullptr);
     }
-
-    source[size] = '\0';
-
-    return source;
+    if (status == CL_SUCCESS) {
+        status = recorder.replay();
+    }
+    float *inverse = status == CL_SUCCESS ? mapBuffer<float>(queue, d_inv, CL_MAP_READ, datasize, &status) : nullptr;
+    if (inverse != nullptr) {
+        mismatches = 0;
+        for (int i = 0; i < size * size; i++) {
+            mismatches += inverse[i] != (float) expected[i];
+        }
+        unmapBuffer(queue, d_inv, inverse);
+        clFinish(queue);
+    }
+    clReleaseMemObject(d_work);
+    clReleaseMemObject(d_inv);
+
+    size_t launches = recorder.launches() > 0 ? recorder.launches() : 1;
+    int failed = status != CL_SUCCESS || mismatches != 0;
+    printf("Launch overhead, %u launches : setArg+enqueue %.3f us, %s %.3f us per launch (%u kernel objects), "
+           "%d mismatches, %s\n", (unsigned) recorder.launches(), direct / launches,
+           recorder.usesCommandBuffer() ? "command buffer" : "pre-bound replay", replayed / launches,
+           (unsigned) recorder.kernels(), mismatches, failed ? "Check failed." : "Check passed.");
+    return failed;
 }
 
 double *convertValArrayToDouble(valarray<double> array) {
@@ -1,57 +1,59 @@
-__kernel void matrix_mult(__global float4 *a_mat, 
-      __global float4 *b_mat, __global float *c_mat) {
+#ifndef TILE
+#define TILE 16
+#endif
 
-   float sum;
+/* C = A * B with B already transposed. A work-group computes a TILE x TILE
+   block of C: each step stages TILE float4 columns of TILE rows of A and
+   of B^T in local memory, so every loaded vector is used TILE times. The
+   matrix dimension must be a multiple of 4*TILE (the host pads it). */
+__kernel void matrix_mult(__global float4 *a_mat,
+      __global float4 *b_mat, __global float *c_mat, uint dim) {
 
-   int num_rows = get_global_size(0);
-   int vectors_per_row = num_rows/4;
-   int start = get_global_id(0) * vectors_per_row;
-   a_mat += start;
-   c_mat += start*4;
+   __local float4 l_a[TILE][TILE];
+   __local float4 l_b[TILE][TILE + 1];
 
-   for(int i=0; i<num_rows; i++) {
-      sum = 0.0f;
-      for(int j=0; j<vectors_per_row; j++) {
-         sum += dot(a_mat[j], b_mat[i * vectors_per_row + j]);
-      }
-      c_mat[i] = sum;
-   }   
-}
+   int lx = get_local_id(0);
+   int ly = get_local_id(1);
+   int col = get_global_id(0);
+   int row = get_global_id(1);
+   int b_row = get_group_id(0) * TILE + ly;
+   int vectors_per_row = dim/4;
+   float sum = 0.0f;
 
-inline void on_diagonal_transpose(int row_size, 
-   __local float4 *l_mat, __global float4 *src) {
+   for(int t=0; t<vectors_per_row; t+=TILE) {
+      l_a[ly][lx] = a_mat[row * vectors_per_row + t + lx];
+      l_b[ly][lx] = b_mat[b_row * vectors_per_row + t + lx];
+      barrier(CLK_LOCAL_MEM_FENCE);
 
-   /* Read 4x4 block from global memory to local memory */
-   l_mat[0] = src[0];
-   l_mat[1] = src[row_size];
-   l_mat[2] = src[2*row_size];
-   l_mat[3] = src[3*row_size];
-
-   /* Write back to global memory in transposed order */
-   src[0] = 
-         (float4)(l_mat[0].x, l_mat[1].x, l_mat[2].x, l_mat[3].x);
-   src[row_size] = 
-         (float4)(l_mat[0].y, l_mat[1].y, l_mat[2].y, l_mat[3].y);
-   src[2*row_size] = 
-         (float4)(l_mat[0].z, l_mat[1].z, l_mat[2].z, l_mat[3].z);
-   src[3*row_size] = 
-         (float4)(l_mat[0].w, l_mat[1].w, l_mat[2].w, l_mat[3].w);
+      for(int k=0; k<TILE; k++) {
+         sum += dot(l_a[ly][k], l_b[lx][k]);
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+   c_mat[row * dim + col] = sum;
 }
 
-__kernel void transpose(__global float4 *g_mat, 
+/* Work-item k transposes block (row, col), row <= col, of the upper
+   triangle of 4x4 blocks. Blocks are numbered from the bottom row up, so
+   rows have 1, 2, 3, ... blocks and the row follows from k with one
+   well-conditioned square root. l_mat holds 8 float4 per work-item. */
+__kernel void transpose(__global float4 *g_mat,
    __local float4 *l_mat, uint size) {
 
    __global float4 *src, *dst;
+   uint k = get_global_id(0);
 
-   /* Determine row and column location */
-   int col = get_global_id(0);
-   int row = 0;
-   while(col >= size) {
-      col -= size--;
-      row++;
-   }
-   col += row;
-   size += row;
+   if(k >= size * (size + 1) / 2)
+      return;
+
+   /* r is the largest integer with r(r+1)/2 <= k; fix float rounding */
+   uint r = (uint)((sqrt(8.0f * k + 1.0f) - 1.0f) / 2.0f);
+   if(r * (r + 1) / 2 > k)
+      r--;
+   if((r + 1) * (r + 2) / 2 <= k)
+      r++;
+   uint row = size - 1 - r;
+   uint col = row + k - r * (r + 1) / 2;
 
    /* Read source block into local memory */
    src = g_mat + row * size * 4 + col;
@@ -63,13 +65,13 @@ __kernel void transpose(__global float4 *g_mat,
 
    /* Process block on diagonal */
    if(row == col) {
-      src[0] = 
+      src[0] =
          (float4)(l_mat[0].x, l_mat[1].x, l_mat[2].x, l_mat[3].x);
-      src[size] = 
+      src[size] =
          (float4)(l_mat[0].y, l_mat[1].y, l_mat[2].y, l_mat[3].y);
-      src[2*size] = 
+      src[2*size] =
          (float4)(l_mat[0].z, l_mat[1].z, l_mat[2].z, l_mat[3].z);
-      src[3*size] = 
+      src[3*size] =
          (float4)(l_mat[0].w, l_mat[1].w, l_mat[2].w, l_mat[3].w);
    }
    /* Process block off diagonal */
@@ -82,23 +84,23 @@ __kernel void transpose(__global float4 *g_mat,
       l_mat[7] = dst[3*size];
 
       /* Set elements of destination block */
-      dst[0] = 
+      dst[0] =
          (float4)(l_mat[0].x, l_mat[1].x, l_mat[2].x, l_mat[3].x);
-      dst[size] = 
+      dst[size] =
          (float4)(l_mat[0].y, l_mat[1].y, l_mat[2].y, l_mat[3].y);
-      dst[2*size] = 
+      dst[2*size] =
          (float4)(l_mat[0].z, l_mat[1].z, l_mat[2].z, l_mat[3].z);
-      dst[3*size] = 
+      dst[3*size] =
          (float4)(l_mat[0].w, l_mat[1].w, l_mat[2].w, l_mat[3].w);
 
       /* Set elements of source block */
-      src[0] = 
+      src[0] =
          (float4)(l_mat[4].x, l_mat[5].x, l_mat[6].x, l_mat[7].x);
-      src[size] = 
+      src[size] =
          (float4)(l_mat[4].y, l_mat[5].y, l_mat[6].y, l_mat[7].y);
-      src[2*size] = 
+      src[2*size] =
          (float4)(l_mat[4].z, l_mat[5].z, l_mat[6].z, l_mat[7].z);
-      src[3*size] = 
+      src[3*size] =
          (float4)(l_mat[4].w, l_mat[5].w, l_mat[6].w, l_mat[7].w);
    }
 }
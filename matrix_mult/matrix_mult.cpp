@@ -3,7 +3,11 @@
 #define TRANSPOSE_FUNC "transpose"
 #define MULT_FUNC "matrix_mult"
 
-#define MATRIX_DIM 32
+#define MATRIX_DIM 1024
+#define TILE 16
+#define TRANSPOSE_LOCAL_SIZE 64
+#define FULL_CHECK_DIM 512
+#define SAMPLE_CHECKS 4096
 
 #include <math.h>
 #include <stdio.h>
@@ -16,6 +20,7 @@
 #else
 #include <CL/cl.h>
 #endif
+#include "../common/host_memory.hpp"
 
 /* Find a GPU or CPU associated with the first available platform */
 cl_device_id create_device() {
@@ -45,7 +50,8 @@ cl_device_id create_device() {
 }
 
 /* Create program from a file and compile it */
-cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename) {
+cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename,
+      const char* options) {
 
    cl_program program;
    FILE *program_handle;
@@ -77,7 +83,7 @@ cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename)
    free(program_buffer);
 
    /* Build program */
-   err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+   err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
    if(err < 0) {
 
       /* Find size of log and print to std output */
@@ -94,7 +100,30 @@ cl_program build_program(cl_context ctx, cl_device_id dev, const char* filename)
    return program;
 }
 
-int main() {
+double event_ms(cl_event event) {
+
+   cl_ulong start, end;
+   clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,
+         sizeof(start), &start, NULL);
+   clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,
+         sizeof(end), &end, NULL);
+   return (end - start) * 1e-6;
+}
+
+/* A[i][k] * B[k][j] summed in double */
+double reference(const float *a_mat, const float *b_mat, size_t dim,
+      size_t i, size_t j) {
+
+   double sum = 0.0;
+   for(size_t k=0; k<dim; k++) {
+      sum += (double)a_mat[i*dim + k] * b_mat[k*dim + j];
+   }
+   return sum;
+}
+
+/* Usage: matrix_mult [N] (default 1024). The matrices are stored padded
+   to a multiple of 4*TILE; the padding is zero and does not change C. */
+int main(int argc, char *argv[]) {
 
    /* Host/device data structures */
    cl_device_id device;
@@ -102,35 +131,42 @@ int main() {
    cl_command_queue queue;
    cl_program program;
    cl_kernel transpose_kernel, mult_kernel;
-   size_t global_size;
-   cl_ulong mem_size;
-   cl_int i, j, k, err, check;
+   size_t global_size, local_size, mult_global[2], mult_local[2];
+   size_t i, j, checked, bytes;
+   cl_int err;
+   cl_event transpose_event, mult_event;
+   char options[32];
+   int check;
 
    /* Data and buffers */
-   cl_uint matrix_dim;
-   float a_mat[MATRIX_DIM][MATRIX_DIM], b_mat[MATRIX_DIM][MATRIX_DIM], 
-         c_mat[MATRIX_DIM][MATRIX_DIM], check_mat[MATRIX_DIM][MATRIX_DIM];
+   cl_uint n = MATRIX_DIM, dim, blocks;
+   float *a_mat, *b_mat, *c_mat, *mapped;
    cl_mem a_buffer, b_buffer, c_buffer;
-   
-   /* Initialize A, B, and check matrices */
-   srand((unsigned int)time(0));
-   for(i=0; i<MATRIX_DIM; i++) {
-      for(j=0; j<MATRIX_DIM; j++) {
-         a_mat[i][j] = (float)rand()/RAND_MAX;
-      }
+
+   if(argc > 1) {
+      n = (cl_uint)strtoul(argv[1], NULL, 10);
    }
-   srand((unsigned int)time(0));
-   for(i=0; i<MATRIX_DIM; i++) {
-      for(j=0; j<MATRIX_DIM; j++) {
-         b_mat[i][j] = (float)rand()/RAND_MAX;
-         check_mat[i][j] = 0.0f;
-      }
+   if(n == 0) {
+      printf("Usage: %s [N]\n", argv[0]);
+      exit(1);
    }
-   for(i=0; i<MATRIX_DIM; i++) {
-      for(j=0; j<MATRIX_DIM; j++) {
-         for(k=0; k<MATRIX_DIM; k++) {
-            check_mat[i][j] += a_mat[i][k] * b_mat[k][j];
-         }
+   dim = (n + 4*TILE - 1) / (4*TILE) * (4*TILE);
+   bytes = (size_t)dim * dim * sizeof(float);
+
+   /* Initialize A and B; the padding stays zero. A is page aligned so
+      its buffer can use it in place */
+   a_mat = (float*)alignedAlloc(bytes);
+   b_mat = (float*)calloc((size_t)dim * dim, sizeof(float));
+   if(a_mat == NULL || b_mat == NULL) {
+      perror("Couldn't allocate the matrices");
+      exit(1);
+   }
+   memset(a_mat, 0, bytes);
+   srand((unsigned int)time(0));
+   for(i=0; i<n; i++) {
+      for(j=0; j<n; j++) {
+         a_mat[i*dim + j] = (float)rand()/RAND_MAX;
+         b_mat[i*dim + j] = (float)rand()/RAND_MAX;
       }
    }
 
@@ -139,11 +175,12 @@ int main() {
    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
    if(err < 0) {
       perror("Couldn't create a context");
-      exit(1);   
+      exit(1);
    }
 
    /* Build the program */
-   program = build_program(context, device, PROGRAM_FILE);
+   snprintf(options, sizeof(options), "-D TILE=%d", TILE);
+   program = build_program(context, device, PROGRAM_FILE, options);
 
    /* Create a kernel for the transpose function */
    transpose_kernel = clCreateKernel(program, TRANSPOSE_FUNC, &err);
@@ -159,85 +196,122 @@ int main() {
       exit(1);
    };
 
-   /* Create buffers */
-   a_buffer = clCreateBuffer(context, 
-         CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 
-         sizeof(a_mat), a_mat, &err);
+   /* Create buffers: A is used in place; B is transposed in place, so it
+      gets its own memory and the host copy stays for the check; C is
+      mapped, not read back */
+   a_buffer = createHostBuffer(context, CL_MEM_READ_ONLY, bytes, a_mat, &err);
    if(err < 0) {
       perror("Couldn't create a buffer");
-      exit(1);   
+      exit(1);
+   };
+   b_buffer = createHostBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+   if(err < 0) {
+      perror("Couldn't create a buffer");
+      exit(1);
+   };
+   c_buffer = createHostBuffer(context, CL_MEM_WRITE_ONLY, bytes, NULL, &err);
+   if(err < 0) {
+      perror("Couldn't create a buffer");
+      exit(1);
    };
-   b_buffer = clCreateBuffer(context, 
-         CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 
-         sizeof(b_mat), b_mat, &err);
-   c_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, 
-         sizeof(c_mat), NULL, &err);
 
    /* Create a command queue */
-   queue = clCreateCommandQueue(context, device, 0, &err);
+   queue = clCreateCommandQueue(context, device,
+         CL_QUEUE_PROFILING_ENABLE, &err);
    if(err < 0) {
       perror("Couldn't create a command queue");
-      exit(1);   
+      exit(1);
    };
 
-   /* Determine transpose parameters */
-   global_size = (MATRIX_DIM/4 * (MATRIX_DIM/4 + 1))/2;
-   clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, 	
-         sizeof(mem_size), &mem_size, NULL);
+   /* Fill B through a mapping */
+   mapped = mapBuffer<float>(queue, b_buffer, CL_MAP_WRITE_INVALIDATE_REGION,
+         bytes, &err);
+   if(err < 0) {
+      perror("Couldn't map the buffer");
+      exit(1);
+   }
+   memcpy(mapped, b_mat, bytes);
+   unmapBuffer(queue, b_buffer, mapped);
+
+   /* One work-item per block of the upper triangle, 8 float4 of local
+      memory each */
+   blocks = dim/4;
+   local_size = TRANSPOSE_LOCAL_SIZE;
+   global_size = ((size_t)blocks * (blocks + 1) / 2 + local_size - 1)
+         / local_size * local_size;
 
    /* Set arguments for transpose kernel */
-   matrix_dim = MATRIX_DIM/4;
-   err |= clSetKernelArg(transpose_kernel, 0, sizeof(cl_mem), &b_buffer);
-   err |= clSetKernelArg(transpose_kernel, 1, (size_t)mem_size, NULL);
-   err = clSetKernelArg(transpose_kernel, 2, sizeof(matrix_dim), &matrix_dim);
+   err = clSetKernelArg(transpose_kernel, 0, sizeof(cl_mem), &b_buffer);
+   err |= clSetKernelArg(transpose_kernel, 1,
+         local_size * 8 * sizeof(cl_float4), NULL);
+   err |= clSetKernelArg(transpose_kernel, 2, sizeof(blocks), &blocks);
    if(err < 0) {
       printf("Couldn't set an argument for the transpose kernel");
-      exit(1);   
+      exit(1);
    };
 
    /* Enqueue transpose kernel */
-   err = clEnqueueNDRangeKernel(queue, transpose_kernel, 1, NULL, 
-         &global_size, NULL, 0, NULL, NULL);
+   err = clEnqueueNDRangeKernel(queue, transpose_kernel, 1, NULL,
+         &global_size, &local_size, 0, NULL, &transpose_event);
    if(err < 0) {
       perror("Couldn't enqueue the transpose kernel");
-      exit(1);   
+      exit(1);
    }
 
    /* Create arguments for multiplication kernel */
    err = clSetKernelArg(mult_kernel, 0, sizeof(cl_mem), &a_buffer);
    err |= clSetKernelArg(mult_kernel, 1, sizeof(cl_mem), &b_buffer);
    err |= clSetKernelArg(mult_kernel, 2, sizeof(cl_mem), &c_buffer);
+   err |= clSetKernelArg(mult_kernel, 3, sizeof(dim), &dim);
    if(err < 0) {
-      printf("Couldn't set an argument for the transpose kernel");
-      exit(1);   
+      printf("Couldn't set an argument for the multiplication kernel");
+      exit(1);
    };
 
-   /* Enqueue multiplication kernel */
-   global_size = MATRIX_DIM;
-   err = clEnqueueNDRangeKernel(queue, mult_kernel, 1, NULL, &global_size, 
-         NULL, 0, NULL, NULL);
+   /* Enqueue multiplication kernel: one work-item per element of C,
+      TILE x TILE per work-group */
+   mult_global[0] = dim;
+   mult_global[1] = dim;
+   mult_local[0] = TILE;
+   mult_local[1] = TILE;
+   err = clEnqueueNDRangeKernel(queue, mult_kernel, 2, NULL, mult_global,
+         mult_local, 0, NULL, &mult_event);
    if(err < 0) {
       perror("Couldn't enqueue the multiplication kernel");
-      exit(1);   
-   } 
+      exit(1);
+   }
 
-   /* Read output buffer */
-   err = clEnqueueReadBuffer(queue, c_buffer, CL_TRUE, 0, 
-      sizeof(c_mat), c_mat, 0, NULL, NULL);
+   /* Map output buffer */
+   c_mat = mapBuffer<float>(queue, c_buffer, CL_MAP_READ, bytes, &err);
    if(err < 0) {
-      perror("Couldn't read the buffer");
-      exit(1);   
-   } 
+      perror("Couldn't map the buffer");
+      exit(1);
+   }
+   printf("N = %u (padded to %u): transpose %.3f ms, multiply %.3f ms, "
+         "%.1f GFLOP/s\n", n, dim, event_ms(transpose_event),
+         event_ms(mult_event),
+         2.0 * n * n * n / (event_ms(mult_event) * 1e6));
+   clReleaseEvent(transpose_event);
+   clReleaseEvent(mult_event);
 
-   /* Check result */
+   /* Check the whole result for small N, random entries otherwise */
    check = 1;
-   for(i=0; i<MATRIX_DIM; i++) {
-      for(j=0; j<MATRIX_DIM; j++) {
-         if(fabs(c_mat[i][j] - check_mat[i][j]) > 0.01f) {
-		 	printf("%f\n",c_mat[i][j]);
-            check = 0;
-            break;
-         }
+   checked = (size_t)n * n <= (size_t)FULL_CHECK_DIM * FULL_CHECK_DIM ?
+         (size_t)n * n : SAMPLE_CHECKS;
+   for(size_t c=0; c<checked && check; c++) {
+      if(checked == (size_t)n * n) {
+         i = c / n;
+         j = c % n;
+      }
+      else {
+         i = (size_t)rand() % n;
+         j = (size_t)rand() % n;
+      }
+      double expected = reference(a_mat, b_mat, dim, i, j);
+      if(fabs(c_mat[i*dim + j] - expected) > 1e-5 * n + 1e-4 * expected) {
+         printf("C[%u][%u] = %f, expected %f\n",
+               (unsigned int)i, (unsigned int)j, c_mat[i*dim + j], expected);
+         check = 0;
       }
    }
    if(check)
@@ -246,6 +320,7 @@ int main() {
       printf("Multiplication check failed.\n");
 
    /* Deallocate resources */
+   unmapBuffer(queue, c_buffer, c_mat);
    clReleaseMemObject(a_buffer);
    clReleaseMemObject(b_buffer);
    clReleaseMemObject(c_buffer);
@@ -254,5 +329,7 @@ int main() {
    clReleaseCommandQueue(queue);
    clReleaseProgram(program);
    clReleaseContext(context);
-   return 0;
+   alignedFree(a_mat);
+   free(b_mat);
+   return !check;
 }
@@ -0,0 +1,172 @@
+/*
+ * y = alpha*A*x + beta*y for an m x n float matrix A with leading dimension
+ * lda (row stride for row-major, column stride for column-major). With
+ * beta == 0, y is not read, so it may hold garbage.
+ *
+ *    -D ROWS=<n>   rows per work-group in gemv_row_major
+ *    -D BATCH=<k>  vectors per launch
+ *
+ * A batch applies A to k vectors x_0..x_k-1 (x_b at x + x_offset + b*ldx)
+ * giving y_b at y + y_offset + b*ldy. Every element of A is loaded once per launch and used
+ * for all k vectors.
+ */
+
+#ifndef ROWS
+#define ROWS 4
+#endif
+
+#ifndef BATCH
+#define BATCH 1
+#endif
+
+/* Four elements from p[j], zero past n */
+inline float4 load4(__global const float *p, uint j, uint n) {
+
+   float4 v = (float4)(0.0f);
+
+   if(j + 4 <= n)
+      return vload4(0, p + j);
+   if(j < n)
+      v.s0 = p[j];
+   if(j + 1 < n)
+      v.s1 = p[j + 1];
+   if(j + 2 < n)
+      v.s2 = p[j + 2];
+   return v;
+}
+
+inline float scale_output(float sum, float alpha, float beta, __global const float *y, uint row) {
+   return beta != 0.0f ? alpha * sum + beta * y[row] : alpha * sum;
+}
+
+/* Row-major: a group owns ROWS rows and walks them in tiles of
+   4*get_local_size(0) columns with coalesced float4 loads. A work-item's
+   x slices are loaded once per tile and reused, from registers, for all
+   ROWS rows; the partials are then combined with a local tree.
+   l_sum holds ROWS*BATCH*get_local_size(0) floats. */
+__kernel void gemv_row_major(uint m, uint n, float alpha,
+      __global const float *a, uint lda, __global const float *x,
+      float beta, __global float *y, __local float *l_sum,
+      uint ldx, uint ldy, ulong x_offset, ulong y_offset) {
+
+   uint lid = get_local_id(0);
+   uint size = get_local_size(0);
+   uint row0 = get_group_id(0) * ROWS;
+   float sum[ROWS][BATCH];
+   float4 av, xv[BATCH];
+
+   x += x_offset;
+   y += y_offset;
+
+   for(uint r = 0; r < ROWS; r++) {
+      for(uint b = 0; b < BATCH; b++) {
+         sum[r][b] = 0.0f;
+      }
+   }
+
+   for(uint j = 4 * lid; j < n; j += 4 * size) {
+      for(uint b = 0; b < BATCH; b++) {
+         xv[b] = load4(x + (ulong)b * ldx, j, n);
+      }
+      for(uint r = 0; r < ROWS; r++) {
+         if(row0 + r < m) {
+            av = load4(a + (ulong)(row0 + r) * lda, j, n);
+            for(uint b = 0; b < BATCH; b++) {
+               sum[r][b] += dot(av, xv[b]);
+            }
+         }
+      }
+   }
+
+   for(uint r = 0; r < ROWS; r++) {
+      for(uint b = 0; b < BATCH; b++) {
+         l_sum[(r * BATCH + b) * size + lid] = sum[r][b];
+      }
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for(uint i = size/2; i > 0; i >>= 1) {
+      if(lid < i) {
+         for(uint k = 0; k < ROWS * BATCH; k++) {
+            l_sum[k * size + lid] += l_sum[k * size + lid + i];
+         }
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   /* Work-item k writes row k / BATCH of vector k % BATCH */
+   for(uint k = lid; k < ROWS * BATCH; k += size) {
+      uint row = row0 + k / BATCH;
+      __global float *yb = y + (ulong)(k % BATCH) * ldy;
+      if(row < m) {
+         yb[row] = scale_output(l_sum[k * size], alpha, beta, yb, row);
+      }
+   }
+}
+
+/* Column-major: the group is get_local_size(0) consecutive rows by
+   get_local_size(1) column slices. Each tile of x_tile entries of every
+   x_b is staged in local memory once for the whole group; work-item (r, s)
+   reads columns s, s + slices, ... of the tile, so every column read is a
+   contiguous run of rows. The slices are summed with a local tree.
+   l_x holds BATCH*x_tile floats, l_sum BATCH*get_local_size(0)*get_local_size(1). */
+__kernel void gemv_col_major(uint m, uint n, float alpha,
+      __global const float *a, uint lda, __global const float *x,
+      float beta, __global float *y, __local float *l_x,
+      __local float *l_sum, uint x_tile, uint ldx, uint ldy,
+      ulong x_offset, ulong y_offset) {
+
+   uint lr = get_local_id(0);
+   uint ls = get_local_id(1);
+   uint rows = get_local_size(0);
+   uint slices = get_local_size(1);
+   uint threads = rows * slices;
+   uint flat = ls * rows + lr;
+   uint row = get_group_id(0) * rows + lr;
+   float sum[BATCH], av;
+
+   x += x_offset;
+   y += y_offset;
+
+   for(uint b = 0; b < BATCH; b++) {
+      sum[b] = 0.0f;
+   }
+
+   for(uint tile = 0; tile < n; tile += x_tile) {
+      barrier(CLK_LOCAL_MEM_FENCE);
+      for(uint k = flat; k < BATCH * x_tile; k += threads) {
+         uint b = k / x_tile, col = tile + k % x_tile;
+         l_x[k] = col < n ? x[(ulong)b * ldx + col] : 0.0f;
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+
+      if(row < m) {
+         for(uint k = ls; k < x_tile && tile + k < n; k += slices) {
+            av = a[row + (ulong)(tile + k) * lda];
+            for(uint b = 0; b < BATCH; b++) {
+               sum[b] += av * l_x[b * x_tile + k];
+            }
+         }
+      }
+   }
+
+   for(uint b = 0; b < BATCH; b++) {
+      l_sum[b * threads + flat] = sum[b];
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+   for(uint i = slices/2; i > 0; i >>= 1) {
+      if(ls < i) {
+         for(uint b = 0; b < BATCH; b++) {
+            l_sum[b * threads + flat] += l_sum[b * threads + flat + i * rows];
+         }
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   if(ls == 0 && row < m) {
+      for(uint b = 0; b < BATCH; b++) {
+         __global float *yb = y + (ulong)b * ldy;
+         yb[row] = scale_output(l_sum[b * threads + lr], alpha, beta, yb, row);
+      }
+   }
+}
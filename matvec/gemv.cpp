@@ -0,0 +1,429 @@
+#include <CL/cl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include "gemv.hpp"
+
+#define BENCH_DIM 16384
+#define STREAM_DIM 4096
+#define STREAM_VECTORS 256
+#define LOOP 10
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+cl_mem create_buffer(cl_context context, size_t bytes, const void *host)
+{
+    cl_int err;
+    cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | (host != NULL ? CL_MEM_COPY_HOST_PTR : 0),
+                                   bytes, (void *)host, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a buffer");
+        exit(1);
+    }
+    return buffer;
+}
+
+double event_ms(cl_event event)
+{
+    cl_ulong start, end;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    return (end - start) * 1e-6;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+}
+
+/* Host reference in double */
+void reference(GemvLayout layout, cl_uint m, cl_uint n, float alpha, const std::vector<float> &a, cl_uint lda,
+               const std::vector<float> &x, float beta, std::vector<float> &y)
+{
+    for (cl_uint i = 0; i < m; i++)
+    {
+        double sum = 0.0;
+        for (cl_uint j = 0; j < n; j++)
+        {
+            sum += (double)(layout == GEMV_ROW_MAJOR ? a[(size_t)i * lda + j] : a[i + (size_t)j * lda]) * x[j];
+        }
+        y[i] = (float)(beta != 0.0f ? alpha * sum + beta * y[i] : alpha * sum);
+    }
+}
+
+bool check_gemv(cl_context context, cl_command_queue queue, GemvEngine &engine, GemvLayout layout,
+                cl_uint m, cl_uint n, float alpha, float beta)
+{
+    cl_uint lda = (layout == GEMV_ROW_MAJOR ? n : m) + 3;
+    size_t elements = (size_t)lda * (layout == GEMV_ROW_MAJOR ? m : n);
+    std::vector<float> a(elements), x(n), y(m), expected(m), out(m);
+    for (size_t i = 0; i < elements; i++)
+        a[i] = (float)rand() / RAND_MAX - 0.5f;
+    for (cl_uint j = 0; j < n; j++)
+        x[j] = (float)rand() / RAND_MAX - 0.5f;
+
+    /* With beta == 0 the old y must be ignored, even NaN */
+    for (cl_uint i = 0; i < m; i++)
+        y[i] = expected[i] = beta != 0.0f ? (float)rand() / RAND_MAX : NAN;
+    reference(layout, m, n, alpha, a, lda, x, beta, expected);
+
+    cl_mem bufA = create_buffer(context, elements * sizeof(float), a.data());
+    cl_mem bufX = create_buffer(context, n * sizeof(float), x.data());
+    cl_mem bufY = create_buffer(context, m * sizeof(float), y.data());
+    cl_int err = engine.gemv(layout, m, n, alpha, bufA, lda, bufX, beta, bufY);
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(queue, bufY, CL_TRUE, 0, m * sizeof(float), out.data(), 0, NULL, NULL);
+    clReleaseMemObject(bufA);
+    clReleaseMemObject(bufX);
+    clReleaseMemObject(bufY);
+
+    bool ok = err == CL_SUCCESS;
+    for (cl_uint i = 0; i < m && ok; i++)
+    {
+        ok = fabs(out[i] - expected[i]) <= 1e-4f * sqrtf((float)n) + 1e-4f * fabs(expected[i]);
+    }
+    return ok;
+}
+
+/* batch vectors with padded strides, more than one launch past GEMV_MAX_BATCH */
+bool check_batched(cl_context context, cl_command_queue queue, GemvEngine &engine, GemvLayout layout,
+                   cl_uint m, cl_uint n, cl_uint batch)
+{
+    cl_uint lda = (layout == GEMV_ROW_MAJOR ? n : m) + 1, ldx = n + 2, ldy = m + 5;
+    size_t elements = (size_t)lda * (layout == GEMV_ROW_MAJOR ? m : n);
+    std::vector<float> a(elements), x((size_t)ldx * batch), y((size_t)ldy * batch), out(y.size());
+    for (size_t i = 0; i < elements; i++)
+        a[i] = (float)rand() / RAND_MAX - 0.5f;
+    for (size_t j = 0; j < x.size(); j++)
+        x[j] = (float)rand() / RAND_MAX - 0.5f;
+    for (size_t i = 0; i < y.size(); i++)
+        y[i] = (float)rand() / RAND_MAX;
+
+    cl_mem bufA = create_buffer(context, elements * sizeof(float), a.data());
+    cl_mem bufX = create_buffer(context, x.size() * sizeof(float), x.data());
+    cl_mem bufY = create_buffer(context, y.size() * sizeof(float), y.data());
+    cl_int err = engine.gemvBatched(layout, m, n, batch, 2.0f, bufA, lda, bufX, ldx, 0.25f, bufY, ldy);
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(queue, bufY, CL_TRUE, 0, out.size() * sizeof(float), out.data(), 0, NULL, NULL);
+    clReleaseMemObject(bufA);
+    clReleaseMemObject(bufX);
+    clReleaseMemObject(bufY);
+
+    bool ok = err == CL_SUCCESS;
+    for (cl_uint b = 0; b < batch && ok; b++)
+    {
+        std::vector<float> xb(x.begin() + (size_t)b * ldx, x.begin() + (size_t)b * ldx + n);
+        std::vector<float> expected(y.begin() + (size_t)b * ldy, y.begin() + (size_t)b * ldy + m);
+        reference(layout, m, n, 2.0f, a, lda, xb, 0.25f, expected);
+        for (cl_uint i = 0; i < m && ok; i++)
+        {
+            float got = out[(size_t)b * ldy + i];
+            ok = fabs(got - expected[i]) <= 2e-4f * sqrtf((float)n) + 1e-4f * fabs(expected[i]);
+        }
+        /* The padding between vectors is left alone */
+        for (cl_uint i = m; i < ldy && ok && b + 1 < batch; i++)
+            ok = out[(size_t)b * ldy + i] == y[(size_t)b * ldy + i];
+    }
+    return ok;
+}
+
+/* Per-vector kernel time and matrix read rate as the batch grows */
+void batch_sweep(cl_context context, cl_command_queue queue, GemvEngine &engine, cl_uint dim)
+{
+    static const cl_uint batches[] = { 1, 2, 4, 8, 16, 32 };
+    static const char *layoutNames[] = { "row-major", "col-major" };
+    const cl_uint maxBatch = 32;
+    float one = 1.0f;
+    cl_event event;
+    size_t bytes = (size_t)dim * dim * sizeof(float);
+
+    cl_mem bufA = create_buffer(context, bytes, NULL);
+    cl_mem bufX = create_buffer(context, (size_t)dim * maxBatch * sizeof(float), NULL);
+    cl_mem bufY = create_buffer(context, (size_t)dim * maxBatch * sizeof(float), NULL);
+    clEnqueueFillBuffer(queue, bufA, &one, sizeof(one), 0, bytes, 0, NULL, NULL);
+    clEnqueueFillBuffer(queue, bufX, &one, sizeof(one), 0, (size_t)dim * maxBatch * sizeof(float), 0, NULL, NULL);
+
+    printf("batched %u x %u (ms per vector, vectors/s, effective GB/s):\n", dim, dim);
+    for (int layout = GEMV_ROW_MAJOR; layout <= GEMV_COL_MAJOR; layout++)
+    {
+        for (size_t k = 0; k < sizeof(batches) / sizeof(batches[0]); k++)
+        {
+            cl_uint batch = batches[k];
+            engine.gemvBatched((GemvLayout)layout, dim, dim, batch, 1.0f, bufA, dim, bufX, dim, 0.0f, bufY, dim);
+            clFinish(queue);
+
+            /* Wall time covers every launch of a batch larger than GEMV_MAX_BATCH */
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int i = 0; i < LOOP; i++)
+            {
+                engine.gemvBatched((GemvLayout)layout, dim, dim, batch, 1.0f, bufA, dim, bufX, dim, 0.0f, bufY, dim,
+                                   &event);
+                clWaitForEvents(1, &event);
+                clReleaseEvent(event);
+            }
+            double ms = elapsed_ms(start, std::chrono::steady_clock::now()) / LOOP;
+
+            float yLast;
+            clEnqueueReadBuffer(queue, bufY, CL_TRUE, ((size_t)(batch - 1) * dim + dim - 1) * sizeof(float),
+                                sizeof(yLast), &yLast, 0, NULL, NULL);
+            printf("  %s batch %2u: %8.4f ms  %10.0f /s  %7.2f GB/s  %s\n", layoutNames[layout], batch,
+                   ms / batch, batch * 1e3 / ms, (double)bytes * batch / (ms * 1e6),
+                   yLast == (float)dim ? "Check passed." : "Check failed.");
+        }
+    }
+
+    clReleaseMemObject(bufA);
+    clReleaseMemObject(bufX);
+    clReleaseMemObject(bufY);
+}
+
+/*
+ * A resident STREAM_DIM matrix with vectors pushed through a GemvStream:
+ * the latency of one vector alone against the throughput with the ring
+ * kept full.
+ */
+bool stream_benchmark(cl_context context, cl_device_id device, cl_command_queue queue, GemvEngine &engine)
+{
+    cl_uint dim = STREAM_DIM;
+    cl_int err;
+    std::vector<float> a((size_t)dim * dim), x((size_t)dim * GEMV_MAX_BATCH), y(x.size()), expected(dim);
+    for (size_t i = 0; i < a.size(); i++)
+        a[i] = (float)rand() / RAND_MAX - 0.5f;
+    for (size_t j = 0; j < x.size(); j++)
+        x[j] = (float)rand() / RAND_MAX - 0.5f;
+    std::vector<float> x0(x.begin(), x.begin() + dim);
+    reference(GEMV_ROW_MAJOR, dim, dim, 1.0f, a, dim, x0, 0.0f, expected);
+
+    cl_command_queue transfer = clCreateCommandQueue(context, device, 0, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a command queue");
+        exit(1);
+    }
+    cl_mem bufA = create_buffer(context, a.size() * sizeof(float), a.data());
+    bool ok = true;
+
+    printf("streaming through a resident %u x %u matrix, %d slots:\n", dim, dim, GEMV_RING_SLOTS);
+    for (cl_uint batch = 1; batch <= GEMV_MAX_BATCH; batch *= 2)
+    {
+        GemvStream stream(engine, context, transfer, queue, GEMV_ROW_MAJOR, dim, dim, bufA, dim, batch);
+        if (stream.status() != CL_SUCCESS)
+        {
+            printf("  batch %u: couldn't create the ring\n", batch);
+            ok = false;
+            break;
+        }
+
+        /* Latency: one batch at a time, push to pop */
+        std::chrono::steady_clock::time_point start, end;
+        double latency = 0.0;
+        for (int i = 0; i <= LOOP; i++)
+        {
+            start = std::chrono::steady_clock::now();
+            err = stream.push(x.data());
+            err |= stream.pop(y.data());
+            end = std::chrono::steady_clock::now();
+            if (i > 0)
+                latency += elapsed_ms(start, end);
+        }
+        latency /= LOOP;
+
+        /* Throughput: the ring stays full so transfers overlap compute */
+        cl_uint pushes = STREAM_VECTORS / batch, pushed = 0, popped = 0;
+        start = std::chrono::steady_clock::now();
+        while (popped < pushes && err == CL_SUCCESS)
+        {
+            if (pushed < pushes && !stream.full())
+            {
+                err = stream.push(x.data());
+                pushed++;
+            }
+            else
+            {
+                err = stream.pop(y.data());
+                popped++;
+            }
+        }
+        end = std::chrono::steady_clock::now();
+        double ms = elapsed_ms(start, end);
+
+        bool batchOk = err == CL_SUCCESS;
+        for (cl_uint i = 0; i < dim && batchOk; i++)
+            batchOk = fabs(y[i] - expected[i]) <= 1e-4f * sqrtf((float)dim) + 1e-4f * fabs(expected[i]);
+        ok &= batchOk;
+        printf("  batch %u: latency %.3f ms (%.3f ms per vector), %.0f vectors/s  %s\n", batch, latency,
+               latency / batch, pushes * batch * 1e3 / ms, batchOk ? "Check passed." : "Check failed.");
+    }
+
+    clReleaseMemObject(bufA);
+    clReleaseCommandQueue(transfer);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *layoutNames[] = { "row-major", "col-major" };
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_int err;
+    cl_uint dim = BENCH_DIM;
+    int failed = 0;
+
+    if (argc > 1)
+    {
+        dim = (cl_uint)strtoul(argv[1], NULL, 10);
+    }
+
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+    queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a command queue");
+        exit(1);
+    }
+
+    ProgramCache cache(context, device);
+    GemvEngine engine(cache, queue);
+
+    /* Shapes around the tile sizes of both kernels, padded leading dimension */
+    cl_uint shapes[][2] = { { 1, 1 }, { 3, 5 }, { 17, 1023 }, { 1000, 777 }, { 513, 4099 }, { 4099, 65 } };
+    srand(123);
+    for (int layout = GEMV_ROW_MAJOR; layout <= GEMV_COL_MAJOR; layout++)
+    {
+        int passed = 0, total = 0;
+        for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+        {
+            bool ok = check_gemv(context, queue, engine, (GemvLayout)layout, shapes[s][0], shapes[s][1], 1.5f, 0.5f) &&
+                      check_gemv(context, queue, engine, (GemvLayout)layout, shapes[s][0], shapes[s][1], -1.0f, 0.0f);
+            if (!ok)
+                printf("  %u x %u failed\n", shapes[s][0], shapes[s][1]);
+            passed += ok;
+            total++;
+        }
+        failed |= passed != total;
+        printf("%s: %d/%d shapes, %s\n", layoutNames[layout], passed, total,
+               passed == total ? "Check passed." : "Check failed.");
+    }
+
+    cl_uint batches[] = { 1, 3, 8, 13 };
+    for (int layout = GEMV_ROW_MAJOR; layout <= GEMV_COL_MAJOR; layout++)
+    {
+        int passed = 0, total = 0;
+        for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+        {
+            for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++)
+            {
+                bool ok = check_batched(context, queue, engine, (GemvLayout)layout, shapes[s][0], shapes[s][1],
+                                        batches[b]);
+                if (!ok)
+                    printf("  %u x %u, batch %u failed\n", shapes[s][0], shapes[s][1], batches[b]);
+                passed += ok;
+                total++;
+            }
+        }
+        failed |= passed != total;
+        printf("%s batched: %d/%d, %s\n", layoutNames[layout], passed, total,
+               passed == total ? "Check passed." : "Check failed.");
+    }
+
+    /* Bandwidth on a dim x dim matrix against a device copy of the same bytes */
+    cl_ulong maxAlloc = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, NULL);
+    while ((cl_ulong)dim * dim * sizeof(float) > maxAlloc)
+        dim /= 2;
+    size_t bytes = (size_t)dim * dim * sizeof(float);
+    float one = 1.0f;
+    cl_event event;
+
+    cl_mem bufA = create_buffer(context, bytes, NULL);
+    cl_mem bufX = create_buffer(context, dim * sizeof(float), NULL);
+    cl_mem bufY = create_buffer(context, dim * sizeof(float), NULL);
+    clEnqueueFillBuffer(queue, bufA, &one, sizeof(one), 0, bytes, 0, NULL, NULL);
+    clEnqueueFillBuffer(queue, bufX, &one, sizeof(one), 0, dim * sizeof(float), 0, NULL, NULL);
+
+    cl_mem bufCopy = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes / 2, NULL, &err);
+    double copyRate = 0.0;
+    if (err == CL_SUCCESS)
+    {
+        /* Copying half the matrix reads and writes as many bytes as gemv reads */
+        clEnqueueCopyBuffer(queue, bufA, bufCopy, 0, 0, bytes / 2, 0, NULL, &event);
+        clWaitForEvents(1, &event);
+        clReleaseEvent(event);
+        double ms = 0.0;
+        for (int i = 0; i < LOOP; i++)
+        {
+            clEnqueueCopyBuffer(queue, bufA, bufCopy, 0, 0, bytes / 2, 0, NULL, &event);
+            clWaitForEvents(1, &event);
+            ms += event_ms(event);
+            clReleaseEvent(event);
+        }
+        copyRate = bytes * LOOP / (ms * 1e6);
+        clReleaseMemObject(bufCopy);
+    }
+    printf("%u x %u: device copy %.2f GB/s\n", dim, dim, copyRate);
+
+    for (int layout = GEMV_ROW_MAJOR; layout <= GEMV_COL_MAJOR; layout++)
+    {
+        double ms = 0.0;
+        engine.gemv((GemvLayout)layout, dim, dim, 1.0f, bufA, dim, bufX, 0.0f, bufY);
+        for (int i = 0; i < LOOP; i++)
+        {
+            engine.gemv((GemvLayout)layout, dim, dim, 1.0f, bufA, dim, bufX, 0.0f, bufY, &event);
+            clWaitForEvents(1, &event);
+            ms += event_ms(event);
+            clReleaseEvent(event);
+        }
+        float y0;
+        clEnqueueReadBuffer(queue, bufY, CL_TRUE, 0, sizeof(y0), &y0, 0, NULL, NULL);
+        double rate = (double)bytes * LOOP / (ms * 1e6);
+        printf("  %s: %.3f ms, %.2f GB/s (%.0f%% of copy)  %s\n", layoutNames[layout], ms / LOOP, rate,
+               copyRate > 0.0 ? 100.0 * rate / copyRate : 0.0, y0 == (float)dim ? "Check passed." : "Check failed.");
+    }
+
+    clReleaseMemObject(bufA);
+    clReleaseMemObject(bufX);
+    clReleaseMemObject(bufY);
+
+    batch_sweep(context, queue, engine, dim / 4 > 0 ? dim / 4 : 1);
+    failed |= !stream_benchmark(context, device, queue, engine);
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+    return failed;
+}
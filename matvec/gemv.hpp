@@ -0,0 +1,344 @@
+#ifndef GEMV_HPP
+#define GEMV_HPP
+
+#include <CL/cl.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../common/future.hpp"
+#include "../common/program_cache.hpp"
+
+#define GEMV_PROGRAM_FILE "gemv.cl"
+#define GEMV_ROWS 4
+#define GEMV_LOCAL_SIZE 256
+#define GEMV_COL_ROWS 64
+#define GEMV_COL_SLICES 4
+#define GEMV_X_TILE 1024
+#define GEMV_MAX_BATCH 8
+#define GEMV_RING_SLOTS 3
+
+enum GemvLayout
+{
+    GEMV_ROW_MAJOR,
+    GEMV_COL_MAJOR
+};
+
+/*
+ * y = alpha*A*x + beta*y on the device for any m x n float matrix, in
+ * row-major or column-major storage with a leading dimension. Row-major
+ * uses a group of GEMV_LOCAL_SIZE work-items per GEMV_ROWS rows;
+ * column-major uses GEMV_COL_ROWS rows by GEMV_COL_SLICES column slices
+ * with x staged in local memory, GEMV_X_TILE entries at a time.
+ * gemvBatched applies the same matrix to several vectors per launch.
+ */
+class GemvEngine
+{
+public:
+    GemvEngine(ProgramCache &cache, cl_command_queue queue, const std::string &programFile = GEMV_PROGRAM_FILE)
+        : m_cache(cache), m_queue(queue), m_programFile(programFile)
+    {
+    }
+
+    ~GemvEngine()
+    {
+        for (std::map<std::string, cl_kernel>::iterator it = m_kernels.begin(); it != m_kernels.end(); ++it)
+        {
+            clReleaseKernel(it->second);
+        }
+    }
+
+    /* lda >= n for row-major, lda >= m for column-major */
+    cl_int gemv(GemvLayout layout, cl_uint m, cl_uint n, cl_float alpha, cl_mem a, cl_uint lda, cl_mem x,
+                cl_float beta, cl_mem y, cl_event *event = NULL)
+    {
+        return gemvBatched(layout, m, n, 1, alpha, a, lda, x, n, beta, y, m, event);
+    }
+
+    /* gemv() after the futures in after, without waiting for it */
+    Future gemvAsync(GemvLayout layout, cl_uint m, cl_uint n, cl_float alpha, cl_mem a, cl_uint lda, cl_mem x,
+                     cl_float beta, cl_mem y, const WaitList &after = WaitList())
+    {
+        return enqueueAfter(m_queue, after, [&](cl_event *event) {
+            return gemv(layout, m, n, alpha, a, lda, x, beta, y, event);
+        });
+    }
+
+    /*
+     * Y = alpha*A*X + beta*Y for batch vectors: x_b starts at x + b*ldx and
+     * y_b at y + b*ldy (in floats). Each launch covers up to GEMV_MAX_BATCH
+     * vectors and reads A once for all of them. event, if given, is the
+     * last launch.
+     */
+    cl_int gemvBatched(GemvLayout layout, cl_uint m, cl_uint n, cl_uint batch, cl_float alpha, cl_mem a,
+                       cl_uint lda, cl_mem x, cl_uint ldx, cl_float beta, cl_mem y, cl_uint ldy,
+                       cl_event *event = NULL)
+    {
+        cl_int status = CL_SUCCESS;
+        if (lda < (layout == GEMV_ROW_MAJOR ? n : m) || ldx < n || ldy < m)
+            return CL_INVALID_VALUE;
+
+        for (cl_uint b = 0; status == CL_SUCCESS && b < batch; b += GEMV_MAX_BATCH)
+        {
+            cl_uint k = batch - b < GEMV_MAX_BATCH ? batch - b : GEMV_MAX_BATCH;
+            bool last = b + k == batch;
+            status = launch(layout, m, n, k, alpha, a, lda, x, ldx, (cl_ulong)b * ldx, beta, y, ldy,
+                            (cl_ulong)b * ldy, last ? event : NULL);
+        }
+        return status;
+    }
+
+private:
+    cl_int launch(GemvLayout layout, cl_uint m, cl_uint n, cl_uint batch, cl_float alpha, cl_mem a, cl_uint lda,
+                  cl_mem x, cl_uint ldx, cl_ulong xOffset, cl_float beta, cl_mem y, cl_uint ldy, cl_ulong yOffset,
+                  cl_event *event)
+    {
+        cl_int status;
+        if (m == 0)
+            return CL_SUCCESS;
+
+        cl_kernel kernel = getKernel(layout == GEMV_ROW_MAJOR ? "gemv_row_major" : "gemv_col_major", batch, &status);
+        if (status != CL_SUCCESS)
+            return status;
+
+        status = clSetKernelArg(kernel, 0, sizeof(cl_uint), &m);
+        status |= clSetKernelArg(kernel, 1, sizeof(cl_uint), &n);
+        status |= clSetKernelArg(kernel, 2, sizeof(cl_float), &alpha);
+        status |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &a);
+        status |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &lda);
+        status |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &x);
+        status |= clSetKernelArg(kernel, 6, sizeof(cl_float), &beta);
+        status |= clSetKernelArg(kernel, 7, sizeof(cl_mem), &y);
+
+        if (layout == GEMV_ROW_MAJOR)
+        {
+            /* Fewer work-items for larger batches keeps l_sum at ROWS*256 floats */
+            size_t localSize = GEMV_LOCAL_SIZE / batch >= 32 ? GEMV_LOCAL_SIZE / batch : 32;
+            while (localSize & (localSize - 1))
+                localSize &= localSize - 1;
+            size_t globalSize = (m + GEMV_ROWS - 1) / GEMV_ROWS * localSize;
+            status |= clSetKernelArg(kernel, 8, GEMV_ROWS * batch * localSize * sizeof(cl_float), NULL);
+            status |= clSetKernelArg(kernel, 9, sizeof(cl_uint), &ldx);
+            status |= clSetKernelArg(kernel, 10, sizeof(cl_uint), &ldy);
+            status |= clSetKernelArg(kernel, 11, sizeof(cl_ulong), &xOffset);
+            status |= clSetKernelArg(kernel, 12, sizeof(cl_ulong), &yOffset);
+            if (status != CL_SUCCESS)
+                return status;
+            return clEnqueueNDRangeKernel(m_queue, kernel, 1, NULL, &globalSize, &localSize, 0, NULL, event);
+        }
+
+        cl_uint xTile = GEMV_X_TILE / batch;
+        size_t localSize[2] = { GEMV_COL_ROWS, GEMV_COL_SLICES };
+        size_t globalSize[2] = { (m + GEMV_COL_ROWS - 1) / GEMV_COL_ROWS * GEMV_COL_ROWS, GEMV_COL_SLICES };
+        status |= clSetKernelArg(kernel, 8, batch * xTile * sizeof(cl_float), NULL);
+        status |= clSetKernelArg(kernel, 9, batch * localSize[0] * localSize[1] * sizeof(cl_float), NULL);
+        status |= clSetKernelArg(kernel, 10, sizeof(cl_uint), &xTile);
+        status |= clSetKernelArg(kernel, 11, sizeof(cl_uint), &ldx);
+        status |= clSetKernelArg(kernel, 12, sizeof(cl_uint), &ldy);
+        status |= clSetKernelArg(kernel, 13, sizeof(cl_ulong), &xOffset);
+        status |= clSetKernelArg(kernel, 14, sizeof(cl_ulong), &yOffset);
+        if (status != CL_SUCCESS)
+            return status;
+        return clEnqueueNDRangeKernel(m_queue, kernel, 2, NULL, globalSize, localSize, 0, NULL, event);
+    }
+
+    /* One program per batch width */
+    cl_kernel getKernel(const char *name, cl_uint batch, cl_int *status)
+    {
+        char options[64];
+        snprintf(options, sizeof(options), "-D ROWS=%d -D BATCH=%u", GEMV_ROWS, batch);
+        std::string key = std::string(options) + ' ' + name;
+        std::map<std::string, cl_kernel>::iterator it = m_kernels.find(key);
+        if (it != m_kernels.end())
+        {
+            *status = CL_SUCCESS;
+            return it->second;
+        }
+
+        cl_kernel kernel = m_cache.createKernel(m_programFile, options, name, status);
+        if (*status == CL_SUCCESS)
+        {
+            m_kernels[key] = kernel;
+        }
+        return kernel;
+    }
+
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::string m_programFile;
+    std::map<std::string, cl_kernel> m_kernels;
+};
+
+/*
+ * Keeps one matrix resident on the device and streams vectors through it.
+ * Each of the ring's slots owns pinned (CL_MEM_ALLOC_HOST_PTR, mapped once)
+ * host staging for batch input and output vectors plus device x/y buffers.
+ * Uploads and read-backs go on a transfer queue and the gemv on a compute
+ * queue, chained by events, so the upload of one slot overlaps the compute
+ * of the previous one. push() fills the next slot, pop() returns the
+ * oldest; push() fails with CL_OUT_OF_RESOURCES while every slot is busy.
+ */
+class GemvStream
+{
+public:
+    GemvStream(GemvEngine &engine, cl_context context, cl_command_queue transferQueue,
+               cl_command_queue computeQueue, GemvLayout layout, cl_uint m, cl_uint n, cl_mem a, cl_uint lda,
+               cl_uint batch = 1, cl_uint slots = GEMV_RING_SLOTS)
+        : m_engine(engine), m_transfer(transferQueue), m_compute(computeQueue), m_layout(layout), m_m(m), m_n(n),
+          m_a(a), m_lda(lda), m_batch(batch), m_slots(slots), m_head(0), m_size(0), m_status(CL_SUCCESS)
+    {
+        for (cl_uint i = 0; i < slots; i++)
+        {
+            Slot slot;
+            memset(&slot, 0, sizeof(slot));
+            slot.hostX = createPinned(context, (size_t)n * batch, &slot.pinnedX);
+            slot.hostY = createPinned(context, (size_t)m * batch, &slot.pinnedY);
+            slot.x = createBuffer(context, (size_t)n * batch, CL_MEM_READ_ONLY);
+            slot.y = createBuffer(context, (size_t)m * batch, CL_MEM_READ_WRITE);
+            m_ring.push_back(slot);
+        }
+    }
+
+    ~GemvStream()
+    {
+        clFinish(m_transfer);
+        clFinish(m_compute);
+        for (size_t i = 0; i < m_ring.size(); i++)
+        {
+            Slot &slot = m_ring[i];
+            if (slot.done != NULL)
+                clReleaseEvent(slot.done);
+            if (slot.pinnedX != NULL)
+            {
+                clEnqueueUnmapMemObject(m_transfer, slot.pinnedX, slot.hostX, 0, NULL, NULL);
+                clReleaseMemObject(slot.pinnedX);
+            }
+            if (slot.pinnedY != NULL)
+            {
+                clEnqueueUnmapMemObject(m_transfer, slot.pinnedY, slot.hostY, 0, NULL, NULL);
+                clReleaseMemObject(slot.pinnedY);
+            }
+            if (slot.x != NULL)
+                clReleaseMemObject(slot.x);
+            if (slot.y != NULL)
+                clReleaseMemObject(slot.y);
+        }
+        clFinish(m_transfer);
+    }
+
+    /* CL_SUCCESS if every buffer of the ring was created */
+    cl_int status() const { return m_status; }
+    cl_uint batch() const { return m_batch; }
+    bool full() const { return m_size == m_slots; }
+    bool empty() const { return m_size == 0; }
+
+    /* x holds batch vectors of n floats back to back */
+    cl_int push(const float *x)
+    {
+        if (m_status != CL_SUCCESS)
+            return m_status;
+        if (full())
+            return CL_OUT_OF_RESOURCES;
+
+        Slot &slot = m_ring[(m_head + m_size) % m_slots];
+        cl_event written, computed;
+        size_t xBytes = (size_t)m_n * m_batch * sizeof(float);
+        size_t yBytes = (size_t)m_m * m_batch * sizeof(float);
+
+        memcpy(slot.hostX, x, xBytes);
+        cl_int status = clEnqueueWriteBuffer(m_transfer, slot.x, CL_FALSE, 0, xBytes, slot.hostX, 0, NULL, &written);
+        if (status != CL_SUCCESS)
+            return status;
+        clFlush(m_transfer);
+
+        /* The compute queue waits for the upload, the read-back for the compute */
+        status = clEnqueueMarkerWithWaitList(m_compute, 1, &written, NULL);
+        clReleaseEvent(written);
+        if (status == CL_SUCCESS)
+            status = m_engine.gemvBatched(m_layout, m_m, m_n, m_batch, 1.0f, m_a, m_lda, slot.x, m_n, 0.0f,
+                                          slot.y, m_m, &computed);
+        if (status != CL_SUCCESS)
+            return status;
+        clFlush(m_compute);
+
+        status = clEnqueueReadBuffer(m_transfer, slot.y, CL_FALSE, 0, yBytes, slot.hostY, 1, &computed, &slot.done);
+        clReleaseEvent(computed);
+        if (status != CL_SUCCESS)
+            return status;
+        clFlush(m_transfer);
+        m_size++;
+        return CL_SUCCESS;
+    }
+
+    /* Waits for the oldest slot and copies its batch * m results to y */
+    cl_int pop(float *y)
+    {
+        if (empty())
+            return CL_INVALID_OPERATION;
+
+        Slot &slot = m_ring[m_head];
+        cl_int status = clWaitForEvents(1, &slot.done);
+        clReleaseEvent(slot.done);
+        slot.done = NULL;
+        if (status == CL_SUCCESS)
+            memcpy(y, slot.hostY, (size_t)m_m * m_batch * sizeof(float));
+        m_head = (m_head + 1) % m_slots;
+        m_size--;
+        return status;
+    }
+
+private:
+    struct Slot
+    {
+        cl_mem pinnedX, pinnedY;
+        float *hostX, *hostY;
+        cl_mem x, y;
+        cl_event done;
+    };
+
+    float *createPinned(cl_context context, size_t count, cl_mem *buffer)
+    {
+        cl_int status;
+        *buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, count * sizeof(float), NULL,
+                                 &status);
+        if (status != CL_SUCCESS)
+        {
+            *buffer = NULL;
+            m_status = status;
+            return NULL;
+        }
+        float *host = (float *)clEnqueueMapBuffer(m_transfer, *buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
+                                                  count * sizeof(float), 0, NULL, NULL, &status);
+        if (status != CL_SUCCESS)
+            m_status = status;
+        return host;
+    }
+
+    cl_mem createBuffer(cl_context context, size_t count, cl_mem_flags flags)
+    {
+        cl_int status;
+        cl_mem buffer = clCreateBuffer(context, flags, count * sizeof(float), NULL, &status);
+        if (status != CL_SUCCESS)
+        {
+            m_status = status;
+            return NULL;
+        }
+        return buffer;
+    }
+
+    GemvEngine &m_engine;
+    cl_command_queue m_transfer;
+    cl_command_queue m_compute;
+    GemvLayout m_layout;
+    cl_uint m_m, m_n;
+    cl_mem m_a;
+    cl_uint m_lda;
+    cl_uint m_batch;
+    cl_uint m_slots;
+    cl_uint m_head, m_size;
+    cl_int m_status;
+    std::vector<Slot> m_ring;
+};
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * One reduction tree for every element type and operator. The host picks
+ * both at build time:
+ *
+ *    -D T=<storage type> -D ACC=<accumulator type> -D T_HALF (half storage)
+ *    -D ACC_LOWEST=<min value> -D ACC_HIGHEST=<max value>
+ *    -D OP_SUM | OP_MIN | OP_MAX | OP_ARGMIN | OP_ARGMAX | OP_MEANVAR
+ *    -D USE_SUBGROUPS (device reports cl_khr_subgroups)
+ *    -D MAP_MUL | MAP_ABS | MAP_SQUARE (fused map for reduce_map*)
+ */
+
+#ifdef USE_FP64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+#ifdef USE_SUBGROUPS
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+#endif
+
+#define CAT(a, b) a##b
+#define VEC4(t) CAT(t, 4)
+#define CONVERT(t) CAT(convert_, t)
+
+/* half data is read through vload_half, so cl_khr_fp16 is not required */
+#ifdef T_HALF
+#define LOAD(p, i) vload_half(i, p)
+#define LOAD4(p, i) vload_half4((i) / 4, p)
+#else
+#define LOAD(p, i) ((ACC)(p)[i])
+#define LOAD4(p, i) CONVERT(VEC4(ACC))(vload4((i) / 4, p))
+#endif
+
+#if defined(OP_SUM) || defined(OP_MIN) || defined(OP_MAX)
+
+typedef ACC state_t;
+
+#if defined(OP_SUM)
+#define IDENTITY ((ACC)0)
+#define COMBINE(a, b) ((a) + (b))
+#define SUB_GROUP_REDUCE(x) sub_group_reduce_add(x)
+#elif defined(OP_MIN)
+#define IDENTITY ((ACC)ACC_HIGHEST)
+#define COMBINE(a, b) min(a, b)
+#define SUB_GROUP_REDUCE(x) sub_group_reduce_min(x)
+#else
+#define IDENTITY ((ACC)ACC_LOWEST)
+#define COMBINE(a, b) max(a, b)
+#define SUB_GROUP_REDUCE(x) sub_group_reduce_max(x)
+#endif
+
+inline state_t make_state(ACC x, ulong index) {
+   return x;
+}
+
+inline state_t identity_state() {
+   return IDENTITY;
+}
+
+inline state_t combine(state_t a, state_t b) {
+   return COMBINE(a, b);
+}
+
+#elif defined(OP_ARGMIN) || defined(OP_ARGMAX)
+
+typedef struct {
+   ACC value;
+   ulong index;
+} state_t;
+
+inline state_t make_state(ACC x, ulong index) {
+   state_t s;
+   s.value = x;
+   s.index = index;
+   return s;
+}
+
+inline state_t identity_state() {
+#ifdef OP_ARGMIN
+   return make_state((ACC)ACC_HIGHEST, ULONG_MAX);
+#else
+   return make_state((ACC)ACC_LOWEST, ULONG_MAX);
+#endif
+}
+
+/* Ties go to the lower index so the result does not depend on the tree */
+inline state_t combine(state_t a, state_t b) {
+#ifdef OP_ARGMIN
+   if(b.value < a.value || (b.value == a.value && b.index < a.index))
+#else
+   if(b.value > a.value || (b.value == a.value && b.index < a.index))
+#endif
+      return b;
+   return a;
+}
+
+#elif defined(OP_MEANVAR)
+
+/* Welford running mean and sum of squared deviations */
+typedef struct {
+   ACC mean;
+   ACC m2;
+   ulong count;
+} state_t;
+
+inline state_t make_state(ACC x, ulong index) {
+   state_t s;
+   s.mean = x;
+   s.m2 = (ACC)0;
+   s.count = 1;
+   return s;
+}
+
+inline state_t identity_state() {
+   state_t s;
+   s.mean = (ACC)0;
+   s.m2 = (ACC)0;
+   s.count = 0;
+   return s;
+}
+
+/* Chan et al. pairwise update; a single element is the Welford step */
+inline state_t combine(state_t a, state_t b) {
+   state_t s;
+   ACC n, delta;
+
+   if(a.count == 0)
+      return b;
+   if(b.count == 0)
+      return a;
+
+   s.count = a.count + b.count;
+   n = (ACC)s.count;
+   delta = b.mean - a.mean;
+   s.mean = a.mean + delta * ((ACC)b.count / n);
+   s.m2 = a.m2 + b.m2 + delta * delta * ((ACC)a.count * (ACC)b.count / n);
+   return s;
+}
+
+#else
+#error "Define one of OP_SUM, OP_MIN, OP_MAX, OP_ARGMIN, OP_ARGMAX, OP_MEANVAR"
+#endif
+
+/* Tree over the work-group; the local size must be a power of two */
+inline void reduce_group(__local state_t *scratch) {
+
+   uint lid = get_local_id(0);
+
+   barrier(CLK_LOCAL_MEM_FENCE);
+   for(uint i = get_local_size(0)/2; i > 0; i >>= 1) {
+      if(lid < i) {
+         scratch[lid] = combine(scratch[lid], scratch[lid + i]);
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+}
+
+/* Combine one state per work-item; the result is valid in work-item 0.
+   Scalar ops use sub-group reductions in place of the barrier steps. */
+inline state_t reduce_group_state(state_t s, __local state_t *scratch) {
+
+#if defined(USE_SUBGROUPS) && defined(SUB_GROUP_REDUCE)
+   uint num_sub_groups = get_num_sub_groups();
+
+   s = SUB_GROUP_REDUCE(s);
+   if(get_sub_group_local_id() == 0) {
+      scratch[get_sub_group_id()] = s;
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   if(get_sub_group_id() == 0) {
+      s = identity_state();
+      for(uint i = get_sub_group_local_id(); i < num_sub_groups;
+            i += get_sub_group_size()) {
+         s = combine(s, scratch[i]);
+      }
+      s = SUB_GROUP_REDUCE(s);
+   }
+   return s;
+#else
+   scratch[get_local_id(0)] = s;
+   reduce_group(scratch);
+   return scratch[0];
+#endif
+}
+
+/* First pass: one element per work-item, out-of-range items add the identity.
+   base is the index of data[0] in the whole input when it arrives in chunks. */
+__kernel void reduce_data(__global const T *data, ulong count,
+      __local state_t *scratch, __global state_t *partials, ulong base) {
+
+   ulong gid = get_global_id(0);
+   state_t s;
+
+   s = gid < count ? make_state(LOAD(data, gid), base + gid) : identity_state();
+   s = reduce_group_state(s, scratch);
+
+   if(get_local_id(0) == 0) {
+      partials[get_group_id(0)] = s;
+   }
+}
+
+/* First pass for large inputs: a fixed grid walks the data with four-wide
+   loads, so each work-item accumulates many elements before the tree */
+__kernel void reduce_data_strided(__global const T *data, ulong count,
+      __local state_t *scratch, __global state_t *partials, ulong base) {
+
+   ulong stride = get_global_size(0) * 4;
+   state_t s = identity_state();
+   VEC4(ACC) v;
+
+   for(ulong i = get_global_id(0) * 4; i < count; i += stride) {
+      if(i + 4 <= count) {
+         v = LOAD4(data, i);
+         s = combine(s, make_state(v.s0, base + i));
+         s = combine(s, make_state(v.s1, base + i + 1));
+         s = combine(s, make_state(v.s2, base + i + 2));
+         s = combine(s, make_state(v.s3, base + i + 3));
+      }
+      else {
+         for(ulong j = i; j < count; j++) {
+            s = combine(s, make_state(LOAD(data, j), base + j));
+         }
+      }
+   }
+   s = reduce_group_state(s, scratch);
+
+   if(get_local_id(0) == 0) {
+      partials[get_group_id(0)] = s;
+   }
+}
+
+#if defined(MAP_MUL) || defined(MAP_ABS) || defined(MAP_SQUARE)
+
+/* Fused map-reduce: the mapped value of a (and b) goes straight into the
+   state, the mapped array never exists. MAP works on scalars and vectors. */
+#if defined(MAP_MUL)
+#define MAP(x, y) ((x) * (y))
+#elif defined(MAP_ABS)
+#define MAP(x, y) fabs(x)
+#else
+#define MAP(x, y) ((x) * (x))
+#endif
+
+__kernel void reduce_map(__global const T *a, ulong count,
+      __local state_t *scratch, __global state_t *partials, ulong base,
+      __global const T *b) {
+
+   ulong gid = get_global_id(0);
+   state_t s;
+
+   s = gid < count ? make_state(MAP(LOAD(a, gid), LOAD(b, gid)), base + gid) : identity_state();
+   s = reduce_group_state(s, scratch);
+
+   if(get_local_id(0) == 0) {
+      partials[get_group_id(0)] = s;
+   }
+}
+
+__kernel void reduce_map_strided(__global const T *a, ulong count,
+      __local state_t *scratch, __global state_t *partials, ulong base,
+      __global const T *b) {
+
+   ulong stride = get_global_size(0) * 4;
+   state_t s = identity_state();
+   VEC4(ACC) v;
+
+   for(ulong i = get_global_id(0) * 4; i < count; i += stride) {
+      if(i + 4 <= count) {
+         v = MAP(LOAD4(a, i), LOAD4(b, i));
+         s = combine(s, make_state(v.s0, base + i));
+         s = combine(s, make_state(v.s1, base + i + 1));
+         s = combine(s, make_state(v.s2, base + i + 2));
+         s = combine(s, make_state(v.s3, base + i + 3));
+      }
+      else {
+         for(ulong j = i; j < count; j++) {
+            s = combine(s, make_state(MAP(LOAD(a, j), LOAD(b, j)), base + j));
+         }
+      }
+   }
+   s = reduce_group_state(s, scratch);
+
+   if(get_local_id(0) == 0) {
+      partials[get_group_id(0)] = s;
+   }
+}
+
+#endif
+
+/* Later passes combine the partial states of the previous pass */
+__kernel void reduce_states(__global const state_t *input, ulong count,
+      __local state_t *scratch, __global state_t *output) {
+
+   ulong gid = get_global_id(0);
+   state_t s;
+
+   s = gid < count ? input[gid] : identity_state();
+   s = reduce_group_state(s, scratch);
+
+   if(get_local_id(0) == 0) {
+      output[get_group_id(0)] = s;
+   }
+}
@@ -0,0 +1,500 @@
+#include <CL/cl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "reduction.hpp"
+#include "../common/host_memory.hpp"
+
+#define ARRAY_SIZE (1 << 20)
+#define BENCH_SIZE (1 << 26)
+#define LOOP 10
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+bool has_extension(cl_device_id device, const char *name)
+{
+    size_t size = 0;
+    clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, NULL, &size);
+    std::string extensions(size, '\0');
+    clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, size, &extensions[0], NULL);
+    return extensions.find(name) != std::string::npos;
+}
+
+/* Round-to-nearest-even float to half; the test data are small integers */
+cl_half float_to_half(float value)
+{
+    cl_uint bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    cl_uint sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    cl_uint mantissa = bits & 0x7fffff;
+
+    if (exponent <= 0)
+        return (cl_half)sign;
+    if (exponent >= 31)
+        return (cl_half)(sign | 0x7c00);
+
+    cl_uint half = sign | (exponent << 10) | (mantissa >> 13);
+    cl_uint rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return (cl_half)half;
+}
+
+/* Reference result computed in double on the host */
+template <typename T>
+ReduceResult reference(const std::vector<T> &data, ReduceOp op)
+{
+    ReduceResult r;
+    memset(&r, 0, sizeof(r));
+
+    double sum = 0.0, mean = 0.0, m2 = 0.0;
+    if (data.empty())
+        return r;
+    r.value = data[0];
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        double x = data[i];
+        sum += x;
+        if ((op == REDUCE_MIN || op == REDUCE_ARGMIN) && x < r.value)
+        {
+            r.value = x;
+            r.index = i;
+        }
+        if ((op == REDUCE_MAX || op == REDUCE_ARGMAX) && x > r.value)
+        {
+            r.value = x;
+            r.index = i;
+        }
+        double delta = x - mean;
+        mean += delta / (i + 1);
+        m2 += delta * (x - mean);
+    }
+
+    if (op == REDUCE_SUM)
+        r.value = sum;
+    if (op == REDUCE_MEANVAR)
+    {
+        r.value = r.mean = mean;
+        r.variance = m2 / data.size();
+        r.count = data.size();
+    }
+    return r;
+}
+
+bool close_enough(double actual, double expected)
+{
+    return fabs(actual - expected) <= 1e-3 * fabs(expected) + 1e-3;
+}
+
+bool check(const ReduceResult &r, const ReduceResult &ref, ReduceOp op)
+{
+    switch (op)
+    {
+    case REDUCE_ARGMIN:
+    case REDUCE_ARGMAX:
+        return r.value == ref.value && r.index == ref.index;
+    case REDUCE_MEANVAR:
+        return close_enough(r.mean, ref.mean) && close_enough(r.variance, ref.variance) &&
+               r.count == ref.count;
+    default:
+        return close_enough(r.value, ref.value);
+    }
+}
+
+/* Lengths around every boundary of the tree and strided passes, plus primes */
+std::vector<size_t> sweep_lengths(size_t localSize)
+{
+    static const size_t fixed[] = { 1, 2, 3, 5, 7, 13, 31, 97, 251, 1021, 4099, 65521, 1000003 };
+    std::vector<size_t> lengths(fixed, fixed + sizeof(fixed) / sizeof(fixed[0]));
+    for (size_t p = 4; p <= (1 << 18); p <<= 2)
+    {
+        lengths.push_back(p - 1);
+        lengths.push_back(p);
+        lengths.push_back(p + 1);
+    }
+    lengths.push_back(4 * localSize - 1);
+    lengths.push_back(4 * localSize + 1);
+    lengths.push_back(localSize * localSize + 1);
+    return lengths;
+}
+
+/*
+ * Every sweep length through both variants and both entry points. The host
+ * path uses a small chunk so long inputs cross several chunks, and reads
+ * from a host pointer one element past an aligned address.
+ */
+int length_sweep(cl_context context, ReductionEngine &engine)
+{
+    static const ReduceOp ops[] = { REDUCE_SUM, REDUCE_ARGMAX, REDUCE_MEANVAR };
+    static const char *opNames[] = { "sum", "min", "max", "argmin", "argmax", "meanvar" };
+    std::vector<size_t> lengths = sweep_lengths(REDUCTION_LOCAL_SIZE);
+    int failed = 0, cases = 0;
+    cl_int err;
+
+    engine.setChunkBytes(40000 * sizeof(cl_float));
+    for (size_t l = 0; l < lengths.size(); l++)
+    {
+        size_t count = lengths[l];
+        std::vector<float> data(count);
+        std::vector<cl_float> f(count + 1);
+        std::vector<cl_int> n(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            data[i] = (float)((i * 7919 + count) % 2001) - 1000.0f;
+            f[i + 1] = data[i];
+            n[i] = (cl_int)data[i];
+        }
+
+        cl_mem floats = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                       count * sizeof(cl_float), &f[1], &err);
+        cl_mem ints = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                     n.size() * sizeof(cl_int), n.data(), &err);
+        if (err < 0)
+        {
+            perror("Couldn't create a buffer");
+            exit(1);
+        }
+
+        for (int variant = REDUCE_TREE; variant <= REDUCE_STRIDED; variant++)
+        {
+            engine.setVariant((ReduceVariant)variant);
+            for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++)
+            {
+                ReduceResult ref = reference(data, ops[o]);
+                ReduceResult fromHost, fromDevice;
+
+                err = engine.reduce(&f[1], count, REDUCE_FLOAT, ops[o], &fromHost);
+                bool ok = err == CL_SUCCESS && check(fromHost, ref, ops[o]);
+
+                err = engine.reduce(floats, count, REDUCE_FLOAT, ops[o], &fromDevice);
+                ok = ok && err == CL_SUCCESS && check(fromDevice, ref, ops[o]);
+
+                cases++;
+                if (!ok)
+                {
+                    failed = 1;
+                    printf("sweep float %s length %u variant %d: Check failed.\n", opNames[ops[o]],
+                           (unsigned int)count, variant);
+                }
+            }
+
+            ReduceResult ref = reference(data, REDUCE_SUM), fromHost, fromDevice;
+            err = engine.reduce(n.data(), count, REDUCE_INT, REDUCE_SUM, &fromHost);
+            bool ok = err == CL_SUCCESS && fromHost.value == ref.value;
+            err = engine.reduce(ints, count, REDUCE_INT, REDUCE_SUM, &fromDevice);
+            ok = ok && err == CL_SUCCESS && fromDevice.value == ref.value;
+            cases++;
+            if (!ok)
+            {
+                failed = 1;
+                printf("sweep int sum length %u variant %d: Check failed.\n", (unsigned int)count, variant);
+            }
+        }
+
+        clReleaseMemObject(floats);
+        clReleaseMemObject(ints);
+    }
+    engine.setChunkBytes(REDUCTION_CHUNK_BYTES);
+
+    printf("length sweep: %d cases over %u lengths, %s\n", cases, (unsigned int)lengths.size(),
+           failed ? "Check failed." : "Check passed.");
+    return failed;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+}
+
+/* Float sum bandwidth of each variant against a device buffer copy */
+void bandwidth_benchmark(cl_context context, cl_command_queue queue, ReductionEngine &engine, size_t count)
+{
+    static const char *variantNames[] = { "tree", "strided" };
+    size_t bytes = count * sizeof(cl_float);
+    cl_float one = 1.0f;
+    cl_int err;
+    std::chrono::steady_clock::time_point start, end;
+
+    cl_mem src = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    cl_mem dst = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a buffer");
+        exit(1);
+    }
+    clEnqueueFillBuffer(queue, src, &one, sizeof(one), 0, bytes, 0, NULL, NULL);
+
+    /* A copy reads and writes every byte */
+    clEnqueueCopyBuffer(queue, src, dst, 0, 0, bytes, 0, NULL, NULL);
+    clFinish(queue);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < LOOP; i++)
+    {
+        clEnqueueCopyBuffer(queue, src, dst, 0, 0, bytes, 0, NULL, NULL);
+    }
+    clFinish(queue);
+    end = std::chrono::steady_clock::now();
+    double copyRate = 2.0 * bytes * LOOP / (elapsed_ms(start, end) * 1e6);
+    printf("bandwidth, %u floats: device copy %.2f GB/s\n", (unsigned int)count, copyRate);
+
+    for (int variant = REDUCE_TREE; variant <= REDUCE_STRIDED; variant++)
+    {
+        ReduceResult result;
+        engine.setVariant((ReduceVariant)variant);
+        engine.reduce(src, count, REDUCE_FLOAT, REDUCE_SUM, &result);
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < LOOP; i++)
+        {
+            engine.reduce(src, count, REDUCE_FLOAT, REDUCE_SUM, &result);
+        }
+        end = std::chrono::steady_clock::now();
+        double rate = (double)bytes * LOOP / (elapsed_ms(start, end) * 1e6);
+        printf("  %-7s sum %.2f GB/s (%.0f%% of copy)%s\n", variantNames[variant], rate,
+               100.0 * rate / copyRate, close_enough(result.value, (double)count) ? "" : "  Check failed.");
+    }
+
+    clReleaseMemObject(src);
+    clReleaseMemObject(dst);
+}
+
+/*
+ * Every op and variant over the elements of an array file, in a buffer over
+ * the mapped file. float32, float64 and int32 files, any shape.
+ */
+int reduce_file(cl_context context, cl_device_id device, ReductionEngine &engine, const char *path)
+{
+    static const char *opNames[] = { "sum", "min", "max", "argmin", "argmax", "meanvar" };
+    static const char *variantNames[] = { "tree", "strided" };
+    ArrayFile file;
+    if (!file.open(path))
+    {
+        printf("%s: %s\n", path, file.error());
+        return 1;
+    }
+    ReduceType type = file.type() == ARRAY_FLOAT32 ? REDUCE_FLOAT :
+                      file.type() == ARRAY_FLOAT64 ? REDUCE_DOUBLE :
+                      file.type() == ARRAY_INT32 ? REDUCE_INT : (ReduceType)-1;
+    if (type == (ReduceType)-1 || !file.contiguous() || file.count() == 0)
+    {
+        printf("%s: expected contiguous float32, float64 or int32 data, got %s\n", path,
+               arrayTypeName(file.type()));
+        return 1;
+    }
+    if (type == REDUCE_DOUBLE && !has_extension(device, "cl_khr_fp64"))
+    {
+        printf("%s: float64 data, but the device has no cl_khr_fp64\n", path);
+        return 1;
+    }
+
+    size_t count = file.count();
+    std::vector<double> data(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        data[i] = type == REDUCE_FLOAT ? file.data<cl_float>()[i] :
+                  type == REDUCE_DOUBLE ? file.data<cl_double>()[i] : file.data<cl_int>()[i];
+    }
+
+    cl_int err;
+    cl_mem buffer = createArrayBuffer(context, CL_MEM_READ_ONLY, file, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a buffer");
+        exit(1);
+    }
+
+    int failed = 0;
+    printf("%s: %u %s elements\n", path, (unsigned int)count, arrayTypeName(file.type()));
+    for (int n = 0; n < 2 * (REDUCE_MEANVAR + 1); n++)
+    {
+        int op = n % (REDUCE_MEANVAR + 1);
+        int variant = n / (REDUCE_MEANVAR + 1);
+        ReduceResult result;
+        engine.setVariant((ReduceVariant)variant);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        err = engine.reduce(buffer, count, type, (ReduceOp)op, &result);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        bool ok = err == CL_SUCCESS && check(result, reference(data, (ReduceOp)op), (ReduceOp)op);
+        failed |= !ok;
+        printf("  %-7s %-7s: %s  value %g index %llu  %.3f ms\n", opNames[op], variantNames[variant],
+               ok ? "Check passed." : "Check failed.", result.value, (unsigned long long)result.index,
+               std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0);
+    }
+
+    clReleaseMemObject(buffer);
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *typeNames[] = { "float", "double", "int", "half" };
+    static const char *opNames[] = { "sum", "min", "max", "argmin", "argmax", "meanvar" };
+    static const char *variantNames[] = { "tree", "strided" };
+
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_int err;
+    size_t count = ARRAY_SIZE;
+    size_t benchCount = BENCH_SIZE;
+    int failed = 0;
+
+    /* reduction [count | data.arr] [bandwidth count] */
+    const char *path = NULL;
+    if (argc > 1)
+    {
+        if (isArrayFileArgument(argv[1]))
+            path = argv[1];
+        else if (!parseArrayCount(argv[1], &count))
+        {
+            printf("%s: neither a positive count nor an array file\n", argv[1]);
+            printf("usage: %s [count | data.arr] [bandwidth count]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (argc > 2)
+    {
+        benchCount = strtoull(argv[2], NULL, 10);
+    }
+
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+    queue = clCreateCommandQueue(context, device, 0, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a command queue");
+        exit(1);
+    }
+
+    ProgramCache cache(context, device);
+    ReductionEngine engine(cache, queue);
+    bool fp64 = has_extension(device, "cl_khr_fp64");
+    printf("sub-group tail: %s\n", engine.usesSubgroups() ? "yes" : "no (needs cl_khr_subgroups and OpenCL C 2.0)");
+
+    /* reduction data.arr: reduce the elements of an array file instead of the tests */
+    if (path != NULL)
+    {
+        failed = reduce_file(context, device, engine, path);
+        clReleaseCommandQueue(queue);
+        clReleaseContext(context);
+        return failed;
+    }
+
+    /* Small integers are exact in every element type */
+    std::vector<float> data(count);
+    srand(123);
+    for (size_t i = 0; i < count; i++)
+    {
+        data[i] = (float)(rand() % 2001 - 1000);
+    }
+
+    for (int type = REDUCE_FLOAT; type <= REDUCE_HALF; type++)
+    {
+        if (type == REDUCE_DOUBLE && !fp64)
+        {
+            printf("double: skipped, device has no cl_khr_fp64\n");
+            continue;
+        }
+
+        /* Convert the test data to the element type */
+        size_t elementSize = ReductionEngine::elementSize((ReduceType)type);
+        std::vector<unsigned char> host(count * elementSize);
+        for (size_t i = 0; i < count; i++)
+        {
+            cl_float f = data[i];
+            cl_double d = data[i];
+            cl_int n = (cl_int)data[i];
+            cl_half h = float_to_half(data[i]);
+            const void *src = type == REDUCE_DOUBLE ? (const void *)&d :
+                              type == REDUCE_INT ? (const void *)&n :
+                              type == REDUCE_HALF ? (const void *)&h : (const void *)&f;
+            memcpy(&host[i * elementSize], src, elementSize);
+        }
+
+        cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                       host.size(), host.data(), &err);
+        if (err < 0)
+        {
+            perror("Couldn't create a buffer");
+            exit(1);
+        }
+
+        for (int n = 0; n < 2 * (REDUCE_MEANVAR + 1); n++)
+        {
+            int op = n % (REDUCE_MEANVAR + 1);
+            int variant = n / (REDUCE_MEANVAR + 1);
+            ReduceResult result;
+            engine.setVariant((ReduceVariant)variant);
+            ReduceResult ref = reference(data, (ReduceOp)op);
+
+            /* The first call builds the program, the second one is timed */
+            engine.reduce(buffer, count, (ReduceType)type, (ReduceOp)op, &result);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            err = engine.reduce(buffer, count, (ReduceType)type, (ReduceOp)op, &result);
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            if (err != CL_SUCCESS)
+            {
+                printf("%s %s %s: reduce error %d\n", typeNames[type], opNames[op],
+                       variantNames[variant], err);
+                failed = 1;
+                continue;
+            }
+
+            bool ok = check(result, ref, (ReduceOp)op);
+            failed |= !ok;
+            printf("%-6s %-7s %-7s: %s  value %g index %llu mean %g variance %g  %.3f ms\n",
+                   typeNames[type], opNames[op], variantNames[variant], ok ? "Check passed." : "Check failed.",
+                   result.value, (unsigned long long)result.index, result.mean, result.variance,
+                   std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0);
+        }
+
+        clReleaseMemObject(buffer);
+    }
+
+    failed |= length_sweep(context, engine);
+
+    printf("programs built: %u\n", (unsigned int)cache.builds());
+
+    bandwidth_benchmark(context, queue, engine, benchCount);
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+    return failed;
+}
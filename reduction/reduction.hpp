@@ -0,0 +1,575 @@
+#ifndef REDUCTION_HPP
+#define REDUCTION_HPP
+
+#include <CL/cl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../common/future.hpp"
+#include "../common/program_cache.hpp"
+
+#define REDUCTION_PROGRAM_FILE "reduction.cl"
+#define REDUCTION_LOCAL_SIZE 256
+#define REDUCTION_CHUNK_BYTES (64 << 20)
+
+enum ReduceType
+{
+    REDUCE_FLOAT,
+    REDUCE_DOUBLE,
+    REDUCE_INT,
+    REDUCE_HALF
+};
+
+enum ReduceOp
+{
+    REDUCE_SUM,
+    REDUCE_MIN,
+    REDUCE_MAX,
+    REDUCE_ARGMIN,
+    REDUCE_ARGMAX,
+    REDUCE_MEANVAR
+};
+
+/*
+ * REDUCE_TREE loads one element per work-item in the first pass.
+ * REDUCE_STRIDED launches a fixed grid sized to the device that walks the
+ * data with four-wide loads, leaving only a few partials for later passes.
+ */
+enum ReduceVariant
+{
+    REDUCE_TREE,
+    REDUCE_STRIDED
+};
+
+/* Fused map-reduce over one or two inputs; the mapped values are never stored */
+enum MapReduceOp
+{
+    MAPREDUCE_DOT,            /* sum(a*b) */
+    MAPREDUCE_L1,             /* sum(|a|) */
+    MAPREDUCE_L2,             /* sqrt(sum(a*a)) */
+    MAPREDUCE_LINF,           /* max(|a|) */
+    MAPREDUCE_MUL_MAX,        /* max(a*b) */
+    MAPREDUCE_WEIGHTED_SUM = MAPREDUCE_DOT  /* sum(w*a), weights in b */
+};
+
+/* value holds sum/min/max; index is set by argmin/argmax; mean/variance by meanvar */
+struct ReduceResult
+{
+    double value;
+    cl_ulong index;
+    double mean;
+    double variance;
+    cl_ulong count;
+};
+
+/*
+ * Runs reduction.cl for any (type, op) pair. The first pass reads the data,
+ * further passes reduce the per-group states until one is left, all on the
+ * device; only the final state is read back. Sub-group reductions replace
+ * the last barrier steps when the device reports cl_khr_subgroups and
+ * OpenCL C 2.0, unless that build fails.
+ * mapReduce fuses an elementwise map of one or two inputs into the first
+ * pass (dot products, norms, multiply-max).
+ *
+ * The Async forms return once everything is enqueued; the result is written
+ * when the returned future is waited on. They share the scratch buffers, so
+ * calls on one engine must stay on its in-order queue.
+ */
+class ReductionEngine
+{
+public:
+    ReductionEngine(ProgramCache &cache, cl_command_queue queue,
+                    const std::string &programFile = REDUCTION_PROGRAM_FILE,
+                    size_t localSize = REDUCTION_LOCAL_SIZE)
+        : m_cache(cache), m_queue(queue), m_programFile(programFile), m_localSize(localSize),
+          m_variant(REDUCE_STRIDED)
+    {
+        m_scratch[0] = m_scratch[1] = NULL;
+        m_scratchSize = 0;
+        m_staging = m_states = NULL;
+        m_stagingSize = m_statesSize = 0;
+        setChunkBytes(REDUCTION_CHUNK_BYTES);
+
+        /* Enough groups to fill every compute unit a few times over */
+        cl_uint computeUnits = 1;
+        clGetDeviceInfo(cache.device(), CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, NULL);
+        m_stridedGroups = computeUnits * 8;
+
+        size_t size = 0;
+        clGetDeviceInfo(cache.device(), CL_DEVICE_EXTENSIONS, 0, NULL, &size);
+        std::string extensions(size, '\0');
+        clGetDeviceInfo(cache.device(), CL_DEVICE_EXTENSIONS, size, &extensions[0], NULL);
+
+        /* The sub_group_* built-ins need OpenCL C 2.0; 1.2 compilers may not declare them */
+        char version[64] = "";
+        clGetDeviceInfo(cache.device(), CL_DEVICE_OPENCL_C_VERSION, sizeof(version) - 1, version, NULL);
+        int major = 0;
+        sscanf(version, "OpenCL C %d", &major);
+        m_subgroups = extensions.find("cl_khr_subgroups") != std::string::npos && major >= 2;
+    }
+
+    ~ReductionEngine()
+    {
+        for (std::map<std::string, cl_kernel>::iterator it = m_kernels.begin(); it != m_kernels.end(); ++it)
+        {
+            clReleaseKernel(it->second);
+        }
+        releaseScratch();
+        if (m_staging != NULL)
+            clReleaseMemObject(m_staging);
+        if (m_states != NULL)
+            clReleaseMemObject(m_states);
+    }
+
+    void setVariant(ReduceVariant variant) { m_variant = variant; }
+    ReduceVariant variant() const { return m_variant; }
+    bool usesSubgroups() const { return m_subgroups; }
+
+    static size_t elementSize(ReduceType type)
+    {
+        switch (type)
+        {
+        case REDUCE_DOUBLE: return sizeof(cl_double);
+        case REDUCE_INT:    return sizeof(cl_int);
+        case REDUCE_HALF:   return sizeof(cl_half);
+        default:            return sizeof(cl_float);
+        }
+    }
+
+    /* Reduce count elements of type held in a device buffer */
+    cl_int reduce(cl_mem data, cl_ulong count, ReduceType type, ReduceOp op, ReduceResult *result)
+    {
+        return reduceAsync(data, count, type, op, result).wait();
+    }
+
+    /* reduce() after the futures in after; *result is set by the future's wait() */
+    Future reduceAsync(cl_mem data, cl_ulong count, ReduceType type, ReduceOp op, ReduceResult *result,
+                       const WaitList &after = WaitList())
+    {
+        Pass pass;
+        cl_mem state;
+        cl_int status = enqueueWait(m_queue, after);
+        if (status == CL_SUCCESS)
+            status = prepare(type, op, &pass);
+        if (status == CL_SUCCESS)
+            status = reserveScratch(firstPassGroups(count) * pass.stateSize);
+        if (status == CL_SUCCESS)
+            status = reduceData(pass, data, count, 0, &state);
+        if (status != CL_SUCCESS)
+            return Future::failed(status);
+        return readStateAsync(pass, state, [result](const ReduceResult &r) { *result = r; });
+    }
+
+    /*
+     * Reduce count elements of type in host memory. The data go through a
+     * staging buffer in chunks of at most setChunkBytes() bytes; each chunk
+     * leaves its state on the device and the chunk states are reduced
+     * together at the end, so the length is not bounded by device memory.
+     */
+    cl_int reduce(const void *data, cl_ulong count, ReduceType type, ReduceOp op, ReduceResult *result)
+    {
+        Pass pass;
+        cl_mem state;
+        cl_int status = prepare(type, op, &pass);
+        if (status != CL_SUCCESS)
+            return status;
+
+        size_t bytes = elementSize(type);
+        cl_ulong chunk = m_chunkBytes / bytes > 0 ? m_chunkBytes / bytes : 1;
+        chunk = count < chunk ? (count > 0 ? count : 1) : chunk;
+        cl_ulong numChunks = count > 0 ? (count + chunk - 1) / chunk : 1;
+
+        cl_ulong groups = firstPassGroups(chunk);
+        cl_ulong stateGroups = (numChunks + m_localSize - 1) / m_localSize;
+        status = reserveScratch((groups > stateGroups ? groups : stateGroups) * pass.stateSize);
+        if (status == CL_SUCCESS)
+            status = reserveBuffer(&m_staging, &m_stagingSize, chunk * bytes, CL_MEM_READ_ONLY);
+        if (status == CL_SUCCESS)
+            status = reserveBuffer(&m_states, &m_statesSize, numChunks * pass.stateSize, CL_MEM_READ_WRITE);
+
+        for (cl_ulong k = 0; status == CL_SUCCESS && k < numChunks; k++)
+        {
+            cl_ulong base = k * chunk;
+            cl_ulong n = count - base < chunk ? count - base : chunk;
+
+            /* The in-order queue keeps the staging buffer from being overwritten early */
+            if (n > 0)
+            {
+                status = clEnqueueWriteBuffer(m_queue, m_staging, CL_FALSE, 0, (size_t)(n * bytes),
+                                              (const char *)data + base * bytes, 0, NULL, NULL);
+            }
+            if (status == CL_SUCCESS)
+                status = reduceData(pass, m_staging, n, base, &state);
+            if (status == CL_SUCCESS)
+                status = clEnqueueCopyBuffer(m_queue, state, m_states, 0, (size_t)(k * pass.stateSize),
+                                             pass.stateSize, 0, NULL, NULL);
+        }
+
+        if (status == CL_SUCCESS)
+            status = reduceStates(pass, m_states, numChunks, &state);
+        if (status == CL_SUCCESS)
+            status = readState(pass, state, result);
+        return status;
+    }
+
+    /*
+     * Map every element (pair) and reduce in the same pass, reading each
+     * input once. b may be NULL for L1/L2/Linf. Float and double only.
+     */
+    cl_int mapReduce(cl_mem a, cl_mem b, cl_ulong count, ReduceType type, MapReduceOp op, double *result)
+    {
+        return mapReduceAsync(a, b, count, type, op, result).wait();
+    }
+
+    Future mapReduceAsync(cl_mem a, cl_mem b, cl_ulong count, ReduceType type, MapReduceOp op, double *result,
+                          const WaitList &after = WaitList())
+    {
+        static const char *mapNames[] = { " -D MAP_MUL", " -D MAP_ABS", " -D MAP_SQUARE", " -D MAP_ABS", " -D MAP_MUL" };
+        bool twoInputs = op == MAPREDUCE_DOT || op == MAPREDUCE_MUL_MAX;
+        if ((type != REDUCE_FLOAT && type != REDUCE_DOUBLE) || (twoInputs && b == NULL))
+            return Future::failed(CL_INVALID_VALUE);
+        if (b == NULL)
+            b = a;
+
+        Pass pass;
+        cl_mem state;
+        ReduceOp reduceOp = op == MAPREDUCE_LINF || op == MAPREDUCE_MUL_MAX ? REDUCE_MAX : REDUCE_SUM;
+        cl_int status = prepare(type, reduceOp, &pass, mapNames[op]);
+        if (status == CL_SUCCESS)
+            status = enqueueWait(m_queue, after);
+
+        /* runPass sets arguments 0-4; the second input follows them */
+        if (status == CL_SUCCESS)
+            status = clSetKernelArg(pass.dataKernel, 5, sizeof(cl_mem), &b);
+        if (status == CL_SUCCESS)
+            status = reserveScratch(firstPassGroups(count) * pass.stateSize);
+        if (status == CL_SUCCESS)
+            status = reduceData(pass, a, count, 0, &state);
+        if (status != CL_SUCCESS)
+            return Future::failed(status);
+
+        return readStateAsync(pass, state, [result, op](const ReduceResult &r) {
+            *result = op == MAPREDUCE_L2 ? sqrt(r.value) : r.value;
+        });
+    }
+
+    /* Upper bound on the staging buffer used by the host-pointer reduce */
+    void setChunkBytes(size_t bytes)
+    {
+        cl_ulong maxAlloc = 0;
+        clGetDeviceInfo(m_cache.device(), CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, NULL);
+        m_chunkBytes = maxAlloc > 0 && bytes > maxAlloc ? (size_t)maxAlloc : bytes;
+    }
+
+private:
+    enum AccType
+    {
+        ACC_FLOAT,
+        ACC_DOUBLE,
+        ACC_INT,
+        ACC_LONG
+    };
+
+    /* Kernels and state layout for one (type, op) pair */
+    struct Pass
+    {
+        AccType acc;
+        ReduceOp op;
+        size_t stateSize;
+        cl_kernel dataKernel;
+        cl_kernel statesKernel;
+    };
+
+    /* With map (the MAP_* define of a map-reduce) the data pass maps each element first */
+    cl_int prepare(ReduceType type, ReduceOp op, Pass *pass, const char *map = NULL)
+    {
+        cl_int status;
+        pass->acc = accType(type, op);
+        pass->op = op;
+        pass->stateSize = stateBytes(pass->acc, op);
+
+        std::string options = buildOptions(type, op, pass->acc) + (map != NULL ? map : "");
+        const char *dataName = map != NULL ? (m_variant == REDUCE_STRIDED ? "reduce_map_strided" : "reduce_map")
+                                           : (m_variant == REDUCE_STRIDED ? "reduce_data_strided" : "reduce_data");
+        pass->dataKernel = getKernel(options, dataName, &status);
+        if (status == CL_SUCCESS)
+            pass->statesKernel = getKernel(options, "reduce_states", &status);
+
+        /* A compiler that rejects the sub-group tail still builds the local memory one */
+        if (status == CL_BUILD_PROGRAM_FAILURE && m_subgroups)
+        {
+            m_subgroups = false;
+            return prepare(type, op, pass, map);
+        }
+        return status;
+    }
+
+    cl_ulong firstPassGroups(cl_ulong count) const
+    {
+        cl_ulong groups = (count + m_localSize - 1) / m_localSize;
+        if (m_variant == REDUCE_STRIDED)
+        {
+            groups = (count + 4 * m_localSize - 1) / (4 * m_localSize);
+            groups = groups < m_stridedGroups ? groups : m_stridedGroups;
+        }
+        return groups > 0 ? groups : 1;
+    }
+
+    /* Data pass followed by state passes; *state receives the buffer holding the result */
+    cl_int reduceData(const Pass &pass, cl_mem data, cl_ulong count, cl_ulong base, cl_mem *state)
+    {
+        cl_ulong groups = firstPassGroups(count);
+        cl_int status = runPass(pass.dataKernel, data, count, (size_t)(groups * m_localSize),
+                                pass.stateSize, m_scratch[0], &base);
+        if (status != CL_SUCCESS)
+            return status;
+        return reduceStates(pass, m_scratch[0], groups, state);
+    }
+
+    /* Reduce count states in input until one is left, ping-ponging through the scratch buffers */
+    cl_int reduceStates(const Pass &pass, cl_mem input, cl_ulong count, cl_mem *state)
+    {
+        cl_int status = CL_SUCCESS;
+        int next = input == m_scratch[0] ? 1 : 0;
+
+        while (status == CL_SUCCESS && count > 1)
+        {
+            cl_ulong groups = (count + m_localSize - 1) / m_localSize;
+            status = runPass(pass.statesKernel, input, count, (size_t)(groups * m_localSize),
+                             pass.stateSize, m_scratch[next], NULL);
+            input = m_scratch[next];
+            next = 1 - next;
+            count = groups;
+        }
+        *state = input;
+        return status;
+    }
+
+    cl_int readState(const Pass &pass, cl_mem state, ReduceResult *result)
+    {
+        return readStateAsync(pass, state, [result](const ReduceResult &r) { *result = r; }).wait();
+    }
+
+    /*
+     * Non-blocking read of the final state; done gets it decoded when the
+     * future is waited on. The staging bytes live in the finish step, which
+     * the future keeps until the read completes even if it is dropped.
+     */
+    Future readStateAsync(const Pass &pass, cl_mem state, const std::function<void(const ReduceResult &)> &done)
+    {
+        std::shared_ptr<std::vector<unsigned char> > bytes = std::make_shared<std::vector<unsigned char> >(32);
+        cl_event event;
+        cl_int status = clEnqueueReadBuffer(m_queue, state, CL_FALSE, 0, pass.stateSize, &(*bytes)[0], 0, NULL,
+                                            &event);
+        if (status != CL_SUCCESS)
+            return Future::failed(status);
+
+        AccType acc = pass.acc;
+        ReduceOp op = pass.op;
+        return Future(event, [bytes, acc, op, done]() {
+            ReduceResult r;
+            decodeState(&(*bytes)[0], acc, op, &r);
+            done(r);
+        });
+    }
+
+    static AccType accType(ReduceType type, ReduceOp op)
+    {
+        switch (type)
+        {
+        case REDUCE_DOUBLE:
+            return ACC_DOUBLE;
+        case REDUCE_INT:
+            if (op == REDUCE_SUM)
+                return ACC_LONG;
+            if (op == REDUCE_MEANVAR)
+                return ACC_FLOAT;
+            return ACC_INT;
+        default:
+            return ACC_FLOAT;
+        }
+    }
+
+    static size_t accBytes(AccType acc)
+    {
+        return (acc == ACC_DOUBLE || acc == ACC_LONG) ? 8 : 4;
+    }
+
+    /* Matches the state_t layouts in reduction.cl */
+    static size_t stateBytes(AccType acc, ReduceOp op)
+    {
+        switch (op)
+        {
+        case REDUCE_ARGMIN:
+        case REDUCE_ARGMAX:
+            return 16;
+        case REDUCE_MEANVAR:
+            return (2 * accBytes(acc) + 7) / 8 * 8 + 8;
+        default:
+            return accBytes(acc);
+        }
+    }
+
+    std::string buildOptions(ReduceType type, ReduceOp op, AccType acc) const
+    {
+        static const char *opNames[] = { "OP_SUM", "OP_MIN", "OP_MAX", "OP_ARGMIN", "OP_ARGMAX", "OP_MEANVAR" };
+        static const char *accNames[] = { "float", "double", "int", "long" };
+        static const char *typeNames[] = { "float", "double", "int", "half" };
+
+        std::string options = std::string("-D T=") + typeNames[type] + " -D ACC=" + accNames[acc];
+        options += std::string(" -D ") + opNames[op];
+        if (acc == ACC_INT)
+            options += " -D ACC_LOWEST=INT_MIN -D ACC_HIGHEST=INT_MAX";
+        else if (acc == ACC_LONG)
+            options += " -D ACC_LOWEST=LONG_MIN -D ACC_HIGHEST=LONG_MAX";
+        else
+            options += " -D ACC_LOWEST=-INFINITY -D ACC_HIGHEST=INFINITY";
+        if (type == REDUCE_HALF)
+            options += " -D T_HALF";
+        if (acc == ACC_DOUBLE)
+            options += " -D USE_FP64";
+        if (m_subgroups)
+            options += " -D USE_SUBGROUPS -cl-std=CL2.0";
+        return options;
+    }
+
+    static double readAcc(const unsigned char *p, AccType acc)
+    {
+        cl_float f; cl_double d; cl_int i; cl_long l;
+        switch (acc)
+        {
+        case ACC_DOUBLE: memcpy(&d, p, sizeof(d)); return d;
+        case ACC_INT:    memcpy(&i, p, sizeof(i)); return i;
+        case ACC_LONG:   memcpy(&l, p, sizeof(l)); return (double)l;
+        default:         memcpy(&f, p, sizeof(f)); return f;
+        }
+    }
+
+    static void decodeState(const unsigned char *state, AccType acc, ReduceOp op, ReduceResult *result)
+    {
+        memset(result, 0, sizeof(*result));
+        switch (op)
+        {
+        case REDUCE_ARGMIN:
+        case REDUCE_ARGMAX:
+            result->value = readAcc(state, acc);
+            memcpy(&result->index, state + 8, sizeof(cl_ulong));
+            break;
+        case REDUCE_MEANVAR:
+        {
+            double m2 = readAcc(state + accBytes(acc), acc);
+            result->mean = readAcc(state, acc);
+            memcpy(&result->count, state + (2 * accBytes(acc) + 7) / 8 * 8, sizeof(cl_ulong));
+            result->variance = result->count > 0 ? m2 / result->count : 0.0;
+            result->value = result->mean;
+            break;
+        }
+        default:
+            result->value = readAcc(state, acc);
+            break;
+        }
+    }
+
+    /* Kernels are created once per build options and reused across calls */
+    cl_kernel getKernel(const std::string &options, const char *name, cl_int *status)
+    {
+        std::string key = options + ' ' + name;
+        std::map<std::string, cl_kernel>::iterator it = m_kernels.find(key);
+        if (it != m_kernels.end())
+        {
+            *status = CL_SUCCESS;
+            return it->second;
+        }
+
+        cl_kernel kernel = m_cache.createKernel(m_programFile, options, name, status);
+        if (*status == CL_SUCCESS)
+        {
+            m_kernels[key] = kernel;
+        }
+        return kernel;
+    }
+
+    cl_int runPass(cl_kernel kernel, cl_mem input, cl_ulong count, size_t globalSize,
+                   size_t stateSize, cl_mem output, const cl_ulong *base)
+    {
+        cl_int status;
+        status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+        status |= clSetKernelArg(kernel, 1, sizeof(cl_ulong), &count);
+        status |= clSetKernelArg(kernel, 2, m_localSize * stateSize, NULL);
+        status |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &output);
+        if (base != NULL)
+            status |= clSetKernelArg(kernel, 4, sizeof(cl_ulong), base);
+        if (status == CL_SUCCESS)
+        {
+            status = clEnqueueNDRangeKernel(m_queue, kernel, 1, NULL, &globalSize, &m_localSize,
+                                            0, NULL, NULL);
+        }
+        return status;
+    }
+
+    cl_int reserveBuffer(cl_mem *buffer, size_t *capacity, size_t size, cl_mem_flags flags)
+    {
+        cl_int status = CL_SUCCESS;
+        if (size <= *capacity)
+            return CL_SUCCESS;
+        if (*buffer != NULL)
+            clReleaseMemObject(*buffer);
+        *buffer = clCreateBuffer(m_cache.context(), flags, size, NULL, &status);
+        *capacity = status == CL_SUCCESS ? size : 0;
+        if (status != CL_SUCCESS)
+            *buffer = NULL;
+        return status;
+    }
+
+    cl_int reserveScratch(size_t size)
+    {
+        cl_int status = CL_SUCCESS;
+        if (size <= m_scratchSize)
+        {
+            return CL_SUCCESS;
+        }
+        releaseScratch();
+        for (int i = 0; i < 2 && status == CL_SUCCESS; i++)
+        {
+            m_scratch[i] = clCreateBuffer(m_cache.context(), CL_MEM_READ_WRITE, size, NULL, &status);
+        }
+        m_scratchSize = status == CL_SUCCESS ? size : 0;
+        return status;
+    }
+
+    void releaseScratch()
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            if (m_scratch[i] != NULL)
+            {
+                clReleaseMemObject(m_scratch[i]);
+                m_scratch[i] = NULL;
+            }
+        }
+        m_scratchSize = 0;
+    }
+
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::string m_programFile;
+    size_t m_localSize;
+    ReduceVariant m_variant;
+    cl_ulong m_stridedGroups;
+    bool m_subgroups;
+    std::map<std::string, cl_kernel> m_kernels;
+    cl_mem m_scratch[2];
+    size_t m_scratchSize;
+    cl_mem m_staging;
+    size_t m_stagingSize;
+    cl_mem m_states;
+    size_t m_statesSize;
+    size_t m_chunkBytes;
+};
+
+#endif
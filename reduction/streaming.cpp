@@ -0,0 +1,204 @@
+#include <CL/cl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "reduction.hpp"
+#include "../VectorAdd/elementwise.hpp"
+#include "../bitonicsort/bitonic-sort.hpp"
+#include "../common/stream_pipeline.hpp"
+
+#define STREAM_FILE "stream.bin"
+#define STREAM_SIZE (1 << 25)     /* floats in the generated file */
+#define CHUNK_SIZE (1 << 20)      /* floats per chunk, a power of two for the sort */
+#define CLAMP_LO 0.25
+#define CLAMP_HI 0.75
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+/* Host reference of what the stages compute, in double */
+struct Reference
+{
+    double sum;
+    double clampedSum;
+};
+
+/* Writes count floats in [0, 1) to fileName in blocks */
+Reference write_stream(const char *fileName, size_t count)
+{
+    Reference ref = { 0.0, 0.0 };
+    std::vector<float> block(CHUNK_SIZE);
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL)
+    {
+        perror("Couldn't create the stream file");
+        exit(1);
+    }
+    srand(42);
+    for (size_t done = 0; done < count; done += block.size())
+    {
+        size_t n = std::min(block.size(), count - done);
+        for (size_t i = 0; i < n; i++)
+        {
+            block[i] = (float)rand() / ((float)RAND_MAX + 1.0f);
+            ref.sum += block[i];
+            ref.clampedSum += std::min(std::max((double)block[i], CLAMP_LO), CLAMP_HI);
+        }
+        if (fwrite(block.data(), sizeof(float), n, file) != n)
+        {
+            perror("Couldn't write the stream file");
+            exit(1);
+        }
+    }
+    fclose(file);
+    return ref;
+}
+
+/* Reads the next chunk straight into the pipeline's pinned staging */
+StreamPipeline::Source file_source(FILE *file)
+{
+    return [file](void *chunk, size_t capacity) { return fread(chunk, 1, capacity, file); };
+}
+
+/*
+ * Streams a file from disk through three stages, each with the pipeline at
+ * depth 1 (upload, compute and download in turn) and at the default depth:
+ * a sum reduction with no output, a clamp whose output comes back, and a
+ * sort of each chunk. The stages run on the pipeline's compute queue.
+ */
+int main(int argc, char *argv[])
+{
+    cl_device_id device;
+    cl_context context;
+    cl_int err;
+    size_t count = STREAM_SIZE;
+    int failed = 0;
+
+    if (argc > 1)
+    {
+        count = strtoull(argv[1], NULL, 10);
+    }
+    /* Whole chunks, so every sorted chunk is a power of two */
+    count = std::max((size_t)CHUNK_SIZE, count / CHUNK_SIZE * CHUNK_SIZE);
+
+    Reference ref = write_stream(STREAM_FILE, count);
+    printf("%u floats in %s, %u per chunk\n", (unsigned int)count, STREAM_FILE, (unsigned int)CHUNK_SIZE);
+
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+
+    const size_t chunkBytes = CHUNK_SIZE * sizeof(float);
+    const int depths[] = { 1, STREAM_PIPELINE_DEPTH };
+    ProgramCache cache(context, device);
+    for (int d = 0; d < 2; d++)
+    {
+        StreamPipeline reducePipe(context, device, chunkBytes, 0, depths[d]);
+        StreamPipeline outputPipe(context, device, chunkBytes, chunkBytes, depths[d]);
+        ReductionEngine reducer(cache, reducePipe.computeQueue(), "reduction.cl");
+        ElementwiseEngine elementwise(cache, outputPipe.computeQueue(), "../VectorAdd/elementwise.cl");
+        BitonicSortEngine sorter(cache, outputPipe.computeQueue(), "../bitonicsort/bitonic-sort.cl");
+        char name[64];
+
+        /* Sum: one ReduceResult per chunk, combined on the host in order */
+        std::vector<ReduceResult> partial(count / CHUNK_SIZE + 1);
+        double sum = 0.0;
+        FILE *file = fopen(STREAM_FILE, "rb");
+        err = reducePipe.run(file_source(file),
+            [&](StreamChunk &chunk) {
+                return reducer.reduceAsync(chunk.input, chunk.bytes / sizeof(float), REDUCE_FLOAT, REDUCE_SUM,
+                                           &partial[chunk.index]);
+            },
+            [&](const StreamChunk &chunk, const void *) { sum += partial[chunk.index].value; });
+        fclose(file);
+        snprintf(name, sizeof(name), "sum   depth %d", depths[d]);
+        reducePipe.printStats(name);
+        bool ok = err == CL_SUCCESS && fabs(sum - ref.sum) <= 1e-4 * ref.sum;
+        printf("  sum %f, expected %f. %s\n", sum, ref.sum, ok ? "Check passed." : "Check failed.");
+        failed |= !ok;
+
+        /* Clamp: the chunk comes back and is summed on the host */
+        double clampedSum = 0.0;
+        ElementwiseArgs range(0.0, CLAMP_LO, CLAMP_HI);
+        file = fopen(STREAM_FILE, "rb");
+        err = outputPipe.run(file_source(file),
+            [&](StreamChunk &chunk) {
+                return enqueueAfter(outputPipe.computeQueue(), WaitList(), [&](cl_event *event) {
+                    return elementwise.apply(ELEMENTWISE_CLAMP, ELEM_FLOAT, chunk.input, NULL, chunk.output,
+                                             chunk.bytes / sizeof(float), range, 0, event);
+                });
+            },
+            [&](const StreamChunk &chunk, const void *output) {
+                const float *values = (const float *)output;
+                for (size_t i = 0; i < chunk.outputBytes / sizeof(float); i++)
+                    clampedSum += values[i];
+            });
+        fclose(file);
+        snprintf(name, sizeof(name), "clamp depth %d", depths[d]);
+        outputPipe.printStats(name);
+        ok = err == CL_SUCCESS && fabs(clampedSum - ref.clampedSum) <= 1e-6 * ref.clampedSum;
+        printf("  clamped sum %f, expected %f. %s\n", clampedSum, ref.clampedSum,
+               ok ? "Check passed." : "Check failed.");
+        failed |= !ok;
+
+        /* Sort: non-negative floats order like their bits, so the int sort orders each chunk */
+        size_t unsorted = 0;
+        file = fopen(STREAM_FILE, "rb");
+        err = outputPipe.run(file_source(file),
+            [&](StreamChunk &chunk) {
+                Future copied = enqueueAfter(outputPipe.computeQueue(), WaitList(), [&](cl_event *event) {
+                    return clEnqueueCopyBuffer(outputPipe.computeQueue(), chunk.input, chunk.output, 0, 0,
+                                               chunk.bytes, 0, NULL, event);
+                });
+                return sorter.sortAsync(chunk.output, (cl_uint)(chunk.bytes / sizeof(cl_int)), false,
+                                        WaitList(1, copied));
+            },
+            [&](const StreamChunk &chunk, const void *output) {
+                const cl_int *keys = (const cl_int *)output;
+                for (size_t i = 1; i < chunk.outputBytes / sizeof(cl_int); i++)
+                    unsorted += keys[i - 1] > keys[i];
+            });
+        fclose(file);
+        snprintf(name, sizeof(name), "sort  depth %d", depths[d]);
+        outputPipe.printStats(name);
+        ok = err == CL_SUCCESS && unsorted == 0;
+        printf("  %u keys out of order. %s\n", (unsigned int)unsorted, ok ? "Check passed." : "Check failed.");
+        failed |= !ok;
+    }
+
+    remove(STREAM_FILE);
+    clReleaseContext(context);
+    return failed;
+}
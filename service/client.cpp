@@ -0,0 +1,306 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "protocol.hpp"
+
+#define SHM_BYTES (16 << 20)
+#define SHM_IN0 0
+#define SHM_IN1 (4 << 20)
+#define SHM_OUT (8 << 20)
+#define REQUESTS 200
+
+/* Problem sizes of the small requests */
+#define GEMM_N 64
+#define SORT_N 4096
+#define REDUCE_N 65536
+#define INVERT_N 32
+#define MATVEC_N 256
+
+double elapsed_us(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1000.0;
+}
+
+/* A connection to kerneld with the shared memory the payloads go through */
+struct Client
+{
+    int fd;
+    char *shm;
+    uint64_t next;
+
+    Client() : fd(-1), shm(NULL), next(1) {}
+
+    bool open(const char *path)
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) < 0)
+        {
+            perror("Couldn't connect to kerneld");
+            return false;
+        }
+
+        /* Anonymous memory passed to the daemon by descriptor; sealed so it can never shrink under the daemon */
+#ifdef MFD_ALLOW_SEALING
+        int shmFd = memfd_create("kerneld-client", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        bool created = shmFd >= 0 && ftruncate(shmFd, SHM_BYTES) == 0 &&
+                       fcntl(shmFd, F_ADD_SEALS, F_SEAL_SHRINK) == 0;
+#else
+        char name[64];
+        snprintf(name, sizeof(name), "/kerneld-client-%d", (int)getpid());
+        int shmFd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (shmFd >= 0)
+            shm_unlink(name);
+        bool created = shmFd >= 0 && ftruncate(shmFd, SHM_BYTES) == 0;
+#endif
+        if (!created)
+        {
+            perror("Couldn't create the shared memory");
+            if (shmFd >= 0)
+                close(shmFd);
+            return false;
+        }
+        void *mapped = mmap(NULL, SHM_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            close(shmFd);
+            perror("Couldn't map the shared memory");
+            return false;
+        }
+        shm = (char *)mapped;
+
+        ServiceRequest request = make(SERVICE_ATTACH);
+        request.bytes = SHM_BYTES;
+        ServiceResponse response;
+        bool attached = serviceWriteFd(fd, &request, sizeof(request), shmFd) &&
+                        serviceRead(fd, &response, sizeof(response)) && response.id == request.id &&
+                        response.status == 0;
+        close(shmFd);
+        if (!attached)
+            printf("attach failed\n");
+        return attached;
+    }
+
+    ~Client()
+    {
+        if (shm != NULL)
+            munmap(shm, SHM_BYTES);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    ServiceRequest make(ServiceOp op)
+    {
+        ServiceRequest request;
+        memset(&request, 0, sizeof(request));
+        request.magic = SERVICE_MAGIC;
+        request.op = op;
+        request.id = next++;
+        request.in0 = SHM_IN0;
+        request.in1 = SHM_IN1;
+        request.out = SHM_OUT;
+        return request;
+    }
+
+    /* One request and its response */
+    bool call(const ServiceRequest &request, ServiceResponse *response)
+    {
+        return serviceWrite(fd, &request, sizeof(request)) && serviceRead(fd, response, sizeof(*response)) &&
+               response->id == request.id;
+    }
+
+    template <typename T>
+    T *at(uint64_t offset) { return (T *)(shm + offset); }
+};
+
+/* Fills the inputs of op in the shared memory and returns its request */
+ServiceRequest prepare(Client &client, ServiceOp op, std::minstd_rand &generator)
+{
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    ServiceRequest request = client.make(op);
+    float *in0 = client.at<float>(SHM_IN0), *in1 = client.at<float>(SHM_IN1);
+    switch (op)
+    {
+    case SERVICE_GEMM:
+        request.m = request.k = request.n = GEMM_N;
+        for (int i = 0; i < GEMM_N * GEMM_N; i++)
+        {
+            in0[i] = uniform(generator);
+            in1[i] = uniform(generator);
+        }
+        break;
+    case SERVICE_SORT:
+        request.m = SORT_N;
+        for (int i = 0; i < SORT_N; i++)
+            client.at<int>(SHM_IN0)[i] = (int)generator();
+        break;
+    case SERVICE_REDUCE:
+        request.m = REDUCE_N;
+        request.flags = 0;        /* REDUCE_SUM */
+        for (int i = 0; i < REDUCE_N; i++)
+            in0[i] = uniform(generator);
+        break;
+    case SERVICE_INVERT:
+        /* Diagonally dominant: the kernels do not pivot */
+        request.m = INVERT_N;
+        for (int i = 0; i < INVERT_N * INVERT_N; i++)
+            in0[i] = uniform(generator) + (i / INVERT_N == i % INVERT_N ? INVERT_N : 0.0f);
+        break;
+    case SERVICE_MATVEC:
+        request.m = request.n = MATVEC_N;
+        request.alpha = 1.0f;
+        request.beta = 0.0f;
+        for (int i = 0; i < MATVEC_N * MATVEC_N; i++)
+            in0[i] = uniform(generator);
+        for (int i = 0; i < MATVEC_N; i++)
+            in1[i] = uniform(generator);
+        break;
+    default:
+        break;
+    }
+    return request;
+}
+
+/* Checks the result of request against the host */
+bool verify(Client &client, const ServiceRequest &request, const ServiceResponse &response)
+{
+    const float *in0 = client.at<float>(SHM_IN0), *in1 = client.at<float>(SHM_IN1);
+    const float *out = client.at<float>(SHM_OUT);
+    size_t m = request.m, n = request.n, k = request.k;
+    if (response.status != 0)
+        return false;
+    switch (request.op)
+    {
+    case SERVICE_GEMM:
+        for (size_t i = 0; i < m; i++)
+            for (size_t j = 0; j < n; j++)
+            {
+                double sum = 0.0;
+                for (size_t l = 0; l < k; l++)
+                    sum += (double)in0[i * k + l] * in1[l * n + j];
+                if (fabs(out[i * n + j] - sum) > 1e-3 * sum)
+                    return false;
+            }
+        return true;
+    case SERVICE_SORT:
+    {
+        std::vector<int> keys(client.at<int>(SHM_IN0), client.at<int>(SHM_IN0) + m);
+        std::sort(keys.begin(), keys.end());
+        return std::equal(keys.begin(), keys.end(), client.at<int>(SHM_OUT));
+    }
+    case SERVICE_REDUCE:
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < m; i++)
+            sum += in0[i];
+        return fabs(response.value - sum) <= 1e-4 * sum;
+    }
+    case SERVICE_INVERT:
+        /* A * A^-1 = I */
+        for (size_t i = 0; i < m; i++)
+            for (size_t j = 0; j < m; j++)
+            {
+                double sum = 0.0;
+                for (size_t l = 0; l < m; l++)
+                    sum += (double)in0[i * m + l] * out[l * m + j];
+                if (fabs(sum - (i == j ? 1.0 : 0.0)) > 1e-4)
+                    return false;
+            }
+        return true;
+    case SERVICE_MATVEC:
+        for (size_t i = 0; i < m; i++)
+        {
+            double sum = 0.0;
+            for (size_t j = 0; j < n; j++)
+                sum += (double)in0[i * n + j] * in1[j];
+            if (fabs(out[i] - sum) > 1e-4 * sum)
+                return false;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * client [socket path] [--shutdown]: times the first result from process
+ * start, then REQUESTS small requests of each kind against kerneld, and
+ * prints the round-trip and service time percentiles per op. Every result
+ * is checked on the host.
+ */
+int main(int argc, char *argv[])
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    char defaultPath[sizeof(((sockaddr_un *)NULL)->sun_path)];
+    serviceSocketPath(defaultPath, sizeof(defaultPath));
+    const char *path = defaultPath;
+    bool shutdown = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--shutdown") == 0)
+            shutdown = true;
+        else
+            path = argv[i];
+    }
+
+    Client client;
+    if (!client.open(path))
+        return 1;
+
+    std::minstd_rand generator(7);
+    int failed = 0;
+    ServiceRequest request = prepare(client, SERVICE_REDUCE, generator);
+    ServiceResponse response;
+    if (!client.call(request, &response))
+    {
+        printf("kerneld went away\n");
+        return 1;
+    }
+    double first = elapsed_us(start, std::chrono::steady_clock::now());
+    failed |= !verify(client, request, response);
+    printf("first result %.1f us after start (connect, attach, one %d-float reduction)\n", first, REDUCE_N);
+
+    const ServiceOp ops[] = { SERVICE_GEMM, SERVICE_SORT, SERVICE_REDUCE, SERVICE_INVERT, SERVICE_MATVEC };
+    printf("round trip per request:\n");
+    for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++)
+    {
+        std::vector<double> roundTrip, service;
+        int wrong = 0;
+        for (int i = 0; i < REQUESTS; i++)
+        {
+            request = prepare(client, ops[o], generator);
+            std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+            if (!client.call(request, &response))
+            {
+                printf("kerneld went away\n");
+                return 1;
+            }
+            roundTrip.push_back(elapsed_us(sent, std::chrono::steady_clock::now()));
+            service.push_back(response.serviceUs);
+            wrong += !verify(client, request, response);
+        }
+        servicePrintLatency(serviceOpName(ops[o]), roundTrip);
+        servicePrintLatency("  daemon", service);
+        if (wrong != 0)
+            printf("%s: %d wrong results. Check failed.\n", serviceOpName(ops[o]), wrong);
+        failed |= wrong != 0;
+    }
+    printf("%s\n", failed ? "Check failed." : "Check passed.");
+
+    request = client.make(shutdown ? SERVICE_SHUTDOWN : SERVICE_STATS);
+    client.call(request, &response);
+    return failed;
+}
@@ -0,0 +1,660 @@
+#include <CL/cl.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "protocol.hpp"
+#include "../bitonicsort/bitonic-sort.hpp"
+#include "../common/buffer_pool.hpp"
+#include "../common/thread_pool.hpp"
+#include "../gemm/gemm.hpp"
+#include "../matrix_inversion/inversion.hpp"
+#include "../matvec/gemv.hpp"
+#include "../reduction/reduction.hpp"
+
+#define SERVICE_MAX_DIM (1 << 24)
+#define SERVICE_SEND_TIMEOUT_MS 1000
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+double elapsed_us(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1000.0;
+}
+
+/* A command queue and every engine, one set per pool worker */
+struct Engines
+{
+    cl_command_queue queue;
+    GemmEngine gemm;
+    BitonicSortEngine sort;
+    ReductionEngine reduce;
+    InversionEngine invert;
+    GemvEngine gemv;
+
+    Engines(ProgramCache &cache, cl_command_queue queue)
+        : queue(queue), gemm(cache, queue, "../gemm/gemm_kernel.cl"),
+          sort(cache, queue, "../bitonicsort/bitonic-sort.cl"), reduce(cache, queue, "../reduction/reduction.cl"),
+          invert(cache, queue, "../matrix_inversion/inversion.cl"), gemv(cache, queue, "../matvec/gemv.cl")
+    {
+    }
+
+    ~Engines()
+    {
+        clReleaseCommandQueue(queue);
+    }
+};
+
+/* The user at the other end of a connected socket */
+static bool peer_uid(int fd, uid_t *uid)
+{
+#ifdef SO_PEERCRED
+    struct ucred credentials;
+    socklen_t size = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0)
+        return false;
+    *uid = credentials.uid;
+    return true;
+#else
+    gid_t gid;
+    return getpeereid(fd, uid, &gid) == 0;
+#endif
+}
+
+/* Creates the directory of the default socket 0700; false if it is not private to this user */
+static bool private_directory(const char *socketPath)
+{
+    std::string directory(socketPath, strrchr(socketPath, '/') - socketPath);
+    struct stat info;
+    if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST)
+    {
+        perror(directory.c_str());
+        return false;
+    }
+    if (lstat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != getuid() ||
+        (info.st_mode & 077) != 0)
+    {
+        printf("%s is not a directory private to this user\n", directory.c_str());
+        return false;
+    }
+    return true;
+}
+
+/* One client: its socket, its user, its shared memory, and the requests it has in flight */
+struct Connection
+{
+    int fd;
+    uid_t uid;
+    char *shm;
+    size_t shmBytes;
+    std::mutex mutex;                 /* one response on the socket at a time; guards inflight and broken */
+    std::condition_variable idle;
+    int inflight;
+    bool broken;                      /* a response could not be sent; the rest are dropped */
+
+    Connection(int fd, uid_t uid) : fd(fd), uid(uid), shm(NULL), shmBytes(0), inflight(0), broken(false) {}
+
+    ~Connection()
+    {
+        if (shm != NULL)
+            munmap(shm, shmBytes);
+        close(fd);
+    }
+
+    /* offset..offset+bytes inside the shared memory, NULL otherwise */
+    void *payload(uint64_t offset, uint64_t bytes) const
+    {
+        if (shm == NULL || offset > shmBytes || bytes > shmBytes - offset)
+            return NULL;
+        return shm + offset;
+    }
+};
+
+/* Service times per op, for the percentiles */
+class LatencyLog
+{
+public:
+    void add(uint32_t op, double us)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_samples[op < SERVICE_OPS ? op : (uint32_t)SERVICE_STATS].push_back(us);
+    }
+
+    void print()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        printf("service time per request:\n");
+        for (int op = SERVICE_GEMM; op <= SERVICE_MATVEC; op++)
+            servicePrintLatency(serviceOpName(op), m_samples[op]);
+        fflush(stdout);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<double> m_samples[SERVICE_OPS];
+};
+
+/*
+ * Keeps one context, the built programs, a device buffer pool and a
+ * command queue with engines per worker for as long as it runs, so a
+ * request costs its transfers and kernels only. Each connection has a
+ * reader thread; the requests it reads run on the pool and answer on the
+ * socket as they finish.
+ */
+class Service
+{
+public:
+    Service(cl_context context, cl_device_id device, size_t threads)
+        : m_context(context), m_device(device), m_cache(context, device), m_buffers(context, device),
+          m_pool(threads), m_engines(m_pool, [this]() { return makeEngines(); }), m_listen(-1), m_stopping(false),
+          m_connections(0)
+    {
+    }
+
+    /* Builds every program with a tiny request of each kind */
+    cl_int warm()
+    {
+        Engines &e = m_engines.local();
+        Buffers buffers(m_buffers, 16 * sizeof(float), 16 * sizeof(float), 16 * sizeof(float));
+        if (buffers.status != CL_SUCCESS)
+            return buffers.status;
+        cl_mem a = buffers.mem[0], b = buffers.mem[1], c = buffers.mem[2];
+        cl_int status;
+        float host[16] = { 4.0f, 0.0f, 0.0f, 0.0f, 0.0f, 4.0f, 0.0f, 0.0f,
+                           0.0f, 0.0f, 4.0f, 0.0f, 0.0f, 0.0f, 0.0f, 4.0f };
+        ReduceResult result;
+        status = clEnqueueWriteBuffer(e.queue, a, CL_TRUE, 0, sizeof(host), host, 0, NULL, NULL);
+        status |= clEnqueueWriteBuffer(e.queue, b, CL_TRUE, 0, sizeof(host), host, 0, NULL, NULL);
+        status |= e.gemm.gemm(a, b, c, 4, 4, 4);
+        status |= e.gemv.gemv(GEMV_ROW_MAJOR, 4, 4, 1.0f, a, 4, b, 0.0f, c);
+        status |= e.invert.invert(a, c, 4);
+        status |= e.sort.sort(b, 8);
+        status |= e.reduce.reduce(host, 16, REDUCE_FLOAT, REDUCE_SUM, &result);
+        status |= clFinish(e.queue);
+        return status;
+    }
+
+    size_t builds() const { return m_cache.builds(); }
+
+    bool listen(const char *path)
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+        unlink(path);
+
+        /* Owner only from the moment it exists */
+        m_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+        mode_t mask = umask(0177);
+        bool bound = m_listen >= 0 && bind(m_listen, (sockaddr *)&address, sizeof(address)) == 0;
+        umask(mask);
+        if (!bound || chmod(path, 0600) != 0 || ::listen(m_listen, SOMAXCONN) < 0)
+        {
+            perror("Couldn't listen on the socket");
+            return false;
+        }
+        m_path = path;
+        return true;
+    }
+
+    /* Until SERVICE_SHUTDOWN or stop() */
+    void run()
+    {
+        std::chrono::milliseconds backoff(0);
+        while (!m_stopping)
+        {
+            int fd = accept(m_listen, NULL, NULL);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED || m_stopping)
+                    continue;
+
+                /* Out of descriptors or memory: spinning would not free any */
+                backoff = std::min(std::max(backoff * 2, std::chrono::milliseconds(10)),
+                                   std::chrono::milliseconds(1000));
+                perror("accept");
+                std::this_thread::sleep_for(backoff);
+                continue;
+            }
+            backoff = std::chrono::milliseconds(0);
+
+            /* The socket mode keeps other users out; root may still connect */
+            uid_t uid;
+            if (!peer_uid(fd, &uid) || (uid != getuid() && uid != 0))
+            {
+                close(fd);
+                continue;
+            }
+
+            /* A client that stops reading fails its own responses instead of holding a worker */
+            timeval timeout;
+            timeout.tv_sec = SERVICE_SEND_TIMEOUT_MS / 1000;
+            timeout.tv_usec = SERVICE_SEND_TIMEOUT_MS % 1000 * 1000;
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            std::shared_ptr<Connection> connection = std::make_shared<Connection>(fd, uid);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_open.insert(fd);
+                m_connections++;
+            }
+            std::thread(&Service::serve, this, connection).detach();
+        }
+
+        /* Wake the readers and wait until every connection is done */
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (std::set<int>::iterator it = m_open.begin(); it != m_open.end(); ++it)
+            shutdown(*it, SHUT_RDWR);
+        m_closed.wait(lock, [this]() { return m_connections == 0; });
+        close(m_listen);
+        unlink(m_path.c_str());
+    }
+
+    void stop()
+    {
+        m_stopping = true;
+        shutdown(m_listen, SHUT_RDWR);
+    }
+
+    void printStats()
+    {
+        m_log.print();
+        ThreadPoolStats pool = m_pool.stats();
+        printf("pool: %u threads, %llu tasks, %llu stolen\n", (unsigned int)m_pool.threads(), pool.executed,
+               pool.stolen);
+        m_buffers.printStats("buffer pool");
+        fflush(stdout);
+    }
+
+private:
+    Engines *makeEngines()
+    {
+        cl_int status;
+        cl_command_queue queue = clCreateCommandQueue(m_context, m_device, 0, &status);
+        if (status != CL_SUCCESS)
+        {
+            perror("Couldn't create a command queue");
+            exit(1);
+        }
+        return new Engines(m_cache, queue);
+    }
+
+    void serve(std::shared_ptr<Connection> connection)
+    {
+        ServiceRequest request;
+        int passed;
+        while (serviceReadFd(connection->fd, &request, sizeof(request), &passed))
+        {
+            std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
+            ServiceResponse response;
+            memset(&response, 0, sizeof(response));
+            response.id = request.id;
+            if (passed >= 0 && request.op != SERVICE_ATTACH)
+            {
+                close(passed);
+                passed = -1;
+            }
+            if (request.magic != SERVICE_MAGIC)
+            {
+                if (passed >= 0)
+                    close(passed);
+                break;
+            }
+
+            if (request.op == SERVICE_ATTACH || request.op == SERVICE_STATS || request.op == SERVICE_SHUTDOWN)
+            {
+                /* Control requests answer on the reader thread */
+                bool shutdownAllowed = request.op == SERVICE_SHUTDOWN && connection->uid == getuid();
+                if (request.op == SERVICE_ATTACH)
+                    response.status = attach(*connection, request, passed);
+                else if (request.op == SERVICE_STATS)
+                    printStats();
+                else if (!shutdownAllowed)
+                    response.status = CL_INVALID_OPERATION;
+                respond(*connection, request.op, received, response);
+                if (shutdownAllowed)
+                {
+                    stop();
+                    break;
+                }
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                connection->inflight++;
+            }
+            m_pool.submit([this, connection, request, received]() {
+                ServiceResponse response;
+                memset(&response, 0, sizeof(response));
+                response.id = request.id;
+                response.status = execute(m_engines.local(), *connection, request, &response);
+                respond(*connection, request.op, received, response);
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                if (--connection->inflight == 0)
+                    connection->idle.notify_all();
+            });
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(connection->mutex);
+            connection->idle.wait(lock, [&]() { return connection->inflight == 0; });
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_open.erase(connection->fd);
+        if (--m_connections == 0)
+            m_closed.notify_all();
+    }
+
+    void respond(Connection &connection, uint32_t op, std::chrono::steady_clock::time_point received,
+                 ServiceResponse &response)
+    {
+        response.serviceUs = elapsed_us(received, std::chrono::steady_clock::now());
+        {
+            /* On failure the reader sees the end of the stream and the connection winds down */
+            std::lock_guard<std::mutex> lock(connection.mutex);
+            if (!connection.broken && !serviceWrite(connection.fd, &response, sizeof(response)))
+            {
+                connection.broken = true;
+                shutdown(connection.fd, SHUT_RDWR);
+            }
+        }
+        if (op != SERVICE_ATTACH && op != SERVICE_STATS && op != SERVICE_SHUTDOWN)
+            m_log.add(op, response.serviceUs);
+    }
+
+    /*
+     * Maps the shared memory the client passed along (fd, closed here). It
+     * must be the client's own and, with file seals, unable to shrink: a
+     * client truncating it under a running request would fault the daemon.
+     */
+    static cl_int attach(Connection &connection, const ServiceRequest &request, int fd)
+    {
+        if (fd < 0)
+            return CL_INVALID_VALUE;
+        if (connection.shm != NULL || request.bytes == 0)
+        {
+            close(fd);
+            return CL_INVALID_OPERATION;
+        }
+
+        struct stat info;
+        bool usable = fstat(fd, &info) == 0 && info.st_uid == connection.uid &&
+                      (uint64_t)info.st_size >= request.bytes;
+#ifdef F_GET_SEALS
+        int seals = fcntl(fd, F_GET_SEALS);
+        usable = usable && seals >= 0 && (seals & F_SEAL_SHRINK) != 0;
+#endif
+        void *shm = MAP_FAILED;
+        if (usable)
+            shm = mmap(NULL, request.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (shm == MAP_FAILED)
+            return CL_INVALID_VALUE;
+        connection.shm = (char *)shm;
+        connection.shmBytes = request.bytes;
+        return CL_SUCCESS;
+    }
+
+    /* One request on the calling worker's queue; results go to the shared memory or *response */
+    cl_int execute(Engines &e, Connection &connection, const ServiceRequest &r, ServiceResponse *response)
+    {
+        const size_t f = sizeof(float);
+        /* Keeps the byte counts below from overflowing */
+        if (r.m > SERVICE_MAX_DIM || r.k > SERVICE_MAX_DIM || r.n > SERVICE_MAX_DIM)
+            return CL_INVALID_VALUE;
+        switch (r.op)
+        {
+        case SERVICE_GEMM:
+        {
+            void *a = connection.payload(r.in0, r.m * r.k * f);
+            void *b = connection.payload(r.in1, r.k * r.n * f);
+            void *c = connection.payload(r.out, r.m * r.n * f);
+            if (a == NULL || b == NULL || c == NULL || r.m == 0 || r.k == 0 || r.n == 0)
+                return CL_INVALID_VALUE;
+            Buffers buffers(m_buffers, r.m * r.k * f, r.k * r.n * f, r.m * r.n * f);
+            cl_int status = buffers.status;
+            if (status == CL_SUCCESS)
+                status = clEnqueueWriteBuffer(e.queue, buffers.mem[0], CL_FALSE, 0, r.m * r.k * f, a, 0, NULL, NULL);
+            if (status == CL_SUCCESS)
+                status = clEnqueueWriteBuffer(e.queue, buffers.mem[1], CL_FALSE, 0, r.k * r.n * f, b, 0, NULL, NULL);
+            if (status == CL_SUCCESS)
+                status = e.gemm.gemm(buffers.mem[0], buffers.mem[1], buffers.mem[2], (cl_uint)r.m, (cl_uint)r.k,
+                                     (cl_uint)r.n);
+            if (status == CL_SUCCESS)
+                status = clEnqueueReadBuffer(e.queue, buffers.mem[2], CL_TRUE, 0, r.m * r.n * f, c, 0, NULL, NULL);
+            return finish(e, status);
+        }
+        case SERVICE_SORT:
+        {
+            void *in = connection.payload(r.in0, r.m * sizeof(cl_int));
+            void *out = connection.payload(r.out, r.m * sizeof(cl_int));
+            if (in == NULL || out == NULL)
+                return CL_INVALID_VALUE;
+            Buffers buffers(m_buffers, r.m * sizeof(cl_int));
+            cl_int status = buffers.status;
+            if (status == CL_SUCCESS)
+                status = clEnqueueWriteBuffer(e.queue, buffers.mem[0], CL_FALSE, 0, r.m * sizeof(cl_int), in, 0,
+                                              NULL, NULL);
+            if (status == CL_SUCCESS)
+                status = e.sort.sort(buffers.mem[0], (cl_uint)r.m, (r.flags & 1) != 0);
+            if (status == CL_SUCCESS)
+                status = clEnqueueReadBuffer(e.queue, buffers.mem[0], CL_TRUE, 0, r.m * sizeof(cl_int), out, 0,
+                                             NULL, NULL);
+            return finish(e, status);
+        }
+        case SERVICE_REDUCE:
+        {
+            void *in = connection.payload(r.in0, r.m * f);
+            if (in == NULL || r.flags > REDUCE_ARGMAX)
+                return CL_INVALID_VALUE;
+            ReduceResult result;
+            cl_int status = e.reduce.reduce(in, r.m, REDUCE_FLOAT, (ReduceOp)r.flags, &result);
+            response->value = result.value;
+            response->index = result.index;
+            return finish(e, status);
+        }
+        case SERVICE_INVERT:
+        {
+            void *in = connection.payload(r.in0, r.m * r.m * f);
+            void *out = connection.payload(r.out, r.m * r.m * f);
+            if (in == NULL || out == NULL || r.m == 0)
+                return CL_INVALID_VALUE;
+            Buffers buffers(m_buffers, r.m * r.m * f, r.m * r.m * f);
+            cl_int status = buffers.status;
+            if (status == CL_SUCCESS)
+                status = clEnqueueWriteBuffer(e.queue, buffers.mem[0], CL_FALSE, 0, r.m * r.m * f, in, 0, NULL, NULL);
+            if (status == CL_SUCCESS)
+                status = e.invert.invert(buffers.mem[0], buffers.mem[1], (cl_uint)r.m);
+            if (status == CL_SUCCESS)
+                status = clEnqueueReadBuffer(e.queue, buffers.mem[1], CL_TRUE, 0, r.m * r.m * f, out, 0, NULL, NULL);
+            return finish(e, status);
+        }
+        case SERVICE_MATVEC:
+        {
+            void *a = connection.payload(r.in0, r.m * r.n * f);
+            void *x = connection.payload(r.in1, r.n * f);
+            void *y = connection.payload(r.out, r.m * f);
+            if (a == NULL || x == NULL || y == NULL || r.m == 0 || r.n == 0)
+                return CL_INVALID_VALUE;
+            Buffers buffers(m_buffers, r.m * r.n * f, r.n * f, r.m * f);
+            cl_int status = buffers.status;
+            if (status == CL_SUCCESS)
+                status = clEnqueueWriteBuffer(e.queue, buffers.mem[0], CL_FALSE, 0, r.m * r.n * f, a, 0, NULL, NULL);
+            if (status == CL_SUCCESS)
+                status = clEnqueueWriteBuffer(e.queue, buffers.mem[1], CL_FALSE, 0, r.n * f, x, 0, NULL, NULL);
+            if (status == CL_SUCCESS && r.beta != 0.0f)
+                status = clEnqueueWriteBuffer(e.queue, buffers.mem[2], CL_FALSE, 0, r.m * f, y, 0, NULL, NULL);
+            if (status == CL_SUCCESS)
+                status = e.gemv.gemv(GEMV_ROW_MAJOR, (cl_uint)r.m, (cl_uint)r.n, r.alpha, buffers.mem[0],
+                                     (cl_uint)r.n, buffers.mem[1], r.beta, buffers.mem[2]);
+            if (status == CL_SUCCESS)
+                status = clEnqueueReadBuffer(e.queue, buffers.mem[2], CL_TRUE, 0, r.m * f, y, 0, NULL, NULL);
+            return finish(e, status);
+        }
+        default:
+            return CL_INVALID_OPERATION;
+        }
+    }
+
+    /* After an error the queue may still hold commands on the pooled buffers */
+    static cl_int finish(Engines &e, cl_int status)
+    {
+        if (status != CL_SUCCESS)
+            clFinish(e.queue);
+        return status;
+    }
+
+    /* Pooled device buffers for one request, back to the pool when it is done */
+    struct Buffers
+    {
+        BufferPool &pool;
+        cl_mem mem[3];
+        cl_int status;
+
+        Buffers(BufferPool &pool, size_t bytes0, size_t bytes1 = 0, size_t bytes2 = 0) : pool(pool)
+        {
+            size_t bytes[3] = { bytes0, bytes1, bytes2 };
+            status = CL_SUCCESS;
+            for (int i = 0; i < 3; i++)
+            {
+                mem[i] = NULL;
+                if (bytes[i] > 0 && status == CL_SUCCESS)
+                    mem[i] = pool.acquire(bytes[i], &status);
+            }
+        }
+
+        ~Buffers()
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                if (mem[i] != NULL)
+                    pool.release(mem[i]);
+            }
+        }
+    };
+
+    cl_context m_context;
+    cl_device_id m_device;
+    ProgramCache m_cache;
+    BufferPool m_buffers;
+    ThreadPool m_pool;
+    PerWorker<Engines> m_engines;
+    LatencyLog m_log;
+    int m_listen;
+    std::string m_path;
+    std::atomic<bool> m_stopping;
+    std::mutex m_mutex;               /* guards m_open and m_connections */
+    std::condition_variable m_closed;
+    std::set<int> m_open;
+    int m_connections;
+};
+
+static Service *service = NULL;
+
+static void on_signal(int)
+{
+    if (service != NULL)
+        service->stop();
+}
+
+/*
+ * kerneld [socket path] [threads]: serves gemm, sort, reduce, invert and
+ * matvec requests (see protocol.hpp) until SERVICE_SHUTDOWN or SIGINT,
+ * then prints the service time percentiles per op. The socket is created
+ * 0600; by default it goes in a directory private to the user.
+ */
+int main(int argc, char *argv[])
+{
+    char defaultPath[sizeof(((sockaddr_un *)NULL)->sun_path)];
+    const char *path = argc > 1 ? argv[1] : defaultPath;
+    if (argc <= 1)
+    {
+        serviceSocketPath(defaultPath, sizeof(defaultPath));
+        if (!private_directory(defaultPath))
+            exit(1);
+    }
+    size_t threads = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+    cl_device_id device;
+    cl_context context;
+    cl_int err;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+
+    {
+        Service kerneld(context, device, threads);
+        err = kerneld.warm();
+        if (err != CL_SUCCESS)
+        {
+            printf("warm-up failed: %d\n", err);
+            exit(1);
+        }
+        if (!kerneld.listen(path))
+            exit(1);
+        printf("kerneld ready on %s in %.1f ms (%u programs built or loaded)\n", path,
+               elapsed_us(start, std::chrono::steady_clock::now()) / 1000.0, (unsigned int)kerneld.builds());
+        fflush(stdout);
+
+        /* A client that goes away must not kill the daemon */
+        signal(SIGPIPE, SIG_IGN);
+        service = &kerneld;
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        kerneld.run();
+        service = NULL;
+        kerneld.printStats();
+    }
+
+    clReleaseContext(context);
+    return 0;
+}
@@ -0,0 +1,232 @@
+#ifndef SERVICE_PROTOCOL_HPP
+#define SERVICE_PROTOCOL_HPP
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+/*
+ * Wire format between kerneld and its clients: fixed-size little-endian
+ * structs over a Unix domain stream socket. Payloads do not go through the
+ * socket. A client creates shared memory, passes its descriptor along with
+ * SERVICE_ATTACH (SCM_RIGHTS), and every later request gives byte offsets
+ * into it, so a request is one small struct on the socket whatever its
+ * payload. The memory must belong to the client's user and, where the
+ * system has file seals, be a memfd sealed against shrinking
+ * (F_SEAL_SHRINK): the daemon touches it for as long as the connection
+ * lasts, and a smaller object would fault it (SIGBUS).
+ *
+ * The socket is private to the daemon's user (see serviceSocketPath());
+ * other users may connect only as root, and only the daemon's own user can
+ * shut it down.
+ *
+ * Requests may be pipelined; responses carry the request id and can come
+ * back out of order.
+ */
+
+#define SERVICE_MAGIC 0x4b434c44u  /* "KCLD" */
+
+enum ServiceOp
+{
+    SERVICE_ATTACH,       /* map the first bytes of the shared memory passed along */
+    SERVICE_GEMM,         /* out[m x n] = in0[m x k] * in1[k x n], float, m, k, n multiples of 4 */
+    SERVICE_SORT,         /* out[m] = sorted in0[m], int, m a power of two >= 8; flags 1 = descending */
+    SERVICE_REDUCE,       /* value/index of in0[m] floats; flags is a ReduceOp */
+    SERVICE_INVERT,       /* out[m x m] = inverse of in0[m x m], float, no pivoting */
+    SERVICE_MATVEC,       /* out[m] = alpha * in0[m x n] * in1[n] + beta * out[m], float, row major */
+    SERVICE_STATS,        /* the daemon prints its latency percentiles */
+    SERVICE_SHUTDOWN,
+    SERVICE_OPS
+};
+
+struct ServiceRequest
+{
+    uint32_t magic;
+    uint32_t op;
+    uint64_t id;
+    uint64_t m, k, n;
+    uint32_t flags;
+    float alpha, beta;
+    uint32_t reserved;
+    uint64_t in0, in1, out;           /* byte offsets into the shared memory */
+    uint64_t bytes;                   /* SERVICE_ATTACH: size of the shared memory */
+};
+
+struct ServiceResponse
+{
+    uint64_t id;
+    int32_t status;                   /* CL_SUCCESS or an OpenCL error code */
+    uint32_t reserved;
+    double value;                     /* SERVICE_REDUCE */
+    uint64_t index;                   /* SERVICE_REDUCE argmin/argmax */
+    double serviceUs;                 /* request read to response written, in the daemon */
+};
+
+static inline const char *serviceOpName(uint32_t op)
+{
+    static const char *names[SERVICE_OPS] = { "attach", "gemm", "sort", "reduce", "invert", "matvec", "stats",
+                                              "shutdown" };
+    return op < SERVICE_OPS ? names[op] : "unknown";
+}
+
+/* Whole-struct socket I/O; false on error or end of stream */
+static inline bool serviceRead(int fd, void *data, size_t bytes)
+{
+    char *p = (char *)data;
+    while (bytes > 0)
+    {
+        ssize_t n = read(fd, p, bytes);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+static inline bool serviceWrite(int fd, const void *data, size_t bytes)
+{
+    const char *p = (const char *)data;
+    while (bytes > 0)
+    {
+        ssize_t n = write(fd, p, bytes);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+/* Like serviceWrite, with fd passed along the first bytes */
+static inline bool serviceWriteFd(int socket, const void *data, size_t bytes, int fd)
+{
+    union
+    {
+        cmsghdr align;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    iovec io;
+    io.iov_base = (void *)data;
+    io.iov_len = bytes;
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+    ssize_t n;
+    do
+        n = sendmsg(socket, &message, 0);
+    while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return false;
+    return serviceWrite(socket, (const char *)data + n, bytes - (size_t)n);
+}
+
+/*
+ * Like serviceRead; a descriptor passed along is returned in *fd, -1
+ * without one. Further descriptors are closed.
+ */
+static inline bool serviceReadFd(int socket, void *data, size_t bytes, int *fd)
+{
+#ifdef MSG_CMSG_CLOEXEC
+    const int flags = MSG_CMSG_CLOEXEC;
+#else
+    const int flags = 0;
+#endif
+    char *p = (char *)data;
+    *fd = -1;
+    while (bytes > 0)
+    {
+        union
+        {
+            cmsghdr align;
+            char buffer[CMSG_SPACE(4 * sizeof(int))];
+        } control;
+        iovec io;
+        io.iov_base = p;
+        io.iov_len = bytes;
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &io;
+        message.msg_iovlen = 1;
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        ssize_t n = recvmsg(socket, &message, flags);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        for (cmsghdr *header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header))
+        {
+            if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+                continue;
+            size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; i++)
+            {
+                int passed;
+                memcpy(&passed, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                if (*fd < 0)
+                    *fd = passed;
+                else
+                    close(passed);
+            }
+        }
+        p += n;
+        bytes -= (size_t)n;
+    }
+    if (bytes > 0 && *fd >= 0)
+    {
+        close(*fd);
+        *fd = -1;
+    }
+    return bytes == 0;
+}
+
+/*
+ * The default socket: kerneld.sock in $XDG_RUNTIME_DIR, or in
+ * /tmp/kerneld-<uid> without one. kerneld creates the latter 0700 and
+ * refuses a directory another user owns or can enter.
+ */
+static inline void serviceSocketPath(char *path, size_t size)
+{
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime != NULL && runtime[0] == '/')
+        snprintf(path, size, "%s/kerneld.sock", runtime);
+    else
+        snprintf(path, size, "/tmp/kerneld-%u/kerneld.sock", (unsigned int)getuid());
+}
+
+/* p50/p95/p99/max of samples in microseconds, on one line */
+static inline void servicePrintLatency(const char *label, std::vector<double> samples)
+{
+    if (samples.empty())
+        return;
+    std::sort(samples.begin(), samples.end());
+    size_t last = samples.size() - 1;
+    printf("%-10s %6u requests  p50 %9.1f us  p95 %9.1f us  p99 %9.1f us  max %9.1f us\n", label,
+           (unsigned int)samples.size(), samples[last * 50 / 100], samples[last * 95 / 100], samples[last * 99 / 100],
+           samples[last]);
+}
+
+#endif
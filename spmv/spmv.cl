@@ -0,0 +1,88 @@
+/*
+ * y = A*x for a sparse float matrix.
+ *
+ *    -D LANES=<n>  work-items per row in spmv_csr_vector (power of two)
+ *
+ * CSR: row i holds values[row_ptr[i] .. row_ptr[i+1]) at the columns in
+ * col_idx. SELL-C-sigma: rows (reordered by perm) are packed into slices of
+ * C = get_local_size(0) rows, each padded to its longest row and stored
+ * column by column, so slice s, entry j of row r is at
+ * slice_ptr[s] + j*C + r. Padding has value 0 and column 0.
+ */
+
+#ifndef LANES
+#define LANES 8
+#endif
+
+/* One work-item per row: fine for short, even rows */
+__kernel void spmv_csr_scalar(uint rows, __global const uint *row_ptr,
+      __global const uint *col_idx, __global const float *values,
+      __global const float *x, __global float *y) {
+
+   uint row = get_global_id(0);
+   float sum = 0.0f;
+
+   if(row >= rows)
+      return;
+
+   for(uint k = row_ptr[row]; k < row_ptr[row + 1]; k++) {
+      sum += values[k] * x[col_idx[k]];
+   }
+   y[row] = sum;
+}
+
+/* LANES work-items per row read its entries with coalesced loads and sum
+   them with a local tree; l_sum holds get_local_size(0) floats. */
+__kernel void spmv_csr_vector(uint rows, __global const uint *row_ptr,
+      __global const uint *col_idx, __global const float *values,
+      __global const float *x, __global float *y, __local float *l_sum) {
+
+   uint lid = get_local_id(0);
+   uint lane = lid & (LANES - 1);
+   uint row = get_global_id(0) / LANES;
+   float sum = 0.0f;
+
+   if(row < rows) {
+      for(uint k = row_ptr[row] + lane; k < row_ptr[row + 1]; k += LANES) {
+         sum += values[k] * x[col_idx[k]];
+      }
+   }
+
+   l_sum[lid] = sum;
+   barrier(CLK_LOCAL_MEM_FENCE);
+   for(uint i = LANES/2; i > 0; i >>= 1) {
+      if(lane < i) {
+         l_sum[lid] += l_sum[lid + i];
+      }
+      barrier(CLK_LOCAL_MEM_FENCE);
+   }
+
+   if(lane == 0 && row < rows) {
+      y[row] = l_sum[lid];
+   }
+}
+
+/* One work-item per row of a slice; consecutive work-items read
+   consecutive entries, and only the slice's own width is walked. */
+__kernel void spmv_sell(uint rows, __global const uint *slice_ptr,
+      __global const uint *col_idx, __global const float *values,
+      __global const float *x, __global float *y,
+      __global const uint *perm) {
+
+   uint gid = get_global_id(0);
+   uint c = get_local_size(0);
+   uint slice = get_group_id(0);
+   uint r = get_local_id(0);
+   uint start = slice_ptr[slice];
+   uint width = (slice_ptr[slice + 1] - start) / c;
+   float sum = 0.0f;
+
+   for(uint j = 0; j < width; j++) {
+      uint k = start + j * c + r;
+      sum += values[k] * x[col_idx[k]];
+   }
+
+   if(gid < rows) {
+      y[perm[gid]] = sum;
+   }
+}
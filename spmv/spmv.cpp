@@ -0,0 +1,370 @@
+#include <CL/cl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "spmv.hpp"
+#include "../matvec/gemv.hpp"
+
+#define BENCH_DIM 8192
+#define BENCH_DENSITY 0.005
+#define LOOP 10
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+cl_mem create_buffer(cl_context context, size_t bytes, const void *host)
+{
+    cl_int err;
+    cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | (host != NULL ? CL_MEM_COPY_HOST_PTR : 0),
+                                   bytes, (void *)host, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a buffer");
+        exit(1);
+    }
+    return buffer;
+}
+
+double event_ms(cl_event event)
+{
+    cl_ulong start, end;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    return (end - start) * 1e-6;
+}
+
+float random_value()
+{
+    return (float)rand() / RAND_MAX - 0.5f;
+}
+
+/*
+ * Row lengths follow a power law: row i (in shuffled order) gets a share
+ * proportional to (i + 1)^-exponent of density * n * n entries, so a few
+ * rows are nearly dense and most hold a handful. Columns are random;
+ * duplicates are summed by cooToCsr.
+ */
+CsrMatrix power_law(cl_uint n, double density, double exponent)
+{
+    std::vector<double> weight(n);
+    double total = 0.0;
+    for (cl_uint i = 0; i < n; i++)
+    {
+        weight[i] = pow(i + 1.0, -exponent);
+        total += weight[i];
+    }
+    /* Seeded from rand() so srand() still fixes the matrix */
+    std::mt19937 generator((unsigned int)rand());
+    std::shuffle(weight.begin(), weight.end(), generator);
+
+    std::vector<CooEntry> coo;
+    double target = density * n * n;
+    for (cl_uint i = 0; i < n; i++)
+    {
+        size_t len = std::min((size_t)n, (size_t)(weight[i] / total * target) + 1);
+        for (size_t k = 0; k < len; k++)
+        {
+            CooEntry e = { i, (cl_uint)(rand() % n), random_value() };
+            coo.push_back(e);
+        }
+    }
+    return cooToCsr(n, n, coo);
+}
+
+/* Diagonals -half..half, clipped at the edges */
+CsrMatrix banded(cl_uint n, cl_uint half)
+{
+    std::vector<CooEntry> coo;
+    for (cl_uint i = 0; i < n; i++)
+    {
+        cl_uint first = i > half ? i - half : 0, last = std::min(n - 1, i + half);
+        for (cl_uint j = first; j <= last; j++)
+        {
+            CooEntry e = { i, j, random_value() };
+            coo.push_back(e);
+        }
+    }
+    return cooToCsr(n, n, coo);
+}
+
+/* Host reference in double */
+void reference(const CsrMatrix &a, const std::vector<float> &x, std::vector<double> &y)
+{
+    y.assign(a.rows, 0.0);
+    for (cl_uint i = 0; i < a.rows; i++)
+    {
+        for (cl_uint k = a.rowPtr[i]; k < a.rowPtr[i + 1]; k++)
+            y[i] += (double)a.values[k] * x[a.colIdx[k]];
+    }
+}
+
+bool close_enough(const std::vector<float> &out, const std::vector<double> &expected, const CsrMatrix &a)
+{
+    for (cl_uint i = 0; i < a.rows; i++)
+    {
+        double len = a.rowPtr[i + 1] - a.rowPtr[i];
+        if (fabs(out[i] - expected[i]) > 1e-5 * (len + 1.0) + 1e-5 * fabs(expected[i]))
+            return false;
+    }
+    return true;
+}
+
+/* Runs all three kernels on a and compares them with the host */
+bool check_spmv(cl_context context, cl_command_queue queue, SpmvEngine &engine, const CsrMatrix &a)
+{
+    static const SpmvKernel kernels[] = { SPMV_CSR_SCALAR, SPMV_CSR_VECTOR, SPMV_SELL };
+    std::vector<float> x(a.cols), out(a.rows);
+    std::vector<double> expected;
+    for (cl_uint j = 0; j < a.cols; j++)
+        x[j] = random_value();
+    reference(a, x, expected);
+
+    SpmvMatrix csr, sell;
+    cl_int err = engine.upload(a, &csr);
+    if (err == CL_SUCCESS)
+        err = engine.upload(csrToSell(a), &sell);
+    if (err != CL_SUCCESS)
+        return false;
+
+    cl_mem bufX = create_buffer(context, std::max<size_t>(a.cols, 1) * sizeof(float), a.cols ? x.data() : NULL);
+    cl_mem bufY = create_buffer(context, std::max<size_t>(a.rows, 1) * sizeof(float), NULL);
+    bool ok = true;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]) && ok; k++)
+    {
+        std::fill(out.begin(), out.end(), NAN);
+        err = engine.multiply(kernels[k] == SPMV_SELL ? sell : csr, kernels[k], bufX, bufY);
+        if (err == CL_SUCCESS && a.rows > 0)
+            err = clEnqueueReadBuffer(queue, bufY, CL_TRUE, 0, a.rows * sizeof(float), out.data(), 0, NULL, NULL);
+        ok = err == CL_SUCCESS && close_enough(out, expected, a);
+    }
+
+    engine.release(&csr);
+    engine.release(&sell);
+    clReleaseMemObject(bufX);
+    clReleaseMemObject(bufY);
+    return ok;
+}
+
+/* COO and dense input must give the same CSR, and SELL must hold every entry */
+bool check_converters(cl_uint rows, cl_uint cols)
+{
+    std::vector<float> dense((size_t)rows * cols, 0.0f);
+    std::vector<CooEntry> coo;
+    for (size_t k = 0; k < (size_t)rows * cols / 7; k++)
+    {
+        CooEntry e = { (cl_uint)(rand() % rows), (cl_uint)(rand() % cols), (float)(rand() % 9 + 1) };
+        coo.push_back(e);
+        dense[(size_t)e.row * cols + e.col] += e.value;
+    }
+
+    CsrMatrix fromCoo = cooToCsr(rows, cols, coo);
+    CsrMatrix fromDense = denseToCsr(rows, cols, dense.data(), cols);
+    bool ok = fromCoo.rowPtr == fromDense.rowPtr && fromCoo.colIdx == fromDense.colIdx &&
+              fromCoo.values == fromDense.values;
+
+    std::vector<float> back(dense.size());
+    csrToDense(fromCoo, back.data(), cols);
+    ok = ok && back == dense;
+
+    SellMatrix sell = csrToSell(fromCoo, 8, 32);
+    double sum = 0.0, sellSum = 0.0;
+    for (size_t k = 0; k < fromCoo.nnz(); k++)
+        sum += fromCoo.values[k];
+    for (size_t k = 0; k < sell.values.size(); k++)
+        sellSum += sell.values[k];
+    return ok && sum == sellSum && sell.perm.size() == sell.slices() * 8;
+}
+
+/* GFLOP/s counts 2 flops per stored nonzero; GB/s the matrix plus x and y once */
+void benchmark(cl_context context, cl_command_queue queue, SpmvEngine &engine, const char *name,
+               const CsrMatrix &a, double denseMs)
+{
+    static const SpmvKernel kernels[] = { SPMV_CSR_SCALAR, SPMV_CSR_VECTOR, SPMV_SELL };
+    static const char *kernelNames[] = { "csr scalar", "csr vector", "sell-32-1024" };
+    std::vector<float> x(a.cols, 1.0f), out(a.rows);
+    SellMatrix s = csrToSell(a);
+    SpmvMatrix csr, sell;
+    cl_event event;
+
+    if (engine.upload(a, &csr) != CL_SUCCESS || engine.upload(s, &sell) != CL_SUCCESS)
+    {
+        printf("%s: couldn't upload the matrix\n", name);
+        return;
+    }
+    cl_mem bufX = create_buffer(context, a.cols * sizeof(float), x.data());
+    cl_mem bufY = create_buffer(context, a.rows * sizeof(float), NULL);
+
+    printf("%s: %u x %u, %u nonzeros (%.2f%%), SELL fill %.2f, csr vector %u lanes\n", name, a.rows, a.cols,
+           (unsigned int)a.nnz(), 100.0 * a.nnz() / ((double)a.rows * a.cols),
+           (double)s.values.size() / std::max<size_t>(a.nnz(), 1), csr.lanes);
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+        const SpmvMatrix &m = kernels[k] == SPMV_SELL ? sell : csr;
+        double ms = 0.0;
+        engine.multiply(m, kernels[k], bufX, bufY);
+        for (int i = 0; i < LOOP; i++)
+        {
+            engine.multiply(m, kernels[k], bufX, bufY, &event);
+            clWaitForEvents(1, &event);
+            ms += event_ms(event);
+            clReleaseEvent(event);
+        }
+        ms /= LOOP;
+
+        /* With x all ones, y is the row sums */
+        clEnqueueReadBuffer(queue, bufY, CL_TRUE, 0, a.rows * sizeof(float), out.data(), 0, NULL, NULL);
+        bool ok = true;
+        for (cl_uint i = 0; i < a.rows && ok; i++)
+        {
+            double sum = 0.0;
+            for (cl_uint j = a.rowPtr[i]; j < a.rowPtr[i + 1]; j++)
+                sum += a.values[j];
+            ok = fabs(out[i] - sum) <= 1e-5 * (a.rowPtr[i + 1] - a.rowPtr[i] + 1.0);
+        }
+
+        double bytes = m.bytes + (double)(a.rows + a.cols) * sizeof(float);
+        printf("  %-12s %8.3f ms  %7.2f GFLOP/s  %7.2f GB/s", kernelNames[k], ms, 2.0 * a.nnz() / (ms * 1e6),
+               bytes / (ms * 1e6));
+        if (denseMs > 0.0)
+            printf("  %6.1fx dense", denseMs / ms);
+        printf("  %s\n", ok ? "Check passed." : "Check failed.");
+    }
+
+    engine.release(&csr);
+    engine.release(&sell);
+    clReleaseMemObject(bufX);
+    clReleaseMemObject(bufY);
+}
+
+/* Dense row-major gemv on an n x n matrix of the same size; < 0 if it does not fit */
+double dense_ms(cl_context context, cl_device_id device, cl_command_queue queue, GemvEngine &dense, cl_uint n)
+{
+    cl_ulong maxAlloc = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, NULL);
+    size_t bytes = (size_t)n * n * sizeof(float);
+    if (bytes > maxAlloc)
+        return -1.0;
+
+    float one = 1.0f;
+    cl_event event;
+    double ms = 0.0;
+    cl_mem bufA = create_buffer(context, bytes, NULL);
+    cl_mem bufX = create_buffer(context, n * sizeof(float), NULL);
+    cl_mem bufY = create_buffer(context, n * sizeof(float), NULL);
+    clEnqueueFillBuffer(queue, bufA, &one, sizeof(one), 0, bytes, 0, NULL, NULL);
+    clEnqueueFillBuffer(queue, bufX, &one, sizeof(one), 0, n * sizeof(float), 0, NULL, NULL);
+
+    dense.gemv(GEMV_ROW_MAJOR, n, n, 1.0f, bufA, n, bufX, 0.0f, bufY);
+    for (int i = 0; i < LOOP; i++)
+    {
+        dense.gemv(GEMV_ROW_MAJOR, n, n, 1.0f, bufA, n, bufX, 0.0f, bufY, &event);
+        clWaitForEvents(1, &event);
+        ms += event_ms(event);
+        clReleaseEvent(event);
+    }
+    ms /= LOOP;
+    printf("dense gemv %u x %u: %8.3f ms  %7.2f GFLOP/s  %7.2f GB/s\n", n, n, ms, 2.0 * n * n / (ms * 1e6),
+           bytes / (ms * 1e6));
+
+    clReleaseMemObject(bufA);
+    clReleaseMemObject(bufX);
+    clReleaseMemObject(bufY);
+    return ms;
+}
+
+int main(int argc, char *argv[])
+{
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_int err;
+    cl_uint dim = BENCH_DIM;
+    double density = BENCH_DENSITY;
+    int failed = 0;
+
+    if (argc > 1)
+    {
+        dim = (cl_uint)strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2)
+    {
+        density = atof(argv[2]);
+    }
+
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+    queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a command queue");
+        exit(1);
+    }
+
+    ProgramCache cache(context, device);
+    SpmvEngine engine(cache, queue);
+    GemvEngine dense(cache, queue, "../matvec/gemv.cl");
+
+    srand(123);
+    int passed = 0, total = 0;
+    cl_uint shapes[][2] = { { 1, 1 }, { 7, 13 }, { 100, 100 }, { 257, 1000 } };
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+    {
+        bool ok = check_converters(shapes[s][0], shapes[s][1]);
+        passed += ok;
+        total++;
+    }
+    CsrMatrix checks[] = { power_law(1000, 0.01, 1.2), power_law(5000, 0.002, 2.0), banded(1000, 0),
+                           banded(3001, 40), power_law(33, 0.5, 0.5) };
+    for (size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); c++)
+    {
+        bool ok = check_spmv(context, queue, engine, checks[c]);
+        if (!ok)
+            printf("  matrix %u failed\n", (unsigned int)c);
+        passed += ok;
+        total++;
+    }
+    failed = passed != total;
+    printf("converters and kernels: %d/%d, %s\n", passed, total, failed ? "Check failed." : "Check passed.");
+
+    double denseMs = dense_ms(context, device, queue, dense, dim);
+    cl_uint half = (cl_uint)(density * dim / 2);
+    benchmark(context, queue, engine, "power-law", power_law(dim, density, 1.5), denseMs);
+    benchmark(context, queue, engine, "banded", banded(dim, half), denseMs);
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+    return failed;
+}
@@ -0,0 +1,353 @@
+#ifndef SPMV_HPP
+#define SPMV_HPP
+
+#include <CL/cl.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "../common/program_cache.hpp"
+
+#define SPMV_PROGRAM_FILE "spmv.cl"
+#define SPMV_LOCAL_SIZE 256
+#define SPMV_MAX_LANES 32
+#define SPMV_SLICE_HEIGHT 32
+#define SPMV_SIGMA 1024
+
+struct CooEntry
+{
+    cl_uint row;
+    cl_uint col;
+    cl_float value;
+};
+
+struct CsrMatrix
+{
+    cl_uint rows, cols;
+    std::vector<cl_uint> rowPtr;   /* rows + 1 */
+    std::vector<cl_uint> colIdx;
+    std::vector<cl_float> values;
+
+    size_t nnz() const { return values.size(); }
+};
+
+/*
+ * SELL-C-sigma: rows are sorted by length, longest first, within windows of
+ * sigma rows, and cut into slices of C rows. Each slice is padded to its
+ * longest row and stored column by column. perm[k] is the original row at
+ * sorted position k; padded rows past the end map to nothing.
+ */
+struct SellMatrix
+{
+    cl_uint rows, cols;
+    cl_uint sliceHeight, sigma;
+    std::vector<cl_uint> slicePtr; /* slices + 1 */
+    std::vector<cl_uint> colIdx;
+    std::vector<cl_float> values;
+    std::vector<cl_uint> perm;
+
+    size_t slices() const { return slicePtr.size() - 1; }
+};
+
+/* Sorts by (row, col) and sums duplicate entries */
+inline CsrMatrix cooToCsr(cl_uint rows, cl_uint cols, const std::vector<CooEntry> &coo)
+{
+    CsrMatrix csr;
+    std::vector<CooEntry> sorted(coo);
+    std::sort(sorted.begin(), sorted.end(), [](const CooEntry &a, const CooEntry &b) {
+        return a.row != b.row ? a.row < b.row : a.col < b.col;
+    });
+
+    csr.rows = rows;
+    csr.cols = cols;
+    csr.rowPtr.assign(rows + 1, 0);
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        const CooEntry &e = sorted[i];
+        if (i > 0 && sorted[i - 1].row == e.row && sorted[i - 1].col == e.col)
+        {
+            csr.values.back() += e.value;
+            continue;
+        }
+        csr.colIdx.push_back(e.col);
+        csr.values.push_back(e.value);
+        csr.rowPtr[e.row + 1]++;
+    }
+    for (cl_uint i = 0; i < rows; i++)
+        csr.rowPtr[i + 1] += csr.rowPtr[i];
+    return csr;
+}
+
+/* Keeps the nonzeros of a dense matrix with leading dimension lda */
+inline CsrMatrix denseToCsr(cl_uint rows, cl_uint cols, const float *a, size_t lda)
+{
+    CsrMatrix csr;
+    csr.rows = rows;
+    csr.cols = cols;
+    csr.rowPtr.reserve(rows + 1);
+    csr.rowPtr.push_back(0);
+    for (cl_uint i = 0; i < rows; i++)
+    {
+        for (cl_uint j = 0; j < cols; j++)
+        {
+            float v = a[i * lda + j];
+            if (v != 0.0f)
+            {
+                csr.colIdx.push_back(j);
+                csr.values.push_back(v);
+            }
+        }
+        csr.rowPtr.push_back((cl_uint)csr.values.size());
+    }
+    return csr;
+}
+
+inline void csrToDense(const CsrMatrix &csr, float *a, size_t lda)
+{
+    for (cl_uint i = 0; i < csr.rows; i++)
+    {
+        std::fill(a + i * lda, a + i * lda + csr.cols, 0.0f);
+        for (cl_uint k = csr.rowPtr[i]; k < csr.rowPtr[i + 1]; k++)
+            a[i * lda + csr.colIdx[k]] = csr.values[k];
+    }
+}
+
+/* sigma == 1 keeps the row order (plain SELL-C); sigma is rounded to a multiple of C */
+inline SellMatrix csrToSell(const CsrMatrix &csr, cl_uint sliceHeight = SPMV_SLICE_HEIGHT,
+                            cl_uint sigma = SPMV_SIGMA)
+{
+    SellMatrix sell;
+    cl_uint c = sliceHeight;
+    size_t slices = (csr.rows + c - 1) / c;
+    sigma = sigma <= 1 ? 1 : (sigma + c - 1) / c * c;
+
+    sell.rows = csr.rows;
+    sell.cols = csr.cols;
+    sell.sliceHeight = c;
+    sell.sigma = sigma;
+    sell.perm.resize(slices * c);
+    for (size_t k = 0; k < sell.perm.size(); k++)
+        sell.perm[k] = (cl_uint)k;
+
+    if (sigma > 1)
+    {
+        for (size_t w = 0; w < csr.rows; w += sigma)
+        {
+            size_t end = std::min(w + sigma, (size_t)csr.rows);
+            std::stable_sort(sell.perm.begin() + w, sell.perm.begin() + end, [&csr](cl_uint a, cl_uint b) {
+                return csr.rowPtr[a + 1] - csr.rowPtr[a] > csr.rowPtr[b + 1] - csr.rowPtr[b];
+            });
+        }
+    }
+
+    sell.slicePtr.assign(slices + 1, 0);
+    for (size_t s = 0; s < slices; s++)
+    {
+        cl_uint width = 0;
+        for (size_t k = s * c; k < (s + 1) * c && k < csr.rows; k++)
+        {
+            cl_uint row = sell.perm[k];
+            width = std::max(width, csr.rowPtr[row + 1] - csr.rowPtr[row]);
+        }
+        sell.slicePtr[s + 1] = sell.slicePtr[s] + width * c;
+    }
+
+    sell.colIdx.assign(sell.slicePtr[slices], 0);
+    sell.values.assign(sell.slicePtr[slices], 0.0f);
+    for (size_t k = 0; k < csr.rows; k++)
+    {
+        size_t s = k / c, r = k % c;
+        cl_uint row = sell.perm[k];
+        for (cl_uint j = 0; j < csr.rowPtr[row + 1] - csr.rowPtr[row]; j++)
+        {
+            size_t dst = sell.slicePtr[s] + (size_t)j * c + r;
+            sell.colIdx[dst] = csr.colIdx[csr.rowPtr[row] + j];
+            sell.values[dst] = csr.values[csr.rowPtr[row] + j];
+        }
+    }
+    return sell;
+}
+
+enum SpmvKernel
+{
+    SPMV_CSR_SCALAR,
+    SPMV_CSR_VECTOR,
+    SPMV_SELL
+};
+
+/* A matrix uploaded by SpmvEngine::upload; ptr is rowPtr or slicePtr */
+struct SpmvMatrix
+{
+    SpmvKernel format;
+    cl_uint rows, cols;
+    cl_uint lanes;        /* CSR: work-items per row for SPMV_CSR_VECTOR */
+    cl_uint sliceHeight;  /* SELL */
+    cl_mem ptr, colIdx, values, perm;
+    size_t bytes;         /* matrix bytes read by one multiply */
+};
+
+/*
+ * y = A*x for CSR or SELL-C-sigma matrices. A CSR matrix can run with one
+ * work-item per row (SPMV_CSR_SCALAR) or with a power-of-two team of lanes
+ * per row (SPMV_CSR_VECTOR), chosen from the mean row length at upload.
+ * SELL uses one work-group per slice.
+ */
+class SpmvEngine
+{
+public:
+    SpmvEngine(ProgramCache &cache, cl_command_queue queue, const std::string &programFile = SPMV_PROGRAM_FILE)
+        : m_cache(cache), m_queue(queue), m_programFile(programFile)
+    {
+    }
+
+    ~SpmvEngine()
+    {
+        for (std::map<std::string, cl_kernel>::iterator it = m_kernels.begin(); it != m_kernels.end(); ++it)
+        {
+            clReleaseKernel(it->second);
+        }
+    }
+
+    cl_int upload(const CsrMatrix &csr, SpmvMatrix *matrix)
+    {
+        cl_int status;
+        memset(matrix, 0, sizeof(*matrix));
+        matrix->format = SPMV_CSR_SCALAR;
+        matrix->rows = csr.rows;
+        matrix->cols = csr.cols;
+
+        /* Roughly one lane per entry of the mean row */
+        size_t mean = csr.rows > 0 ? csr.nnz() / csr.rows : 0;
+        matrix->lanes = 2;
+        while (matrix->lanes < SPMV_MAX_LANES && matrix->lanes < mean)
+            matrix->lanes <<= 1;
+
+        matrix->ptr = createBuffer(csr.rowPtr, &status);
+        if (status == CL_SUCCESS)
+            matrix->colIdx = createBuffer(csr.colIdx, &status);
+        if (status == CL_SUCCESS)
+            matrix->values = createBuffer(csr.values, &status);
+        matrix->bytes = csr.rowPtr.size() * sizeof(cl_uint) + csr.nnz() * (sizeof(cl_uint) + sizeof(cl_float));
+        if (status != CL_SUCCESS)
+            release(matrix);
+        return status;
+    }
+
+    cl_int upload(const SellMatrix &sell, SpmvMatrix *matrix)
+    {
+        cl_int status;
+        memset(matrix, 0, sizeof(*matrix));
+        matrix->format = SPMV_SELL;
+        matrix->rows = sell.rows;
+        matrix->cols = sell.cols;
+        matrix->sliceHeight = sell.sliceHeight;
+
+        matrix->ptr = createBuffer(sell.slicePtr, &status);
+        if (status == CL_SUCCESS)
+            matrix->colIdx = createBuffer(sell.colIdx, &status);
+        if (status == CL_SUCCESS)
+            matrix->values = createBuffer(sell.values, &status);
+        if (status == CL_SUCCESS)
+            matrix->perm = createBuffer(sell.perm, &status);
+        matrix->bytes = (sell.slicePtr.size() + sell.perm.size()) * sizeof(cl_uint) +
+                        sell.values.size() * (sizeof(cl_uint) + sizeof(cl_float));
+        if (status != CL_SUCCESS)
+            release(matrix);
+        return status;
+    }
+
+    void release(SpmvMatrix *matrix)
+    {
+        cl_mem *buffers[] = { &matrix->ptr, &matrix->colIdx, &matrix->values, &matrix->perm };
+        for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i++)
+        {
+            if (*buffers[i] != NULL)
+                clReleaseMemObject(*buffers[i]);
+            *buffers[i] = NULL;
+        }
+    }
+
+    /* kernel must match the format: a CSR upload runs either CSR kernel, SELL only SPMV_SELL */
+    cl_int multiply(const SpmvMatrix &matrix, SpmvKernel kernel, cl_mem x, cl_mem y, cl_event *event = NULL)
+    {
+        cl_int status;
+        if ((kernel == SPMV_SELL) != (matrix.format == SPMV_SELL))
+            return CL_INVALID_VALUE;
+        if (matrix.rows == 0)
+            return CL_SUCCESS;
+
+        char options[64];
+        snprintf(options, sizeof(options), "-D LANES=%u", kernel == SPMV_CSR_VECTOR ? matrix.lanes : 1);
+        static const char *names[] = { "spmv_csr_scalar", "spmv_csr_vector", "spmv_sell" };
+        cl_kernel k = getKernel(options, names[kernel], &status);
+        if (status != CL_SUCCESS)
+            return status;
+
+        status = clSetKernelArg(k, 0, sizeof(cl_uint), &matrix.rows);
+        status |= clSetKernelArg(k, 1, sizeof(cl_mem), &matrix.ptr);
+        status |= clSetKernelArg(k, 2, sizeof(cl_mem), &matrix.colIdx);
+        status |= clSetKernelArg(k, 3, sizeof(cl_mem), &matrix.values);
+        status |= clSetKernelArg(k, 4, sizeof(cl_mem), &x);
+        status |= clSetKernelArg(k, 5, sizeof(cl_mem), &y);
+
+        size_t localSize, globalSize;
+        switch (kernel)
+        {
+        case SPMV_CSR_SCALAR:
+            localSize = SPMV_LOCAL_SIZE;
+            globalSize = ((size_t)matrix.rows + localSize - 1) / localSize * localSize;
+            break;
+        case SPMV_CSR_VECTOR:
+            localSize = SPMV_LOCAL_SIZE;
+            globalSize = ((size_t)matrix.rows * matrix.lanes + localSize - 1) / localSize * localSize;
+            status |= clSetKernelArg(k, 6, localSize * sizeof(cl_float), NULL);
+            break;
+        default:
+            localSize = matrix.sliceHeight;
+            globalSize = ((size_t)matrix.rows + localSize - 1) / localSize * localSize;
+            status |= clSetKernelArg(k, 6, sizeof(cl_mem), &matrix.perm);
+            break;
+        }
+        if (status != CL_SUCCESS)
+            return status;
+        return clEnqueueNDRangeKernel(m_queue, k, 1, NULL, &globalSize, &localSize, 0, NULL, event);
+    }
+
+private:
+    template <typename T>
+    cl_mem createBuffer(const std::vector<T> &host, cl_int *status)
+    {
+        /* Empty matrices still get a valid buffer */
+        T dummy = T();
+        return clCreateBuffer(m_cache.context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                              std::max<size_t>(host.size(), 1) * sizeof(T),
+                              host.empty() ? &dummy : (void *)host.data(), status);
+    }
+
+    cl_kernel getKernel(const std::string &options, const char *name, cl_int *status)
+    {
+        std::string key = options + ' ' + name;
+        std::map<std::string, cl_kernel>::iterator it = m_kernels.find(key);
+        if (it != m_kernels.end())
+        {
+            *status = CL_SUCCESS;
+            return it->second;
+        }
+
+        cl_kernel kernel = m_cache.createKernel(m_programFile, options, name, status);
+        if (*status == CL_SUCCESS)
+        {
+            m_kernels[key] = kernel;
+        }
+        return kernel;
+    }
+
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::string m_programFile;
+    std::map<std::string, cl_kernel> m_kernels;
+};
+
+#endif
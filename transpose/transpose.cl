@@ -0,0 +1,74 @@
+/*
+ * out = in^T for a batch of rows x cols matrices stored back to back,
+ * out-of-place. Elements are moved as raw bits:
+ *
+ *    -D T=<type>   uint, uint2 or uint4 (4, 8 or 16 bytes)
+ *    -D TILE=<n>   tile edge, get_local_size(0) == TILE
+ *
+ * A work-group of TILE x get_local_size(1) work-items moves one TILE x TILE
+ * tile, each work-item TILE/get_local_size(1) rows of it. Reads and writes
+ * are both row-contiguous; the turn happens in a local tile padded by one
+ * column, so the column reads hit TILE different banks. Batch b is
+ * get_global_id(2).
+ */
+
+#ifndef T
+#define T uint
+#endif
+
+#ifndef TILE
+#define TILE 32
+#endif
+
+__kernel void transpose_tiled(__global const T *in, __global T *out,
+      uint rows, uint cols) {
+
+   __local T tile[TILE][TILE + 1];
+
+   uint lx = get_local_id(0);
+   uint ly = get_local_id(1);
+   uint step = get_local_size(1);
+   uint col0 = get_group_id(0) * TILE;
+   uint row0 = get_group_id(1) * TILE;
+   ulong matrix = (ulong)get_global_id(2) * rows * cols;
+
+   in += matrix;
+   out += matrix;
+
+   /* Tile rows row0.. of in, columns col0 + lx */
+   for(uint r = ly; r < TILE; r += step) {
+      if(row0 + r < rows && col0 + lx < cols) {
+         tile[r][lx] = in[(ulong)(row0 + r) * cols + col0 + lx];
+      }
+   }
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   /* Output row col0 + r is tile column r */
+   for(uint r = ly; r < TILE; r += step) {
+      if(col0 + r < cols && row0 + lx < rows) {
+         out[(ulong)(col0 + r) * rows + row0 + lx] = tile[lx][r];
+      }
+   }
+}
+
+/* Same grid and access pattern without the turn: the bandwidth bound */
+__kernel void copy_tiled(__global const T *in, __global T *out,
+      uint rows, uint cols) {
+
+   uint lx = get_local_id(0);
+   uint ly = get_local_id(1);
+   uint step = get_local_size(1);
+   uint col0 = get_group_id(0) * TILE;
+   uint row0 = get_group_id(1) * TILE;
+   ulong matrix = (ulong)get_global_id(2) * rows * cols;
+
+   in += matrix;
+   out += matrix;
+
+   for(uint r = ly; r < TILE; r += step) {
+      if(row0 + r < rows && col0 + lx < cols) {
+         ulong i = (ulong)(row0 + r) * cols + col0 + lx;
+         out[i] = in[i];
+      }
+   }
+}
@@ -0,0 +1,203 @@
+#include <CL/cl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "transpose.hpp"
+
+#define BENCH_DIM 8192
+#define LOOP 10
+
+/* Find a GPU or CPU associated with the first available platform */
+cl_device_id create_device()
+{
+    cl_platform_id platform;
+    cl_device_id dev;
+    int err;
+
+    err = clGetPlatformIDs(1, &platform, NULL);
+    if (err < 0)
+    {
+        perror("Couldn't identify a platform");
+        exit(1);
+    }
+
+    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+    if (err == CL_DEVICE_NOT_FOUND)
+    {
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+    }
+    if (err < 0)
+    {
+        perror("Couldn't access any devices");
+        exit(1);
+    }
+
+    return dev;
+}
+
+cl_mem create_buffer(cl_context context, size_t bytes, const void *host)
+{
+    cl_int err;
+    cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | (host != NULL ? CL_MEM_COPY_HOST_PTR : 0),
+                                   bytes, (void *)host, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a buffer");
+        exit(1);
+    }
+    return buffer;
+}
+
+double event_ms(cl_event event)
+{
+    cl_ulong start, end;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    return (end - start) * 1e-6;
+}
+
+/* Every element is distinct, so a misplaced one shows up */
+bool check_transpose(cl_context context, cl_command_queue queue, TransposeEngine &engine, cl_uint rows,
+                     cl_uint cols, size_t elementSize, cl_uint batch)
+{
+    size_t elements = (size_t)rows * cols * batch, bytes = elements * elementSize;
+    std::vector<unsigned char> in(bytes), out(bytes, 0xff);
+    for (size_t i = 0; i < bytes; i++)
+        in[i] = (unsigned char)(rand() & 0xff);
+    for (size_t e = 0; e < elements; e++)
+        memcpy(&in[e * elementSize], &e, std::min(sizeof(e), elementSize));
+
+    cl_mem input = create_buffer(context, bytes, in.data());
+    cl_mem output = create_buffer(context, bytes, NULL);
+    cl_int err = engine.transpose(input, output, rows, cols, elementSize, batch);
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(queue, output, CL_TRUE, 0, bytes, out.data(), 0, NULL, NULL);
+    clReleaseMemObject(input);
+    clReleaseMemObject(output);
+
+    bool ok = err == CL_SUCCESS;
+    for (cl_uint b = 0; b < batch && ok; b++)
+    {
+        size_t matrix = (size_t)b * rows * cols;
+        for (cl_uint i = 0; i < rows && ok; i++)
+        {
+            for (cl_uint j = 0; j < cols && ok; j++)
+            {
+                ok = memcmp(&out[(matrix + (size_t)j * rows + i) * elementSize],
+                            &in[(matrix + (size_t)i * cols + j) * elementSize], elementSize) == 0;
+            }
+        }
+    }
+    return ok;
+}
+
+/* GB/s counts one read and one write of every element */
+void benchmark(cl_context context, TransposeEngine &engine, cl_uint rows, cl_uint cols, size_t elementSize,
+               cl_uint batch)
+{
+    size_t bytes = (size_t)rows * cols * batch * elementSize;
+    cl_mem input = create_buffer(context, bytes, NULL);
+    cl_mem output = create_buffer(context, bytes, NULL);
+    double ms[2] = { 0.0, 0.0 };
+    cl_event event;
+
+    for (int k = 0; k < 2; k++)
+    {
+        if (k == 0)
+            engine.copy(input, output, rows, cols, elementSize, batch);
+        else
+            engine.transpose(input, output, rows, cols, elementSize, batch);
+        for (int i = 0; i < LOOP; i++)
+        {
+            if (k == 0)
+                engine.copy(input, output, rows, cols, elementSize, batch, &event);
+            else
+                engine.transpose(input, output, rows, cols, elementSize, batch, &event);
+            clWaitForEvents(1, &event);
+            ms[k] += event_ms(event);
+            clReleaseEvent(event);
+        }
+        ms[k] /= LOOP;
+    }
+
+    double copyRate = 2.0 * bytes / (ms[0] * 1e6), rate = 2.0 * bytes / (ms[1] * 1e6);
+    printf("  %5u x %-5u x %-3u %2u B: copy %7.3f ms %7.2f GB/s, transpose %7.3f ms %7.2f GB/s (%3.0f%%)\n", rows,
+           cols, batch, (unsigned int)elementSize, ms[0], copyRate, ms[1], rate, 100.0 * rate / copyRate);
+
+    clReleaseMemObject(input);
+    clReleaseMemObject(output);
+}
+
+int main(int argc, char *argv[])
+{
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_int err;
+    cl_uint dim = BENCH_DIM;
+    int failed = 0;
+
+    if (argc > 1)
+    {
+        dim = (cl_uint)strtoul(argv[1], NULL, 10);
+    }
+
+    device = create_device();
+    context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a context");
+        exit(1);
+    }
+    queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (err < 0)
+    {
+        perror("Couldn't create a command queue");
+        exit(1);
+    }
+
+    ProgramCache cache(context, device);
+    TransposeEngine engine(cache, queue);
+
+    /* Shapes off the tile grid, thin, and single row/column */
+    cl_uint shapes[][3] = { { 1, 1, 1 }, { 1, 100, 1 }, { 100, 1, 1 }, { 33, 31, 1 },
+                            { 257, 1000, 1 }, { 64, 96, 5 }, { 17, 45, 3 } };
+    size_t elementSizes[] = { 4, 8, 16 };
+    int passed = 0, total = 0;
+    srand(123);
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+    {
+        for (size_t e = 0; e < sizeof(elementSizes) / sizeof(elementSizes[0]); e++)
+        {
+            bool ok = check_transpose(context, queue, engine, shapes[s][0], shapes[s][1], elementSizes[e],
+                                      shapes[s][2]);
+            if (!ok)
+                printf("  %u x %u x %u, %u bytes failed\n", shapes[s][0], shapes[s][1], shapes[s][2],
+                       (unsigned int)elementSizes[e]);
+            passed += ok;
+            total++;
+        }
+    }
+    failed = passed != total;
+    printf("transpose: %d/%d, %s\n", passed, total, failed ? "Check failed." : "Check passed.");
+
+    cl_ulong maxAlloc = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, NULL);
+    printf("tiled copy vs transpose:\n");
+    for (size_t e = 0; e < sizeof(elementSizes) / sizeof(elementSizes[0]); e++)
+    {
+        cl_uint n = dim;
+        while ((cl_ulong)n * n * elementSizes[e] > maxAlloc)
+            n /= 2;
+        benchmark(context, engine, n, n, elementSizes[e], 1);
+        benchmark(context, engine, n + 7, n / 2 - 3, elementSizes[e], 1);
+    }
+    benchmark(context, engine, 256, 256, 4, 256);
+    benchmark(context, engine, 96, 1000, 4, 64);
+
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+    return failed;
+}
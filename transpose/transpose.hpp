@@ -0,0 +1,123 @@
+#ifndef TRANSPOSE_HPP
+#define TRANSPOSE_HPP
+
+#include <CL/cl.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include "../common/program_cache.hpp"
+
+#define TRANSPOSE_PROGRAM_FILE "transpose.cl"
+#define TRANSPOSE_TILE 32
+#define TRANSPOSE_ROWS 8
+
+/*
+ * Out-of-place transpose of a batch of row-major rows x cols matrices,
+ * stored back to back, into cols x rows matrices. elementSize is 4, 8 or
+ * 16 bytes; the bits are moved unchanged. copy() runs the same grid
+ * without the transpose and is the bandwidth reference.
+ */
+class TransposeEngine
+{
+public:
+    TransposeEngine(ProgramCache &cache, cl_command_queue queue,
+                    const std::string &programFile = TRANSPOSE_PROGRAM_FILE)
+        : m_cache(cache), m_queue(queue), m_programFile(programFile), m_localMemSize(16384)
+    {
+        clGetDeviceInfo(cache.device(), CL_DEVICE_LOCAL_MEM_SIZE, sizeof(m_localMemSize), &m_localMemSize, NULL);
+    }
+
+    ~TransposeEngine()
+    {
+        for (std::map<std::string, cl_kernel>::iterator it = m_kernels.begin(); it != m_kernels.end(); ++it)
+        {
+            clReleaseKernel(it->second);
+        }
+    }
+
+    cl_int transpose(cl_mem input, cl_mem output, cl_uint rows, cl_uint cols, size_t elementSize,
+                     cl_uint batch = 1, cl_event *event = NULL)
+    {
+        return launch("transpose_tiled", input, output, rows, cols, elementSize, batch, event);
+    }
+
+    cl_int copy(cl_mem input, cl_mem output, cl_uint rows, cl_uint cols, size_t elementSize,
+                cl_uint batch = 1, cl_event *event = NULL)
+    {
+        return launch("copy_tiled", input, output, rows, cols, elementSize, batch, event);
+    }
+
+private:
+    cl_int launch(const char *name, cl_mem input, cl_mem output, cl_uint rows, cl_uint cols, size_t elementSize,
+                  cl_uint batch, cl_event *event)
+    {
+        const char *type;
+        cl_int status;
+        switch (elementSize)
+        {
+        case 4:  type = "uint"; break;
+        case 8:  type = "uint2"; break;
+        case 16: type = "uint4"; break;
+        default: return CL_INVALID_VALUE;
+        }
+        if (rows == 0 || cols == 0 || batch == 0)
+            return CL_SUCCESS;
+
+        size_t tile = tileSize(elementSize);
+        char options[64];
+        snprintf(options, sizeof(options), "-D T=%s -D TILE=%d", type, (int)tile);
+        cl_kernel kernel = getKernel(options, name, &status);
+        if (status != CL_SUCCESS)
+            return status;
+
+        status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+        status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+        status |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &rows);
+        status |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &cols);
+        if (status != CL_SUCCESS)
+            return status;
+
+        size_t localSize[3] = { tile, TRANSPOSE_ROWS, 1 };
+        size_t globalSize[3] = { (cols + tile - 1) / tile * tile, (rows + tile - 1) / tile * TRANSPOSE_ROWS, batch };
+        return clEnqueueNDRangeKernel(m_queue, kernel, 3, NULL, globalSize, localSize, 0, NULL, event);
+    }
+
+    /*
+     * The padded local tile is TILE x (TILE + 1) elements: 16.5 KiB for
+     * 16-byte elements at TILE 32, over the 16 KiB minimum a device may
+     * have. Those use TILE 16, and any tile that does not fit is halved.
+     */
+    size_t tileSize(size_t elementSize) const
+    {
+        size_t tile = elementSize >= 16 ? 16 : TRANSPOSE_TILE;
+        while (tile > TRANSPOSE_ROWS && tile * (tile + 1) * elementSize > m_localMemSize)
+            tile /= 2;
+        return tile;
+    }
+
+    cl_kernel getKernel(const std::string &options, const char *name, cl_int *status)
+    {
+        std::string key = options + ' ' + name;
+        std::map<std::string, cl_kernel>::iterator it = m_kernels.find(key);
+        if (it != m_kernels.end())
+        {
+            *status = CL_SUCCESS;
+            return it->second;
+        }
+
+        cl_kernel kernel = m_cache.createKernel(m_programFile, options, name, status);
+        if (*status == CL_SUCCESS)
+        {
+            m_kernels[key] = kernel;
+        }
+        return kernel;
+    }
+
+    ProgramCache &m_cache;
+    cl_command_queue m_queue;
+    std::string m_programFile;
+    cl_ulong m_localMemSize;
+    std::map<std::string, cl_kernel> m_kernels;
+};
+
+#endif